@@ -0,0 +1,109 @@
+#include "../core/common.h"
+#include "../core/red_allocation_log.h"
+#include "../core/red_allocator.h"
+
+#include <chrono>
+#include <thread>
+#ifndef _MSC_VER
+#include <x86intrin.h>
+#endif
+
+/*
+Cost per event of ALLOCATION_LOG_RECORD with the log stopped and running, on its own and inside a new and delete
+pair. Events go in batches a ring holds, and the drainer gets time to empty it after each, so none is dropped and
+only the recording thread's cost is timed.
+
+allocation_log_benchmark [-n batchCount] [log path]
+*/
+#define LOG_BENCHMARK_BATCH_SIZE (ALLOCATION_LOG_RING_CAPACITY / 4)
+
+using Clock = std::chrono::high_resolution_clock;
+
+static u8* volatile benchmarkSink;
+
+static double benchmark_record(u32 batchCount, bool32 running)
+{
+	double seconds = 0.0;
+	for (u32 batch = 0; batch < batchCount; batch++)
+	{
+		Clock::time_point start = Clock::now();
+		for (u32 i = 0; i < LOG_BENCHMARK_BATCH_SIZE; i++)
+		{
+			void* memory = (void*)(uintptr_t(i + 1) * 64);
+			ALLOCATION_LOG_RECORD(memory, 64, ALLOCATION_TAG_UNTAGGED);
+		}
+		seconds += std::chrono::duration<double>(Clock::now() - start).count();
+		if (running)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(3 * ALLOCATION_LOG_DRAIN_INTERVAL_MS));
+		}
+	}
+	return seconds * 1e9 / (double(batchCount) * LOG_BENCHMARK_BATCH_SIZE);
+}
+
+// Two events per pair when running
+static double benchmark_newDelete(u32 batchCount, bool32 running)
+{
+	double seconds = 0.0;
+	for (u32 batch = 0; batch < batchCount; batch++)
+	{
+		Clock::time_point start = Clock::now();
+		for (u32 i = 0; i < LOG_BENCHMARK_BATCH_SIZE / 2; i++)
+		{
+			benchmarkSink = new u8[64];
+			delete[] benchmarkSink;
+		}
+		seconds += std::chrono::duration<double>(Clock::now() - start).count();
+		if (running)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(3 * ALLOCATION_LOG_DRAIN_INTERVAL_MS));
+		}
+	}
+	return seconds * 1e9 / (double(batchCount) * (LOG_BENCHMARK_BATCH_SIZE / 2));
+}
+
+int main(int argc, char** argv)
+{
+	u32 batchCount = 100;
+	const char* logPath = "allocation_log_benchmark.alog";
+	for (int i = 1; i < argc; i++)
+	{
+		if (i + 1 < argc && strcmp(argv[i], "-n") == 0)
+		{
+			batchCount = u32(atoi(argv[++i]));
+		}
+		else
+		{
+			logPath = argv[i];
+		}
+	}
+
+	// Warms the allocator's caches and the code up
+	benchmark_newDelete(4, false);
+	const double recordStopped = benchmark_record(batchCount, false);
+	const double newDeleteStopped = benchmark_newDelete(batchCount, false);
+	if (!allocationLog_begin(logPath))
+	{
+		printf("Couldn't create the allocation log %s\n", logPath);
+		return 1;
+	}
+	const double recordRunning = benchmark_record(batchCount, true);
+	const double newDeleteRunning = benchmark_newDelete(batchCount, true);
+	allocationLog_end();
+	remove(logPath);
+
+	const u64 rdtscStart = __rdtsc();
+	Clock::time_point start = Clock::now();
+	u64 ticks = 0;
+	for (u32 i = 0; i < LOG_BENCHMARK_BATCH_SIZE; i++)
+	{
+		ticks += __rdtsc();
+	}
+	const double rdtscNanoseconds = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / LOG_BENCHMARK_BATCH_SIZE;
+	benchmarkSink = (u8*)uintptr_t(ticks - rdtscStart);
+
+	printf("ALLOCATION_LOG_RECORD: %6.2f ns stopped, %6.2f ns running, %6.2f ns per event recorded\n", recordStopped, recordRunning, recordRunning - recordStopped);
+	printf("new and delete pair:   %6.2f ns stopped, %6.2f ns running, %6.2f ns per event recorded\n", newDeleteStopped, newDeleteRunning, (newDeleteRunning - newDeleteStopped) / 2.0);
+	printf("rdtsc, part of every recorded event: %.2f ns\n", rdtscNanoseconds);
+	return 0;
+}
@@ -0,0 +1,64 @@
+#include "../core/common.h"
+#include "../core/red_allocator_benchmark.h"
+#include "../core/red_thread_pool.h"
+
+/*
+Replays allocation traces with this allocator and with malloc, on 1, 2, 4... up to threadCount threads.
+The renderer's allocatorTraceCapture saves the loader, frames and resize traces next to it. Without trace files, a
+synthetic trace replays instead.
+
+allocator_benchmark [-i iterations] [-t threadCount] [-n syntheticAllocations] [trace.atrace...]
+threadCount 0, the default, is one per hardware thread
+*/
+int main(int argc, char** argv)
+{
+	u32 iterationCount = 5;
+	u32 threadCount = 0;
+	u32 syntheticAllocationCount = 1000000;
+	vector<const char*> tracePaths;
+	for (int i = 1; i < argc; i++)
+	{
+		if (i + 1 < argc && strcmp(argv[i], "-i") == 0)
+		{
+			iterationCount = u32(atoi(argv[++i]));
+		}
+		else if (i + 1 < argc && strcmp(argv[i], "-t") == 0)
+		{
+			threadCount = u32(atoi(argv[++i]));
+		}
+		else if (i + 1 < argc && strcmp(argv[i], "-n") == 0)
+		{
+			syntheticAllocationCount = u32(atoi(argv[++i]));
+		}
+		else
+		{
+			tracePaths.push_back(argv[i]);
+		}
+	}
+
+	ThreadPool* pool = threadPool_create(threadCount);
+	bool32 success = true;
+	if (tracePaths.empty())
+	{
+		AllocationTrace trace;
+		allocationTrace_synthetic(&trace, syntheticAllocationCount, 1);
+		allocator_benchmark("synthetic", trace, iterationCount, pool);
+	}
+	for (const char* tracePath : tracePaths)
+	{
+		AllocationTrace trace;
+		if (allocationTrace_load(tracePath, &trace))
+		{
+			allocator_benchmark(tracePath, trace, iterationCount, pool);
+		}
+		else
+		{
+			printf("Couldn't load the allocation trace %s\n", tracePath);
+			success = false;
+		}
+	}
+	printAllocatorStats(allocator_getStats());
+	threadPool_destroy(pool);
+
+	return success ? 0 : 1;
+}
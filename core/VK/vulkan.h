@@ -1,6 +1,12 @@
 #pragma once
 
 #include "../common.h"
+#include "../red_arena.h"
+#include "../red_allocator.h"
+#include "../red_pool.h"
+#include "../red_memory.h"
+#include "../red_tlsf.h"
+#include "../red_thread_pool.h"
 
 #define VOLK 1
 #if VOLK
@@ -28,34 +34,238 @@
 
 #include "../glm.h"
 
-#define MAX_FRAMES_IN_FLIGHT 2
+#define MAX_VERTEX_ATTRIBUTES 8
+// Transient memory of one frame in flight, reset once its fence is signaled. Reserved, committed as frames use it.
+// Smaller when the machine or the container has little memory
+#define FRAME_SCRATCH_ARENA_SIZE (64 * MEGABYTE)
+#define FRAME_SCRATCH_ARENA_MEMORY_SHARE (1.0 / 256.0)
 
+// One of each per frame slot: the CPU records frame n + 1 while the GPU still renders frame n
 struct VulkanFrameSynchronization
 {
-	array<VkSemaphore, MAX_FRAMES_IN_FLIGHT> imageAcquireSemaphores;
-	array<VkSemaphore, MAX_FRAMES_IN_FLIGHT> imageReleaseSemaphores;
-	array<VkFence, MAX_FRAMES_IN_FLIGHT> inflightFences;
+	vector<VkSemaphore> imageAcquireSemaphores;
+	vector<VkSemaphore> imageReleaseSemaphores;
+	vector<VkFence> inflightFences;
+	vector<LinearArena> scratchArenas;
+	// Per swapchain image, the fence of the slot that last rendered to it. Null until one did
+	vector<VkFence> imagesInFlight;
 	u32 maxFramesInFlight;
 	u32 currentFrame;
 };
 
+/*
+Where frame time goes, summed over the frames since the last report. CPU wait is time blocked on the frame slot, the
+swapchain and the image's previous frame. GPU busy is the time between the first and last timestamp of the image's
+command buffer, read once that frame is done. When frames overlap, GPU busy gets close to the frame time and CPU wait
+covers what's left of it.
+*/
+struct VulkanFrameTimings
+{
+	// Two timestamps per swapchain image. Null when the graphics queue has no timestamps
+	VkQueryPool queryPool;
+	double timestampPeriod;
+	u64 timestampMask;
+	// Per swapchain image: its queries were written by a submission since the pool was created
+	vector<u8> imageTimestamped;
+	u32 frameCount;
+	u32 gpuFrameCount;
+	double frameSeconds;
+	double cpuWaitSeconds;
+	double gpuBusySeconds;
+};
+
+/*
+Records the frame's commands every frame, so the draw list can change from one frame to the next. The draw list is
+split in contiguous ranges, each recorded by a pool thread into a secondary command buffer that continues the render
+pass, and the primary executes them in order. Every thread has a command pool per frame slot, reset as a whole once the
+slot's fence is signalled: command buffers are never freed, only recorded again.
+*/
+// Below this many draws per range, waking another thread costs more than it saves. The default of minDrawsPerJob
+#define VULKAN_RECORD_MIN_DRAWS_PER_JOB 512
+
+struct VulkanFrameRecorder
+{
+	// [frame slot * threadCount + thread index]
+	vector<VkCommandPool> threadCommandPools;
+	vector<vector<VkCommandBuffer>> threadSecondaryCommandBuffers;
+	vector<u32> threadSecondaryUsedCounts;
+	// Per frame slot
+	vector<VkCommandPool> primaryCommandPools;
+	vector<VkCommandBuffer> primaryCommandBuffers;
+	// Secondaries of the frame being recorded, in draw order
+	vector<VkCommandBuffer> jobCommandBuffers;
+	u32 threadCount;
+	u32 framesInFlight;
+	u32 minDrawsPerJob;
+	u32 jobCount; // Ranges the last frame was recorded in
+};
+
+/*
+Device memory is allocated in large blocks per memory type and carved up by a TLSF allocator, so the number of
+vkAllocateMemory objects stays far below maxMemoryAllocationCount and creating a resource rarely reaches the driver.
+Host visible blocks stay mapped for their whole life. Buffers and optimally tiled images only get separate blocks
+when bufferImageGranularity could make them alias. Resources the driver wants alone, or too big to share a block
+sensibly, get a dedicated allocation.
+*/
+#define VULKAN_MEMORY_BLOCK_SIZE (64 * MEGABYTE)
+// Heaps up to this size get blocks of VULKAN_MEMORY_SMALL_HEAP_BLOCK_SHARE of the heap instead
+#define VULKAN_MEMORY_SMALL_HEAP_SIZE (1 * GIGABYTE)
+#define VULKAN_MEMORY_SMALL_HEAP_BLOCK_SHARE 8
+#define VULKAN_DEDICATED_BLOCK 0xFFFFFFFFu
+
+struct VulkanAllocation
+{
+	VkDeviceMemory memory;
+	VkDeviceSize offset;
+	VkDeviceSize size;
+	// Null unless the memory is host visible
+	u8* mapped;
+	u32 pool;
+	// VULKAN_DEDICATED_BLOCK when the allocation owns memory
+	u32 block;
+	u32 node;
+};
+
+// A block that was released keeps its slot with null memory, since allocations refer to blocks by index
+struct VulkanMemoryPool
+{
+	vector<VkDeviceMemory> memory;
+	vector<u8*> mapped;
+	vector<TlsfAllocator> blocks;
+};
+
+struct VulkanMemoryAllocator
+{
+	VkDevice device;
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	VkDeviceSize bufferImageGranularity;
+	u32 maxMemoryAllocationCount;
+	// Vulkan 1.1 devices say which resources want memory of their own
+	bool32 dedicatedAllocation;
+	array<VkDeviceSize, VK_MAX_MEMORY_TYPES> blockSizes;
+	// Two per memory type: linear resources, then optimally tiled images
+	array<VulkanMemoryPool, VK_MAX_MEMORY_TYPES * 2> pools;
+	u32 deviceMemoryCount;
+	VkDeviceSize deviceMemoryBytes;
+	u32 dedicatedAllocationCount;
+	VkDeviceSize dedicatedBytes;
+};
+
 struct VulkanBuffer
 {
 	VkBuffer handle;
-	VkDeviceMemory memory;
+	VulkanAllocation memory;
 };
 
 struct VulkanBufferList
 {
 	vector<VkBuffer> handle;
-	vector<VkDeviceMemory> memory;
+	vector<VulkanAllocation> memory;
+};
+
+// Per swapchain image: one VkDrawIndexedIndirectCommand per submesh followed by the indices of the meshlets that survived culling
+#define MESHLET_DRAW_INDEX_ALIGNMENT 64
+
+struct VulkanMeshletDraws
+{
+	VulkanBufferList buffers;
+	vector<u8*> mapped;
+	u32 drawCount;
+	u32 indexOffset;
+	u32 indexCapacity;
+};
+
+/*
+Per-draw uniforms: a single persistently mapped, host coherent buffer split in one partition per swapchain image, with
+one slot per draw, minUniformBufferOffsetAlignment apart. The frame descriptor set is a dynamic uniform buffer, so
+every draw binds it with its slot's offset and there are no per-frame maps or per-object buffers. The command buffers
+are recorded once per swapchain image, offsets included, so partitions follow the image index
+*/
+struct VulkanUniformRing
+{
+	VkBuffer handle;
+	VulkanAllocation memory;
+	VkDeviceSize stride;
+	VkDeviceSize partitionSize;
+	u32 partitionCount;
+	u32 slotCount;
+};
+
+/*
+Uploads to device local buffers and images. Data is copied once, into a persistently mapped staging ring, and the
+copies out of it are recorded in the command buffer of the open batch. A batch is submitted when its staging space or
+its command buffer is needed again, or on vulkan_submitUploads, and its fence tells when that space can be reused:
+nothing waits for the queue to go idle. Each upload returns the token of its batch, to poll or wait on.
+With a transfer queue of its own family, copies run there, overlapping rendering. Each batch then releases what it
+wrote to the graphics family, and its acquire command buffer takes it over on the graphics queue, along with what only
+the graphics queue can do: mipmaps are blitted there. Acquires are submitted once their batch is done, waiting on the
+semaphore the batch signalled, so the graphics queue never stalls on a copy.
+*/
+#define VULKAN_UPLOAD_STAGING_SIZE (64 * MEGABYTE)
+#define VULKAN_UPLOAD_BATCH_COUNT 4
+// Enough for the texel size of any format copied to an image, as vkCmdCopyBufferToImage requires
+#define VULKAN_UPLOAD_ALIGNMENT 16
+// Where uploaded buffers are read
+#define VULKAN_UPLOAD_DST_STAGES (VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT)
+#define VULKAN_UPLOAD_DST_ACCESS (VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT)
+
+typedef u64 VulkanUploadToken;
+
+struct VulkanUploader
+{
+	VkDevice device;
+	VkQueue queue;
+	VkQueue graphicsQueue;
+	u32 queueFamilyIndex;
+	u32 graphicsQueueFamilyIndex;
+	bool32 ownershipTransfer;
+	VulkanMemoryAllocator* allocator;
+	VkCommandPool commandPool;
+	VkCommandPool acquireCommandPool;
+	VkBuffer stagingBuffer;
+	VulkanAllocation stagingMemory;
+	VkDeviceSize stagingSize;
+	// Bytes ever reserved and ever released: ring offsets are these modulo stagingSize
+	u64 stagingHead;
+	u64 stagingTail;
+	// Batch n records into slot n % VULKAN_UPLOAD_BATCH_COUNT. Batches up to completedBatch are done, openBatch takes new uploads
+	array<VkCommandBuffer, VULKAN_UPLOAD_BATCH_COUNT> commandBuffers;
+	array<VkFence, VULKAN_UPLOAD_BATCH_COUNT> fences;
+	array<u64, VULKAN_UPLOAD_BATCH_COUNT> batchStagingEnds;
+	// Only with ownershipTransfer: the graphics queue side of each batch
+	array<VkCommandBuffer, VULKAN_UPLOAD_BATCH_COUNT> acquireCommandBuffers;
+	array<VkSemaphore, VULKAN_UPLOAD_BATCH_COUNT> semaphores;
+	array<VkFence, VULKAN_UPLOAD_BATCH_COUNT> acquireFences;
+	VulkanUploadToken openBatch;
+	VulkanUploadToken completedBatch;
+	bool32 recording;
+	// Uploads bigger than the ring, destroyed once their batch completes
+	vector<VulkanBuffer> oversizedStaging;
+	vector<VulkanUploadToken> oversizedStagingBatches;
+	u32 uploadCount;
+	u32 submitCount;
+	VkDeviceSize uploadBytes;
+};
+
+// Set 0 changes once per draw through its dynamic offset, set 1 once per material
+#define DESCRIPTOR_SET_FRAME 0
+#define DESCRIPTOR_SET_MATERIAL 1
+#define DESCRIPTOR_SET_COUNT 2
+
+struct VulkanSubmeshDraw
+{
+	u32 submesh;
+	u32 materialSet;
+	// Only used by the direct draw, the meshlet draw reads its range from the indirect command
+	u32 firstIndex;
+	u32 indexCount;
 };
 
 struct VulkanTexture
 {
 	u32 mipLevels;
 	VkImage handle;
-	VkDeviceMemory memory;
+	VulkanAllocation memory;
 	VkImageView view;
 	VkSampler sampler;
 };
@@ -64,10 +274,65 @@ struct VulkanMSAA
 {
 	VkSampleCountFlagBits samples;
 	VkImage image;
-	VkDeviceMemory memory;
+	VulkanAllocation memory;
 	VkImageView view;
 };
 
+// Buffers, textures and MSAA targets live in these pools, referred to by generational handle. Records are dense,
+// so teardown and stats walk arrays with no holes, and a handle to a destroyed resource stops resolving
+struct VulkanBufferHandle
+{
+	u32 value;
+};
+
+struct VulkanTextureHandle
+{
+	u32 value;
+};
+
+struct VulkanMSAAHandle
+{
+	u32 value;
+};
+
+#define VULKAN_MAX_BUFFERS 256
+#define VULKAN_MAX_TEXTURES 1024
+#define VULKAN_MAX_MSAA_TARGETS 4
+
+struct VulkanBufferPool
+{
+	HandlePool slots;
+	vector<VkBuffer> handle;
+	vector<VulkanAllocation> memory;
+	vector<VkDeviceSize> size;
+};
+
+struct VulkanTexturePool
+{
+	HandlePool slots;
+	vector<VkImage> handle;
+	vector<VulkanAllocation> memory;
+	vector<VkImageView> view;
+	vector<VkSampler> sampler;
+	vector<u32> mipLevels;
+};
+
+struct VulkanMSAAPool
+{
+	HandlePool slots;
+	vector<VkImage> image;
+	vector<VulkanAllocation> memory;
+	vector<VkImageView> view;
+	vector<VkSampleCountFlagBits> samples;
+};
+
+struct VulkanResources
+{
+	VulkanBufferPool buffers;
+	VulkanTexturePool textures;
+	VulkanMSAAPool msaa;
+};
+
 struct VulkanSwapchain
 {
 	VkSwapchainKHR handle;
@@ -88,7 +353,7 @@ enum class SwapchainStatus : u32
 struct VulkanDepthStencil
 {
 	VkImage image;
-	VkDeviceMemory memory;
+	VulkanAllocation memory;
 	VkImageView imageView;
 	VkFormat depthFormat;
 };
@@ -118,6 +383,13 @@ struct VulkanPhysicalDeviceDescription
 	vector<VkDeviceQueueCreateInfo> deviceQueueConfiguration;
 };
 
+struct VulkanVertexInput
+{
+	VkVertexInputBindingDescription binding;
+	array<VkVertexInputAttributeDescription, MAX_VERTEX_ATTRIBUTES> attributes;
+	u32 attributeCount;
+};
+
 struct VulkanApplication
 {
 	VkInstance instance;
@@ -126,6 +398,8 @@ struct VulkanApplication
 	VkSurfaceKHR surface;
 	VkDevice device;
 	VulkanPhysicalDeviceDescription deviceDescription;
+	VulkanMemoryAllocator memoryAllocator;
+	VulkanUploader uploader;
 	VkCommandPool graphicsCommandPool;
 	VulkanSwapchain swapchain;
 	vector<VkCommandBuffer> drawCommandBuffers;
@@ -135,22 +409,475 @@ struct VulkanApplication
 	VkPipelineCache pipelineCache;
 	vector<VkFramebuffer> framebuffers;
 	VkQueue graphicsQueue;
-	VulkanMSAA msaa;
+	// The graphics queue when there's no transfer family of its own
+	VkQueue transferQueue;
+	VulkanResources resources;
+	VulkanMSAAHandle msaa;
 	VkShaderModule FS;
 	VkShaderModule VS;
-	VkDescriptorSetLayout descriptorSetLayout;
+	array<VkDescriptorSetLayout, DESCRIPTOR_SET_COUNT> descriptorSetLayouts;
 	VkPipelineLayout graphicsPipelineLayout;
 	VkPipeline graphicsPipeline;
-	VulkanTexture texture;
-	Mesh mesh;
-	VulkanBuffer vertexBuffer;
-	VulkanBuffer indexBuffer;
-	VulkanBufferList uniformBuffers;
+	VulkanVertexInput vertexInput;
+	vector<VulkanTextureHandle> textures;
+	MeshView mesh;
+	MeshQuantization meshQuantization;
+	VulkanBufferHandle vertexBuffer;
+	VulkanBufferHandle indexBuffer;
+	// Only used when meshletCulling is set: replaces indexBuffer in the draw
+	bool32 meshletCulling;
+	VulkanMeshletDraws meshletDraws;
+	VulkanUniformRing uniformRing;
 	VkDescriptorPool descriptorPool;
-	vector<VkDescriptorSet> descriptorSets;
+	VkDescriptorSet frameDescriptorSet;
+	// One per texture, indexed by VulkanSubmeshDraw::materialSet
+	vector<VkDescriptorSet> materialDescriptorSets;
+	// Sorted by materialSet
+	vector<VulkanSubmeshDraw> submeshDraws;
 	VulkanFrameSynchronization frameSync;
+	VulkanFrameTimings frameTimings;
+	VulkanFrameRecorder frameRecorder;
 };
 
+u32 vulkan_findMemoryType(u32 typeFilter, VkMemoryPropertyFlags properties, const VkPhysicalDeviceMemoryProperties& memoryProperties)
+{
+	for (u32 i = 0; i < memoryProperties.memoryTypeCount; i++)
+		if (typeFilter & (1 << i) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+			return i;
+	assert(!"Error");
+	return ~0u;
+}
+
+void vulkan_createMemoryAllocator(VulkanMemoryAllocator* allocator, VkDevice device, const VulkanPhysicalDeviceDescription& deviceDescription)
+{
+	*allocator = {};
+	allocator->device = device;
+	allocator->memoryProperties = deviceDescription.memoryProperties;
+	allocator->bufferImageGranularity = deviceDescription.properties.limits.bufferImageGranularity;
+	allocator->maxMemoryAllocationCount = deviceDescription.properties.limits.maxMemoryAllocationCount;
+	allocator->dedicatedAllocation = deviceDescription.properties.apiVersion >= VK_API_VERSION_1_1;
+	for (u32 i = 0; i < allocator->memoryProperties.memoryTypeCount; i++)
+	{
+		const VkDeviceSize heapSize = allocator->memoryProperties.memoryHeaps[allocator->memoryProperties.memoryTypes[i].heapIndex].size;
+		allocator->blockSizes[i] = heapSize <= VULKAN_MEMORY_SMALL_HEAP_SIZE ? heapSize / VULKAN_MEMORY_SMALL_HEAP_BLOCK_SHARE : VULKAN_MEMORY_BLOCK_SIZE;
+	}
+}
+
+static VkDeviceMemory vulkan_allocateDeviceMemory(VulkanMemoryAllocator* allocator, u32 memoryType, VkDeviceSize size, const void* next, u8** mapped)
+{
+	VkMemoryAllocateInfo allocateInfo;
+	allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocateInfo.pNext = next;
+	allocateInfo.allocationSize = size;
+	allocateInfo.memoryTypeIndex = memoryType;
+
+	VkDeviceMemory memory = nullptr;
+	VKCHECK(vkAllocateMemory(allocator->device, &allocateInfo, nullptr, &memory));
+	*mapped = nullptr;
+	if (allocator->memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		void* data;
+		VKCHECK(vkMapMemory(allocator->device, memory, 0, VK_WHOLE_SIZE, 0, &data));
+		*mapped = (u8*)data;
+	}
+	allocator->deviceMemoryCount++;
+	allocator->deviceMemoryBytes += size;
+	assert(allocator->deviceMemoryCount <= allocator->maxMemoryAllocationCount);
+	return memory;
+}
+
+// Freeing mapped memory unmaps it
+static void vulkan_freeDeviceMemory(VulkanMemoryAllocator* allocator, VkDeviceMemory memory, VkDeviceSize size)
+{
+	vkFreeMemory(allocator->device, memory, nullptr);
+	allocator->deviceMemoryCount--;
+	allocator->deviceMemoryBytes -= size;
+}
+
+// dedicatedInfo names the resource the memory is for and is only used when the allocation ends up dedicated
+VulkanAllocation vulkan_allocateMemory(VulkanMemoryAllocator* allocator, const VkMemoryRequirements& requirements, VkMemoryPropertyFlags memoryFlags, bool32 optimalTiling, bool32 dedicated, const VkMemoryDedicatedAllocateInfo* dedicatedInfo)
+{
+	const u32 memoryType = vulkan_findMemoryType(requirements.memoryTypeBits, memoryFlags, allocator->memoryProperties);
+	const VkDeviceSize blockSize = allocator->blockSizes[memoryType];
+
+	VulkanAllocation allocation = {};
+	allocation.size = requirements.size;
+	if (dedicated || requirements.size >= blockSize / 2)
+	{
+		allocation.memory = vulkan_allocateDeviceMemory(allocator, memoryType, requirements.size, dedicatedInfo, &allocation.mapped);
+		allocation.block = VULKAN_DEDICATED_BLOCK;
+		allocator->dedicatedAllocationCount++;
+		allocator->dedicatedBytes += requirements.size;
+		return allocation;
+	}
+
+	allocation.pool = memoryType * 2 + (optimalTiling && allocator->bufferImageGranularity > 1 ? 1 : 0);
+	VulkanMemoryPool& pool = allocator->pools[allocation.pool];
+	u32 releasedBlock = VULKAN_DEDICATED_BLOCK;
+	for (u32 block = 0; block < pool.blocks.size(); block++)
+	{
+		if (!pool.memory[block])
+		{
+			releasedBlock = block;
+			continue;
+		}
+		allocation.node = tlsf_allocate(&pool.blocks[block], requirements.size, requirements.alignment, &allocation.offset);
+		if (allocation.node != TLSF_INVALID_NODE)
+		{
+			allocation.block = block;
+			allocation.memory = pool.memory[block];
+			allocation.mapped = pool.mapped[block] ? pool.mapped[block] + allocation.offset : nullptr;
+			return allocation;
+		}
+	}
+
+	if (releasedBlock == VULKAN_DEDICATED_BLOCK)
+	{
+		releasedBlock = u32(pool.blocks.size());
+		pool.memory.push_back(nullptr);
+		pool.mapped.push_back(nullptr);
+		pool.blocks.emplace_back();
+	}
+	allocation.block = releasedBlock;
+	pool.memory[allocation.block] = vulkan_allocateDeviceMemory(allocator, memoryType, blockSize, nullptr, &pool.mapped[allocation.block]);
+	tlsf_create(&pool.blocks[allocation.block], blockSize);
+	allocation.node = tlsf_allocate(&pool.blocks[allocation.block], requirements.size, requirements.alignment, &allocation.offset);
+	assert(allocation.node != TLSF_INVALID_NODE);
+	allocation.memory = pool.memory[allocation.block];
+	allocation.mapped = pool.mapped[allocation.block] ? pool.mapped[allocation.block] + allocation.offset : nullptr;
+	return allocation;
+}
+
+static void vulkan_releaseMemoryBlock(VulkanMemoryAllocator* allocator, VulkanMemoryPool* pool, u32 block)
+{
+	vulkan_freeDeviceMemory(allocator, pool->memory[block], pool->blocks[block].size);
+	pool->memory[block] = nullptr;
+	pool->mapped[block] = nullptr;
+	pool->blocks[block] = {};
+}
+
+// One empty block per pool is kept, so a resource recreated right away, like on a resize, doesn't go to the driver
+void vulkan_freeMemory(VulkanMemoryAllocator* allocator, const VulkanAllocation& allocation)
+{
+	if (!allocation.memory)
+	{
+		return;
+	}
+	if (allocation.block == VULKAN_DEDICATED_BLOCK)
+	{
+		vulkan_freeDeviceMemory(allocator, allocation.memory, allocation.size);
+		allocator->dedicatedAllocationCount--;
+		allocator->dedicatedBytes -= allocation.size;
+		return;
+	}
+
+	VulkanMemoryPool& pool = allocator->pools[allocation.pool];
+	tlsf_free(&pool.blocks[allocation.block], allocation.node);
+	if (pool.blocks[allocation.block].allocationCount)
+	{
+		return;
+	}
+	for (u32 block = 0; block < pool.blocks.size(); block++)
+	{
+		if (block != allocation.block && pool.memory[block] && !pool.blocks[block].allocationCount)
+		{
+			vulkan_releaseMemoryBlock(allocator, &pool, allocation.block);
+			return;
+		}
+	}
+}
+
+VulkanAllocation vulkan_allocateMemoryForImage(VulkanMemoryAllocator* allocator, VkImage image, VkImageTiling tiling, VkMemoryPropertyFlags memoryFlags)
+{
+	VkMemoryDedicatedAllocateInfo dedicatedInfo = {};
+	dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+	dedicatedInfo.image = image;
+	VkMemoryRequirements requirements;
+	bool32 dedicated = false;
+	if (allocator->dedicatedAllocation)
+	{
+		VkImageMemoryRequirementsInfo2 requirementsInfo = {};
+		requirementsInfo.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2;
+		requirementsInfo.image = image;
+		VkMemoryDedicatedRequirements dedicatedRequirements = {};
+		dedicatedRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+		VkMemoryRequirements2 memoryRequirements = {};
+		memoryRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+		memoryRequirements.pNext = &dedicatedRequirements;
+		vkGetImageMemoryRequirements2(allocator->device, &requirementsInfo, &memoryRequirements);
+		requirements = memoryRequirements.memoryRequirements;
+		dedicated = dedicatedRequirements.prefersDedicatedAllocation || dedicatedRequirements.requiresDedicatedAllocation;
+	}
+	else
+	{
+		vkGetImageMemoryRequirements(allocator->device, image, &requirements);
+	}
+	VulkanAllocation allocation = vulkan_allocateMemory(allocator, requirements, memoryFlags, tiling == VK_IMAGE_TILING_OPTIMAL, dedicated, allocator->dedicatedAllocation ? &dedicatedInfo : nullptr);
+
+	VKCHECK(vkBindImageMemory(allocator->device, image, allocation.memory, allocation.offset));
+
+	return allocation;
+}
+
+VulkanAllocation vulkan_allocateMemoryForBuffer(VulkanMemoryAllocator* allocator, VkBuffer buffer, VkMemoryPropertyFlags memoryFlags)
+{
+	VkMemoryDedicatedAllocateInfo dedicatedInfo = {};
+	dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+	dedicatedInfo.buffer = buffer;
+	VkMemoryRequirements requirements;
+	bool32 dedicated = false;
+	if (allocator->dedicatedAllocation)
+	{
+		VkBufferMemoryRequirementsInfo2 requirementsInfo = {};
+		requirementsInfo.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2;
+		requirementsInfo.buffer = buffer;
+		VkMemoryDedicatedRequirements dedicatedRequirements = {};
+		dedicatedRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+		VkMemoryRequirements2 memoryRequirements = {};
+		memoryRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+		memoryRequirements.pNext = &dedicatedRequirements;
+		vkGetBufferMemoryRequirements2(allocator->device, &requirementsInfo, &memoryRequirements);
+		requirements = memoryRequirements.memoryRequirements;
+		dedicated = dedicatedRequirements.prefersDedicatedAllocation || dedicatedRequirements.requiresDedicatedAllocation;
+	}
+	else
+	{
+		vkGetBufferMemoryRequirements(allocator->device, buffer, &requirements);
+	}
+	VulkanAllocation allocation = vulkan_allocateMemory(allocator, requirements, memoryFlags, false, dedicated, allocator->dedicatedAllocation ? &dedicatedInfo : nullptr);
+
+	VKCHECK(vkBindBufferMemory(allocator->device, buffer, allocation.memory, allocation.offset));
+
+	return allocation;
+}
+
+// Everything must have been freed already: only the blocks kept around are left
+void vulkan_destroyMemoryAllocator(VulkanMemoryAllocator* allocator)
+{
+	assert(!allocator->dedicatedAllocationCount);
+	for (VulkanMemoryPool& pool : allocator->pools)
+	{
+		for (u32 block = 0; block < pool.blocks.size(); block++)
+		{
+			if (pool.memory[block])
+			{
+				assert(!pool.blocks[block].allocationCount);
+				vulkan_releaseMemoryBlock(allocator, &pool, block);
+			}
+		}
+	}
+	*allocator = {};
+}
+
+void printVulkanMemoryStats(const VulkanMemoryAllocator& allocator)
+{
+	const double mebibyte = 1024.0 * 1024.0;
+	printf("Vulkan memory: %u device memory objects of %u allowed, %.2f MiB. %u dedicated allocations, %.2f MiB\n", allocator.deviceMemoryCount, allocator.maxMemoryAllocationCount, double(allocator.deviceMemoryBytes) / mebibyte, allocator.dedicatedAllocationCount, double(allocator.dedicatedBytes) / mebibyte);
+	for (u32 i = 0; i < allocator.pools.size(); i++)
+	{
+		const VulkanMemoryPool& pool = allocator.pools[i];
+		u32 blockCount = 0;
+		u32 allocationCount = 0;
+		VkDeviceSize blockBytes = 0;
+		VkDeviceSize freeBytes = 0;
+		VkDeviceSize largestFreeBlock = 0;
+		for (u32 block = 0; block < pool.blocks.size(); block++)
+		{
+			if (!pool.memory[block])
+			{
+				continue;
+			}
+			const TlsfAllocator& tlsf = pool.blocks[block];
+			const VkDeviceSize largest = tlsf_largestFreeBlock(tlsf);
+			blockCount++;
+			allocationCount += tlsf.allocationCount;
+			blockBytes += tlsf.size;
+			freeBytes += tlsf.freeBytes;
+			largestFreeBlock = largest > largestFreeBlock ? largest : largestFreeBlock;
+		}
+		if (blockCount)
+		{
+			// Free space split in many small holes is fragmentation: the largest hole is a small share of it
+			printf("\tType %2u %-7s: %u blocks, %.2f MiB, %u allocations, %.2f MiB used, %.2f MiB free, largest free %.2f MiB\n", i / 2, i % 2 ? "optimal" : "linear", blockCount, double(blockBytes) / mebibyte, allocationCount, double(blockBytes - freeBytes) / mebibyte, double(freeBytes) / mebibyte, double(largestFreeBlock) / mebibyte);
+		}
+	}
+}
+
+void vulkan_createResources(VulkanResources* resources)
+{
+	VulkanBufferPool& buffers = resources->buffers;
+	handlePool_create(&buffers.slots, VULKAN_MAX_BUFFERS);
+	buffers.handle.reserve(VULKAN_MAX_BUFFERS);
+	buffers.memory.reserve(VULKAN_MAX_BUFFERS);
+	buffers.size.reserve(VULKAN_MAX_BUFFERS);
+
+	VulkanTexturePool& textures = resources->textures;
+	handlePool_create(&textures.slots, VULKAN_MAX_TEXTURES);
+	textures.handle.reserve(VULKAN_MAX_TEXTURES);
+	textures.memory.reserve(VULKAN_MAX_TEXTURES);
+	textures.view.reserve(VULKAN_MAX_TEXTURES);
+	textures.sampler.reserve(VULKAN_MAX_TEXTURES);
+	textures.mipLevels.reserve(VULKAN_MAX_TEXTURES);
+
+	VulkanMSAAPool& msaa = resources->msaa;
+	handlePool_create(&msaa.slots, VULKAN_MAX_MSAA_TARGETS);
+	msaa.image.reserve(VULKAN_MAX_MSAA_TARGETS);
+	msaa.memory.reserve(VULKAN_MAX_MSAA_TARGETS);
+	msaa.view.reserve(VULKAN_MAX_MSAA_TARGETS);
+	msaa.samples.reserve(VULKAN_MAX_MSAA_TARGETS);
+}
+
+VulkanBufferHandle vulkan_addBuffer(VulkanResources* resources, const VulkanBuffer& buffer, VkDeviceSize size)
+{
+	VulkanBufferPool& pool = resources->buffers;
+	VulkanBufferHandle handle = { handlePool_allocate(&pool.slots) };
+	assert(handle.value);
+	pool.handle.push_back(buffer.handle);
+	pool.memory.push_back(buffer.memory);
+	pool.size.push_back(size);
+	return handle;
+}
+
+VulkanBuffer vulkan_getBuffer(const VulkanResources& resources, VulkanBufferHandle handle)
+{
+	const u32 record = handlePool_recordIndex(resources.buffers.slots, handle.value);
+	assert(record != HANDLE_INVALID_INDEX);
+	return { resources.buffers.handle[record], resources.buffers.memory[record] };
+}
+
+void vulkan_destroyBuffer(VkDevice device, VulkanMemoryAllocator* allocator, VulkanResources* resources, VulkanBufferHandle handle)
+{
+	VulkanBufferPool& pool = resources->buffers;
+	u32 record;
+	if (!handlePool_free(&pool.slots, handle.value, &record))
+	{
+		assert(!"Stale buffer handle");
+		return;
+	}
+	vkDestroyBuffer(device, pool.handle[record], nullptr);
+	vulkan_freeMemory(allocator, pool.memory[record]);
+	soaPool_removeRecord(pool.handle, record);
+	soaPool_removeRecord(pool.memory, record);
+	soaPool_removeRecord(pool.size, record);
+}
+
+VulkanTextureHandle vulkan_addTexture(VulkanResources* resources, const VulkanTexture& texture)
+{
+	VulkanTexturePool& pool = resources->textures;
+	VulkanTextureHandle handle = { handlePool_allocate(&pool.slots) };
+	assert(handle.value);
+	pool.handle.push_back(texture.handle);
+	pool.memory.push_back(texture.memory);
+	pool.view.push_back(texture.view);
+	pool.sampler.push_back(texture.sampler);
+	pool.mipLevels.push_back(texture.mipLevels);
+	return handle;
+}
+
+VulkanTexture vulkan_getTexture(const VulkanResources& resources, VulkanTextureHandle handle)
+{
+	const VulkanTexturePool& pool = resources.textures;
+	const u32 record = handlePool_recordIndex(pool.slots, handle.value);
+	assert(record != HANDLE_INVALID_INDEX);
+	return { pool.mipLevels[record], pool.handle[record], pool.memory[record], pool.view[record], pool.sampler[record] };
+}
+
+static void vulkan_destroyTextureRecord(VkDevice device, VulkanMemoryAllocator* allocator, const VulkanTexturePool& pool, u32 record)
+{
+	vkDestroyImage(device, pool.handle[record], nullptr);
+	vkDestroyImageView(device, pool.view[record], nullptr);
+	vkDestroySampler(device, pool.sampler[record], nullptr);
+	vulkan_freeMemory(allocator, pool.memory[record]);
+}
+
+void vulkan_destroyTexture(VkDevice device, VulkanMemoryAllocator* allocator, VulkanResources* resources, VulkanTextureHandle handle)
+{
+	VulkanTexturePool& pool = resources->textures;
+	u32 record;
+	if (!handlePool_free(&pool.slots, handle.value, &record))
+	{
+		assert(!"Stale texture handle");
+		return;
+	}
+	vulkan_destroyTextureRecord(device, allocator, pool, record);
+	soaPool_removeRecord(pool.handle, record);
+	soaPool_removeRecord(pool.memory, record);
+	soaPool_removeRecord(pool.view, record);
+	soaPool_removeRecord(pool.sampler, record);
+	soaPool_removeRecord(pool.mipLevels, record);
+}
+
+VulkanMSAAHandle vulkan_addMSAA(VulkanResources* resources, const VulkanMSAA& msaa)
+{
+	VulkanMSAAPool& pool = resources->msaa;
+	VulkanMSAAHandle handle = { handlePool_allocate(&pool.slots) };
+	assert(handle.value);
+	pool.image.push_back(msaa.image);
+	pool.memory.push_back(msaa.memory);
+	pool.view.push_back(msaa.view);
+	pool.samples.push_back(msaa.samples);
+	return handle;
+}
+
+VulkanMSAA vulkan_getMSAA(const VulkanResources& resources, VulkanMSAAHandle handle)
+{
+	const VulkanMSAAPool& pool = resources.msaa;
+	const u32 record = handlePool_recordIndex(pool.slots, handle.value);
+	assert(record != HANDLE_INVALID_INDEX);
+	return { pool.samples[record], pool.image[record], pool.memory[record], pool.view[record] };
+}
+
+void vulkan_destroyMSAA(VkDevice device, VulkanMemoryAllocator* allocator, VulkanResources* resources, VulkanMSAAHandle handle)
+{
+	VulkanMSAAPool& pool = resources->msaa;
+	u32 record;
+	if (!handlePool_free(&pool.slots, handle.value, &record))
+	{
+		assert(!"Stale MSAA handle");
+		return;
+	}
+	vkDestroyImage(device, pool.image[record], nullptr);
+	vkDestroyImageView(device, pool.view[record], nullptr);
+	vulkan_freeMemory(allocator, pool.memory[record]);
+	soaPool_removeRecord(pool.image, record);
+	soaPool_removeRecord(pool.memory, record);
+	soaPool_removeRecord(pool.view, record);
+	soaPool_removeRecord(pool.samples, record);
+}
+
+// Everything still alive, straight from the dense arrays
+void vulkan_destroyResources(VkDevice device, VulkanMemoryAllocator* allocator, VulkanResources* resources)
+{
+	VulkanBufferPool& buffers = resources->buffers;
+	for (u32 i = 0; i < buffers.slots.count; i++)
+	{
+		vkDestroyBuffer(device, buffers.handle[i], nullptr);
+		vulkan_freeMemory(allocator, buffers.memory[i]);
+	}
+	for (u32 i = 0; i < resources->textures.slots.count; i++)
+	{
+		vulkan_destroyTextureRecord(device, allocator, resources->textures, i);
+	}
+	VulkanMSAAPool& msaa = resources->msaa;
+	for (u32 i = 0; i < msaa.slots.count; i++)
+	{
+		vkDestroyImage(device, msaa.image[i], nullptr);
+		vkDestroyImageView(device, msaa.view[i], nullptr);
+		vulkan_freeMemory(allocator, msaa.memory[i]);
+	}
+	*resources = {};
+}
+
+void printVulkanResourceStats(const VulkanResources& resources)
+{
+	VkDeviceSize bufferBytes = 0;
+	for (VkDeviceSize size : resources.buffers.size)
+	{
+		bufferBytes += size;
+	}
+	printf("Vulkan resources: %u buffers (%.2f MiB), %u textures, %u MSAA targets\n", resources.buffers.slots.count, double(bufferBytes) / (1024.0 * 1024.0), resources.textures.slots.count, resources.msaa.slots.count);
+}
+
 VkInstance vulkan_createInstance()
 {
 	u32 layerCount = 0;
@@ -366,7 +1093,8 @@ u32 vulkan_getQueueFamilyIndex(VkQueueFlags queueFlags, const vector<VkQueueFami
 vector<VkDeviceQueueCreateInfo> vulkan_setupQueueCreation(const vector<VkQueueFamilyProperties>& queueFamilyProperties, VulkanQueueFamilyIndices& queueFamilyIndices, VkQueueFlags requestedQueueTypes)
 {
 	vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-	const float defaultQueuePriority(0.0f);
+	// Pointed to by the create infos, which are used long after this returns
+	static const float defaultQueuePriority(0.0f);
 
 	// Graphics queue
 	if (requestedQueueTypes & VK_QUEUE_GRAPHICS_BIT)
@@ -572,15 +1300,6 @@ VkPhysicalDevice vulkan_pickPhysicalDevice(VkInstance instance, VkSurfaceKHR sur
 	return pickedPhysicalDevice;
 }
 
-u32 vulkan_findMemoryType(u32 typeFilter, VkMemoryPropertyFlags properties, const VkPhysicalDeviceMemoryProperties& memoryProperties)
-{
-	for (u32 i = 0; i < memoryProperties.memoryTypeCount; i++)
-		if (typeFilter & (1 << i) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
-			return i;
-	assert(!"Error");
-	return ~0u;
-}
-
 VulkanPhysicalDeviceDescription vulkan_getPhysicalDeviceDescription(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface)
 {
 	VulkanPhysicalDeviceDescription description = {};
@@ -658,13 +1377,13 @@ VkDevice vulkan_createDevice(VkPhysicalDevice physicalDevice, const VulkanPhysic
 	return device;
 }
 
-VkSurfaceFormatKHR vulkan_pickSurfaceFormat(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface)
+VkSurfaceFormatKHR vulkan_pickSurfaceFormat(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, LinearArena* scratch = nullptr)
 {
 	u32 formatCount = 0;
 	VKCHECK(vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, nullptr));
 	assert(formatCount > 0);
 
-	vector<VkSurfaceFormatKHR> surfaceFormats(formatCount);
+	ScratchVector<VkSurfaceFormatKHR> surfaceFormats(formatCount, LinearArenaAllocator(scratch));
 	VKCHECK(vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, surfaceFormats.data()));
 
 	VkFormat colorFormat = VK_FORMAT_UNDEFINED;
@@ -700,8 +1419,9 @@ VkSurfaceFormatKHR vulkan_pickSurfaceFormat(VkPhysicalDevice physicalDevice, VkS
 	return pickedSurfaceFormat;
 }
 
-VulkanSwapchain vulkan_createSwapchain(VkPhysicalDevice physicalDevice, VkDevice device, VkSurfaceKHR surface, u32 width, u32 height, VulkanSwapchain* oldSwapchain = nullptr)
+VulkanSwapchain vulkan_createSwapchain(VkPhysicalDevice physicalDevice, VkDevice device, VkSurfaceKHR surface, u32 width, u32 height, VulkanSwapchain* oldSwapchain = nullptr, LinearArena* scratch = nullptr)
 {
+	AllocationTagScope tagScope(ALLOCATION_TAG_SWAPCHAIN);
 	VulkanSwapchain swapchain;
 
 	VkSurfaceCapabilitiesKHR surfaceCapabilities;
@@ -711,7 +1431,7 @@ VulkanSwapchain vulkan_createSwapchain(VkPhysicalDevice physicalDevice, VkDevice
 	VKCHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, nullptr));
 	assert(presentModeCount > 0);
 
-	vector<VkPresentModeKHR> presentModes(presentModeCount);
+	ScratchVector<VkPresentModeKHR> presentModes(presentModeCount, LinearArenaAllocator(scratch));
 	VKCHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, presentModes.data()));
 
 	swapchain.presentMode = VK_PRESENT_MODE_FIFO_KHR;
@@ -749,14 +1469,14 @@ VulkanSwapchain vulkan_createSwapchain(VkPhysicalDevice physicalDevice, VkDevice
 	// Find a supported composite alpha format (not all devices support alpha opaque)
 	VkCompositeAlphaFlagBitsKHR compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 	// Simply select the first composite alpha format available
-	vector<VkCompositeAlphaFlagBitsKHR> compositeAlphaFlags =
+	const VkCompositeAlphaFlagBitsKHR compositeAlphaFlags[] =
 	{
 		VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
 		VK_COMPOSITE_ALPHA_PRE_MULTIPLIED_BIT_KHR,
 		VK_COMPOSITE_ALPHA_POST_MULTIPLIED_BIT_KHR,
 		VK_COMPOSITE_ALPHA_INHERIT_BIT_KHR,
 	};
-	for (VkCompositeAlphaFlagBitsKHR& compositeAlphaFlag : compositeAlphaFlags)
+	for (VkCompositeAlphaFlagBitsKHR compositeAlphaFlag : compositeAlphaFlags)
 	{
 		if (surfaceCapabilities.supportedCompositeAlpha & compositeAlphaFlag)
 		{
@@ -765,7 +1485,7 @@ VulkanSwapchain vulkan_createSwapchain(VkPhysicalDevice physicalDevice, VkDevice
 		}
 	}
 
-	swapchain.surfaceFormat = vulkan_pickSurfaceFormat(physicalDevice, surface);
+	swapchain.surfaceFormat = vulkan_pickSurfaceFormat(physicalDevice, surface, scratch);
 
 	swapchain.extent.width = width;
 	swapchain.extent.height = height;
@@ -847,13 +1567,13 @@ VulkanSwapchain vulkan_createSwapchain(VkPhysicalDevice physicalDevice, VkDevice
 	return swapchain;
 }
 
-VkCommandPool vulkan_createCommandPool(VkDevice device, u32 queueIndex)
+VkCommandPool vulkan_createCommandPool(VkDevice device, u32 queueIndex, VkCommandPoolCreateFlags flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT)
 {
 	VkCommandPoolCreateInfo createInfo;
 	createInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 	createInfo.pNext = nullptr;
 	createInfo.queueFamilyIndex = queueIndex;
-	createInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	createInfo.flags = flags;
 	VkCommandPool commandPool = nullptr;
 	VKCHECK(vkCreateCommandPool(device, &createInfo, nullptr, &commandPool));
 
@@ -905,25 +1625,6 @@ VkImage vulkan_createImage(VkDevice device, VkExtent3D extent, u32 mipLevels, Vk
 	return image;
 }
 
-VkDeviceMemory vulkan_allocateMemoryForImage(VkDevice device, VkImage image, VkMemoryPropertyFlags memoryPropertyFlags, VkPhysicalDeviceMemoryProperties memoryProperties)
-{
-	VkMemoryRequirements memoryRequirements;
-	vkGetImageMemoryRequirements(device, image, &memoryRequirements);
-
-	VkMemoryAllocateInfo allocateInfo;
-	allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocateInfo.pNext = nullptr;
-	allocateInfo.allocationSize = memoryRequirements.size;
-	allocateInfo.memoryTypeIndex = vulkan_findMemoryType(memoryRequirements.memoryTypeBits, memoryPropertyFlags, memoryProperties);
-
-	VkDeviceMemory memory = nullptr;
-	VKCHECK(vkAllocateMemory(device, &allocateInfo, nullptr, &memory));
-
-	VKCHECK(vkBindImageMemory(device, image, memory, 0));
-
-	return memory;
-}
-
 
 VkImageView vulkan_createImageView(VkDevice device, VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, u32 mipLevels)
 {
@@ -999,10 +1700,8 @@ static inline bool32 vulkan_hasStencilComponent(VkFormat format)
 	return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
 }
 
-void vulkan_transitionImageLayout(VkDevice device, VkCommandPool commandPool, VkQueue queue, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, u32 mipLevels)
+void vulkan_cmdTransitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, u32 mipLevels)
 {
-	VkCommandBuffer	transferCommandBuffer = vulkan_beginSingleTimeCommands(device, commandPool);
-
 	VkImageMemoryBarrier barrier;
 	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 	barrier.pNext = nullptr;
@@ -1069,17 +1768,22 @@ void vulkan_transitionImageLayout(VkDevice device, VkCommandPool commandPool, Vk
 		assert(!"Unsupported transition");
 	}
 
-	vkCmdPipelineBarrier(transferCommandBuffer, sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
 
+void vulkan_transitionImageLayout(VkDevice device, VkCommandPool commandPool, VkQueue queue, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, u32 mipLevels)
+{
+	VkCommandBuffer	transferCommandBuffer = vulkan_beginSingleTimeCommands(device, commandPool);
+	vulkan_cmdTransitionImageLayout(transferCommandBuffer, image, format, oldLayout, newLayout, mipLevels);
 	vulkan_endSingleTimeCommands(device, commandPool, transferCommandBuffer, queue);
 }
 
-VulkanMSAA vulkan_createMultisamplingBuffer(VkDevice device, VkCommandPool commandPool, VkQueue queue, const VkPhysicalDeviceProperties& physicalDeviceProperties, const VkPhysicalDeviceMemoryProperties& physicalDeviceMemoryProperties, VkFormat swapchainImageFormat, const VkExtent2D& swapchainExtent, u32 mipLevels)
+VulkanMSAA vulkan_createMultisamplingBuffer(VkDevice device, VkCommandPool commandPool, VkQueue queue, const VkPhysicalDeviceProperties& physicalDeviceProperties, VulkanMemoryAllocator* allocator, VkFormat swapchainImageFormat, const VkExtent2D& swapchainExtent, u32 mipLevels)
 {
 	VulkanMSAA msaa;
 	msaa.samples = vulkan_pickSampleCount(physicalDeviceProperties);
 	msaa.image = vulkan_createImage(device, { swapchainExtent.width, swapchainExtent.height, 1}, mipLevels, msaa.samples, swapchainImageFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT);
-	msaa.memory = vulkan_allocateMemoryForImage(device, msaa.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, physicalDeviceMemoryProperties);
+	msaa.memory = vulkan_allocateMemoryForImage(allocator, msaa.image, VK_IMAGE_TILING_OPTIMAL, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 	msaa.view = vulkan_createImageView(device, msaa.image, swapchainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
 
 	vulkan_transitionImageLayout(device, commandPool, queue, msaa.image, swapchainImageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 1);
@@ -1119,30 +1823,21 @@ VkShaderModule vulkan_createShaderModule(VkDevice device, const char* path)
 	return shaderModule;
 }
 
-VkDescriptorSetLayout vulkan_createDescriptorSetLayout(VkDevice device)
+static VkDescriptorSetLayout vulkan_createSingleBindingDescriptorSetLayout(VkDevice device, VkDescriptorType descriptorType, VkShaderStageFlags stageFlags)
 {
-	VkDescriptorSetLayoutBinding uboLayoutBinding;
-	uboLayoutBinding.binding = 0;
-	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	uboLayoutBinding.descriptorCount = 1;
-	uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-	uboLayoutBinding.pImmutableSamplers = nullptr;
-
-	VkDescriptorSetLayoutBinding samplerLayoutBinding;
-	samplerLayoutBinding.binding = 1;
-	samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	samplerLayoutBinding.descriptorCount = 1;
-	samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-	samplerLayoutBinding.pImmutableSamplers = nullptr;
-
-	VkDescriptorSetLayoutBinding layoutBindings[2] = { uboLayoutBinding, samplerLayoutBinding };
+	VkDescriptorSetLayoutBinding layoutBinding;
+	layoutBinding.binding = 0;
+	layoutBinding.descriptorType = descriptorType;
+	layoutBinding.descriptorCount = 1;
+	layoutBinding.stageFlags = stageFlags;
+	layoutBinding.pImmutableSamplers = nullptr;
 
 	VkDescriptorSetLayoutCreateInfo createInfo;
 	createInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 	createInfo.pNext = nullptr;
 	createInfo.flags = 0;
-	createInfo.bindingCount = ARRAYSIZE(layoutBindings);
-	createInfo.pBindings = layoutBindings;
+	createInfo.bindingCount = 1;
+	createInfo.pBindings = &layoutBinding;
 
 	VkDescriptorSetLayout descriptorSetLayout = nullptr;
 	VKCHECK(vkCreateDescriptorSetLayout(device, &createInfo, nullptr, &descriptorSetLayout));
@@ -1150,16 +1845,31 @@ VkDescriptorSetLayout vulkan_createDescriptorSetLayout(VkDevice device)
 	return descriptorSetLayout;
 }
 
-VkPipelineLayout vulkan_createPipelineLayout(VkDevice device, VkDescriptorSetLayout* pDescriptorSetLayout)
+// Frame set: the per-draw uniforms at binding 0. Material set: the diffuse texture at binding 0
+array<VkDescriptorSetLayout, DESCRIPTOR_SET_COUNT> vulkan_createDescriptorSetLayouts(VkDevice device)
+{
+	array<VkDescriptorSetLayout, DESCRIPTOR_SET_COUNT> descriptorSetLayouts;
+	descriptorSetLayouts[DESCRIPTOR_SET_FRAME] = vulkan_createSingleBindingDescriptorSetLayout(device, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT);
+	descriptorSetLayouts[DESCRIPTOR_SET_MATERIAL] = vulkan_createSingleBindingDescriptorSetLayout(device, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+	return descriptorSetLayouts;
+}
+
+VkPipelineLayout vulkan_createPipelineLayout(VkDevice device, const array<VkDescriptorSetLayout, DESCRIPTOR_SET_COUNT>& descriptorSetLayouts)
 {
 	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo;
 	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipelineLayoutCreateInfo.pNext = nullptr;
 	pipelineLayoutCreateInfo.flags = 0;
-	pipelineLayoutCreateInfo.setLayoutCount = 1;
-	pipelineLayoutCreateInfo.pSetLayouts = pDescriptorSetLayout;
-	pipelineLayoutCreateInfo.pushConstantRangeCount = 0;
-	pipelineLayoutCreateInfo.pPushConstantRanges = nullptr;
+	pipelineLayoutCreateInfo.setLayoutCount = u32(descriptorSetLayouts.size());
+	pipelineLayoutCreateInfo.pSetLayouts = descriptorSetLayouts.data();
+	// Per-mesh vertex dequantization
+	VkPushConstantRange pushConstantRange;
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(MeshQuantization);
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
 
 	VkPipelineLayout pipelineLayout = nullptr;
 	VKCHECK(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout));
@@ -1255,36 +1965,43 @@ VkRenderPass vulkan_createRenderPass(VkDevice device, VkFormat swapchainFormat,
 }
 
 // Helpers
-static inline VkVertexInputBindingDescription vulkan_getBindingDescription()
+static constexpr VkFormat vulkan_vertexFormat(VertexAttributeFormat format)
 {
-	VkVertexInputBindingDescription inputBindingDescription;
-	inputBindingDescription.binding = 0;
-	inputBindingDescription.stride = sizeof(Vertex);
-	inputBindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-	return inputBindingDescription;
+	switch (format)
+	{
+		case VertexAttributeFormat::FLOAT2: return VK_FORMAT_R32G32_SFLOAT;
+		case VertexAttributeFormat::FLOAT3: return VK_FORMAT_R32G32B32_SFLOAT;
+		case VertexAttributeFormat::FLOAT4: return VK_FORMAT_R32G32B32A32_SFLOAT;
+		case VertexAttributeFormat::UNORM16x2: return VK_FORMAT_R16G16_UNORM;
+		case VertexAttributeFormat::UNORM16x4: return VK_FORMAT_R16G16B16A16_UNORM;
+		case VertexAttributeFormat::SNORM16x2: return VK_FORMAT_R16G16_SNORM;
+		default: return VK_FORMAT_UNDEFINED;
+	}
 }
 
-static inline array<VkVertexInputAttributeDescription, VERTEX_ATTRIBUTES> vulkan_getAttributeDescriptions()
+// Binding and attribute descriptions generated from VertexLayout<VertexType>
+template<typename VertexType>
+static inline VulkanVertexInput vulkan_getVertexInput()
 {
-	array<VkVertexInputAttributeDescription, VERTEX_ATTRIBUTES> attributeDescriptions;
-	// First attribute: position
-	attributeDescriptions[0].binding = 0;
-	attributeDescriptions[0].location = 0;
-	attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-	attributeDescriptions[0].offset = offsetof(Vertex, pos);
-	// Second attribute: color
-	attributeDescriptions[1].binding = 0;
-	attributeDescriptions[1].location = 1;
-	attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-	attributeDescriptions[1].offset = offsetof(Vertex, color);
-	// Third attribute: texture coordinates
-	attributeDescriptions[2].binding = 0;
-	attributeDescriptions[2].location = 2;
-	attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-	attributeDescriptions[2].offset = offsetof(Vertex, texCoord);
+	constexpr u32 attributeCount = u32(ARRAYSIZE(VertexLayout<VertexType>::attributes));
+	static_assert(attributeCount <= MAX_VERTEX_ATTRIBUTES, "Too many vertex attributes");
+
+	VulkanVertexInput vertexInput;
+	vertexInput.binding.binding = 0;
+	vertexInput.binding.stride = sizeof(VertexType);
+	vertexInput.binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+	vertexInput.attributeCount = attributeCount;
+	for (u32 i = 0; i < attributeCount; i++)
+	{
+		const VertexAttributeDescription& attribute = VertexLayout<VertexType>::attributes[i];
+		vertexInput.attributes[i].binding = 0;
+		vertexInput.attributes[i].location = attribute.location;
+		vertexInput.attributes[i].format = vulkan_vertexFormat(attribute.format);
+		vertexInput.attributes[i].offset = attribute.offset;
+	}
 
-	return attributeDescriptions;
+	return vertexInput;
 }
 
 static inline VkPipelineShaderStageCreateInfo vulkan_createShaderPipelineStage(VkShaderModule shaderModule, VkShaderStageFlagBits shaderStage, const char* entryPoint = "main")
@@ -1301,23 +2018,20 @@ static inline VkPipelineShaderStageCreateInfo vulkan_createShaderPipelineStage(V
 	return createInfo;
 }
 
-VkPipeline vulkan_createGraphicsPipeline(VkDevice device, VkShaderModule vertexShader, VkShaderModule fragmentShader, const VkExtent2D& swapchainExtent, VkPipelineLayout pipelineLayout, VkRenderPass renderPass, VkSampleCountFlagBits sampleCount)
+VkPipeline vulkan_createGraphicsPipeline(VkDevice device, VkShaderModule vertexShader, VkShaderModule fragmentShader, const VulkanVertexInput& vertexInput, const VkExtent2D& swapchainExtent, VkPipelineLayout pipelineLayout, VkRenderPass renderPass, VkSampleCountFlagBits sampleCount)
 {
 	VkPipelineShaderStageCreateInfo vertexShaderStage = vulkan_createShaderPipelineStage(vertexShader, VK_SHADER_STAGE_VERTEX_BIT);
 	VkPipelineShaderStageCreateInfo fragmentShaderStage = vulkan_createShaderPipelineStage(fragmentShader, VK_SHADER_STAGE_FRAGMENT_BIT);
 	VkPipelineShaderStageCreateInfo shaderStages[] = { vertexShaderStage, fragmentShaderStage };
 
-	VkVertexInputBindingDescription bindingDescription = vulkan_getBindingDescription();
-	array<VkVertexInputAttributeDescription, VERTEX_ATTRIBUTES> attributeDescriptions = vulkan_getAttributeDescriptions();
-
 	VkPipelineVertexInputStateCreateInfo vertexInputState;
 	vertexInputState.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 	vertexInputState.pNext = nullptr;
 	vertexInputState.flags = 0;
 	vertexInputState.vertexBindingDescriptionCount = 1;
-	vertexInputState.pVertexBindingDescriptions = &bindingDescription;
-	vertexInputState.vertexAttributeDescriptionCount = u32(attributeDescriptions.size());
-	vertexInputState.pVertexAttributeDescriptions = attributeDescriptions.data();
+	vertexInputState.pVertexBindingDescriptions = &vertexInput.binding;
+	vertexInputState.vertexAttributeDescriptionCount = vertexInput.attributeCount;
+	vertexInputState.pVertexAttributeDescriptions = vertexInput.attributes.data();
 
 	VkPipelineInputAssemblyStateCreateInfo inputAssemblyState;
 	inputAssemblyState.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
@@ -1459,7 +2173,7 @@ VkPipeline vulkan_createGraphicsPipeline(VkDevice device, VkShaderModule vertexS
 	return graphicsPipeline;
 }
 
-VulkanDepthStencil vulkan_createDepthStencil(VkDevice device, VkPhysicalDevice physicalDevice, VkExtent2D const& extent, VkPhysicalDeviceMemoryProperties const& memoryProperties)
+VulkanDepthStencil vulkan_createDepthStencil(VkDevice device, VkPhysicalDevice physicalDevice, VkExtent2D const& extent, VulkanMemoryAllocator* allocator)
 {
 	VulkanDepthStencil depthStencil;
 	VkFormat depthFormat = VK_FORMAT_UNDEFINED;
@@ -1508,19 +2222,7 @@ VulkanDepthStencil vulkan_createDepthStencil(VkDevice device, VkPhysicalDevice p
 		VKCHECK(vkCreateImage(device, &createInfo, nullptr, &depthStencil.image));
 	}
 
-	{
-		VkMemoryRequirements memoryRequirements;
-		vkGetImageMemoryRequirements(device, depthStencil.image, &memoryRequirements);
-
-		VkMemoryAllocateInfo allocateInfo;
-		allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocateInfo.pNext = nullptr;
-		allocateInfo.allocationSize = memoryRequirements.size;
-		allocateInfo.memoryTypeIndex = vulkan_findMemoryType(memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, memoryProperties);
-
-		VKCHECK(vkAllocateMemory(device, &allocateInfo, nullptr, &depthStencil.memory));
-		VKCHECK(vkBindImageMemory(device, depthStencil.image, depthStencil.memory, 0));
-	}
+	depthStencil.memory = vulkan_allocateMemoryForImage(allocator, depthStencil.image, VK_IMAGE_TILING_OPTIMAL, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
 	{
 		VkImageViewCreateInfo createInfo;
@@ -1549,6 +2251,7 @@ VulkanDepthStencil vulkan_createDepthStencil(VkDevice device, VkPhysicalDevice p
 
 vector<VkFramebuffer> vulkan_createFramebuffers(VkDevice device, const vector<VkImageView>& imageViews, const VkExtent2D& swapchainExtent, VkRenderPass renderPass, VkImageView depthImageView, VkImageView colorImageView)
 {
+	AllocationTagScope tagScope(ALLOCATION_TAG_SWAPCHAIN);
 	array<VkImageView, 3> attachments = { colorImageView, depthImageView, VkImageView() };
 
 	VkFramebufferCreateInfo createInfo;
@@ -1588,12 +2291,10 @@ vector<VkCommandBuffer> vulkan_createCommandBuffers(VkDevice device, VkCommandPo
 	return commandBuffers;
 }
 
-static inline void vulkan_copyBufferToImage(VkDevice device, VkCommandPool commandPool, VkQueue queue, VkImage dstImage, VkBuffer srcBuffer, VkExtent2D imageExtent)
+static inline void vulkan_cmdCopyBufferToImage(VkCommandBuffer commandBuffer, VkImage dstImage, VkBuffer srcBuffer, VkDeviceSize srcOffset, VkExtent2D imageExtent)
 {
-	VkCommandBuffer transferCommandBuffer = vulkan_beginSingleTimeCommands(device, commandPool);
-
 	VkBufferImageCopy region;
-	region.bufferOffset = 0;
+	region.bufferOffset = srcOffset;
 	region.bufferRowLength = 0;
 	region.bufferImageHeight = 0;
 	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -1605,9 +2306,7 @@ static inline void vulkan_copyBufferToImage(VkDevice device, VkCommandPool comma
 	region.imageExtent.height = imageExtent.height;
 	region.imageExtent.depth = 1;
 
-	vkCmdCopyBufferToImage(transferCommandBuffer, srcBuffer, dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-	vulkan_endSingleTimeCommands(device, commandPool, transferCommandBuffer, queue);
+	vkCmdCopyBufferToImage(commandBuffer, srcBuffer, dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 }
 
 VkSampler vulkan_createTextureSampler(VkDevice device, u32 mipLevels)
@@ -1638,22 +2337,17 @@ VkSampler vulkan_createTextureSampler(VkDevice device, u32 mipLevels)
 	return sampler;
 }
 
-void vulkan_generateMipmaps(VkPhysicalDevice physicalDevice, VkDevice device, VkCommandPool commandPool, VkQueue queue, VkImage image, VkFormat imageFormat, int textureWidth, int textureHeight, u32 mipLevels)
+// Level 0 is in TRANSFER_DST_OPTIMAL. Every level ends up in SHADER_READ_ONLY_OPTIMAL
+void vulkan_cmdGenerateMipmaps(VkCommandBuffer commandBuffer, VkImage image, int textureWidth, int textureHeight, u32 mipLevels)
 {
-	VkFormatProperties formatProperties;
-	vkGetPhysicalDeviceFormatProperties(physicalDevice, imageFormat, &formatProperties);
-	assert(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT);
-
-	VkCommandBuffer commandBuffer = vulkan_beginSingleTimeCommands(device, commandPool);
-
 	int mipWidth = textureWidth;
 	int mipHeight = textureHeight;
 
 	VkImageMemoryBarrier imageMemoryBarrier;
 	imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 	imageMemoryBarrier.pNext = nullptr;
-	imageMemoryBarrier.srcQueueFamilyIndex = 0;
-	imageMemoryBarrier.dstQueueFamilyIndex = 0;
+	imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 	imageMemoryBarrier.image = image;
 	imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 	imageMemoryBarrier.subresourceRange.baseMipLevel = 0;
@@ -1705,8 +2399,6 @@ void vulkan_generateMipmaps(VkPhysicalDevice physicalDevice, VkDevice device, Vk
 	imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
 	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-
-	vulkan_endSingleTimeCommands(device, commandPool, commandBuffer, queue);
 }
 
 static inline VkBuffer vulkan_createBuffer(VkDevice device, VkDeviceSize bufferSize, VkBufferUsageFlags usage, const VulkanQueueInfo& queueInfo)
@@ -1727,108 +2419,444 @@ static inline VkBuffer vulkan_createBuffer(VkDevice device, VkDeviceSize bufferS
 	return buffer;
 }
 
-static inline VkDeviceMemory vulkan_allocateMemoryForBuffer(VkDevice device, VkBuffer buffer, const VkPhysicalDeviceMemoryProperties& memoryProperties, VkMemoryPropertyFlags memoryFlags)
+// Host visible memory stays mapped, and the memory types asked for are coherent: no flush needed
+void vulkan_copyDataToMemory(const VulkanAllocation& memory, u64 dataSize, const void* dataToCopy)
 {
-	VkMemoryRequirements memoryRequirements;
-	vkGetBufferMemoryRequirements(device, buffer, &memoryRequirements);
+	assert(memory.mapped && dataSize <= memory.size);
+	memcpy(memory.mapped, dataToCopy, dataSize);
+}
 
-	VkMemoryAllocateInfo allocateInfo;
-	allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+VulkanBuffer vulkan_createLocalDeviceBuffer(VkDevice device, u64 bufferSize, VkBufferUsageFlags bufferUsage, const VulkanQueueInfo& queueInfo, VulkanMemoryAllocator* allocator)
+{
+	VulkanBuffer deviceBuffer = {};
+
+	deviceBuffer.handle = vulkan_createBuffer(device, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | bufferUsage, queueInfo);
+	deviceBuffer.memory = vulkan_allocateMemoryForBuffer(allocator, deviceBuffer.handle, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	return deviceBuffer;
+}
+
+// queue may be the graphics queue itself
+void vulkan_createUploader(VulkanUploader* uploader, VkDevice device, VkQueue queue, u32 queueFamilyIndex, VkQueue graphicsQueue, u32 graphicsQueueFamilyIndex, VulkanMemoryAllocator* allocator, VkDeviceSize stagingSize = VULKAN_UPLOAD_STAGING_SIZE)
+{
+	assert(stagingSize % VULKAN_UPLOAD_ALIGNMENT == 0);
+	*uploader = {};
+	uploader->device = device;
+	uploader->queue = queue;
+	uploader->graphicsQueue = graphicsQueue;
+	uploader->queueFamilyIndex = queueFamilyIndex;
+	uploader->graphicsQueueFamilyIndex = graphicsQueueFamilyIndex;
+	uploader->ownershipTransfer = queueFamilyIndex != graphicsQueueFamilyIndex;
+	uploader->allocator = allocator;
+	uploader->commandPool = vulkan_createCommandPool(device, queueFamilyIndex);
+	uploader->stagingSize = stagingSize;
+	uploader->stagingBuffer = vulkan_createBuffer(device, stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, { nullptr, 0, VK_SHARING_MODE_EXCLUSIVE });
+	uploader->stagingMemory = vulkan_allocateMemoryForBuffer(allocator, uploader->stagingBuffer, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+
+	VkCommandBufferAllocateInfo allocateInfo;
+	allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	allocateInfo.pNext = nullptr;
-	allocateInfo.allocationSize = memoryRequirements.size;
-	allocateInfo.memoryTypeIndex = vulkan_findMemoryType(memoryRequirements.memoryTypeBits, memoryFlags, memoryProperties);
+	allocateInfo.commandPool = uploader->commandPool;
+	allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocateInfo.commandBufferCount = VULKAN_UPLOAD_BATCH_COUNT;
+	VKCHECK(vkAllocateCommandBuffers(device, &allocateInfo, uploader->commandBuffers.data()));
 
-	VkDeviceMemory bufferMemory = nullptr;
-	VKCHECK(vkAllocateMemory(device, &allocateInfo, nullptr, &bufferMemory));
+	VkFenceCreateInfo fenceInfo;
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.pNext = nullptr;
+	fenceInfo.flags = 0;
+	for (VkFence& fence : uploader->fences)
+	{
+		VKCHECK(vkCreateFence(device, &fenceInfo, nullptr, &fence));
+	}
 
-	VKCHECK(vkBindBufferMemory(device, buffer, bufferMemory, 0));
+	if (uploader->ownershipTransfer)
+	{
+		uploader->acquireCommandPool = vulkan_createCommandPool(device, graphicsQueueFamilyIndex);
+		allocateInfo.commandPool = uploader->acquireCommandPool;
+		VKCHECK(vkAllocateCommandBuffers(device, &allocateInfo, uploader->acquireCommandBuffers.data()));
 
-	return bufferMemory;
+		VkSemaphoreCreateInfo semaphoreInfo;
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semaphoreInfo.pNext = nullptr;
+		semaphoreInfo.flags = 0;
+		// As if every slot's previous acquire was done
+		fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+		for (u32 i = 0; i < VULKAN_UPLOAD_BATCH_COUNT; i++)
+		{
+			VKCHECK(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &uploader->semaphores[i]));
+			VKCHECK(vkCreateFence(device, &fenceInfo, nullptr, &uploader->acquireFences[i]));
+		}
+	}
+	uploader->openBatch = 1;
 }
 
-void vulkan_copyDataToMemory(VkDevice device, VkDeviceMemory memory, u64 dataSize, const void* dataToCopy)
+// Hands what the batch wrote over to the graphics queue. The batch is done, so the semaphore waited on is already signalled
+static void vulkan_submitUploadAcquire(VulkanUploader* uploader, VulkanUploadToken batch)
 {
-	void* data;
-	VKCHECK(vkMapMemory(device, memory, 0, dataSize, 0, &data));
-	memcpy(data, dataToCopy, dataSize);
-	vkUnmapMemory(device, memory);
+	const u32 slot = batch % VULKAN_UPLOAD_BATCH_COUNT;
+	const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+	VkSubmitInfo submitInfo;
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.pNext = nullptr;
+	submitInfo.waitSemaphoreCount = 1;
+	submitInfo.pWaitSemaphores = &uploader->semaphores[slot];
+	submitInfo.pWaitDstStageMask = &waitStage;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &uploader->acquireCommandBuffers[slot];
+	submitInfo.signalSemaphoreCount = 0;
+	submitInfo.pSignalSemaphores = nullptr;
+
+	VKCHECK(vkResetFences(uploader->device, 1, &uploader->acquireFences[slot]));
+	VKCHECK(vkQueueSubmit(uploader->graphicsQueue, 1, &submitInfo, uploader->acquireFences[slot]));
 }
 
-void vulkan_copyBuffer(VkDevice device, VkCommandPool transferCommandPool, VkQueue transferQueue,
-	VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+// The batch's staging space is free again, and so are the oversized staging buffers it used
+static void vulkan_retireUploadBatch(VulkanUploader* uploader, VulkanUploadToken batch)
 {
-	VkCommandBuffer transferCommandBuffer = vulkan_beginSingleTimeCommands(device, transferCommandPool);
-
-	VkBufferCopy copyRegion;
-	copyRegion.srcOffset = 0;
-	copyRegion.dstOffset = 0;
-	copyRegion.size = size;
-	vkCmdCopyBuffer(transferCommandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+	if (uploader->ownershipTransfer)
+	{
+		vulkan_submitUploadAcquire(uploader, batch);
+	}
+	const u64 stagingEnd = uploader->batchStagingEnds[batch % VULKAN_UPLOAD_BATCH_COUNT];
+	uploader->stagingTail = stagingEnd > uploader->stagingTail ? stagingEnd : uploader->stagingTail;
+	uploader->completedBatch = batch;
+	for (size_t i = 0; i < uploader->oversizedStaging.size();)
+	{
+		if (uploader->oversizedStagingBatches[i] <= batch)
+		{
+			vkDestroyBuffer(uploader->device, uploader->oversizedStaging[i].handle, nullptr);
+			vulkan_freeMemory(uploader->allocator, uploader->oversizedStaging[i].memory);
+			soaPool_removeRecord(uploader->oversizedStaging, u32(i));
+			soaPool_removeRecord(uploader->oversizedStagingBatches, u32(i));
+		}
+		else
+		{
+			i++;
+		}
+	}
+}
 
-	vulkan_endSingleTimeCommands(device, transferCommandPool, transferCommandBuffer, transferQueue);
+static void vulkan_waitForOldestUploadBatch(VulkanUploader* uploader)
+{
+	const VulkanUploadToken batch = uploader->completedBatch + 1;
+	assert(batch < uploader->openBatch);
+	VKCHECK(vkWaitForFences(uploader->device, 1, &uploader->fences[batch % VULKAN_UPLOAD_BATCH_COUNT], true, ~0ull));
+	vulkan_retireUploadBatch(uploader, batch);
 }
 
-VulkanBuffer vulkan_createStagingBuffer(VkDevice device, const void* bufferData, u64 bufferSize, const VulkanQueueInfo& queueInfo, const VkPhysicalDeviceMemoryProperties& memoryProperties)
+// Submits the open batch, if anything was recorded in it. Returns the token of the last batch submitted
+VulkanUploadToken vulkan_submitUploads(VulkanUploader* uploader)
 {
-	VulkanBuffer stagingBuffer;
+	if (!uploader->recording)
+	{
+		return uploader->openBatch - 1;
+	}
+	const u32 slot = uploader->openBatch % VULKAN_UPLOAD_BATCH_COUNT;
+	VkCommandBuffer commandBuffer = uploader->commandBuffers[slot];
 
-	stagingBuffer.handle = vulkan_createBuffer(device, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, queueInfo);
-	stagingBuffer.memory = vulkan_allocateMemoryForBuffer(device, stagingBuffer.handle, memoryProperties, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+	if (uploader->ownershipTransfer)
+	{
+		// Its acquire barriers make the writes visible on the graphics queue
+		VKCHECK(vkEndCommandBuffer(uploader->acquireCommandBuffers[slot]));
+	}
+	else
+	{
+		// Later submissions on the queue read what this batch wrote
+		VkMemoryBarrier barrier;
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.pNext = nullptr;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VULKAN_UPLOAD_DST_ACCESS;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VULKAN_UPLOAD_DST_STAGES, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+	}
+	VKCHECK(vkEndCommandBuffer(commandBuffer));
 
-	vulkan_copyDataToMemory(device, stagingBuffer.memory, bufferSize, bufferData);
+	VkSubmitInfo submitInfo;
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.pNext = nullptr;
+	submitInfo.waitSemaphoreCount = 0;
+	submitInfo.pWaitSemaphores = nullptr;
+	submitInfo.pWaitDstStageMask = nullptr;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	submitInfo.signalSemaphoreCount = uploader->ownershipTransfer ? 1 : 0;
+	submitInfo.pSignalSemaphores = uploader->ownershipTransfer ? &uploader->semaphores[slot] : nullptr;
 
-	return stagingBuffer;
+	VKCHECK(vkResetFences(uploader->device, 1, &uploader->fences[slot]));
+	VKCHECK(vkQueueSubmit(uploader->queue, 1, &submitInfo, uploader->fences[slot]));
+	uploader->batchStagingEnds[slot] = uploader->stagingHead;
+	uploader->recording = false;
+	uploader->submitCount++;
+
+	return uploader->openBatch++;
 }
 
-VulkanBuffer vulkan_createLocalDeviceBuffer(VkDevice device, u64 bufferSize, VkBufferUsageFlags bufferUsage, const VulkanQueueInfo& queueInfo, const VkPhysicalDeviceMemoryProperties& memoryProperties)
+// Space for size bytes in the staging ring. Waits for the oldest batches when the ring is full
+static VkDeviceSize vulkan_reserveStaging(VulkanUploader* uploader, VkDeviceSize size)
 {
-	VulkanBuffer deviceBuffer = {};
+	const VkDeviceSize ringSize = uploader->stagingSize;
+	assert(size <= ringSize);
+	for (;;)
+	{
+		u64 start = (uploader->stagingHead + VULKAN_UPLOAD_ALIGNMENT - 1) & ~u64(VULKAN_UPLOAD_ALIGNMENT - 1);
+		// Copies don't wrap around the end of the ring
+		if (start % ringSize + size > ringSize)
+		{
+			start += ringSize - start % ringSize;
+		}
+		// Nothing in use: start over at the beginning of the ring
+		if (uploader->stagingTail == uploader->stagingHead && start + size - uploader->stagingTail > ringSize)
+		{
+			start = (uploader->stagingHead + ringSize - 1) / ringSize * ringSize;
+			uploader->stagingTail = start;
+		}
+		if (start + size - uploader->stagingTail <= ringSize)
+		{
+			uploader->stagingHead = start + size;
+			return start % ringSize;
+		}
+		// Staging space of the open batch is only reclaimed once it's submitted and done
+		if (uploader->recording)
+		{
+			vulkan_submitUploads(uploader);
+		}
+		else
+		{
+			vulkan_waitForOldestUploadBatch(uploader);
+		}
+	}
+}
 
-	deviceBuffer.handle = vulkan_createBuffer(device, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | bufferUsage, queueInfo);
-	deviceBuffer.memory = vulkan_allocateMemoryForBuffer(device, deviceBuffer.handle, memoryProperties, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+// The open batch's command buffer, begun if nothing was recorded in it yet, along with its acquire command buffer
+static VkCommandBuffer vulkan_uploadCommandBuffer(VulkanUploader* uploader)
+{
+	const u32 slot = uploader->openBatch % VULKAN_UPLOAD_BATCH_COUNT;
+	if (!uploader->recording)
+	{
+		// The last batch that used this command buffer
+		while (uploader->completedBatch + VULKAN_UPLOAD_BATCH_COUNT < uploader->openBatch)
+		{
+			vulkan_waitForOldestUploadBatch(uploader);
+		}
+		VkCommandBufferBeginInfo beginInfo;
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.pNext = nullptr;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		beginInfo.pInheritanceInfo = nullptr;
+		VKCHECK(vkResetCommandBuffer(uploader->commandBuffers[slot], 0));
+		VKCHECK(vkBeginCommandBuffer(uploader->commandBuffers[slot], &beginInfo));
+		if (uploader->ownershipTransfer)
+		{
+			// Submitted when that last batch retired
+			VKCHECK(vkWaitForFences(uploader->device, 1, &uploader->acquireFences[slot], true, ~0ull));
+			VKCHECK(vkResetCommandBuffer(uploader->acquireCommandBuffers[slot], 0));
+			VKCHECK(vkBeginCommandBuffer(uploader->acquireCommandBuffers[slot], &beginInfo));
+		}
+		uploader->recording = true;
+	}
+	return uploader->commandBuffers[slot];
+}
 
-	return deviceBuffer;
+// Copies data to staging memory, the only CPU copy of an upload. Data bigger than the whole ring gets a buffer of its own
+static VkBuffer vulkan_stageUpload(VulkanUploader* uploader, const void* data, VkDeviceSize size, VkDeviceSize* stagingOffset)
+{
+	uploader->uploadCount++;
+	uploader->uploadBytes += size;
+	if (size > uploader->stagingSize)
+	{
+		VulkanBuffer staging;
+		staging.handle = vulkan_createBuffer(uploader->device, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, { nullptr, 0, VK_SHARING_MODE_EXCLUSIVE });
+		staging.memory = vulkan_allocateMemoryForBuffer(uploader->allocator, staging.handle, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+		vulkan_copyDataToMemory(staging.memory, size, data);
+		uploader->oversizedStaging.push_back(staging);
+		uploader->oversizedStagingBatches.push_back(uploader->openBatch);
+		*stagingOffset = 0;
+		return staging.handle;
+	}
+	*stagingOffset = vulkan_reserveStaging(uploader, size);
+	memcpy(uploader->stagingMemory.mapped + *stagingOffset, data, size);
+	return uploader->stagingBuffer;
 }
 
-VulkanBuffer vulkan_bufferDataIntoLocalDevice(VkDevice device, const void* bufferData, u64 bufferSize, VkBufferUsageFlags bufferUsage, VkCommandPool transferCommandPool, VkQueue transferQueue, const VulkanQueueInfo& queueInfo, const VkPhysicalDeviceMemoryProperties& memoryProperties)
+VulkanUploadToken vulkan_uploadBuffer(VulkanUploader* uploader, VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size)
 {
-	VulkanBuffer stagingBuffer = vulkan_createStagingBuffer(device, bufferData, bufferSize, queueInfo, memoryProperties);
-	VulkanBuffer deviceBuffer = vulkan_createLocalDeviceBuffer(device, bufferSize, bufferUsage, queueInfo, memoryProperties);
+	VkBufferCopy copyRegion;
+	copyRegion.dstOffset = offset;
+	copyRegion.size = size;
+	VkBuffer stagingBuffer = vulkan_stageUpload(uploader, data, size, &copyRegion.srcOffset);
+	VkCommandBuffer commandBuffer = vulkan_uploadCommandBuffer(uploader);
+	vkCmdCopyBuffer(commandBuffer, stagingBuffer, buffer, 1, &copyRegion);
 
-	// Copy data to the buffer
-	// VK_MEMORY_PROPERTY_HOST_COHERENT_BIT is slower than using vkFlushMappedMemoryRanges and vkInvalidateMappedMemoryRanges
-	// vkFlushMappedMemoryRanges must be called after writing to the mapped memory
-	// vkInvalidateMappedMemoryRanges must be called before reading from the mapped memory
-	// but actually we're copying to the local device, so it should be fast
+	if (uploader->ownershipTransfer)
+	{
+		VkBufferMemoryBarrier barrier;
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.pNext = nullptr;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = 0;
+		barrier.srcQueueFamilyIndex = uploader->queueFamilyIndex;
+		barrier.dstQueueFamilyIndex = uploader->graphicsQueueFamilyIndex;
+		barrier.buffer = buffer;
+		barrier.offset = offset;
+		barrier.size = size;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
 
-	vulkan_copyDataToMemory(device, stagingBuffer.memory, bufferSize, bufferData);
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VULKAN_UPLOAD_DST_ACCESS;
+		vkCmdPipelineBarrier(uploader->acquireCommandBuffers[uploader->openBatch % VULKAN_UPLOAD_BATCH_COUNT], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VULKAN_UPLOAD_DST_STAGES, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+	}
 
-	vulkan_copyBuffer(device, transferCommandPool, transferQueue, stagingBuffer.handle, deviceBuffer.handle, bufferSize);
+	return uploader->openBatch;
+}
 
-	vkDestroyBuffer(device, stagingBuffer.handle, nullptr);
-	vkFreeMemory(device, stagingBuffer.memory, nullptr);
+// Fills level 0 with pixels and generates the other levels: the image ends up shader readable
+VulkanUploadToken vulkan_uploadImage(VulkanUploader* uploader, VkImage image, VkFormat format, VkExtent2D extent, u32 mipLevels, const void* pixels, VkDeviceSize size)
+{
+	VkDeviceSize stagingOffset;
+	VkBuffer stagingBuffer = vulkan_stageUpload(uploader, pixels, size, &stagingOffset);
+	VkCommandBuffer commandBuffer = vulkan_uploadCommandBuffer(uploader);
+	vulkan_cmdTransitionImageLayout(commandBuffer, image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
+	vulkan_cmdCopyBufferToImage(commandBuffer, image, stagingBuffer, stagingOffset, extent);
+	if (!uploader->ownershipTransfer)
+	{
+		vulkan_cmdGenerateMipmaps(commandBuffer, image, i32(extent.width), i32(extent.height), mipLevels);
+		return uploader->openBatch;
+	}
 
-	return deviceBuffer;
+	// Blits need a graphics queue: the image changes hands still in TRANSFER_DST_OPTIMAL and gets its mipmaps after
+	VkImageMemoryBarrier barrier;
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.pNext = nullptr;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = 0;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcQueueFamilyIndex = uploader->queueFamilyIndex;
+	barrier.dstQueueFamilyIndex = uploader->graphicsQueueFamilyIndex;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = mipLevels;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	VkCommandBuffer acquireCommandBuffer = uploader->acquireCommandBuffers[uploader->openBatch % VULKAN_UPLOAD_BATCH_COUNT];
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(acquireCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	vulkan_cmdGenerateMipmaps(acquireCommandBuffer, image, i32(extent.width), i32(extent.height), mipLevels);
+
+	return uploader->openBatch;
 }
 
-VulkanBufferList vulkan_createUniformBuffers(VkDevice device, VkDeviceSize swapchainImageCount, const VulkanQueueInfo& queueInfo, const VkPhysicalDeviceMemoryProperties& memoryProperties)
+bool32 vulkan_uploadComplete(VulkanUploader* uploader, VulkanUploadToken token)
 {
-	constexpr VkDeviceSize bufferSize = sizeof(UniformBufferObject);
+	while (uploader->completedBatch < token && uploader->completedBatch + 1 < uploader->openBatch)
+	{
+		const VulkanUploadToken batch = uploader->completedBatch + 1;
+		if (vkGetFenceStatus(uploader->device, uploader->fences[batch % VULKAN_UPLOAD_BATCH_COUNT]) != VK_SUCCESS)
+		{
+			break;
+		}
+		vulkan_retireUploadBatch(uploader, batch);
+	}
+	return uploader->completedBatch >= token;
+}
 
-	VulkanBufferList uniformBuffers;
-	uniformBuffers.handle.resize(swapchainImageCount);
-	uniformBuffers.memory.resize(swapchainImageCount);
+// Submits the open batch first if the token belongs to it
+void vulkan_waitForUpload(VulkanUploader* uploader, VulkanUploadToken token)
+{
+	if (token >= uploader->openBatch)
+	{
+		vulkan_submitUploads(uploader);
+	}
+	while (uploader->completedBatch < token && uploader->completedBatch + 1 < uploader->openBatch)
+	{
+		vulkan_waitForOldestUploadBatch(uploader);
+	}
+}
 
-	for (size_t i = 0; i < swapchainImageCount; i++)
+void vulkan_destroyUploader(VulkanUploader* uploader)
+{
+	vulkan_waitForUpload(uploader, uploader->openBatch);
+	for (VkFence fence : uploader->fences)
+	{
+		vkDestroyFence(uploader->device, fence, nullptr);
+	}
+	if (uploader->ownershipTransfer)
+	{
+		VKCHECK(vkWaitForFences(uploader->device, VULKAN_UPLOAD_BATCH_COUNT, uploader->acquireFences.data(), true, ~0ull));
+		for (u32 i = 0; i < VULKAN_UPLOAD_BATCH_COUNT; i++)
+		{
+			vkDestroySemaphore(uploader->device, uploader->semaphores[i], nullptr);
+			vkDestroyFence(uploader->device, uploader->acquireFences[i], nullptr);
+		}
+		vkDestroyCommandPool(uploader->device, uploader->acquireCommandPool, nullptr);
+	}
+	vkDestroyCommandPool(uploader->device, uploader->commandPool, nullptr);
+	vkDestroyBuffer(uploader->device, uploader->stagingBuffer, nullptr);
+	vulkan_freeMemory(uploader->allocator, uploader->stagingMemory);
+	*uploader = {};
+}
+
+void printVulkanUploadStats(const VulkanUploader& uploader)
+{
+	printf("Vulkan uploads: %u uploads, %.2f MiB, %u submits on the %s queue\n", uploader.uploadCount, double(uploader.uploadBytes) / (1024.0 * 1024.0), uploader.submitCount, uploader.ownershipTransfer ? "transfer" : "graphics");
+}
+
+// Usable by graphics queue work submitted once the returned token completes
+VulkanBuffer vulkan_bufferDataIntoLocalDevice(VkDevice device, VulkanUploader* uploader, const void* bufferData, u64 bufferSize, VkBufferUsageFlags bufferUsage, const VulkanQueueInfo& queueInfo, VulkanMemoryAllocator* allocator, VulkanUploadToken* token = nullptr)
+{
+	VulkanBuffer deviceBuffer = vulkan_createLocalDeviceBuffer(device, bufferSize, bufferUsage, queueInfo, allocator);
+	VulkanUploadToken uploadToken = vulkan_uploadBuffer(uploader, deviceBuffer.handle, 0, bufferData, bufferSize);
+	if (token)
 	{
-		uniformBuffers.handle[i] = vulkan_createBuffer(device, bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, queueInfo);
-		uniformBuffers.memory[i] = vulkan_allocateMemoryForBuffer(device, uniformBuffers.handle[i], memoryProperties, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+		*token = uploadToken;
 	}
 
-	return uniformBuffers;
+	return deviceBuffer;
+}
+
+VulkanUniformRing vulkan_createUniformRing(VkDevice device, const VkPhysicalDeviceProperties& properties, u32 partitionCount, u32 slotCount, const VulkanQueueInfo& queueInfo, VulkanMemoryAllocator* allocator)
+{
+	const VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+	assert(partitionCount && slotCount);
+
+	VulkanUniformRing ring;
+	ring.stride = (sizeof(UniformBufferObject) + alignment - 1) & ~(alignment - 1);
+	ring.partitionSize = ring.stride * slotCount;
+	ring.partitionCount = partitionCount;
+	ring.slotCount = slotCount;
+	ring.handle = vulkan_createBuffer(device, ring.partitionSize * partitionCount, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, queueInfo);
+	ring.memory = vulkan_allocateMemoryForBuffer(allocator, ring.handle, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+	assert(ring.memory.mapped);
+
+	return ring;
 }
 
-void vulkan_updateUniformBuffer(VkDevice device, const VkExtent2D& swapchainExtent, VkDeviceMemory uboMemory, float t)
+void vulkan_destroyUniformRing(VkDevice device, VulkanMemoryAllocator* allocator, VulkanUniformRing* ring)
+{
+	vkDestroyBuffer(device, ring->handle, nullptr);
+	vulkan_freeMemory(allocator, ring->memory);
+	*ring = {};
+}
+
+static inline u32 vulkan_uniformRingOffset(const VulkanUniformRing& ring, u32 partition, u32 slot)
+{
+	assert(partition < ring.partitionCount && slot < ring.slotCount);
+	return u32(ring.partitionSize * partition + ring.stride * slot);
+}
+
+// The GPU may still read the partition of the frame before that used the same image
+static inline void vulkan_writeUniforms(const VulkanUniformRing& ring, u32 partition, u32 slot, const UniformBufferObject& ubo)
+{
+	memcpy(ring.memory.mapped + vulkan_uniformRingOffset(ring, partition, slot), &ubo, sizeof(ubo));
+}
+
+UniformBufferObject vulkan_buildUniformBufferObject(const VkExtent2D& swapchainExtent, float t)
 {
 	UniformBufferObject ubo;
 	ubo.model = glm::mat4(1.0f);
@@ -1846,11 +2874,74 @@ void vulkan_updateUniformBuffer(VkDevice device, const VkExtent2D& swapchainExte
 	// Invert to prevent image to be rendered upside down
 	ubo.proj[1][1] *= -1.0f;
 
-	vulkan_copyDataToMemory(device, uboMemory, sizeof(ubo), &ubo);
+	return ubo;
 }
 
-VulkanTexture vulkan_loadTexture(const char* texturePath, VkPhysicalDevice physicalDevice, VkDevice device, VkCommandPool commandPool, VkQueue queue, const VkPhysicalDeviceMemoryProperties& memoryProperties, VkSampleCountFlagBits samples, VkFormat textureFormat = VK_FORMAT_R8G8B8A8_UNORM, VkImageTiling tilingMode = VK_IMAGE_TILING_OPTIMAL, VkImageUsageFlags imageUsage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, const VulkanQueueInfo& queueInfo = { nullptr, 0, VK_SHARING_MODE_EXCLUSIVE })
+VulkanMeshletDraws vulkan_createMeshletDraws(VkDevice device, size_t swapchainImageCount, u32 drawCount, u32 indexCapacity, const VulkanQueueInfo& queueInfo, VulkanMemoryAllocator* allocator)
 {
+	const u32 drawBytes = drawCount * sizeof(VkDrawIndexedIndirectCommand);
+	const u32 indexOffset = (drawBytes + MESHLET_DRAW_INDEX_ALIGNMENT - 1) & ~u32(MESHLET_DRAW_INDEX_ALIGNMENT - 1);
+	const VkDeviceSize bufferSize = indexOffset + VkDeviceSize(indexCapacity) * sizeof(u32);
+
+	VulkanMeshletDraws meshletDraws;
+	meshletDraws.drawCount = drawCount;
+	meshletDraws.indexOffset = indexOffset;
+	meshletDraws.indexCapacity = indexCapacity;
+	meshletDraws.buffers.handle.resize(swapchainImageCount);
+	meshletDraws.buffers.memory.resize(swapchainImageCount);
+	meshletDraws.mapped.resize(swapchainImageCount);
+
+	for (size_t i = 0; i < swapchainImageCount; i++)
+	{
+		meshletDraws.buffers.handle[i] = vulkan_createBuffer(device, bufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, queueInfo);
+		meshletDraws.buffers.memory[i] = vulkan_allocateMemoryForBuffer(allocator, meshletDraws.buffers.handle[i], VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+		meshletDraws.mapped[i] = meshletDraws.buffers.memory[i].mapped;
+
+		VkDrawIndexedIndirectCommand emptyDraw = {};
+		emptyDraw.instanceCount = 1;
+		for (u32 draw = 0; draw < drawCount; draw++)
+		{
+			memcpy(meshletDraws.mapped[i] + draw * sizeof(VkDrawIndexedIndirectCommand), &emptyDraw, sizeof(emptyDraw));
+		}
+	}
+
+	return meshletDraws;
+}
+
+void vulkan_destroyMeshletDraws(VkDevice device, VulkanMemoryAllocator* allocator, VulkanMeshletDraws* meshletDraws)
+{
+	for (size_t i = 0; i < meshletDraws->buffers.handle.size(); i++)
+	{
+		vkDestroyBuffer(device, meshletDraws->buffers.handle[i], nullptr);
+		vulkan_freeMemory(allocator, meshletDraws->buffers.memory[i]);
+	}
+	meshletDraws->buffers.handle.clear();
+	meshletDraws->buffers.memory.clear();
+	meshletDraws->mapped.clear();
+}
+
+static inline u32* vulkan_meshletDrawIndices(const VulkanMeshletDraws& meshletDraws, u32 imageIndex)
+{
+	return (u32*)(meshletDraws.mapped[imageIndex] + meshletDraws.indexOffset);
+}
+
+// The culled indices are stored submesh after submesh, so each draw starts where the previous one ends
+static inline void vulkan_setMeshletDrawIndexCounts(const VulkanMeshletDraws& meshletDraws, u32 imageIndex, const u32* submeshIndexCounts)
+{
+	VkDrawIndexedIndirectCommand* draws = (VkDrawIndexedIndirectCommand*)meshletDraws.mapped[imageIndex];
+	u32 firstIndex = 0;
+	for (u32 i = 0; i < meshletDraws.drawCount; i++)
+	{
+		draws[i].indexCount = submeshIndexCounts[i];
+		draws[i].firstIndex = firstIndex;
+		firstIndex += submeshIndexCounts[i];
+	}
+	assert(firstIndex <= meshletDraws.indexCapacity);
+}
+
+VulkanTexture vulkan_loadTexture(const char* texturePath, VkPhysicalDevice physicalDevice, VkDevice device, VulkanUploader* uploader, VulkanMemoryAllocator* allocator, VkSampleCountFlagBits samples, VkFormat textureFormat = VK_FORMAT_R8G8B8A8_UNORM, VkImageTiling tilingMode = VK_IMAGE_TILING_OPTIMAL, VkImageUsageFlags imageUsage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, const VulkanQueueInfo& queueInfo = { nullptr, 0, VK_SHARING_MODE_EXCLUSIVE })
+{
+	AllocationTagScope tagScope(ALLOCATION_TAG_TEXTURES);
 	int textureWidth;
 	int textureHeight;
 	int textureChannels;
@@ -1860,20 +2951,17 @@ VulkanTexture vulkan_loadTexture(const char* texturePath, VkPhysicalDevice physi
 	VkDeviceSize textureSize = (u64)textureWidth * (u64)textureHeight * 4;
 	VkExtent2D textureExtent = { (u32)textureWidth, (u32)textureHeight};
 
-	VulkanBuffer stagingBuffer = vulkan_createStagingBuffer(device, texturePixels, textureSize, queueInfo, memoryProperties);
-	stbi_image_free(texturePixels);
-
 	VulkanTexture texture;
 	texture.mipLevels = u32(floor(log2(max(textureWidth, textureHeight)))) + 1;
 	texture.handle = vulkan_createImage(device, { textureExtent.width, textureExtent.height, 1 }, texture.mipLevels, samples, textureFormat, tilingMode, imageUsage);
-	texture.memory = vulkan_allocateMemoryForImage(device, texture.handle, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, memoryProperties);
-
-	vulkan_transitionImageLayout(device, commandPool, queue, texture.handle, textureFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, texture.mipLevels);
-	vulkan_copyBufferToImage(device, commandPool, queue, texture.handle, stagingBuffer.handle, textureExtent);
-	vulkan_generateMipmaps(physicalDevice, device, commandPool, queue, texture.handle, textureFormat, (i32)textureExtent.width, (i32)textureExtent.height, texture.mipLevels);
+	texture.memory = vulkan_allocateMemoryForImage(allocator, texture.handle, tilingMode, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-	vkDestroyBuffer(device, stagingBuffer.handle, nullptr);
-	vkFreeMemory(device, stagingBuffer.memory, nullptr);
+	// Mipmaps are blitted with linear filtering
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, textureFormat, &formatProperties);
+	assert(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT);
+	vulkan_uploadImage(uploader, texture.handle, textureFormat, textureExtent, texture.mipLevels, texturePixels, textureSize);
+	stbi_image_free(texturePixels);
 
 	texture.view = vulkan_createImageView(device, texture.handle, textureFormat, VK_IMAGE_ASPECT_COLOR_BIT, texture.mipLevels);
 	texture.sampler = vulkan_createTextureSampler(device, texture.mipLevels);
@@ -1881,19 +2969,19 @@ VulkanTexture vulkan_loadTexture(const char* texturePath, VkPhysicalDevice physi
 	return texture;
 }
 
-VkDescriptorPool vulkan_createDescriptorPool(VkDevice device, u32 swapchainImageCount)
+VkDescriptorPool vulkan_createDescriptorPool(VkDevice device, u32 materialCount)
 {
 	VkDescriptorPoolSize descriptorPoolSizes[2];
-	descriptorPoolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	descriptorPoolSizes[0].descriptorCount = swapchainImageCount;
+	descriptorPoolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	descriptorPoolSizes[0].descriptorCount = 1;
 	descriptorPoolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	descriptorPoolSizes[1].descriptorCount = swapchainImageCount;
+	descriptorPoolSizes[1].descriptorCount = materialCount;
 
 	VkDescriptorPoolCreateInfo createInfo;
 	createInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	createInfo.pNext = nullptr;
 	createInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
-	createInfo.maxSets = swapchainImageCount;
+	createInfo.maxSets = 1 + materialCount;
 	createInfo.poolSizeCount = ARRAYSIZE(descriptorPoolSizes);
 	createInfo.pPoolSizes = descriptorPoolSizes;
 
@@ -1903,79 +2991,167 @@ VkDescriptorPool vulkan_createDescriptorPool(VkDevice device, u32 swapchainImage
 	return descriptorPool;
 }
 
-vector<VkDescriptorSet> vulkan_createDescriptorSets(VkDevice device, VkDescriptorPool descriptorPool, u32 swapchainImageCount, VkDescriptorSetLayout descriptorSetLayout, const
-	VulkanBufferList& uniformBuffers, VkImageView imageView, VkSampler sampler)
+static vector<VkDescriptorSet> vulkan_allocateDescriptorSets(VkDevice device, VkDescriptorPool descriptorPool, u32 count, VkDescriptorSetLayout descriptorSetLayout, LinearArena* scratch = nullptr)
 {
-	vector<VkDescriptorSetLayout> descriptorSetLayouts(swapchainImageCount, descriptorSetLayout);
+	AllocationTagScope tagScope(ALLOCATION_TAG_DESCRIPTORS);
+	ScratchVector<VkDescriptorSetLayout> descriptorSetLayouts(count, descriptorSetLayout, LinearArenaAllocator(scratch));
 
 	VkDescriptorSetAllocateInfo allocateInfo;
 	allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocateInfo.pNext = nullptr;
 	allocateInfo.descriptorPool = descriptorPool;
-	allocateInfo.descriptorSetCount = swapchainImageCount;
+	allocateInfo.descriptorSetCount = count;
 	allocateInfo.pSetLayouts = descriptorSetLayouts.data();
 
-	vector<VkDescriptorSet> descriptorSets(swapchainImageCount);
+	vector<VkDescriptorSet> descriptorSets(count);
 
 	VKCHECK(vkAllocateDescriptorSets(device, &allocateInfo, descriptorSets.data()));
 
-	VkDescriptorImageInfo imageInfo;
-	imageInfo.sampler = sampler;
-	imageInfo.imageView = imageView;
-	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-	for (u32 i = 0; i < swapchainImageCount; i++)
-	{
-		VkDescriptorBufferInfo bufferInfo;
-		bufferInfo.buffer = uniformBuffers.handle[i];
-		bufferInfo.offset = 0;
-		bufferInfo.range = sizeof(UniformBufferObject);
-
-		VkWriteDescriptorSet descriptorWrites[2];
-		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[0].pNext = nullptr;
-		descriptorWrites[0].dstSet = descriptorSets[i];
-		descriptorWrites[0].dstBinding = 0;
-		descriptorWrites[0].dstArrayElement = 0;
-		descriptorWrites[0].descriptorCount = 1;
-		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		descriptorWrites[0].pImageInfo = nullptr;
-		descriptorWrites[0].pBufferInfo = &bufferInfo;
-		descriptorWrites[0].pTexelBufferView = nullptr;
-
-		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[1].pNext = nullptr;
-		descriptorWrites[1].dstSet = descriptorSets[i];
-		descriptorWrites[1].dstBinding = 1;
-		descriptorWrites[1].dstArrayElement = 0;
-		descriptorWrites[1].descriptorCount = 1;
-		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		descriptorWrites[1].pImageInfo = &imageInfo;
-		descriptorWrites[1].pBufferInfo = nullptr;
-		descriptorWrites[1].pTexelBufferView = nullptr;
-
-		vkUpdateDescriptorSets(device, ARRAYSIZE(descriptorWrites), descriptorWrites, 0, nullptr);
+	return descriptorSets;
+}
+
+VkDescriptorSet vulkan_createFrameDescriptorSet(VkDevice device, VkDescriptorPool descriptorPool, VkDescriptorSetLayout descriptorSetLayout, const VulkanUniformRing& uniformRing)
+{
+	VkDescriptorSet descriptorSet = vulkan_allocateDescriptorSets(device, descriptorPool, 1, descriptorSetLayout)[0];
+
+	// The dynamic offset of each draw is added to offset
+	VkDescriptorBufferInfo bufferInfo;
+	bufferInfo.buffer = uniformRing.handle;
+	bufferInfo.offset = 0;
+	bufferInfo.range = sizeof(UniformBufferObject);
+
+	VkWriteDescriptorSet descriptorWrite;
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.pNext = nullptr;
+	descriptorWrite.dstSet = descriptorSet;
+	descriptorWrite.dstBinding = 0;
+	descriptorWrite.dstArrayElement = 0;
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	descriptorWrite.pImageInfo = nullptr;
+	descriptorWrite.pBufferInfo = &bufferInfo;
+	descriptorWrite.pTexelBufferView = nullptr;
+
+	vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+
+	return descriptorSet;
+}
+
+// Does not depend on the swapchain: survives window resizes
+vector<VkDescriptorSet> vulkan_createMaterialDescriptorSets(VkDevice device, VkDescriptorPool descriptorPool, VkDescriptorSetLayout descriptorSetLayout, const VulkanResources& resources, const vector<VulkanTextureHandle>& textures)
+{
+	vector<VkDescriptorSet> descriptorSets = vulkan_allocateDescriptorSets(device, descriptorPool, u32(textures.size()), descriptorSetLayout);
+
+	for (size_t i = 0; i < textures.size(); i++)
+	{
+		const VulkanTexture texture = vulkan_getTexture(resources, textures[i]);
+		VkDescriptorImageInfo imageInfo;
+		imageInfo.sampler = texture.sampler;
+		imageInfo.imageView = texture.view;
+		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+		VkWriteDescriptorSet descriptorWrite;
+		descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrite.pNext = nullptr;
+		descriptorWrite.dstSet = descriptorSets[i];
+		descriptorWrite.dstBinding = 0;
+		descriptorWrite.dstArrayElement = 0;
+		descriptorWrite.descriptorCount = 1;
+		descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrite.pImageInfo = &imageInfo;
+		descriptorWrite.pBufferInfo = nullptr;
+		descriptorWrite.pTexelBufferView = nullptr;
+
+		vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
 	}
 
 	return descriptorSets;
 }
 
-void vulkan_buildCommandBuffers(VkRenderPass renderPass, const VkExtent2D& swapchainExtent, const vector<VkCommandBuffer>& commandBuffers, const vector<VkFramebuffer>& framebuffers, VkBuffer& vertexBuffer, VkBuffer& indexBuffer, VkPipeline graphicsPipeline, VkPipelineLayout pipelineLayout, const vector<Vertex>& vertices, const vector<u32>& indices, const vector<VkDescriptorSet>& descriptorSets)
+// materialSets maps each mesh material to its material descriptor set, submeshes without material use defaultMaterialSet.
+// Draws are sorted by material set, so the material set is rebound once per distinct texture rather than once per submesh
+vector<VulkanSubmeshDraw> vulkan_buildSubmeshDraws(const MeshView& mesh, const vector<u32>& materialSets, u32 defaultMaterialSet)
 {
-	VkCommandBufferBeginInfo beginInfo;
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.pNext = nullptr;
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-	beginInfo.pInheritanceInfo = nullptr;
+	vector<VulkanSubmeshDraw> draws(mesh.submeshCount);
+	for (u32 i = 0; i < mesh.submeshCount; i++)
+	{
+		const Submesh& submesh = mesh.submeshes[i];
+		VulkanSubmeshDraw draw;
+		draw.submesh = i;
+		draw.materialSet = submesh.material == MESH_NO_MATERIAL ? defaultMaterialSet : materialSets[submesh.material];
+		draw.firstIndex = submesh.indexOffset;
+		draw.indexCount = submesh.indexCount;
 
-	array<VkClearValue, 2> clearValues = {};
-	clearValues[0].color = { 0.f, 0.f, 0.f, 1.f };
-	clearValues[1].depthStencil = { 1.0f, 0 };
+		// Insertion sort: stable, and there are only a handful of submeshes
+		u32 j = i;
+		for (; j > 0 && draws[j - 1].materialSet > draw.materialSet; j--)
+		{
+			draws[j] = draws[j - 1];
+		}
+		draws[j] = draw;
+	}
+
+	return draws;
+}
+
+// Secondary command buffers inherit none of this
+static void vulkan_cmdBindDrawState(VkCommandBuffer commandBuffer, u32 imageIndex, VkBuffer vertexBuffer, VkBuffer indexBuffer, VkPipeline graphicsPipeline, VkPipelineLayout pipelineLayout, const VulkanMeshletDraws* meshletDraws, const MeshQuantization& meshQuantization)
+{
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+
+	VkDeviceSize offsets[] = { 0 };
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, offsets);
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshQuantization), &meshQuantization);
+
+	if (meshletDraws)
+	{
+		vkCmdBindIndexBuffer(commandBuffer, meshletDraws->buffers.handle[imageIndex], meshletDraws->indexOffset, VK_INDEX_TYPE_UINT32);
+	}
+	else
+	{
+#define INDEXSIZE 32
+#if INDEXSIZE == 32
+		vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+#elif INDEXSIZE == 16
+		vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+#endif
+	}
+}
+
+// Draws [firstDraw, endDraw) of submeshDraws, reading the uniforms and meshlet draws of the image
+static void vulkan_cmdDrawSubmeshes(VkCommandBuffer commandBuffer, u32 imageIndex, u32 firstDraw, u32 endDraw, VkPipelineLayout pipelineLayout, const vector<VulkanSubmeshDraw>& submeshDraws, const VulkanMeshletDraws* meshletDraws, VkDescriptorSet frameDescriptorSet, const VulkanUniformRing& uniformRing, const vector<VkDescriptorSet>& materialDescriptorSets)
+{
+	u32 boundMaterialSet = ~0u;
+	for (u32 drawIndex = firstDraw; drawIndex < endDraw; drawIndex++)
+	{
+		const VulkanSubmeshDraw& draw = submeshDraws[drawIndex];
+		const u32 uniformOffset = vulkan_uniformRingOffset(uniformRing, imageIndex, drawIndex);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, DESCRIPTOR_SET_FRAME, 1, &frameDescriptorSet, 1, &uniformOffset);
+		if (draw.materialSet != boundMaterialSet)
+		{
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, DESCRIPTOR_SET_MATERIAL, 1, &materialDescriptorSets[draw.materialSet], 0, nullptr);
+			boundMaterialSet = draw.materialSet;
+		}
+
+		if (meshletDraws)
+		{
+			// Index ranges are written by the CPU culling pass every frame, so the draw itself never changes
+			vkCmdDrawIndexedIndirect(commandBuffer, meshletDraws->buffers.handle[imageIndex], draw.submesh * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+		}
+		else
+		{
+			vkCmdDrawIndexed(commandBuffer, draw.indexCount, 1, draw.firstIndex, 0, 0);
+		}
+	}
+}
 
+static inline VkRenderPassBeginInfo vulkan_renderPassBeginInfo(VkRenderPass renderPass, VkFramebuffer framebuffer, const VkExtent2D& swapchainExtent, const array<VkClearValue, 2>& clearValues)
+{
 	VkRenderPassBeginInfo renderPassInfo;
 	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 	renderPassInfo.pNext = nullptr;
 	renderPassInfo.renderPass = renderPass;
+	renderPassInfo.framebuffer = framebuffer;
 	renderPassInfo.renderArea.offset.x = 0;
 	renderPassInfo.renderArea.offset.y = 0;
 	renderPassInfo.renderArea.extent.width = swapchainExtent.width;
@@ -1983,36 +3159,200 @@ void vulkan_buildCommandBuffers(VkRenderPass renderPass, const VkExtent2D& swapc
 	renderPassInfo.clearValueCount = u32(clearValues.size());
 	renderPassInfo.pClearValues = clearValues.data();
 
+	return renderPassInfo;
+}
+
+static inline array<VkClearValue, 2> vulkan_frameClearValues()
+{
+	array<VkClearValue, 2> clearValues = {};
+	clearValues[0].color = { 0.f, 0.f, 0.f, 1.f };
+	clearValues[1].depthStencil = { 1.0f, 0 };
+
+	return clearValues;
+}
+
+void vulkan_buildCommandBuffers(VkRenderPass renderPass, const VkExtent2D& swapchainExtent, const vector<VkCommandBuffer>& commandBuffers, const vector<VkFramebuffer>& framebuffers, VkBuffer vertexBuffer, VkBuffer indexBuffer, VkPipeline graphicsPipeline, VkPipelineLayout pipelineLayout, const vector<VulkanSubmeshDraw>& submeshDraws, const VulkanMeshletDraws* meshletDraws, const MeshQuantization& meshQuantization, VkDescriptorSet frameDescriptorSet, const VulkanUniformRing& uniformRing, const vector<VkDescriptorSet>& materialDescriptorSets, VkQueryPool timestampQueryPool)
+{
+	VkCommandBufferBeginInfo beginInfo;
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.pNext = nullptr;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+	beginInfo.pInheritanceInfo = nullptr;
+
+	const array<VkClearValue, 2> clearValues = vulkan_frameClearValues();
+
 	for (size_t i = 0; i < commandBuffers.size(); i++)
 	{
 		VKCHECK(vkBeginCommandBuffer(commandBuffers[i], &beginInfo));
+		if (timestampQueryPool)
+		{
+			vkCmdResetQueryPool(commandBuffers[i], timestampQueryPool, u32(i) * 2, 2);
+			vkCmdWriteTimestamp(commandBuffers[i], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, u32(i) * 2);
+		}
 
-		renderPassInfo.framebuffer = framebuffers[i];
-
+		const VkRenderPassBeginInfo renderPassInfo = vulkan_renderPassBeginInfo(renderPass, framebuffers[i], swapchainExtent, clearValues);
 		vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+		vulkan_cmdBindDrawState(commandBuffers[i], u32(i), vertexBuffer, indexBuffer, graphicsPipeline, pipelineLayout, meshletDraws, meshQuantization);
+		vulkan_cmdDrawSubmeshes(commandBuffers[i], u32(i), 0, u32(submeshDraws.size()), pipelineLayout, submeshDraws, meshletDraws, frameDescriptorSet, uniformRing, materialDescriptorSets);
+		vkCmdEndRenderPass(commandBuffers[i]);
+		if (timestampQueryPool)
+		{
+			vkCmdWriteTimestamp(commandBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, u32(i) * 2 + 1);
+		}
 
-		vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+		VKCHECK(vkEndCommandBuffer(commandBuffers[i]));
+	}
+}
 
-		VkDeviceSize offsets[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, &vertexBuffer, offsets);
-#define INDEXSIZE 32
-#if INDEXSIZE == 32
-		vkCmdBindIndexBuffer(commandBuffers[i], indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-#elif INDEXSIZE == 16
-		vkCmdBindIndexBuffer(commandBuffers[i], indexBuffer, 0, VK_INDEX_TYPE_UINT16);
-#endif
-		vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[i], 0, nullptr);
+void vulkan_createFrameRecorder(VulkanFrameRecorder* recorder, VkDevice device, u32 queueFamilyIndex, u32 threadCount, u32 framesInFlight, u32 minDrawsPerJob = VULKAN_RECORD_MIN_DRAWS_PER_JOB)
+{
+	assert(minDrawsPerJob);
+	*recorder = {};
+	recorder->threadCount = threadCount;
+	recorder->framesInFlight = framesInFlight;
+	recorder->minDrawsPerJob = minDrawsPerJob;
+	recorder->threadCommandPools.resize(threadCount * framesInFlight);
+	recorder->threadSecondaryCommandBuffers.resize(threadCount * framesInFlight);
+	recorder->threadSecondaryUsedCounts.assign(threadCount * framesInFlight, 0);
+	for (VkCommandPool& commandPool : recorder->threadCommandPools)
+	{
+		commandPool = vulkan_createCommandPool(device, queueFamilyIndex, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+	}
+	recorder->primaryCommandPools.resize(framesInFlight);
+	recorder->primaryCommandBuffers.resize(framesInFlight);
+	for (u32 i = 0; i < framesInFlight; i++)
+	{
+		recorder->primaryCommandPools[i] = vulkan_createCommandPool(device, queueFamilyIndex, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+		recorder->primaryCommandBuffers[i] = vulkan_createCommandBuffers(device, recorder->primaryCommandPools[i], 1)[0];
+	}
+	// One range per thread at most
+	recorder->jobCommandBuffers.resize(threadCount);
+}
 
-		vkCmdDrawIndexed(commandBuffers[i], (u32)indices.size(), 1, 0, 0, 0);
+void vulkan_destroyFrameRecorder(VkDevice device, VulkanFrameRecorder* recorder)
+{
+	for (VkCommandPool commandPool : recorder->threadCommandPools)
+	{
+		vkDestroyCommandPool(device, commandPool, nullptr);
+	}
+	for (VkCommandPool commandPool : recorder->primaryCommandPools)
+	{
+		vkDestroyCommandPool(device, commandPool, nullptr);
+	}
+	*recorder = {};
+}
 
-		vkCmdEndRenderPass(commandBuffers[i]);
+// A secondary command buffer of the thread's pool for the slot, allocated the first time the thread needs this many
+static VkCommandBuffer vulkan_threadSecondaryCommandBuffer(VulkanFrameRecorder* recorder, VkDevice device, u32 frameSlot, u32 threadIndex)
+{
+	const u32 pool = frameSlot * recorder->threadCount + threadIndex;
+	vector<VkCommandBuffer>& commandBuffers = recorder->threadSecondaryCommandBuffers[pool];
+	u32& usedCount = recorder->threadSecondaryUsedCounts[pool];
+	if (usedCount == commandBuffers.size())
+	{
+		VkCommandBufferAllocateInfo allocateInfo;
+		allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocateInfo.pNext = nullptr;
+		allocateInfo.commandPool = recorder->threadCommandPools[pool];
+		allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		allocateInfo.commandBufferCount = 1;
+		VkCommandBuffer commandBuffer = nullptr;
+		VKCHECK(vkAllocateCommandBuffers(device, &allocateInfo, &commandBuffer));
+		commandBuffers.push_back(commandBuffer);
+	}
+	return commandBuffers[usedCount++];
+}
 
-		VKCHECK(vkEndCommandBuffer(commandBuffers[i]));
+/*
+Records the draws of the frame in the slot, into command buffers of that slot only: its fence must have been waited on.
+The uniforms, meshlet draws and timestamps of the image are the ones used, as with vulkan_buildCommandBuffers.
+pool may be null to record on the calling thread.
+*/
+VkCommandBuffer vulkan_recordFrame(VulkanFrameRecorder* recorder, ThreadPool* pool, VkDevice device, u32 frameSlot, u32 imageIndex, VkRenderPass renderPass, VkFramebuffer framebuffer, const VkExtent2D& swapchainExtent, VkBuffer vertexBuffer, VkBuffer indexBuffer, VkPipeline graphicsPipeline, VkPipelineLayout pipelineLayout, const vector<VulkanSubmeshDraw>& submeshDraws, const VulkanMeshletDraws* meshletDraws, const MeshQuantization& meshQuantization, VkDescriptorSet frameDescriptorSet, const VulkanUniformRing& uniformRing, const vector<VkDescriptorSet>& materialDescriptorSets, VkQueryPool timestampQueryPool)
+{
+	assert(!pool || pool->threadCount <= recorder->threadCount);
+	// Threads that recorded nothing last time around have nothing to reset
+	for (u32 thread = 0; thread < recorder->threadCount; thread++)
+	{
+		const u32 poolIndex = frameSlot * recorder->threadCount + thread;
+		if (recorder->threadSecondaryUsedCounts[poolIndex])
+		{
+			VKCHECK(vkResetCommandPool(device, recorder->threadCommandPools[poolIndex], 0));
+			recorder->threadSecondaryUsedCounts[poolIndex] = 0;
+		}
+	}
+	VKCHECK(vkResetCommandPool(device, recorder->primaryCommandPools[frameSlot], 0));
+
+	const u32 drawCount = u32(submeshDraws.size());
+	const u32 threadCount = pool ? pool->threadCount : 1;
+	u32 jobCount = (drawCount + recorder->minDrawsPerJob - 1) / recorder->minDrawsPerJob;
+	jobCount = jobCount < 1 ? 1 : jobCount > threadCount ? threadCount : jobCount;
+	recorder->jobCount = jobCount;
+
+	VkCommandBufferInheritanceInfo inheritanceInfo;
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.pNext = nullptr;
+	inheritanceInfo.renderPass = renderPass;
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = framebuffer;
+	inheritanceInfo.occlusionQueryEnable = false;
+	inheritanceInfo.queryFlags = 0;
+	inheritanceInfo.pipelineStatistics = 0;
+
+	VkCommandBufferBeginInfo secondaryBeginInfo;
+	secondaryBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	secondaryBeginInfo.pNext = nullptr;
+	secondaryBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	secondaryBeginInfo.pInheritanceInfo = &inheritanceInfo;
+
+	auto recordRange = [&](u32 jobIndex, u32 threadIndex)
+	{
+		VkCommandBuffer commandBuffer = vulkan_threadSecondaryCommandBuffer(recorder, device, frameSlot, threadIndex);
+		VKCHECK(vkBeginCommandBuffer(commandBuffer, &secondaryBeginInfo));
+		vulkan_cmdBindDrawState(commandBuffer, imageIndex, vertexBuffer, indexBuffer, graphicsPipeline, pipelineLayout, meshletDraws, meshQuantization);
+		vulkan_cmdDrawSubmeshes(commandBuffer, imageIndex, u32(threadPool_rangeBegin(drawCount, jobIndex, jobCount)), u32(threadPool_rangeBegin(drawCount, jobIndex + 1, jobCount)), pipelineLayout, submeshDraws, meshletDraws, frameDescriptorSet, uniformRing, materialDescriptorSets);
+		VKCHECK(vkEndCommandBuffer(commandBuffer));
+		recorder->jobCommandBuffers[jobIndex] = commandBuffer;
+	};
+	if (jobCount > 1)
+	{
+		threadPool_parallelFor(pool, jobCount, recordRange);
 	}
+	else
+	{
+		recordRange(0, 0);
+	}
+
+	VkCommandBuffer commandBuffer = recorder->primaryCommandBuffers[frameSlot];
+	VkCommandBufferBeginInfo beginInfo;
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.pNext = nullptr;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = nullptr;
+	VKCHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+	if (timestampQueryPool)
+	{
+		vkCmdResetQueryPool(commandBuffer, timestampQueryPool, imageIndex * 2, 2);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, imageIndex * 2);
+	}
+
+	const array<VkClearValue, 2> clearValues = vulkan_frameClearValues();
+	const VkRenderPassBeginInfo renderPassInfo = vulkan_renderPassBeginInfo(renderPass, framebuffer, swapchainExtent, clearValues);
+	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+	vkCmdExecuteCommands(commandBuffer, jobCount, recorder->jobCommandBuffers.data());
+	vkCmdEndRenderPass(commandBuffer);
+	if (timestampQueryPool)
+	{
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, imageIndex * 2 + 1);
+	}
+	VKCHECK(vkEndCommandBuffer(commandBuffer));
+
+	return commandBuffer;
 }
 
-inline VulkanFrameSynchronization vulkan_createSynchronizationResources(VkDevice device, const u32 maxFramesInFlight)
+inline VulkanFrameSynchronization vulkan_createSynchronizationResources(VkDevice device, const u32 maxFramesInFlight, u32 swapchainImageCount)
 {
+	assert(maxFramesInFlight > 0);
 	VulkanFrameSynchronization fss;
 
 	VkSemaphoreCreateInfo semaphoreCreateInfo;
@@ -2027,21 +3367,131 @@ inline VulkanFrameSynchronization vulkan_createSynchronizationResources(VkDevice
 
 	fss.maxFramesInFlight = maxFramesInFlight;
 	fss.currentFrame = 0;
+	fss.imageAcquireSemaphores.resize(maxFramesInFlight);
+	fss.imageReleaseSemaphores.resize(maxFramesInFlight);
+	fss.inflightFences.resize(maxFramesInFlight);
+	fss.scratchArenas.resize(maxFramesInFlight);
+	fss.imagesInFlight.assign(swapchainImageCount, nullptr);
+	const size_t scratchArenaSize = systemMemory_budget(systemMemory_query(), FRAME_SCRATCH_ARENA_MEMORY_SHARE, FRAME_SCRATCH_ARENA_SIZE);
 	for (size_t i = 0; i < maxFramesInFlight; i++)
 	{
 		VKCHECK(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &fss.imageAcquireSemaphores[i]));
 		VKCHECK(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &fss.imageReleaseSemaphores[i]));
 		VKCHECK(vkCreateFence(device, &fenceCreateInfo, nullptr, &fss.inflightFences[i]));
+		linearArena_create(&fss.scratchArenas[i], scratchArenaSize);
 	}
 
 	return fss;
 }
 
+// Until the slot's previous frame is done, nothing the slot owns can be reused
+inline void vulkan_waitForFrameSlot(VkDevice device, const VulkanFrameSynchronization& frameSync)
+{
+	VKCHECK(vkWaitForFences(device, 1, &frameSync.inflightFences[frameSync.currentFrame], true, ~0ull));
+}
+
+// Until the last frame that rendered to the image is done, its uniforms, meshlet draws and command buffer are in use.
+// The image then belongs to the current slot
+inline void vulkan_waitForImage(VkDevice device, VulkanFrameSynchronization& frameSync, u32 imageIndex)
+{
+	VkFence imageFence = frameSync.imagesInFlight[imageIndex];
+	VkFence slotFence = frameSync.inflightFences[frameSync.currentFrame];
+	if (imageFence && imageFence != slotFence)
+	{
+		VKCHECK(vkWaitForFences(device, 1, &imageFence, true, ~0ull));
+	}
+	frameSync.imagesInFlight[imageIndex] = slotFence;
+}
+
 inline void vulkan_updateCurrentFrame(VulkanFrameSynchronization& frameSync)
 {
 	frameSync.currentFrame = (frameSync.currentFrame + 1) % frameSync.maxFramesInFlight;
 }
 
+// Only once the GPU is done with the frame that last used this slot
+inline LinearArena* vulkan_resetFrameScratch(VulkanFrameSynchronization& frameSync)
+{
+	LinearArena* scratch = &frameSync.scratchArenas[frameSync.currentFrame];
+	linearArena_reset(scratch);
+	return scratch;
+}
+
+void vulkan_createFrameTimings(VulkanFrameTimings* timings, VkDevice device, const VulkanPhysicalDeviceDescription& deviceDescription, u32 swapchainImageCount)
+{
+	*timings = {};
+	const u32 timestampValidBits = deviceDescription.queueFamilyProperties[deviceDescription.queueFamilyIndices.graphics].timestampValidBits;
+	if (!timestampValidBits)
+	{
+		return;
+	}
+	timings->timestampPeriod = double(deviceDescription.properties.limits.timestampPeriod) * 1e-9;
+	timings->timestampMask = timestampValidBits < 64 ? (1ull << timestampValidBits) - 1 : ~0ull;
+	timings->imageTimestamped.assign(swapchainImageCount, 0);
+
+	VkQueryPoolCreateInfo createInfo;
+	createInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	createInfo.pNext = nullptr;
+	createInfo.flags = 0;
+	createInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	createInfo.queryCount = swapchainImageCount * 2;
+	createInfo.pipelineStatistics = 0;
+	VKCHECK(vkCreateQueryPool(device, &createInfo, nullptr, &timings->queryPool));
+}
+
+void vulkan_destroyFrameTimings(VkDevice device, VulkanFrameTimings* timings)
+{
+	if (timings->queryPool)
+	{
+		vkDestroyQueryPool(device, timings->queryPool, nullptr);
+	}
+	*timings = {};
+}
+
+// Once vulkan_waitForImage returned: adds the GPU time of the image's previous frame, then expects it to be submitted again
+void vulkan_readFrameTimestamps(VkDevice device, VulkanFrameTimings* timings, u32 imageIndex)
+{
+	if (!timings->queryPool)
+	{
+		return;
+	}
+	if (timings->imageTimestamped[imageIndex])
+	{
+		u64 timestamps[2];
+		if (vkGetQueryPoolResults(device, timings->queryPool, imageIndex * 2, 2, sizeof(timestamps), timestamps, sizeof(u64), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+		{
+			timings->gpuBusySeconds += double((timestamps[1] - timestamps[0]) & timings->timestampMask) * timings->timestampPeriod;
+			timings->gpuFrameCount++;
+		}
+	}
+	timings->imageTimestamped[imageIndex] = 1;
+}
+
+inline void vulkan_addFrameTimes(VulkanFrameTimings* timings, double frameSeconds, double cpuWaitSeconds)
+{
+	timings->frameSeconds += frameSeconds;
+	timings->cpuWaitSeconds += cpuWaitSeconds;
+	timings->frameCount++;
+}
+
+// Averages since the last call, which start over
+void printVulkanFrameTimings(VulkanFrameTimings* timings, u32 framesInFlight)
+{
+	if (!timings->frameCount)
+	{
+		return;
+	}
+	const double frameMilliseconds = timings->frameSeconds * 1000.0 / timings->frameCount;
+	const double cpuWaitMilliseconds = timings->cpuWaitSeconds * 1000.0 / timings->frameCount;
+	const double gpuBusyMilliseconds = timings->gpuFrameCount ? timings->gpuBusySeconds * 1000.0 / timings->gpuFrameCount : 0.0;
+	printf("Frames, %u in flight: %.2f ms, CPU waited %.2f ms and worked %.2f ms, GPU busy %.2f ms (%.0f%% of the frame)\n",
+		framesInFlight, frameMilliseconds, cpuWaitMilliseconds, frameMilliseconds - cpuWaitMilliseconds, gpuBusyMilliseconds, gpuBusyMilliseconds * 100.0 / frameMilliseconds);
+	timings->frameCount = 0;
+	timings->gpuFrameCount = 0;
+	timings->frameSeconds = 0.0;
+	timings->cpuWaitSeconds = 0.0;
+	timings->gpuBusySeconds = 0.0;
+}
+
 void vulkan_submitQueue(VkDevice device, VkQueue graphicsQueue, VkCommandBuffer drawCommandBuffer, VkFence* pInflightFence, VkSemaphore* pImageAcquireSemaphore, VkSemaphore* pImageReleaseSemaphore)
 {
 	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
@@ -2075,7 +3525,7 @@ VkResult vulkan_present(VkDevice device, VkSwapchainKHR swapchain, u32 currentFr
 	return vkQueuePresentKHR(graphicsQueue, &presentInfo);
 }
 
-SwapchainStatus vulkan_updateSwapchain(VulkanSwapchain& swapchain, VkDevice device, VkPhysicalDevice physicalDevice, VkSurfaceKHR surface)
+SwapchainStatus vulkan_updateSwapchain(VulkanSwapchain& swapchain, VkDevice device, VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, LinearArena* scratch = nullptr)
 {
 	VkSurfaceCapabilitiesKHR surfaceCapabilities;
 	VKCHECK(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &surfaceCapabilities));
@@ -2092,62 +3542,61 @@ SwapchainStatus vulkan_updateSwapchain(VulkanSwapchain& swapchain, VkDevice devi
 	}
 	
 	VKCHECK(vkDeviceWaitIdle(device));
-	swapchain = vulkan_createSwapchain(physicalDevice, device, surface, newWidth, newHeight, &swapchain);
+	swapchain = vulkan_createSwapchain(physicalDevice, device, surface, newWidth, newHeight, &swapchain, scratch);
 
 	return SwapchainStatus::RESIZED;
 }
 
 void vulkan_onWindowResize(VulkanApplication* vk)
 {
-	vkDestroyImage(vk->device, vk->msaa.image, nullptr);
-	vkDestroyImageView(vk->device, vk->msaa.view, nullptr);
-	vkFreeMemory(vk->device, vk->msaa.memory, nullptr);
-	vk->msaa = vulkan_createMultisamplingBuffer(vk->device, vk->graphicsCommandPool, vk->graphicsQueue, vk->deviceDescription.properties, vk->deviceDescription.memoryProperties, vk->swapchain.surfaceFormat.format, vk->swapchain.extent, 1);
+	vulkan_destroyMSAA(vk->device, &vk->memoryAllocator, &vk->resources, vk->msaa);
+	const VulkanMSAA msaa = vulkan_createMultisamplingBuffer(vk->device, vk->graphicsCommandPool, vk->graphicsQueue, vk->deviceDescription.properties, &vk->memoryAllocator, vk->swapchain.surfaceFormat.format, vk->swapchain.extent, 1);
+	vk->msaa = vulkan_addMSAA(&vk->resources, msaa);
 
 	vkDestroyImageView(vk->device, vk->depthStencil.imageView, nullptr);
 	vkDestroyImage(vk->device, vk->depthStencil.image, nullptr);
-	vkFreeMemory(vk->device, vk->depthStencil.memory, nullptr);
-	vk->depthStencil = vulkan_createDepthStencil(vk->device, vk->physicalDevice, vk->swapchain.extent, vk->deviceDescription.memoryProperties);
+	vulkan_freeMemory(&vk->memoryAllocator, vk->depthStencil.memory);
+	vk->depthStencil = vulkan_createDepthStencil(vk->device, vk->physicalDevice, vk->swapchain.extent, &vk->memoryAllocator);
 	
 	vkDestroyRenderPass(vk->device, vk->renderPass, nullptr);
-	vk->renderPass = vulkan_createRenderPass(vk->device, vk->swapchain.surfaceFormat.format, vk->depthStencil.depthFormat, vk->msaa.samples);
+	vk->renderPass = vulkan_createRenderPass(vk->device, vk->swapchain.surfaceFormat.format, vk->depthStencil.depthFormat, msaa.samples);
 	for (VkFramebuffer framebuffer : vk->framebuffers)
 	{
 		vkDestroyFramebuffer(vk->device, framebuffer, nullptr);
 	}
-	vk->framebuffers = vulkan_createFramebuffers(vk->device, vk->swapchain.imageViews, vk->swapchain.extent, vk->renderPass, vk->depthStencil.imageView, vk->msaa.view);
+	vk->framebuffers = vulkan_createFramebuffers(vk->device, vk->swapchain.imageViews, vk->swapchain.extent, vk->renderPass, vk->depthStencil.imageView, msaa.view);
 	
 	vkFreeCommandBuffers(vk->device, vk->graphicsCommandPool, u32(vk->drawCommandBuffers.size()), vk->drawCommandBuffers.data());
 	vk->drawCommandBuffers = vulkan_createCommandBuffers(vk->device, vk->graphicsCommandPool, u32(vk->swapchain.images.size()));
 	vkDestroyPipelineLayout(vk->device, vk->graphicsPipelineLayout, nullptr);
-	vk->graphicsPipelineLayout = vulkan_createPipelineLayout(vk->device, &vk->descriptorSetLayout);
+	vk->graphicsPipelineLayout = vulkan_createPipelineLayout(vk->device, vk->descriptorSetLayouts);
 	vkDestroyPipeline(vk->device, vk->graphicsPipeline, nullptr);
-	vk->graphicsPipeline = vulkan_createGraphicsPipeline(vk->device, vk->VS, vk->FS, vk->swapchain.extent, vk->graphicsPipelineLayout, vk->renderPass, vk->msaa.samples);
-	for (VkBuffer uniformBuffer: vk->uniformBuffers.handle)
-	{
-		vkDestroyBuffer(vk->device, uniformBuffer, nullptr);
-	}
-	for (VkDeviceMemory ubMemory: vk->uniformBuffers.memory)
-	{
-		vkFreeMemory(vk->device, ubMemory, nullptr);
+	vk->graphicsPipeline = vulkan_createGraphicsPipeline(vk->device, vk->VS, vk->FS, vk->vertexInput, vk->swapchain.extent, vk->graphicsPipelineLayout, vk->renderPass, msaa.samples);
+	vulkan_destroyUniformRing(vk->device, &vk->memoryAllocator, &vk->uniformRing);
+	vk->uniformRing = vulkan_createUniformRing(vk->device, vk->deviceDescription.properties, u32(vk->swapchain.images.size()), u32(vk->submeshDraws.size()), { nullptr, 0, VK_SHARING_MODE_EXCLUSIVE }, &vk->memoryAllocator);
+	if (vk->meshletCulling)
+	{
+		u32 drawCount = vk->meshletDraws.drawCount;
+		u32 indexCapacity = vk->meshletDraws.indexCapacity;
+		vulkan_destroyMeshletDraws(vk->device, &vk->memoryAllocator, &vk->meshletDraws);
+		vk->meshletDraws = vulkan_createMeshletDraws(vk->device, vk->swapchain.images.size(), drawCount, indexCapacity, { nullptr, 0, VK_SHARING_MODE_EXCLUSIVE }, &vk->memoryAllocator);
 	}
-	vk->uniformBuffers = vulkan_createUniformBuffers(vk->device, vk->swapchain.images.size(), { nullptr, 0, VK_SHARING_MODE_EXCLUSIVE }, vk->deviceDescription.memoryProperties);
-	vkFreeDescriptorSets(vk->device, vk->descriptorPool, u32(vk->descriptorSets.size()), vk->descriptorSets.data());
-	vk->descriptorSets = vulkan_createDescriptorSets(vk->device, vk->descriptorPool, u32(vk->swapchain.images.size()), vk->descriptorSetLayout, vk->uniformBuffers, vk->texture.view, vk->texture.sampler);
-	vulkan_buildCommandBuffers(vk->renderPass, vk->swapchain.extent, vk->drawCommandBuffers, vk->framebuffers, vk->vertexBuffer.handle, vk->indexBuffer.handle, vk->graphicsPipeline, vk->graphicsPipelineLayout, vk->mesh.vertices, vk->mesh.indices, vk->descriptorSets);
+	vkFreeDescriptorSets(vk->device, vk->descriptorPool, 1, &vk->frameDescriptorSet);
+	vk->frameDescriptorSet = vulkan_createFrameDescriptorSet(vk->device, vk->descriptorPool, vk->descriptorSetLayouts[DESCRIPTOR_SET_FRAME], vk->uniformRing);
+	// The device is idle: no image is in flight, and the image count may have changed
+	vk->frameSync.imagesInFlight.assign(vk->swapchain.images.size(), nullptr);
+	vulkan_destroyFrameTimings(vk->device, &vk->frameTimings);
+	vulkan_createFrameTimings(&vk->frameTimings, vk->device, vk->deviceDescription, u32(vk->swapchain.images.size()));
+	vulkan_buildCommandBuffers(vk->renderPass, vk->swapchain.extent, vk->drawCommandBuffers, vk->framebuffers, vulkan_getBuffer(vk->resources, vk->vertexBuffer).handle, vulkan_getBuffer(vk->resources, vk->indexBuffer).handle, vk->graphicsPipeline, vk->graphicsPipelineLayout, vk->submeshDraws, vk->meshletCulling ? &vk->meshletDraws : nullptr, vk->meshQuantization, vk->frameDescriptorSet, vk->uniformRing, vk->materialDescriptorSets, vk->frameTimings.queryPool);
 }
 
 void destroyVulkanApplication(VulkanApplication& vk)
 {
 	VKCHECK(vkDeviceWaitIdle(vk.device));
 
-	vkDestroyImage(vk.device, vk.msaa.image, nullptr);
-	vkDestroyImageView(vk.device, vk.msaa.view, nullptr);
-	vkFreeMemory(vk.device, vk.msaa.memory, nullptr);
-
 	vkDestroyImageView(vk.device, vk.depthStencil.imageView, nullptr);
 	vkDestroyImage(vk.device, vk.depthStencil.image, nullptr);
-	vkFreeMemory(vk.device, vk.depthStencil.memory, nullptr);
+	vulkan_freeMemory(&vk.memoryAllocator, vk.depthStencil.memory);
 
 	vkDestroyRenderPass(vk.device, vk.renderPass, nullptr);
 	for (VkFramebuffer framebuffer : vk.framebuffers)
@@ -2158,9 +3607,11 @@ void destroyVulkanApplication(VulkanApplication& vk)
 	vkFreeCommandBuffers(vk.device, vk.graphicsCommandPool, u32(vk.drawCommandBuffers.size()), vk.drawCommandBuffers.data());
 	vkDestroyPipelineLayout(vk.device, vk.graphicsPipelineLayout, nullptr);
 	vkDestroyPipeline(vk.device, vk.graphicsPipeline, nullptr);
-	vkFreeDescriptorSets(vk.device, vk.descriptorPool, u32(vk.descriptorSets.size()), vk.descriptorSets.data());
+	vkFreeDescriptorSets(vk.device, vk.descriptorPool, 1, &vk.frameDescriptorSet);
+	vkFreeDescriptorSets(vk.device, vk.descriptorPool, u32(vk.materialDescriptorSets.size()), vk.materialDescriptorSets.data());
 	vkDestroyDescriptorPool(vk.device, vk.descriptorPool, nullptr);
 	vkDestroyCommandPool(vk.device, vk.graphicsCommandPool, nullptr);
+	vulkan_destroyUploader(&vk.uploader);
 
 	for (VkSemaphore semaphore : vk.frameSync.imageAcquireSemaphores)
 	{
@@ -2174,6 +3625,12 @@ void destroyVulkanApplication(VulkanApplication& vk)
 	{
 		vkDestroyFence(vk.device, fence, nullptr);
 	}
+	for (LinearArena& scratchArena : vk.frameSync.scratchArenas)
+	{
+		linearArena_destroy(&scratchArena);
+	}
+	vulkan_destroyFrameTimings(vk.device, &vk.frameTimings);
+	vulkan_destroyFrameRecorder(vk.device, &vk.frameRecorder);
 	for (VkFence fence : vk.waitFences)
 	{
 		vkDestroyFence(vk.device, fence, nullptr);
@@ -2182,27 +3639,20 @@ void destroyVulkanApplication(VulkanApplication& vk)
 	vkDestroyShaderModule(vk.device, vk.VS, nullptr);
 	vkDestroyShaderModule(vk.device, vk.FS, nullptr);
 
-	vkDestroyImage(vk.device, vk.texture.handle, nullptr);
-	vkDestroyImageView(vk.device, vk.texture.view, nullptr);
-	vkDestroySampler(vk.device, vk.texture.sampler, nullptr);
-	vkFreeMemory(vk.device, vk.texture.memory, nullptr);
-
-	vkDestroyBuffer(vk.device, vk.vertexBuffer.handle, nullptr);
-	vkFreeMemory(vk.device, vk.vertexBuffer.memory, nullptr);
-	vkDestroyBuffer(vk.device, vk.indexBuffer.handle, nullptr);
-	vkFreeMemory(vk.device, vk.indexBuffer.memory, nullptr);
-
-	for (VkDeviceMemory memory : vk.uniformBuffers.memory)
+	// MSAA target, textures, vertex and index buffers
+	vulkan_destroyResources(vk.device, &vk.memoryAllocator, &vk.resources);
+	if (vk.meshletCulling)
 	{
-		vkFreeMemory(vk.device, memory, nullptr);
+		vulkan_destroyMeshletDraws(vk.device, &vk.memoryAllocator, &vk.meshletDraws);
 	}
-	for (VkBuffer buffer : vk.uniformBuffers.handle)
+
+	vulkan_destroyUniformRing(vk.device, &vk.memoryAllocator, &vk.uniformRing);
+
+	for (VkDescriptorSetLayout descriptorSetLayout : vk.descriptorSetLayouts)
 	{
-		vkDestroyBuffer(vk.device, buffer, nullptr);
+		vkDestroyDescriptorSetLayout(vk.device, descriptorSetLayout, nullptr);
 	}
 
-	vkDestroyDescriptorSetLayout(vk.device, vk.descriptorSetLayout, nullptr);
-
 	for (VkImageView swapchainImageView: vk.swapchain.imageViews)
 	{
 		vkDestroyImageView(vk.device, swapchainImageView, nullptr);
@@ -2210,6 +3660,7 @@ void destroyVulkanApplication(VulkanApplication& vk)
 
 	vkDestroySwapchainKHR(vk.device, vk.swapchain.handle, nullptr);
 	vkDestroySurfaceKHR(vk.instance, vk.surface, nullptr);
+	vulkan_destroyMemoryAllocator(&vk.memoryAllocator);
 	vkDestroyDevice(vk.device, nullptr);
 	vkDestroyDebugReportCallbackEXT(vk.instance, vk.debugCallback, nullptr);
 	vkDestroyInstance(vk.instance, nullptr);
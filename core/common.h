@@ -1,6 +1,8 @@
 #pragma once
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <stdint.h>
 using u8 = uint8_t;
@@ -14,13 +16,18 @@ using i64 = int64_t;
 using bool32 = i32;
 
 // Memory
-#define BYTE_SIZE 1Ui64
+#define BYTE_SIZE UINT64_C(1)
 #define KILOBYTE (1024 * BYTE_SIZE)
 #define MEGABYTE (1024 * KILOBYTE)
 #define GIGABYTE (1024 * MEGABYTE)
 
+#ifdef _WIN64
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#else
+// Only the allocator, the arenas and their tests build off Windows
+#define __cdecl
+#endif
 
 void* __cdecl operator new(size_t size);
 void* __cdecl operator new[](size_t size);
@@ -5,28 +5,131 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/hash.hpp>
-#define VERTEX_ATTRIBUTES 3
+#include <cstddef>
+
+enum class VertexAttributeFormat : u32
+{
+	FLOAT2,
+	FLOAT3,
+	FLOAT4,
+	UNORM16x2,
+	UNORM16x4,
+	SNORM16x2,
+};
+
+struct VertexAttributeDescription
+{
+	u32 location;
+	VertexAttributeFormat format;
+	u32 offset;
+};
+
+// Compile-time description of a vertex type, specialized next to every vertex struct. The Vulkan binding and attribute descriptions are generated from it
+template<typename VertexType>
+struct VertexLayout;
 
 struct Vertex
 {
 	glm::vec3 pos;
-	glm::vec3 color;
+	glm::vec3 normal;
 	glm::vec2 texCoord;
+	glm::vec4 tangent; // w: bitangent sign, bitangent = cross(normal, tangent.xyz) * w
 
 	Vertex()
-		: pos(0.0f, 0.0f, 0.0f), color(0.0f, 0.0f, 0.0f), texCoord(0.0f, 0.0f) {}
+		: pos(0.0f, 0.0f, 0.0f), normal(0.0f, 0.0f, 0.0f), texCoord(0.0f, 0.0f), tangent(0.0f, 0.0f, 0.0f, 0.0f) {}
 
 	Vertex(const Vertex& other)
-		: pos(other.pos), color(other.color), texCoord(other.texCoord) {}
+		: pos(other.pos), normal(other.normal), texCoord(other.texCoord), tangent(other.tangent) {}
 
 	~Vertex() = default;
 
 	bool operator==(const Vertex& other) const
 	{
-		return pos == other.pos && color == other.color && texCoord == other.texCoord;
+		return pos == other.pos && normal == other.normal && texCoord == other.texCoord && tangent == other.tangent;
 	}
 };
 
+// Hash of the raw bits: vertices that compare equal bitwise (as meshopt deduplicates them) hash equal
+inline u32 hashVertex(const Vertex& v)
+{
+	const u32* words = (const u32*)&v;
+	u32 hash = 2166136261u;
+	for (u32 i = 0; i < sizeof(Vertex) / sizeof(u32); i++)
+	{
+		hash ^= words[i];
+		hash *= 16777619u;
+	}
+
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+
+	return hash;
+}
+
+// 32 byte vertex of triangle.vert.glsl: Vertex without the tangent, which no shader reads yet
+struct FloatVertex
+{
+	glm::vec3 pos;
+	glm::vec3 normal;
+	glm::vec2 texCoord;
+};
+static_assert(sizeof(FloatVertex) == 32, "FloatVertex must stay 32 bytes");
+
+template<>
+struct VertexLayout<FloatVertex>
+{
+	static constexpr VertexAttributeDescription attributes[] =
+	{
+		{ 0, VertexAttributeFormat::FLOAT3, offsetof(FloatVertex, pos) },
+		{ 1, VertexAttributeFormat::FLOAT3, offsetof(FloatVertex, normal) },
+		{ 2, VertexAttributeFormat::FLOAT2, offsetof(FloatVertex, texCoord) },
+	};
+};
+
+/*
+16 byte vertex: position quantized to unorm16 inside the mesh bounds, octahedral normal and unorm16 texture coordinates
+inside the mesh UV bounds. MeshQuantization holds the per-mesh dequantization.
+*/
+struct PackedVertex
+{
+	u16 pos[4]; // w is padding
+	i16 normal[2];
+	u16 texCoord[2];
+};
+static_assert(sizeof(PackedVertex) == 16, "PackedVertex must stay 16 bytes");
+
+template<>
+struct VertexLayout<PackedVertex>
+{
+	static constexpr VertexAttributeDescription attributes[] =
+	{
+		{ 0, VertexAttributeFormat::UNORM16x4, offsetof(PackedVertex, pos) },
+		{ 1, VertexAttributeFormat::SNORM16x2, offsetof(PackedVertex, normal) },
+		{ 2, VertexAttributeFormat::UNORM16x2, offsetof(PackedVertex, texCoord) },
+	};
+};
+
+// Pushed per draw: value = offset + scale * normalized value
+struct MeshQuantization
+{
+	alignas(16) glm::vec4 positionOffset;
+	alignas(16) glm::vec4 positionScale;
+	alignas(16) glm::vec4 texCoordOffsetScale; // xy: offset, zw: scale
+};
+
+inline MeshQuantization meshQuantization_identity()
+{
+	MeshQuantization quantization;
+	quantization.positionOffset = glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+	quantization.positionScale = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
+	quantization.texCoordOffsetScale = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+
+	return quantization;
+}
+
 struct UniformBufferObject
 {
 	alignas(16) glm::mat4 model;
@@ -34,8 +137,76 @@ struct UniformBufferObject
 	alignas(16) glm::mat4 proj;
 };
 
+#define MESH_MATERIAL_NAME_SIZE 64
+#define MESH_MATERIAL_PATH_SIZE 260
+#define MESH_NO_MATERIAL ~0u
+
+// Plain data, so a cooked mesh can point straight at it
+struct MeshMaterial
+{
+	char name[MESH_MATERIAL_NAME_SIZE];
+	char diffuseTexturePath[MESH_MATERIAL_PATH_SIZE]; // empty if the material has no diffuse map
+	glm::vec3 diffuseColor;
+};
+
+// Index range drawn with one material. Submeshes are sorted by material and never overlap
+struct Submesh
+{
+	u32 indexOffset;
+	u32 indexCount;
+	u32 material; // MESH_NO_MATERIAL if the OBJ doesn't assign one
+};
+
+// The sphere is centered on the box: not the minimal sphere, but two streaming passes over the positions
+struct MeshBounds
+{
+	glm::vec3 min;
+	glm::vec3 max;
+	glm::vec3 center;
+	float radius;
+};
+
 struct Mesh
 {
 	vector<Vertex> vertices;
 	vector<u32> indices;
+	vector<Submesh> submeshes;
+	vector<MeshMaterial> materials;
+	MeshBounds bounds = {}; // Only valid if the loader computed MESH_ATTRIBUTE_BOUNDS_BIT
+};
+
+// Non-owning view of mesh data: either a Mesh or a memory mapped cooked mesh
+struct MeshView
+{
+	const Vertex* vertices;
+	u32 vertexCount;
+	const u32* indices;
+	u32 indexCount;
+	const Submesh* submeshes;
+	u32 submeshCount;
+	const MeshMaterial* materials;
+	u32 materialCount;
+	MeshBounds bounds;
+};
+
+inline MeshView meshView(const Mesh& mesh)
+{
+	MeshView view;
+	view.vertices = mesh.vertices.data();
+	view.vertexCount = u32(mesh.vertices.size());
+	view.indices = mesh.indices.data();
+	view.indexCount = u32(mesh.indices.size());
+	view.submeshes = mesh.submeshes.data();
+	view.submeshCount = u32(mesh.submeshes.size());
+	view.materials = mesh.materials.data();
+	view.materialCount = u32(mesh.materials.size());
+	view.bounds = mesh.bounds;
+
+	return view;
+}
+
+struct PackedMesh
+{
+	vector<PackedVertex> vertices;
+	MeshQuantization quantization;
 };
\ No newline at end of file
@@ -0,0 +1,692 @@
+#include "common.h"
+#include "glm.h"
+
+#include "mesh_attributes.h"
+
+#include <chrono>
+#include <float.h>
+#include <math.h>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define MESH_ATTRIBUTES_SSE 1
+#include <emmintrin.h>
+#else
+#define MESH_ATTRIBUTES_SSE 0
+#endif
+
+// MSVC compiles AVX2 intrinsics without /arch:AVX2, other compilers only when the whole unit targets AVX2
+#if defined(_M_X64) || defined(__AVX2__)
+#define MESH_ATTRIBUTES_AVX2 1
+#include <immintrin.h>
+#else
+#define MESH_ATTRIBUTES_AVX2 0
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using AttributeClock = std::chrono::high_resolution_clock;
+
+static inline double attributes_secondsSince(AttributeClock::time_point start)
+{
+	return std::chrono::duration<double>(AttributeClock::now() - start).count();
+}
+
+MeshSimdLevel meshSimd_supportedLevel()
+{
+#if MESH_ATTRIBUTES_AVX2
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	const bool32 osxsave = (info[2] & (1 << 27)) != 0;
+	const bool32 avx = (info[2] & (1 << 28)) != 0;
+	__cpuidex(info, 7, 0);
+	const bool32 avx2 = (info[1] & (1 << 5)) != 0;
+	// The OS must also save the upper halves of the YMM registers on context switches
+	if (osxsave && avx && avx2 && (_xgetbv(0) & 0x6) == 0x6)
+	{
+		return MeshSimdLevel::AVX2;
+	}
+#else
+	if (__builtin_cpu_supports("avx2"))
+	{
+		return MeshSimdLevel::AVX2;
+	}
+#endif
+#endif
+#if MESH_ATTRIBUTES_SSE
+	return MeshSimdLevel::SSE;
+#else
+	return MeshSimdLevel::SCALAR;
+#endif
+}
+
+const char* meshSimd_levelName(MeshSimdLevel level)
+{
+	switch (level)
+	{
+		case MeshSimdLevel::SCALAR: return "scalar";
+		case MeshSimdLevel::SSE: return "SSE";
+		case MeshSimdLevel::AVX2: return "AVX2";
+		default: return "unknown";
+	}
+}
+
+/*
+The kernels are written once against these wrappers and instantiated for every width. Only the per triangle math is
+vectorized: accumulating into shared vertices has conflicts between lanes, so the scatter stays scalar.
+*/
+struct SimdScalar
+{
+	typedef float F;
+	static const u32 width = 1;
+
+	static inline F set1(float x) { return x; }
+	static inline F load(const float* p) { return *p; }
+	static inline void store(float* p, F x) { *p = x; }
+	static inline F gather(const float* base, const u32* index) { return base[index[0]]; }
+	static inline F add(F a, F b) { return a + b; }
+	static inline F sub(F a, F b) { return a - b; }
+	static inline F mul(F a, F b) { return a * b; }
+	static inline F div(F a, F b) { return a / b; }
+	static inline F min(F a, F b) { return a < b ? a : b; }
+	static inline F max(F a, F b) { return a > b ? a : b; }
+	static inline F sqrt(F a) { return sqrtf(a); }
+	// a where x < y, b elsewhere
+	static inline F selectLess(F x, F y, F a, F b) { return x < y ? a : b; }
+};
+
+#if MESH_ATTRIBUTES_SSE
+struct SimdSse
+{
+	typedef __m128 F;
+	static const u32 width = 4;
+
+	static inline F set1(float x) { return _mm_set1_ps(x); }
+	static inline F load(const float* p) { return _mm_loadu_ps(p); }
+	static inline void store(float* p, F x) { _mm_storeu_ps(p, x); }
+	static inline F gather(const float* base, const u32* index) { return _mm_set_ps(base[index[3]], base[index[2]], base[index[1]], base[index[0]]); }
+	static inline F add(F a, F b) { return _mm_add_ps(a, b); }
+	static inline F sub(F a, F b) { return _mm_sub_ps(a, b); }
+	static inline F mul(F a, F b) { return _mm_mul_ps(a, b); }
+	static inline F div(F a, F b) { return _mm_div_ps(a, b); }
+	static inline F min(F a, F b) { return _mm_min_ps(a, b); }
+	static inline F max(F a, F b) { return _mm_max_ps(a, b); }
+	static inline F sqrt(F a) { return _mm_sqrt_ps(a); }
+	static inline F selectLess(F x, F y, F a, F b)
+	{
+		F mask = _mm_cmplt_ps(x, y);
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	}
+};
+#endif
+
+#if MESH_ATTRIBUTES_AVX2
+struct SimdAvx2
+{
+	typedef __m256 F;
+	static const u32 width = 8;
+
+	static inline F set1(float x) { return _mm256_set1_ps(x); }
+	static inline F load(const float* p) { return _mm256_loadu_ps(p); }
+	static inline void store(float* p, F x) { _mm256_storeu_ps(p, x); }
+	static inline F gather(const float* base, const u32* index) { return _mm256_i32gather_ps(base, _mm256_loadu_si256((const __m256i*)index), 4); }
+	static inline F add(F a, F b) { return _mm256_add_ps(a, b); }
+	static inline F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+	static inline F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+	static inline F div(F a, F b) { return _mm256_div_ps(a, b); }
+	static inline F min(F a, F b) { return _mm256_min_ps(a, b); }
+	static inline F max(F a, F b) { return _mm256_max_ps(a, b); }
+	static inline F sqrt(F a) { return _mm256_sqrt_ps(a); }
+	static inline F selectLess(F x, F y, F a, F b) { return _mm256_blendv_ps(b, a, _mm256_cmp_ps(x, y, _CMP_LT_OQ)); }
+};
+#endif
+
+template<typename F>
+struct SimdVec3
+{
+	F x, y, z;
+};
+
+template<typename S>
+static inline SimdVec3<typename S::F> simd_gather3(const float* x, const float* y, const float* z, const u32* index)
+{
+	return { S::gather(x, index), S::gather(y, index), S::gather(z, index) };
+}
+
+template<typename S>
+static inline SimdVec3<typename S::F> simd_load3(const float* x, const float* y, const float* z)
+{
+	return { S::load(x), S::load(y), S::load(z) };
+}
+
+template<typename S>
+static inline void simd_store3(float* x, float* y, float* z, const SimdVec3<typename S::F>& v)
+{
+	S::store(x, v.x);
+	S::store(y, v.y);
+	S::store(z, v.z);
+}
+
+template<typename S>
+static inline SimdVec3<typename S::F> simd_sub3(const SimdVec3<typename S::F>& a, const SimdVec3<typename S::F>& b)
+{
+	return { S::sub(a.x, b.x), S::sub(a.y, b.y), S::sub(a.z, b.z) };
+}
+
+template<typename S>
+static inline SimdVec3<typename S::F> simd_scale3(const SimdVec3<typename S::F>& a, typename S::F s)
+{
+	return { S::mul(a.x, s), S::mul(a.y, s), S::mul(a.z, s) };
+}
+
+template<typename S>
+static inline typename S::F simd_dot3(const SimdVec3<typename S::F>& a, const SimdVec3<typename S::F>& b)
+{
+	return S::add(S::add(S::mul(a.x, b.x), S::mul(a.y, b.y)), S::mul(a.z, b.z));
+}
+
+template<typename S>
+static inline SimdVec3<typename S::F> simd_cross3(const SimdVec3<typename S::F>& a, const SimdVec3<typename S::F>& b)
+{
+	return
+	{
+		S::sub(S::mul(a.y, b.z), S::mul(a.z, b.y)),
+		S::sub(S::mul(a.z, b.x), S::mul(a.x, b.z)),
+		S::sub(S::mul(a.x, b.y), S::mul(a.y, b.x)),
+	};
+}
+
+// Zero vectors stay zero instead of turning into NaNs
+template<typename S>
+static inline SimdVec3<typename S::F> simd_normalize3(const SimdVec3<typename S::F>& a)
+{
+	typename S::F inverseLength = S::div(S::set1(1.0f), S::sqrt(S::max(simd_dot3<S>(a, a), S::set1(1e-30f))));
+	return simd_scale3<S>(a, inverseLength);
+}
+
+// a - n * dot(n, a): a projected on the plane of the unit vector n
+template<typename S>
+static inline SimdVec3<typename S::F> simd_reject3(const SimdVec3<typename S::F>& a, const SimdVec3<typename S::F>& n)
+{
+	return simd_sub3<S>(a, simd_scale3<S>(n, simd_dot3<S>(n, a)));
+}
+
+// Abramowitz & Stegun 4.4.45, error below 7e-5 radians: plenty for a weight, and the same polynomial on every path
+template<typename S>
+static inline typename S::F simd_acos(typename S::F x)
+{
+	typedef typename S::F F;
+	F absX = S::max(x, S::sub(S::set1(0.0f), x));
+	F polynomial = S::set1(-0.0187293f);
+	polynomial = S::add(S::mul(polynomial, absX), S::set1(0.0742610f));
+	polynomial = S::sub(S::mul(polynomial, absX), S::set1(0.2121144f));
+	polynomial = S::add(S::mul(polynomial, absX), S::set1(1.5707288f));
+	F result = S::mul(S::sqrt(S::sub(S::set1(1.0f), absX)), polynomial);
+
+	return S::selectLess(x, S::set1(0.0f), S::sub(S::set1(3.14159265f), result), result);
+}
+
+// Structure of arrays copies of the vertex attributes the kernels read and accumulate
+struct AttributeStreams
+{
+	vector<float> px, py, pz;
+	vector<float> u, v;
+	vector<float> nx, ny, nz;
+	vector<float> tx, ty, tz;
+	vector<float> bx, by, bz;
+};
+
+template<u32 W>
+static inline void attributes_loadCorners(const u32* indices, u32 triangle, u32 corners[3][W])
+{
+	for (u32 lane = 0; lane < W; lane++)
+	{
+		corners[0][lane] = indices[(triangle + lane) * 3 + 0];
+		corners[1][lane] = indices[(triangle + lane) * 3 + 1];
+		corners[2][lane] = indices[(triangle + lane) * 3 + 2];
+	}
+}
+
+// Every kernel processes whole vectors from begin and returns where it stopped: the scalar instantiation finishes the tail
+
+template<typename S>
+static u32 attributes_boundsMinMax(const AttributeStreams& streams, u32 begin, u32 end, float boundsMin[3], float boundsMax[3])
+{
+	typedef typename S::F F;
+	const u32 W = S::width;
+	F minX = S::set1(boundsMin[0]), minY = S::set1(boundsMin[1]), minZ = S::set1(boundsMin[2]);
+	F maxX = S::set1(boundsMax[0]), maxY = S::set1(boundsMax[1]), maxZ = S::set1(boundsMax[2]);
+
+	u32 i = begin;
+	for (; i + W <= end; i += W)
+	{
+		F x = S::load(&streams.px[i]);
+		F y = S::load(&streams.py[i]);
+		F z = S::load(&streams.pz[i]);
+		minX = S::min(minX, x);
+		minY = S::min(minY, y);
+		minZ = S::min(minZ, z);
+		maxX = S::max(maxX, x);
+		maxY = S::max(maxY, y);
+		maxZ = S::max(maxZ, z);
+	}
+
+	float lanes[6][W];
+	S::store(lanes[0], minX);
+	S::store(lanes[1], minY);
+	S::store(lanes[2], minZ);
+	S::store(lanes[3], maxX);
+	S::store(lanes[4], maxY);
+	S::store(lanes[5], maxZ);
+	for (u32 lane = 0; lane < W; lane++)
+	{
+		for (u32 axis = 0; axis < 3; axis++)
+		{
+			boundsMin[axis] = lanes[axis][lane] < boundsMin[axis] ? lanes[axis][lane] : boundsMin[axis];
+			boundsMax[axis] = lanes[axis + 3][lane] > boundsMax[axis] ? lanes[axis + 3][lane] : boundsMax[axis];
+		}
+	}
+
+	return i;
+}
+
+template<typename S>
+static u32 attributes_boundsRadius(const AttributeStreams& streams, u32 begin, u32 end, const float center[3], float* maxDistanceSquared)
+{
+	typedef typename S::F F;
+	const u32 W = S::width;
+	const SimdVec3<F> c = { S::set1(center[0]), S::set1(center[1]), S::set1(center[2]) };
+	F maxDistance = S::set1(*maxDistanceSquared);
+
+	u32 i = begin;
+	for (; i + W <= end; i += W)
+	{
+		SimdVec3<F> d = simd_sub3<S>(simd_load3<S>(&streams.px[i], &streams.py[i], &streams.pz[i]), c);
+		maxDistance = S::max(maxDistance, simd_dot3<S>(d, d));
+	}
+
+	float lanes[W];
+	S::store(lanes, maxDistance);
+	for (u32 lane = 0; lane < W; lane++)
+	{
+		*maxDistanceSquared = lanes[lane] > *maxDistanceSquared ? lanes[lane] : *maxDistanceSquared;
+	}
+
+	return i;
+}
+
+template<typename S>
+static u32 attributes_accumulateNormals(AttributeStreams& streams, const u32* indices, u32 begin, u32 end)
+{
+	typedef typename S::F F;
+	const u32 W = S::width;
+	u32 corners[3][W];
+	float face[3][W];
+
+	u32 triangle = begin;
+	for (; triangle + W <= end; triangle += W)
+	{
+		attributes_loadCorners<W>(indices, triangle, corners);
+		SimdVec3<F> p0 = simd_gather3<S>(streams.px.data(), streams.py.data(), streams.pz.data(), corners[0]);
+		SimdVec3<F> p1 = simd_gather3<S>(streams.px.data(), streams.py.data(), streams.pz.data(), corners[1]);
+		SimdVec3<F> p2 = simd_gather3<S>(streams.px.data(), streams.py.data(), streams.pz.data(), corners[2]);
+		// Twice the triangle area long
+		SimdVec3<F> normal = simd_cross3<S>(simd_sub3<S>(p1, p0), simd_sub3<S>(p2, p0));
+		simd_store3<S>(face[0], face[1], face[2], normal);
+
+		for (u32 lane = 0; lane < W; lane++)
+		{
+			for (u32 corner = 0; corner < 3; corner++)
+			{
+				u32 vertex = corners[corner][lane];
+				streams.nx[vertex] += face[0][lane];
+				streams.ny[vertex] += face[1][lane];
+				streams.nz[vertex] += face[2][lane];
+			}
+		}
+	}
+
+	return triangle;
+}
+
+template<typename S>
+static u32 attributes_normalizeNormals(AttributeStreams& streams, u32 begin, u32 end)
+{
+	const u32 W = S::width;
+	u32 i = begin;
+	for (; i + W <= end; i += W)
+	{
+		SimdVec3<typename S::F> normal = simd_load3<S>(&streams.nx[i], &streams.ny[i], &streams.nz[i]);
+		simd_store3<S>(&streams.nx[i], &streams.ny[i], &streams.nz[i], simd_normalize3<S>(normal));
+	}
+
+	return i;
+}
+
+template<typename S>
+static u32 attributes_accumulateTangents(AttributeStreams& streams, const u32* indices, u32 begin, u32 end)
+{
+	typedef typename S::F F;
+	const u32 W = S::width;
+	const F zero = S::set1(0.0f);
+	const F one = S::set1(1.0f);
+	u32 corners[3][W];
+	float tangent[3][3][W];
+	float bitangent[3][3][W];
+
+	u32 triangle = begin;
+	for (; triangle + W <= end; triangle += W)
+	{
+		attributes_loadCorners<W>(indices, triangle, corners);
+
+		SimdVec3<F> p[3];
+		F u[3];
+		F v[3];
+		SimdVec3<F> n[3];
+		for (u32 corner = 0; corner < 3; corner++)
+		{
+			p[corner] = simd_gather3<S>(streams.px.data(), streams.py.data(), streams.pz.data(), corners[corner]);
+			u[corner] = S::gather(streams.u.data(), corners[corner]);
+			v[corner] = S::gather(streams.v.data(), corners[corner]);
+			n[corner] = simd_gather3<S>(streams.nx.data(), streams.ny.data(), streams.nz.data(), corners[corner]);
+		}
+
+		SimdVec3<F> edge1 = simd_sub3<S>(p[1], p[0]);
+		SimdVec3<F> edge2 = simd_sub3<S>(p[2], p[0]);
+		F du1 = S::sub(u[1], u[0]);
+		F dv1 = S::sub(v[1], v[0]);
+		F du2 = S::sub(u[2], u[0]);
+		F dv2 = S::sub(v[2], v[0]);
+
+		// MikkTSpace keeps only the orientation of the UV mapping, faces without UV area add nothing
+		F signedArea = S::sub(S::mul(du1, dv2), S::mul(du2, dv1));
+		F absArea = S::max(signedArea, S::sub(zero, signedArea));
+		F orientation = S::selectLess(signedArea, zero, S::set1(-1.0f), one);
+		orientation = S::selectLess(absArea, S::set1(FLT_MIN), zero, orientation);
+		SimdVec3<F> faceTangent = simd_scale3<S>(simd_sub3<S>(simd_scale3<S>(edge1, dv2), simd_scale3<S>(edge2, dv1)), orientation);
+		SimdVec3<F> faceBitangent = simd_scale3<S>(simd_sub3<S>(simd_scale3<S>(edge2, du1), simd_scale3<S>(edge1, du2)), orientation);
+
+		for (u32 corner = 0; corner < 3; corner++)
+		{
+			const SimdVec3<F>& normal = n[corner];
+			// Corner angle measured in the tangent plane of the vertex, like MikkTSpace
+			SimdVec3<F> toNext = simd_normalize3<S>(simd_reject3<S>(simd_sub3<S>(p[(corner + 1) % 3], p[corner]), normal));
+			SimdVec3<F> toPrevious = simd_normalize3<S>(simd_reject3<S>(simd_sub3<S>(p[(corner + 2) % 3], p[corner]), normal));
+			F cosine = S::max(S::min(simd_dot3<S>(toNext, toPrevious), one), S::set1(-1.0f));
+			F angle = simd_acos<S>(cosine);
+
+			SimdVec3<F> cornerTangent = simd_scale3<S>(simd_normalize3<S>(simd_reject3<S>(faceTangent, normal)), angle);
+			SimdVec3<F> cornerBitangent = simd_scale3<S>(simd_normalize3<S>(simd_reject3<S>(faceBitangent, normal)), angle);
+			simd_store3<S>(tangent[corner][0], tangent[corner][1], tangent[corner][2], cornerTangent);
+			simd_store3<S>(bitangent[corner][0], bitangent[corner][1], bitangent[corner][2], cornerBitangent);
+		}
+
+		for (u32 lane = 0; lane < W; lane++)
+		{
+			for (u32 corner = 0; corner < 3; corner++)
+			{
+				u32 vertex = corners[corner][lane];
+				streams.tx[vertex] += tangent[corner][0][lane];
+				streams.ty[vertex] += tangent[corner][1][lane];
+				streams.tz[vertex] += tangent[corner][2][lane];
+				streams.bx[vertex] += bitangent[corner][0][lane];
+				streams.by[vertex] += bitangent[corner][1][lane];
+				streams.bz[vertex] += bitangent[corner][2][lane];
+			}
+		}
+	}
+
+	return triangle;
+}
+
+// Orthonormalizes the accumulated tangents against the normals and stores the bitangent sign in bx
+template<typename S>
+static u32 attributes_finishTangents(AttributeStreams& streams, u32 begin, u32 end)
+{
+	typedef typename S::F F;
+	const u32 W = S::width;
+	const F zero = S::set1(0.0f);
+	const F one = S::set1(1.0f);
+
+	u32 i = begin;
+	for (; i + W <= end; i += W)
+	{
+		SimdVec3<F> normal = simd_load3<S>(&streams.nx[i], &streams.ny[i], &streams.nz[i]);
+		SimdVec3<F> tangent = simd_reject3<S>(simd_load3<S>(&streams.tx[i], &streams.ty[i], &streams.tz[i]), normal);
+		SimdVec3<F> bitangent = simd_load3<S>(&streams.bx[i], &streams.by[i], &streams.bz[i]);
+
+		// Vertices without UVs still get a tangent frame: any direction perpendicular to the normal
+		F absNormalX = S::max(normal.x, S::sub(zero, normal.x));
+		SimdVec3<F> axis = { S::selectLess(absNormalX, S::set1(0.9f), one, zero), S::selectLess(absNormalX, S::set1(0.9f), zero, one), zero };
+		SimdVec3<F> fallback = simd_normalize3<S>(simd_reject3<S>(axis, normal));
+
+		F lengthSquared = simd_dot3<S>(tangent, tangent);
+		tangent = simd_normalize3<S>(tangent);
+		tangent.x = S::selectLess(lengthSquared, S::set1(1e-20f), fallback.x, tangent.x);
+		tangent.y = S::selectLess(lengthSquared, S::set1(1e-20f), fallback.y, tangent.y);
+		tangent.z = S::selectLess(lengthSquared, S::set1(1e-20f), fallback.z, tangent.z);
+
+		F handedness = simd_dot3<S>(simd_cross3<S>(normal, tangent), bitangent);
+		simd_store3<S>(&streams.tx[i], &streams.ty[i], &streams.tz[i], tangent);
+		S::store(&streams.bx[i], S::selectLess(handedness, zero, S::set1(-1.0f), one));
+	}
+
+	return i;
+}
+
+template<typename S>
+static void attributes_compute(AttributeStreams& streams, u32 vertexCount, const u32* indices, u32 triangleCount, u32 flags, MeshBounds* bounds, MeshAttributeStats* stats)
+{
+	if (flags & MESH_ATTRIBUTE_BOUNDS_BIT)
+	{
+		AttributeClock::time_point boundsStart = AttributeClock::now();
+		float boundsMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+		float boundsMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		u32 done = attributes_boundsMinMax<S>(streams, 0, vertexCount, boundsMin, boundsMax);
+		attributes_boundsMinMax<SimdScalar>(streams, done, vertexCount, boundsMin, boundsMax);
+
+		float center[3];
+		for (u32 axis = 0; axis < 3; axis++)
+		{
+			center[axis] = (boundsMin[axis] + boundsMax[axis]) * 0.5f;
+		}
+		float maxDistanceSquared = 0.0f;
+		done = attributes_boundsRadius<S>(streams, 0, vertexCount, center, &maxDistanceSquared);
+		attributes_boundsRadius<SimdScalar>(streams, done, vertexCount, center, &maxDistanceSquared);
+
+		bounds->min = glm::vec3(boundsMin[0], boundsMin[1], boundsMin[2]);
+		bounds->max = glm::vec3(boundsMax[0], boundsMax[1], boundsMax[2]);
+		bounds->center = glm::vec3(center[0], center[1], center[2]);
+		bounds->radius = sqrtf(maxDistanceSquared);
+		stats->boundsSeconds = attributes_secondsSince(boundsStart);
+	}
+
+	if (flags & (MESH_ATTRIBUTE_NORMALS_BIT | MESH_ATTRIBUTE_TANGENTS_BIT))
+	{
+		AttributeClock::time_point normalsStart = AttributeClock::now();
+		if (flags & MESH_ATTRIBUTE_NORMALS_BIT)
+		{
+			u32 done = attributes_accumulateNormals<S>(streams, indices, 0, triangleCount);
+			attributes_accumulateNormals<SimdScalar>(streams, indices, done, triangleCount);
+		}
+		// Source normals are normalized as well: the tangent frame needs unit normals
+		u32 done = attributes_normalizeNormals<S>(streams, 0, vertexCount);
+		attributes_normalizeNormals<SimdScalar>(streams, done, vertexCount);
+		stats->normalsSeconds = attributes_secondsSince(normalsStart);
+	}
+
+	if (flags & MESH_ATTRIBUTE_TANGENTS_BIT)
+	{
+		AttributeClock::time_point tangentsStart = AttributeClock::now();
+		u32 done = attributes_accumulateTangents<S>(streams, indices, 0, triangleCount);
+		attributes_accumulateTangents<SimdScalar>(streams, indices, done, triangleCount);
+		done = attributes_finishTangents<S>(streams, 0, vertexCount);
+		attributes_finishTangents<SimdScalar>(streams, done, vertexCount);
+		stats->tangentsSeconds = attributes_secondsSince(tangentsStart);
+	}
+}
+
+void computeMeshAttributes(Vertex* vertices, u32 vertexCount, const u32* indices, u32 indexCount, u32 flags, MeshSimdLevel simd, MeshBounds* bounds, MeshAttributeStats* stats)
+{
+	AttributeClock::time_point start = AttributeClock::now();
+	assert(indexCount % 3 == 0);
+	assert(bounds || !(flags & MESH_ATTRIBUTE_BOUNDS_BIT));
+
+	const MeshSimdLevel supported = meshSimd_supportedLevel();
+	simd = u32(simd) > u32(supported) ? supported : simd;
+
+	MeshAttributeStats localStats = {};
+	localStats.simd = simd;
+
+	const bool32 frame = (flags & (MESH_ATTRIBUTE_NORMALS_BIT | MESH_ATTRIBUTE_TANGENTS_BIT)) != 0;
+	const bool32 tangents = (flags & MESH_ATTRIBUTE_TANGENTS_BIT) != 0;
+
+	AttributeStreams streams;
+	streams.px.resize(vertexCount);
+	streams.py.resize(vertexCount);
+	streams.pz.resize(vertexCount);
+	if (frame)
+	{
+		streams.nx.resize(vertexCount);
+		streams.ny.resize(vertexCount);
+		streams.nz.resize(vertexCount);
+	}
+	if (tangents)
+	{
+		streams.u.resize(vertexCount);
+		streams.v.resize(vertexCount);
+		streams.tx.assign(vertexCount, 0.0f);
+		streams.ty.assign(vertexCount, 0.0f);
+		streams.tz.assign(vertexCount, 0.0f);
+		streams.bx.assign(vertexCount, 0.0f);
+		streams.by.assign(vertexCount, 0.0f);
+		streams.bz.assign(vertexCount, 0.0f);
+	}
+
+	const bool32 keepNormals = !(flags & MESH_ATTRIBUTE_NORMALS_BIT);
+	for (u32 i = 0; i < vertexCount; i++)
+	{
+		const Vertex& vertex = vertices[i];
+		streams.px[i] = vertex.pos.x;
+		streams.py[i] = vertex.pos.y;
+		streams.pz[i] = vertex.pos.z;
+		if (frame)
+		{
+			streams.nx[i] = keepNormals ? vertex.normal.x : 0.0f;
+			streams.ny[i] = keepNormals ? vertex.normal.y : 0.0f;
+			streams.nz[i] = keepNormals ? vertex.normal.z : 0.0f;
+		}
+		if (tangents)
+		{
+			streams.u[i] = vertex.texCoord.x;
+			streams.v[i] = vertex.texCoord.y;
+		}
+	}
+
+	const u32 triangleCount = indexCount / 3;
+	switch (simd)
+	{
+#if MESH_ATTRIBUTES_AVX2
+		case MeshSimdLevel::AVX2:
+			attributes_compute<SimdAvx2>(streams, vertexCount, indices, triangleCount, flags, bounds, &localStats);
+			// Avoid the AVX to SSE transition penalty in the code that follows
+			_mm256_zeroupper();
+			break;
+#endif
+#if MESH_ATTRIBUTES_SSE
+		case MeshSimdLevel::SSE:
+			attributes_compute<SimdSse>(streams, vertexCount, indices, triangleCount, flags, bounds, &localStats);
+			break;
+#endif
+		default:
+			attributes_compute<SimdScalar>(streams, vertexCount, indices, triangleCount, flags, bounds, &localStats);
+			break;
+	}
+
+	for (u32 i = 0; i < vertexCount; i++)
+	{
+		Vertex& vertex = vertices[i];
+		if (flags & MESH_ATTRIBUTE_NORMALS_BIT)
+		{
+			vertex.normal = glm::vec3(streams.nx[i], streams.ny[i], streams.nz[i]);
+		}
+		if (tangents)
+		{
+			vertex.tangent = glm::vec4(streams.tx[i], streams.ty[i], streams.tz[i], streams.bx[i]);
+		}
+	}
+
+	localStats.totalSeconds = attributes_secondsSince(start);
+	if (stats)
+	{
+		*stats = localStats;
+	}
+}
+
+void printMeshAttributeStats(const MeshAttributeStats& stats)
+{
+	printf("\tAttributes (%s): %.3f ms (bounds %.3f ms, normals %.3f ms, tangents %.3f ms)\n", meshSimd_levelName(stats.simd),
+		stats.totalSeconds * 1000.0, stats.boundsSeconds * 1000.0, stats.normalsSeconds * 1000.0, stats.tangentsSeconds * 1000.0);
+}
+
+void meshAttributes_benchmark(const char* path, u32 iterationCount)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file)
+	{
+		printf("Mesh attribute benchmark: %s not found, skipped\n", path);
+		return;
+	}
+	fclose(file);
+
+	Mesh mesh = loadMesh_fast(path);
+	const u32 vertexCount = u32(mesh.vertices.size());
+	const u32 indexCount = u32(mesh.indices.size());
+	printf("Mesh attribute benchmark %s: %u vertices, %u triangles, best of %u\n", path, vertexCount, indexCount / 3, iterationCount);
+
+	vector<Vertex> reference = mesh.vertices;
+	MeshBounds referenceBounds;
+	computeMeshAttributes(reference.data(), vertexCount, mesh.indices.data(), indexCount, MESH_ATTRIBUTE_ALL, MeshSimdLevel::SCALAR, &referenceBounds);
+
+	vector<Vertex> vertices;
+	double scalarSeconds = 0.0;
+	const MeshSimdLevel supported = meshSimd_supportedLevel();
+	for (u32 level = u32(MeshSimdLevel::SCALAR); level <= u32(supported); level++)
+	{
+		MeshAttributeStats best = {};
+		MeshBounds bounds;
+		for (u32 iteration = 0; iteration < iterationCount; iteration++)
+		{
+			vertices = mesh.vertices;
+			MeshAttributeStats stats;
+			computeMeshAttributes(vertices.data(), vertexCount, mesh.indices.data(), indexCount, MESH_ATTRIBUTE_ALL, MeshSimdLevel(level), &bounds, &stats);
+			if (iteration == 0 || stats.totalSeconds < best.totalSeconds)
+			{
+				best = stats;
+			}
+		}
+		if (level == u32(MeshSimdLevel::SCALAR))
+		{
+			scalarSeconds = best.totalSeconds;
+		}
+
+		float normalError = 0.0f;
+		float tangentError = 0.0f;
+		u32 handednessMismatches = 0;
+		for (u32 i = 0; i < vertexCount; i++)
+		{
+			normalError = glm::max(normalError, glm::length(vertices[i].normal - reference[i].normal));
+			glm::vec3 tangentDelta = glm::vec3(vertices[i].tangent.x - reference[i].tangent.x, vertices[i].tangent.y - reference[i].tangent.y, vertices[i].tangent.z - reference[i].tangent.z);
+			tangentError = glm::max(tangentError, glm::length(tangentDelta));
+			handednessMismatches += vertices[i].tangent.w != reference[i].tangent.w;
+		}
+		float boundsError = glm::max(glm::length(bounds.min - referenceBounds.min), glm::length(bounds.max - referenceBounds.max));
+		boundsError = glm::max(boundsError, fabsf(bounds.radius - referenceBounds.radius));
+
+		printMeshAttributeStats(best);
+		printf("\t\t%.2fx scalar, max error vs scalar: normal %g, tangent %g, bounds %g, %u handedness mismatches\n",
+			scalarSeconds / best.totalSeconds, normalError, tangentError, boundsError, handednessMismatches);
+	}
+}
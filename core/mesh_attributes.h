@@ -0,0 +1,22 @@
+#pragma once
+
+#include "common.h"
+#include "glm.h"
+#include "model.h"
+
+// Best level this CPU and build support. AVX2 is checked at runtime, so one build runs everywhere
+MeshSimdLevel meshSimd_supportedLevel();
+const char* meshSimd_levelName(MeshSimdLevel level);
+
+/*
+Per vertex normals, tangents and mesh bounds, see MeshAttributeFlagBits. Normals accumulate the unnormalized face normals,
+so every face weighs by its area. Tangents approximate MikkTSpace on the indexed mesh as it is: face tangents projected
+on the vertex normal plane and weighted by the corner angle. Vertices are never split, so where faces sharing a vertex
+disagree on the frame, at UV mirroring seams for one, their tangents are averaged where MikkTSpace would give each side
+its own vertex. Levels above meshSimd_supportedLevel() fall back to it.
+*/
+void computeMeshAttributes(Vertex* vertices, u32 vertexCount, const u32* indices, u32 indexCount, u32 flags, MeshSimdLevel simd, MeshBounds* bounds, MeshAttributeStats* stats = nullptr);
+void printMeshAttributeStats(const MeshAttributeStats& stats);
+
+// Best of iterationCount runs of every supported level on the OBJ, plus how far each level deviates from the scalar path
+void meshAttributes_benchmark(const char* path, u32 iterationCount);
@@ -0,0 +1,240 @@
+#include "common.h"
+#include "glm.h"
+
+#include "mesh_cache.h"
+#include <chrono>
+
+static inline u64 rmesh_alignOffset(u64 offset)
+{
+	return (offset + RMESH_BLOB_ALIGNMENT - 1) & ~u64(RMESH_BLOB_ALIGNMENT - 1);
+}
+
+static inline bool32 rmesh_writePadding(FILE* file, u64 from, u64 to)
+{
+	static const u8 zeroes[RMESH_BLOB_ALIGNMENT] = {};
+	assert(to - from <= RMESH_BLOB_ALIGNMENT);
+	return fwrite(zeroes, 1, size_t(to - from), file) == size_t(to - from);
+}
+
+bool32 rmesh_write(const char* path, const MeshView& mesh, const FileVersion& source, u32 flags)
+{
+	FILE* file = fopen(path, "wb");
+	if (!file)
+	{
+		return false;
+	}
+
+	RMeshHeader header = {};
+	header.magic = RMESH_MAGIC;
+	header.version = RMESH_VERSION;
+	header.source = source;
+	header.vertexStride = sizeof(Vertex);
+	header.vertexCount = mesh.vertexCount;
+	header.indexCount = mesh.indexCount;
+	header.submeshCount = mesh.submeshCount;
+	header.materialCount = mesh.materialCount;
+	header.flags = flags;
+	header.bounds = mesh.bounds;
+
+	const u64 vertexBytes = u64(mesh.vertexCount) * sizeof(Vertex);
+	const u64 indexBytes = u64(mesh.indexCount) * sizeof(u32);
+	const u64 submeshBytes = u64(mesh.submeshCount) * sizeof(Submesh);
+	const u64 materialBytes = u64(mesh.materialCount) * sizeof(MeshMaterial);
+	header.vertexOffset = rmesh_alignOffset(sizeof(RMeshHeader));
+	header.indexOffset = rmesh_alignOffset(header.vertexOffset + vertexBytes);
+	header.submeshOffset = rmesh_alignOffset(header.indexOffset + indexBytes);
+	header.materialOffset = rmesh_alignOffset(header.submeshOffset + submeshBytes);
+	header.fileSize = header.materialOffset + materialBytes;
+
+	// The header goes in last: a cook interrupted halfway leaves a file without magic, which rmesh_open rejects
+	RMeshHeader placeholder = {};
+	bool32 success = fwrite(&placeholder, sizeof(placeholder), 1, file) == 1;
+	success = success && rmesh_writePadding(file, sizeof(RMeshHeader), header.vertexOffset);
+	success = success && fwrite(mesh.vertices, 1, size_t(vertexBytes), file) == size_t(vertexBytes);
+	success = success && rmesh_writePadding(file, header.vertexOffset + vertexBytes, header.indexOffset);
+	success = success && fwrite(mesh.indices, 1, size_t(indexBytes), file) == size_t(indexBytes);
+	success = success && rmesh_writePadding(file, header.indexOffset + indexBytes, header.submeshOffset);
+	success = success && fwrite(mesh.submeshes, 1, size_t(submeshBytes), file) == size_t(submeshBytes);
+	success = success && rmesh_writePadding(file, header.submeshOffset + submeshBytes, header.materialOffset);
+	success = success && fwrite(mesh.materials, 1, size_t(materialBytes), file) == size_t(materialBytes);
+	success = success && fflush(file) == 0;
+	success = success && fseek(file, 0, SEEK_SET) == 0;
+	success = success && fwrite(&header, sizeof(header), 1, file) == 1;
+	success = (fclose(file) == 0) && success;
+
+	if (!success)
+	{
+		remove(path);
+	}
+
+	return success;
+}
+
+bool32 rmesh_open(const char* path, u32 flags, CookedMesh* cooked)
+{
+	cooked->header = nullptr;
+	cooked->view = {};
+	if (!file_map(path, &cooked->file))
+	{
+		return false;
+	}
+
+	if (cooked->file.size < sizeof(RMeshHeader))
+	{
+		file_unmap(&cooked->file);
+		return false;
+	}
+
+	const RMeshHeader* header = (const RMeshHeader*)cooked->file.data;
+	const u64 vertexBytes = u64(header->vertexCount) * header->vertexStride;
+	const u64 indexBytes = u64(header->indexCount) * sizeof(u32);
+	const u64 submeshBytes = u64(header->submeshCount) * sizeof(Submesh);
+	const u64 materialBytes = u64(header->materialCount) * sizeof(MeshMaterial);
+
+	// The blobs follow the header in order and end in the file. Offsets are ordered and bounded by the file size first,
+	// so the sizes can be compared with differences instead of sums that a corrupt offset would wrap
+	const u64 fileSize = cooked->file.size;
+	bool32 valid =
+		header->magic == RMESH_MAGIC &&
+		header->version == RMESH_VERSION &&
+		header->flags == flags &&
+		header->vertexStride == sizeof(Vertex) &&
+		header->fileSize == fileSize &&
+		header->vertexOffset % RMESH_BLOB_ALIGNMENT == 0 &&
+		header->indexOffset % RMESH_BLOB_ALIGNMENT == 0 &&
+		header->submeshOffset % RMESH_BLOB_ALIGNMENT == 0 &&
+		header->materialOffset % RMESH_BLOB_ALIGNMENT == 0 &&
+		header->vertexOffset >= sizeof(RMeshHeader) &&
+		header->vertexOffset <= header->indexOffset &&
+		header->indexOffset <= header->submeshOffset &&
+		header->submeshOffset <= header->materialOffset &&
+		header->materialOffset <= fileSize &&
+		vertexBytes <= header->indexOffset - header->vertexOffset &&
+		indexBytes <= header->submeshOffset - header->indexOffset &&
+		submeshBytes <= header->materialOffset - header->submeshOffset &&
+		materialBytes <= fileSize - header->materialOffset;
+
+	const Submesh* submeshes = (const Submesh*)((const u8*)cooked->file.data + header->submeshOffset);
+	for (u32 i = 0; valid && i < header->submeshCount; i++)
+	{
+		valid = u64(submeshes[i].indexOffset) + submeshes[i].indexCount <= header->indexCount &&
+			(submeshes[i].material < header->materialCount || submeshes[i].material == MESH_NO_MATERIAL);
+	}
+
+	if (!valid)
+	{
+		file_unmap(&cooked->file);
+		return false;
+	}
+
+	const u8* base = (const u8*)cooked->file.data;
+	cooked->header = header;
+	cooked->view.vertices = (const Vertex*)(base + header->vertexOffset);
+	cooked->view.vertexCount = header->vertexCount;
+	cooked->view.indices = (const u32*)(base + header->indexOffset);
+	cooked->view.indexCount = header->indexCount;
+	cooked->view.submeshes = (const Submesh*)(base + header->submeshOffset);
+	cooked->view.submeshCount = header->submeshCount;
+	cooked->view.materials = (const MeshMaterial*)(base + header->materialOffset);
+	cooked->view.materialCount = header->materialCount;
+	cooked->view.bounds = header->bounds;
+
+	return true;
+}
+
+void rmesh_close(CookedMesh* cooked)
+{
+	file_unmap(&cooked->file);
+	cooked->header = nullptr;
+	cooked->view = {};
+}
+
+void meshAsset_load(MeshAsset* asset, const char* path, const char* cachePath, const MeshLoadSettings& settings, MeshLoadStats* stats)
+{
+	using Clock = std::chrono::high_resolution_clock;
+	Clock::time_point loadStart = Clock::now();
+
+	asset->fromCache = false;
+	asset->cooked.header = nullptr;
+	asset->cooked.file.data = nullptr;
+
+	FileVersion sourceVersion = {};
+	double hashSeconds = 0.0;
+	if (cachePath && file_version(path, &sourceVersion))
+	{
+		Clock::time_point mapStart = Clock::now();
+		asset->fromCache = rmesh_open(cachePath, meshCookFlags(settings), &asset->cooked);
+		if (asset->fromCache)
+		{
+			// Only hashes the source when its size or write time changed since the cook, or when asked to verify
+			Clock::time_point hashStart = Clock::now();
+			asset->fromCache = fileVersion_matches(asset->cooked.header->source, &sourceVersion, path, settings.verifySource);
+			hashSeconds = std::chrono::duration<double>(Clock::now() - hashStart).count();
+			if (!asset->fromCache)
+			{
+				rmesh_close(&asset->cooked);
+			}
+			else if (!fileVersion_sameStamp(asset->cooked.header->source, sourceVersion))
+			{
+				// Same content under a new write time, after a copy or a checkout: stamp the cook with it so the next load
+				// doesn't hash again. The file can't be written while it is mapped
+				rmesh_close(&asset->cooked);
+				file_writeAt(cachePath, offsetof(RMeshHeader, source), &sourceVersion, sizeof(sourceVersion));
+				asset->fromCache = rmesh_open(cachePath, meshCookFlags(settings), &asset->cooked);
+			}
+		}
+
+		if (asset->fromCache)
+		{
+			asset->view = asset->cooked.view;
+
+			if (stats)
+			{
+				*stats = {};
+				stats->threadCount = 1;
+				stats->indexCount = asset->view.indexCount;
+				stats->vertexCount = asset->view.vertexCount;
+				stats->cacheHit = true;
+				stats->hashSeconds = hashSeconds;
+				stats->cacheSeconds = std::chrono::duration<double>(Clock::now() - mapStart).count() - hashSeconds;
+				stats->totalSeconds = std::chrono::duration<double>(Clock::now() - loadStart).count();
+			}
+			return;
+		}
+	}
+
+	// Taken before parsing, so a source edited during the load leaves a cook that is already stale
+	if (cachePath && !sourceVersion.hash)
+	{
+		Clock::time_point hashStart = Clock::now();
+		sourceVersion.hash = file_hash(path);
+		hashSeconds += std::chrono::duration<double>(Clock::now() - hashStart).count();
+	}
+
+	MeshLoadSettings cookSettings = settings;
+	cookSettings.cachePath = cachePath;
+	cookSettings.sourceVersion = sourceVersion;
+	asset->mesh = loadMesh_fast(path, cookSettings, stats);
+	asset->view = meshView(asset->mesh);
+
+	if (stats)
+	{
+		stats->hashSeconds += hashSeconds;
+		stats->totalSeconds = std::chrono::duration<double>(Clock::now() - loadStart).count();
+	}
+}
+
+void meshAsset_release(MeshAsset* asset)
+{
+	if (asset->fromCache)
+	{
+		rmesh_close(&asset->cooked);
+	}
+	asset->mesh.vertices.clear();
+	asset->mesh.vertices.shrink_to_fit();
+	asset->mesh.indices.clear();
+	asset->mesh.indices.shrink_to_fit();
+	asset->mesh.submeshes.clear();
+	asset->mesh.materials.clear();
+	asset->view = {};
+}
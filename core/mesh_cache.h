@@ -0,0 +1,55 @@
+#pragma once
+
+#include "common.h"
+#include "glm.h"
+#include "model.h"
+#include "red_file.h"
+
+// Cooked mesh (.rmesh): header followed by aligned vertex, index, submesh and material blobs. Vertices and indices are ready to be copied to the GPU as is
+#define RMESH_MAGIC 0x48534D52u // "RMSH"
+#define RMESH_VERSION 5
+#define RMESH_BLOB_ALIGNMENT 64
+
+struct RMeshHeader
+{
+	u32 magic;
+	u32 version;
+	FileVersion source;
+	u64 fileSize;
+	u32 vertexStride;
+	u32 vertexCount;
+	u32 indexCount;
+	u32 flags; // meshCookFlags the mesh was cooked with
+	u64 vertexOffset;
+	u64 indexOffset;
+	u32 submeshCount;
+	u32 materialCount;
+	u64 submeshOffset;
+	u64 materialOffset;
+	MeshBounds bounds;
+};
+
+struct CookedMesh
+{
+	MappedFile file;
+	const RMeshHeader* header;
+	MeshView view;
+};
+
+bool32 rmesh_write(const char* path, const MeshView& mesh, const FileVersion& source, u32 flags);
+// Fails when the file is missing, corrupt, from another format version or cooked with different flags. Whether it is
+// stale is up to the caller, see fileVersion_matches with header->source
+bool32 rmesh_open(const char* path, u32 flags, CookedMesh* cooked);
+void rmesh_close(CookedMesh* cooked);
+
+// A mesh either loaded from its OBJ or mapped from its cooked cache. view is valid until meshAsset_release
+struct MeshAsset
+{
+	Mesh mesh;
+	CookedMesh cooked;
+	bool32 fromCache;
+	MeshView view;
+};
+
+void meshAsset_load(MeshAsset* asset, const char* path, const char* cachePath, const MeshLoadSettings& settings, MeshLoadStats* stats = nullptr);
+void meshAsset_release(MeshAsset* asset);
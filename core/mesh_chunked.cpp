@@ -0,0 +1,891 @@
+#include "common.h"
+#include "glm.h"
+
+#include "mesh_chunked.h"
+#include "mesh_attributes.h"
+#include "obj_stream.h"
+#include "obj_parse.h"
+#include "red_memory.h"
+
+#include <meshoptimizer.h>
+#include <chrono>
+#include <float.h>
+#include <math.h>
+
+using CookClock = std::chrono::high_resolution_clock;
+
+static inline double cook_secondsSince(CookClock::time_point start)
+{
+	return std::chrono::duration<double>(CookClock::now() - start).count();
+}
+
+#define MESH_COOK_WRITE_BUFFER_SIZE MEGABYTE
+// Minimum budget: the OBJ read buffer, the attribute writers and a few cells and chunk triangles
+#define MESH_COOK_MIN_BUDGET (16 * MEGABYTE)
+
+// Sequential writer with its own buffer; offset counts buffered bytes too
+struct CookWriter
+{
+	FILE* file;
+	vector<u8> buffer;
+	size_t used;
+	u64 offset;
+	bool32 failed;
+};
+
+static bool32 cookWriter_open(CookWriter* writer, const char* path, size_t bufferSize)
+{
+	writer->file = fopen(path, "wb");
+	writer->buffer.resize(bufferSize);
+	writer->used = 0;
+	writer->offset = 0;
+	writer->failed = writer->file == nullptr;
+	return !writer->failed;
+}
+
+static void cookWriter_flush(CookWriter* writer)
+{
+	if (writer->used)
+	{
+		writer->failed |= fwrite(writer->buffer.data(), 1, writer->used, writer->file) != writer->used;
+		writer->used = 0;
+	}
+}
+
+static void cookWriter_write(CookWriter* writer, const void* data, size_t size)
+{
+	if (writer->used + size > writer->buffer.size())
+	{
+		cookWriter_flush(writer);
+	}
+	// Writes larger than the buffer skip it
+	if (size > writer->buffer.size())
+	{
+		writer->failed |= fwrite(data, 1, size, writer->file) != size;
+	}
+	else
+	{
+		memcpy(writer->buffer.data() + writer->used, data, size);
+		writer->used += size;
+	}
+	writer->offset += size;
+}
+
+static void cookWriter_align(CookWriter* writer, u64 alignment)
+{
+	static const u8 zeroes[RCHUNK_BLOB_ALIGNMENT] = {};
+	assert(alignment <= RCHUNK_BLOB_ALIGNMENT);
+	u64 aligned = (writer->offset + alignment - 1) & ~(alignment - 1);
+	cookWriter_write(writer, zeroes, size_t(aligned - writer->offset));
+}
+
+static bool32 cookWriter_close(CookWriter* writer)
+{
+	if (writer->file)
+	{
+		cookWriter_flush(writer);
+		writer->failed |= fclose(writer->file) != 0;
+		writer->file = nullptr;
+	}
+	writer->buffer.clear();
+	writer->buffer.shrink_to_fit();
+	return !writer->failed;
+}
+
+// Pass 1: attributes to temporary files, counts and bounds
+struct CookAttributePass
+{
+	CookWriter positions;
+	CookWriter texCoords;
+	CookWriter normals;
+	// Including the zero element every attribute stream starts with, so index 0 means "not present"
+	u64 positionCount;
+	u64 texCoordCount;
+	u64 normalCount;
+	u64 faceCount;
+	u64 triangleCount;
+	bool32 usesMaterials;
+	float boundsMin[3];
+	float boundsMax[3];
+};
+
+static void cook_parseAttributes(CookAttributePass* pass, const char* text, const char* end)
+{
+	const char* p = text;
+	while (p < end)
+	{
+		p = obj_skipBlanks(p);
+		if (p[0] == 'v')
+		{
+			if (p[1] == ' ' || p[1] == '\t')
+			{
+				float xyz[3];
+				p = obj_parseFloat(p + 2, &xyz[0]);
+				p = obj_parseFloat(p, &xyz[1]);
+				p = obj_parseFloat(p, &xyz[2]);
+				cookWriter_write(&pass->positions, xyz, sizeof(xyz));
+				pass->positionCount++;
+				for (u32 axis = 0; axis < 3; axis++)
+				{
+					pass->boundsMin[axis] = xyz[axis] < pass->boundsMin[axis] ? xyz[axis] : pass->boundsMin[axis];
+					pass->boundsMax[axis] = xyz[axis] > pass->boundsMax[axis] ? xyz[axis] : pass->boundsMax[axis];
+				}
+			}
+			else if (p[1] == 't')
+			{
+				float uv[2];
+				p = obj_parseFloat(p + 2, &uv[0]);
+				p = obj_parseFloat(p, &uv[1]);
+				cookWriter_write(&pass->texCoords, uv, sizeof(uv));
+				pass->texCoordCount++;
+			}
+			else if (p[1] == 'n')
+			{
+				float xyz[3];
+				p = obj_parseFloat(p + 2, &xyz[0]);
+				p = obj_parseFloat(p, &xyz[1]);
+				p = obj_parseFloat(p, &xyz[2]);
+				cookWriter_write(&pass->normals, xyz, sizeof(xyz));
+				pass->normalCount++;
+			}
+		}
+		else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			u32 cornerCount = 0;
+			for (p = obj_skipBlanks(p + 2); obj_isDigit(*p) || *p == '-' || *p == '+'; p = obj_skipBlanks(p))
+			{
+				while (*p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+				{
+					p++;
+				}
+				cornerCount++;
+			}
+			if (cornerCount >= 3)
+			{
+				pass->faceCount++;
+				pass->triangleCount += cornerCount - 2;
+			}
+		}
+		else if (obj_skipKeyword(p, "usemtl"))
+		{
+			pass->usesMaterials = true;
+		}
+
+		p = obj_skipLine(p) + 1;
+	}
+}
+
+struct CookTriangle
+{
+	u32 position[3];
+	u32 texCoord[3];
+	u32 normal[3];
+};
+
+// Blocks of one cell are chained backwards through the bucket file, so only the last block of each cell is kept in memory
+struct CookBlockHeader
+{
+	u64 previousBlock;
+	u32 cell;
+	u32 triangleCount;
+};
+
+#define MESH_COOK_NO_BLOCK ~0ull
+#define MESH_COOK_BLOCK_TRIANGLES u32((MESH_COOK_BUCKET_BLOCK_SIZE - sizeof(CookBlockHeader)) / sizeof(CookTriangle))
+
+// Pass 2: triangles into cells
+struct CookBucketPass
+{
+	const float* positions;
+	u64 positionsSeen;
+	u64 texCoordsSeen;
+	u64 normalsSeen;
+	float gridOrigin[3];
+	float gridScale[3]; // cells per unit
+	u32 gridSize[3];
+	vector<CookTriangle> cellBuffers; // MESH_COOK_BLOCK_TRIANGLES per cell
+	vector<u32> cellBufferCounts;
+	vector<u64> cellLastBlocks;
+	vector<u64> cellTriangleCounts;
+	CookWriter bucket;
+};
+
+static void cook_flushCell(CookBucketPass* pass, u32 cell)
+{
+	CookBlockHeader header;
+	header.previousBlock = pass->cellLastBlocks[cell];
+	header.cell = cell;
+	header.triangleCount = pass->cellBufferCounts[cell];
+	pass->cellLastBlocks[cell] = pass->bucket.offset;
+	cookWriter_write(&pass->bucket, &header, sizeof(header));
+	cookWriter_write(&pass->bucket, &pass->cellBuffers[size_t(cell) * MESH_COOK_BLOCK_TRIANGLES], header.triangleCount * sizeof(CookTriangle));
+	pass->cellBufferCounts[cell] = 0;
+}
+
+static void cook_addTriangle(CookBucketPass* pass, const CookTriangle& triangle)
+{
+	// Past a billion and a half positions, index * 3 no longer fits in 32 bits
+	const float* corners[3] =
+	{
+		pass->positions + size_t(triangle.position[0]) * 3,
+		pass->positions + size_t(triangle.position[1]) * 3,
+		pass->positions + size_t(triangle.position[2]) * 3,
+	};
+	u32 cellCoordinates[3];
+	for (u32 axis = 0; axis < 3; axis++)
+	{
+		float centroid = (corners[0][axis] + corners[1][axis] + corners[2][axis]) * (1.0f / 3.0f);
+		float coordinate = (centroid - pass->gridOrigin[axis]) * pass->gridScale[axis];
+		cellCoordinates[axis] = coordinate <= 0.0f ? 0 : (coordinate >= float(pass->gridSize[axis] - 1) ? pass->gridSize[axis] - 1 : u32(coordinate));
+	}
+	u32 cell = (cellCoordinates[2] * pass->gridSize[1] + cellCoordinates[1]) * pass->gridSize[0] + cellCoordinates[0];
+
+	pass->cellBuffers[size_t(cell) * MESH_COOK_BLOCK_TRIANGLES + pass->cellBufferCounts[cell]] = triangle;
+	pass->cellTriangleCounts[cell]++;
+	if (++pass->cellBufferCounts[cell] == MESH_COOK_BLOCK_TRIANGLES)
+	{
+		cook_flushCell(pass, cell);
+	}
+}
+
+static void cook_parseFaces(CookBucketPass* pass, const char* text, const char* end)
+{
+	const char* p = text;
+	while (p < end)
+	{
+		p = obj_skipBlanks(p);
+		// Relative indices count the attributes declared so far
+		if (p[0] == 'v')
+		{
+			pass->positionsSeen += p[1] == ' ' || p[1] == '\t';
+			pass->texCoordsSeen += p[1] == 't';
+			pass->normalsSeen += p[1] == 'n';
+		}
+		else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			CookTriangle triangle;
+			u32 cornerCount = 0;
+			for (p = obj_skipBlanks(p + 2); obj_isDigit(*p) || *p == '-' || *p == '+'; p = obj_skipBlanks(p))
+			{
+				i32 pi = 0, ti = 0, ni = 0;
+				p = obj_parseInt(p, &pi);
+				if (*p == '/')
+				{
+					p++;
+					if (*p != '/')
+					{
+						p = obj_parseInt(p, &ti);
+					}
+					if (*p == '/')
+					{
+						p++;
+						p = obj_parseInt(p, &ni);
+					}
+				}
+
+				// Fan triangulation, same winding as the other loaders: corner 0 stays, corner 1 is the previous vertex
+				u32 corner = cornerCount < 2 ? cornerCount : 2;
+				triangle.position[corner] = obj_resolveIndex(pi, size_t(pass->positionsSeen));
+				triangle.texCoord[corner] = obj_resolveIndex(ti, size_t(pass->texCoordsSeen));
+				triangle.normal[corner] = obj_resolveIndex(ni, size_t(pass->normalsSeen));
+				if (cornerCount >= 2)
+				{
+					cook_addTriangle(pass, triangle);
+					triangle.position[1] = triangle.position[2];
+					triangle.texCoord[1] = triangle.texCoord[2];
+					triangle.normal[1] = triangle.normal[2];
+				}
+				cornerCount++;
+			}
+		}
+
+		p = obj_skipLine(p) + 1;
+	}
+}
+
+// Pass 3: one chunk from a run of triangles of the same cell
+struct CookChunkBuilder
+{
+	const float* positions;
+	const float* texCoords;
+	const float* normals;
+	u32 attributeFlags;
+	bool32 optimize;
+	// Reserved once for maxChunkTriangles and reused: never grow
+	vector<u32> slots;
+	vector<u32> vertexKeys; // position, texCoord, normal per vertex
+	vector<Vertex> vertices;
+	vector<Vertex> fetchedVertices;
+	vector<u32> indices;
+	vector<u32> remap;
+	CookWriter* output;
+	vector<RChunkEntry> chunks;
+	u64 vertexCount;
+	u64 indexCount;
+	glm::vec2 texCoordMin;
+	glm::vec2 texCoordMax;
+};
+
+static inline u32 cook_hashKey(u32 position, u32 texCoord, u32 normal)
+{
+	u32 hash = position * 0x9E3779B1u;
+	hash ^= texCoord * 0x85EBCA77u + (hash << 6) + (hash >> 2);
+	hash ^= normal * 0xC2B2AE3Du + (hash << 6) + (hash >> 2);
+	return hash ^ (hash >> 16);
+}
+
+static void cook_buildChunk(CookChunkBuilder* builder, const CookTriangle* triangles, u32 triangleCount, u32 cell)
+{
+	const u32 maxVertexCount = triangleCount * 3;
+	u32 slotCount = 1;
+	while (slotCount < maxVertexCount * 2)
+	{
+		slotCount *= 2;
+	}
+	const u32 mask = slotCount - 1;
+	builder->slots.assign(slotCount, ~0u);
+	builder->vertexKeys.clear();
+	builder->vertices.clear();
+	builder->indices.clear();
+
+	for (u32 i = 0; i < triangleCount; i++)
+	{
+		for (u32 corner = 0; corner < 3; corner++)
+		{
+			u32 position = triangles[i].position[corner];
+			u32 texCoord = triangles[i].texCoord[corner];
+			u32 normal = triangles[i].normal[corner];
+
+			u32 slot = cook_hashKey(position, texCoord, normal) & mask;
+			for (;; slot = (slot + 1) & mask)
+			{
+				u32 index = builder->slots[slot];
+				if (index == ~0u)
+				{
+					index = u32(builder->vertices.size());
+					builder->slots[slot] = index;
+					builder->vertexKeys.push_back(position);
+					builder->vertexKeys.push_back(texCoord);
+					builder->vertexKeys.push_back(normal);
+
+					const float* p = builder->positions + size_t(position) * 3;
+					const float* n = builder->normals + size_t(normal) * 3;
+					const float* t = builder->texCoords + size_t(texCoord) * 2;
+					Vertex v;
+					v.pos = { p[0], p[1], p[2] };
+					v.normal = { n[0], n[1], n[2] };
+					v.texCoord = { t[0], 1.0f - t[1] };
+					builder->vertices.push_back(v);
+					builder->texCoordMin = glm::min(builder->texCoordMin, v.texCoord);
+					builder->texCoordMax = glm::max(builder->texCoordMax, v.texCoord);
+					builder->indices.push_back(index);
+					break;
+				}
+				const u32* key = &builder->vertexKeys[index * 3];
+				if (key[0] == position && key[1] == texCoord && key[2] == normal)
+				{
+					builder->indices.push_back(index);
+					break;
+				}
+			}
+		}
+	}
+
+	u32 vertexCount = u32(builder->vertices.size());
+	const u32 indexCount = u32(builder->indices.size());
+	if (builder->optimize)
+	{
+		meshopt_optimizeVertexCache(builder->indices.data(), builder->indices.data(), indexCount, vertexCount);
+		builder->remap.resize(vertexCount);
+		vertexCount = u32(meshopt_optimizeVertexFetchRemap(builder->remap.data(), builder->indices.data(), indexCount, vertexCount));
+		meshopt_remapIndexBuffer(builder->indices.data(), builder->indices.data(), indexCount, builder->remap.data());
+		builder->fetchedVertices.resize(vertexCount);
+		meshopt_remapVertexBuffer(builder->fetchedVertices.data(), builder->vertices.data(), builder->vertices.size(), sizeof(Vertex), builder->remap.data());
+		builder->vertices.swap(builder->fetchedVertices);
+	}
+
+	RChunkEntry entry = {};
+	entry.vertexCount = vertexCount;
+	entry.cell = cell;
+	entry.submesh = { 0, indexCount, MESH_NO_MATERIAL };
+	// Every chunk gets bounds for streaming and culling. Generated normals only see the triangles of their chunk
+	computeMeshAttributes(builder->vertices.data(), vertexCount, builder->indices.data(), indexCount, builder->attributeFlags | MESH_ATTRIBUTE_BOUNDS_BIT,
+		meshSimd_supportedLevel(), &entry.bounds);
+
+	cookWriter_align(builder->output, RCHUNK_BLOB_ALIGNMENT);
+	entry.vertexOffset = builder->output->offset;
+	cookWriter_write(builder->output, builder->vertices.data(), vertexCount * sizeof(Vertex));
+	cookWriter_align(builder->output, RCHUNK_BLOB_ALIGNMENT);
+	entry.indexOffset = builder->output->offset;
+	cookWriter_write(builder->output, builder->indices.data(), indexCount * sizeof(u32));
+
+	builder->chunks.push_back(entry);
+	builder->vertexCount += vertexCount;
+	builder->indexCount += indexCount;
+}
+
+u32 meshCookSettings_flags(const MeshCookSettings& settings)
+{
+	return (settings.optimize ? MESH_OPTIMIZE_VERTEX_CACHE_BIT | MESH_OPTIMIZE_VERTEX_FETCH_BIT : 0) | (settings.attributeFlags << 8);
+}
+
+static u32 cook_gridSize(const float boundsMin[3], const float boundsMax[3], u32 targetCellCount, u32 maxCellCount, u32 gridSize[3])
+{
+	float extents[3];
+	float maxExtent = 0.0f;
+	for (u32 axis = 0; axis < 3; axis++)
+	{
+		extents[axis] = boundsMax[axis] - boundsMin[axis];
+		maxExtent = extents[axis] > maxExtent ? extents[axis] : maxExtent;
+	}
+	// Flat scans still get cubic-ish cells instead of a single layer of needles
+	for (float& extent : extents)
+	{
+		extent = extent > maxExtent * 1e-3f ? extent : (maxExtent > 0.0f ? maxExtent * 1e-3f : 1.0f);
+	}
+
+	float cellsPerUnit = cbrtf(float(targetCellCount) / (extents[0] * extents[1] * extents[2]));
+	for (u32 axis = 0; axis < 3; axis++)
+	{
+		float size = floorf(extents[axis] * cellsPerUnit + 0.5f);
+		gridSize[axis] = size < 1.0f ? 1 : (size > 1024.0f ? 1024 : u32(size));
+	}
+	while (u64(gridSize[0]) * gridSize[1] * gridSize[2] > maxCellCount)
+	{
+		u32 largest = gridSize[0] >= gridSize[1] ? (gridSize[0] >= gridSize[2] ? 0 : 2) : (gridSize[1] >= gridSize[2] ? 1 : 2);
+		gridSize[largest] = (gridSize[largest] + 1) / 2;
+	}
+
+	return gridSize[0] * gridSize[1] * gridSize[2];
+}
+
+bool32 cookMeshChunked(const char* path, const char* outputPath, const FileVersion& source, const MeshCookSettings& settings, MeshCookStats* stats)
+{
+	CookClock::time_point start = CookClock::now();
+	MeshCookStats localStats = {};
+
+	if (settings.memoryBudget < MESH_COOK_MIN_BUDGET)
+	{
+		printf("Mesh cook: a budget of %llu bytes is below the %llu bytes minimum\n", settings.memoryBudget, u64(MESH_COOK_MIN_BUDGET));
+		return false;
+	}
+
+	// Half the budget for the cell write buffers, the rest for one chunk at a time
+	const u64 readBufferBytes = OBJ_STREAM_CHUNK_SIZE + 1;
+	const u32 maxCellCount = u32((settings.memoryBudget / 2) / (MESH_COOK_BUCKET_BLOCK_SIZE + 3 * sizeof(u64)));
+	const u64 chunkBudget = settings.memoryBudget - settings.memoryBudget / 2 - readBufferBytes;
+	const u32 maxChunkTriangles = u32(chunkBudget / MESH_COOK_BYTES_PER_TRIANGLE);
+	localStats.maxChunkTriangles = maxChunkTriangles;
+
+	const string positionsPath = string(outputPath) + ".positions.tmp";
+	const string texCoordsPath = string(outputPath) + ".texcoords.tmp";
+	const string normalsPath = string(outputPath) + ".normals.tmp";
+	const string bucketPath = string(outputPath) + ".bucket.tmp";
+	auto removeTemporaryFiles = [&]()
+	{
+		remove(positionsPath.c_str());
+		remove(texCoordsPath.c_str());
+		remove(normalsPath.c_str());
+		remove(bucketPath.c_str());
+	};
+
+	// Pass 1
+	CookClock::time_point attributeStart = CookClock::now();
+	CookAttributePass attributePass = {};
+	bool32 success = cookWriter_open(&attributePass.positions, positionsPath.c_str(), MESH_COOK_WRITE_BUFFER_SIZE);
+	success = cookWriter_open(&attributePass.texCoords, texCoordsPath.c_str(), MESH_COOK_WRITE_BUFFER_SIZE) && success;
+	success = cookWriter_open(&attributePass.normals, normalsPath.c_str(), MESH_COOK_WRITE_BUFFER_SIZE) && success;
+	const float zeroes[3] = {};
+	cookWriter_write(&attributePass.positions, zeroes, 3 * sizeof(float));
+	cookWriter_write(&attributePass.texCoords, zeroes, 2 * sizeof(float));
+	cookWriter_write(&attributePass.normals, zeroes, 3 * sizeof(float));
+	attributePass.positionCount = attributePass.texCoordCount = attributePass.normalCount = 1;
+	for (u32 axis = 0; axis < 3; axis++)
+	{
+		attributePass.boundsMin[axis] = FLT_MAX;
+		attributePass.boundsMax[axis] = -FLT_MAX;
+	}
+
+	success = success && obj_forEachLines(path, [&](const char* text, const char* end)
+	{
+		cook_parseAttributes(&attributePass, text, end);
+	});
+	localStats.peakWorkingBytes = readBufferBytes + 3 * MESH_COOK_WRITE_BUFFER_SIZE;
+	success = cookWriter_close(&attributePass.positions) && success;
+	success = cookWriter_close(&attributePass.texCoords) && success;
+	success = cookWriter_close(&attributePass.normals) && success;
+	localStats.faceCount = attributePass.faceCount;
+	localStats.triangleCount = attributePass.triangleCount;
+	localStats.attributeSeconds = cook_secondsSince(attributeStart);
+
+	MappedFile positionsFile = {};
+	MappedFile texCoordsFile = {};
+	MappedFile normalsFile = {};
+	if (success && attributePass.usesMaterials)
+	{
+		printf("Mesh cook: %s assigns materials with usemtl, which chunked meshes can't keep. Load it with meshAsset_load instead\n", path);
+		success = false;
+	}
+	success = success && attributePass.triangleCount > 0;
+	success = success && file_map(positionsPath.c_str(), &positionsFile);
+	success = success && file_map(texCoordsPath.c_str(), &texCoordsFile);
+	success = success && file_map(normalsPath.c_str(), &normalsFile);
+	if (!success)
+	{
+		file_unmap(&positionsFile);
+		file_unmap(&texCoordsFile);
+		file_unmap(&normalsFile);
+		removeTemporaryFiles();
+		return false;
+	}
+
+	// Pass 2: cells average half a chunk, so most of them fit in one
+	CookClock::time_point bucketStart = CookClock::now();
+	CookBucketPass bucketPass = {};
+	bucketPass.positions = (const float*)positionsFile.data;
+	bucketPass.positionsSeen = bucketPass.texCoordsSeen = bucketPass.normalsSeen = 1;
+	const u64 targetCellCount = (attributePass.triangleCount * 2 + maxChunkTriangles - 1) / maxChunkTriangles;
+	const u32 cellCount = cook_gridSize(attributePass.boundsMin, attributePass.boundsMax, u32(targetCellCount < maxCellCount ? targetCellCount : maxCellCount), maxCellCount, bucketPass.gridSize);
+	for (u32 axis = 0; axis < 3; axis++)
+	{
+		float extent = attributePass.boundsMax[axis] - attributePass.boundsMin[axis];
+		bucketPass.gridOrigin[axis] = attributePass.boundsMin[axis];
+		bucketPass.gridScale[axis] = extent > 0.0f ? float(bucketPass.gridSize[axis]) / extent : 0.0f;
+	}
+	bucketPass.cellBuffers.resize(size_t(cellCount) * MESH_COOK_BLOCK_TRIANGLES);
+	bucketPass.cellBufferCounts.assign(cellCount, 0);
+	bucketPass.cellLastBlocks.assign(cellCount, MESH_COOK_NO_BLOCK);
+	bucketPass.cellTriangleCounts.assign(cellCount, 0);
+	localStats.cellCount = cellCount;
+
+	// Blocks are written whole: the writer needs no buffer of its own
+	success = cookWriter_open(&bucketPass.bucket, bucketPath.c_str(), 0);
+	success = success && obj_forEachLines(path, [&](const char* text, const char* end)
+	{
+		cook_parseFaces(&bucketPass, text, end);
+	});
+	for (u32 cell = 0; success && cell < cellCount; cell++)
+	{
+		if (bucketPass.cellBufferCounts[cell])
+		{
+			cook_flushCell(&bucketPass, cell);
+		}
+	}
+	success = cookWriter_close(&bucketPass.bucket) && success;
+	const u64 bucketBytes = readBufferBytes + CONTAINER_BYTES(bucketPass.cellBuffers) + CONTAINER_BYTES(bucketPass.cellBufferCounts) +
+		CONTAINER_BYTES(bucketPass.cellLastBlocks) + CONTAINER_BYTES(bucketPass.cellTriangleCounts);
+	localStats.peakWorkingBytes = bucketBytes > localStats.peakWorkingBytes ? bucketBytes : localStats.peakWorkingBytes;
+	bucketPass.cellBuffers.clear();
+	bucketPass.cellBuffers.shrink_to_fit();
+	localStats.bucketSeconds = cook_secondsSince(bucketStart);
+
+	// Pass 3
+	CookClock::time_point chunkStart = CookClock::now();
+	FILE* bucketFile = success ? fopen(bucketPath.c_str(), "rb") : nullptr;
+	CookWriter output = {};
+	success = bucketFile && cookWriter_open(&output, outputPath, MESH_COOK_WRITE_BUFFER_SIZE);
+	if (!success)
+	{
+		if (bucketFile)
+		{
+			fclose(bucketFile);
+		}
+		cookWriter_close(&output);
+		file_unmap(&positionsFile);
+		file_unmap(&texCoordsFile);
+		file_unmap(&normalsFile);
+		removeTemporaryFiles();
+		return false;
+	}
+
+	RChunkHeader header = {};
+	// The header goes in last, as in rmesh_write
+	cookWriter_write(&output, &header, sizeof(header));
+
+	CookChunkBuilder builder = {};
+	builder.positions = (const float*)positionsFile.data;
+	builder.texCoords = (const float*)texCoordsFile.data;
+	builder.normals = (const float*)normalsFile.data;
+	builder.attributeFlags = settings.attributeFlags | (attributePass.normalCount > 1 ? 0 : MESH_ATTRIBUTE_NORMALS_BIT);
+	builder.optimize = settings.optimize;
+	builder.output = &output;
+	builder.texCoordMin = glm::vec2(FLT_MAX);
+	builder.texCoordMax = glm::vec2(-FLT_MAX);
+
+	const u64 chunkTriangles = attributePass.triangleCount < maxChunkTriangles ? attributePass.triangleCount : maxChunkTriangles;
+	u32 slotCount = 1;
+	while (slotCount < chunkTriangles * 6)
+	{
+		slotCount *= 2;
+	}
+	vector<CookTriangle> slice;
+	slice.reserve(chunkTriangles);
+	builder.slots.reserve(slotCount);
+	builder.vertexKeys.reserve(chunkTriangles * 9);
+	builder.vertices.reserve(chunkTriangles * 3);
+	builder.indices.reserve(chunkTriangles * 3);
+	if (settings.optimize)
+	{
+		builder.fetchedVertices.reserve(chunkTriangles * 3);
+		builder.remap.reserve(chunkTriangles * 3);
+	}
+
+	vector<u64> cellBlocks;
+	for (u32 cell = 0; success && cell < cellCount; cell++)
+	{
+		cellBlocks.clear();
+		for (u64 block = bucketPass.cellLastBlocks[cell]; block != MESH_COOK_NO_BLOCK;)
+		{
+			cellBlocks.push_back(block);
+			CookBlockHeader blockHeader;
+			success = success && file_seek(bucketFile, i64(block), SEEK_SET) == 0 && fread(&blockHeader, sizeof(blockHeader), 1, bucketFile) == 1;
+			block = success ? blockHeader.previousBlock : MESH_COOK_NO_BLOCK;
+		}
+
+		// Oldest block first keeps the file order of the triangles inside a cell
+		slice.clear();
+		for (size_t i = cellBlocks.size(); success && i-- > 0;)
+		{
+			CookBlockHeader blockHeader;
+			success = file_seek(bucketFile, i64(cellBlocks[i]), SEEK_SET) == 0 && fread(&blockHeader, sizeof(blockHeader), 1, bucketFile) == 1;
+			u32 remaining = success ? blockHeader.triangleCount : 0;
+			while (success && remaining)
+			{
+				size_t used = slice.size();
+				u32 take = u32(chunkTriangles - used) < remaining ? u32(chunkTriangles - used) : remaining;
+				slice.resize(used + take);
+				success = success && fread(&slice[used], sizeof(CookTriangle), take, bucketFile) == take;
+				remaining -= take;
+				if (slice.size() == chunkTriangles)
+				{
+					cook_buildChunk(&builder, slice.data(), u32(slice.size()), cell);
+					slice.clear();
+				}
+			}
+		}
+		if (success && !slice.empty())
+		{
+			cook_buildChunk(&builder, slice.data(), u32(slice.size()), cell);
+		}
+	}
+	if (bucketFile)
+	{
+		fclose(bucketFile);
+	}
+
+	// meshopt and the attribute kernel allocate their own scratch, estimated from the largest possible chunk
+	const u64 chunkScratchBytes = chunkTriangles * 3 * (14 * sizeof(float) + 4 * sizeof(u32));
+	const u64 chunkBytes = CONTAINER_BYTES(slice) + CONTAINER_BYTES(builder.slots) + CONTAINER_BYTES(builder.vertexKeys) + CONTAINER_BYTES(builder.vertices) +
+		CONTAINER_BYTES(builder.fetchedVertices) + CONTAINER_BYTES(builder.indices) + CONTAINER_BYTES(builder.remap) + CONTAINER_BYTES(builder.chunks) +
+		CONTAINER_BYTES(cellBlocks) + CONTAINER_BYTES(bucketPass.cellLastBlocks) + MESH_COOK_WRITE_BUFFER_SIZE + chunkScratchBytes;
+	localStats.peakWorkingBytes = chunkBytes > localStats.peakWorkingBytes ? chunkBytes : localStats.peakWorkingBytes;
+
+	// Chunk spheres around the box center of the whole mesh keep the sphere conservative
+	MeshBounds bounds;
+	bounds.min = glm::vec3(attributePass.boundsMin[0], attributePass.boundsMin[1], attributePass.boundsMin[2]);
+	bounds.max = glm::vec3(attributePass.boundsMax[0], attributePass.boundsMax[1], attributePass.boundsMax[2]);
+	bounds.center = (bounds.min + bounds.max) * 0.5f;
+	bounds.radius = 0.0f;
+	for (const RChunkEntry& chunk : builder.chunks)
+	{
+		float radius = glm::length(chunk.bounds.center - bounds.center) + chunk.bounds.radius;
+		bounds.radius = radius > bounds.radius ? radius : bounds.radius;
+	}
+
+	cookWriter_align(&output, RCHUNK_BLOB_ALIGNMENT);
+	header.magic = RCHUNK_MAGIC;
+	header.version = RCHUNK_VERSION;
+	header.source = source;
+	header.vertexStride = sizeof(Vertex);
+	header.flags = meshCookSettings_flags(settings);
+	header.chunkCount = u32(builder.chunks.size());
+	header.cellCount = cellCount;
+	header.chunkTableOffset = output.offset;
+	header.vertexCount = builder.vertexCount;
+	header.indexCount = builder.indexCount;
+	header.bounds = bounds;
+	header.texCoordMin = builder.texCoordMin;
+	header.texCoordMax = builder.texCoordMax;
+	cookWriter_write(&output, builder.chunks.data(), CONTAINER_BYTES(builder.chunks));
+	header.fileSize = output.offset;
+	if (output.file)
+	{
+		cookWriter_flush(&output);
+		output.failed |= fseek(output.file, 0, SEEK_SET) != 0;
+		output.failed |= fwrite(&header, sizeof(header), 1, output.file) != 1;
+	}
+	success = cookWriter_close(&output) && success;
+
+	file_unmap(&positionsFile);
+	file_unmap(&texCoordsFile);
+	file_unmap(&normalsFile);
+	removeTemporaryFiles();
+	if (!success)
+	{
+		remove(outputPath);
+		return false;
+	}
+
+	localStats.chunkCount = header.chunkCount;
+	localStats.vertexCount = header.vertexCount;
+	localStats.chunkSeconds = cook_secondsSince(chunkStart);
+	localStats.totalSeconds = cook_secondsSince(start);
+	localStats.peakResidentBytes = process_peakResidentBytes();
+	if (stats)
+	{
+		*stats = localStats;
+	}
+
+	return true;
+}
+
+void printMeshCookStats(const char* path, const MeshCookStats& stats)
+{
+	printf("Chunked cook %s\n", path);
+	printf("\tFaces: %llu, triangles: %llu, vertices: %llu\n", stats.faceCount, stats.triangleCount, stats.vertexCount);
+	printf("\tCells: %u, chunks: %u, at most %u triangles per chunk\n", stats.cellCount, stats.chunkCount, stats.maxChunkTriangles);
+	printf("\tAttributes pass: %.3f ms\n", stats.attributeSeconds * 1000.0);
+	printf("\tBucket pass: %.3f ms\n", stats.bucketSeconds * 1000.0);
+	printf("\tChunk pass: %.3f ms\n", stats.chunkSeconds * 1000.0);
+	printf("\tPeak cook memory: %.2f MiB\n", double(stats.peakWorkingBytes) / (1024.0 * 1024.0));
+	printf("\tPeak process resident memory: %.2f MiB\n", double(stats.peakResidentBytes) / (1024.0 * 1024.0));
+	printf("\tTotal: %.3f ms\n", stats.totalSeconds * 1000.0);
+}
+
+bool32 rchunk_open(const char* path, u32 flags, ChunkedMesh* mesh)
+{
+	mesh->header = nullptr;
+	mesh->chunks = nullptr;
+	if (!file_map(path, &mesh->file))
+	{
+		return false;
+	}
+
+	// As in rmesh_open, offsets are ordered and bounded by the file size before sizes are compared with their differences,
+	// so a corrupt offset can't wrap a sum. Chunks must add up to the header counts, which size the whole mesh
+	const RChunkHeader* header = (const RChunkHeader*)mesh->file.data;
+	const u64 fileSize = mesh->file.size;
+	bool32 valid = fileSize >= sizeof(RChunkHeader);
+	valid = valid &&
+		header->magic == RCHUNK_MAGIC &&
+		header->version == RCHUNK_VERSION &&
+		header->flags == flags &&
+		header->vertexStride == sizeof(Vertex) &&
+		header->fileSize == fileSize &&
+		header->vertexCount <= UINT32_MAX &&
+		header->indexCount <= UINT32_MAX &&
+		header->chunkTableOffset % RCHUNK_BLOB_ALIGNMENT == 0 &&
+		header->chunkTableOffset >= sizeof(RChunkHeader) &&
+		header->chunkTableOffset <= fileSize &&
+		u64(header->chunkCount) * sizeof(RChunkEntry) <= fileSize - header->chunkTableOffset;
+
+	const RChunkEntry* chunks = valid ? (const RChunkEntry*)((const u8*)mesh->file.data + header->chunkTableOffset) : nullptr;
+	u64 vertexCount = 0;
+	u64 indexCount = 0;
+	for (u32 i = 0; valid && i < header->chunkCount; i++)
+	{
+		const RChunkEntry& chunk = chunks[i];
+		valid = chunk.vertexOffset % RCHUNK_BLOB_ALIGNMENT == 0 &&
+			chunk.indexOffset % RCHUNK_BLOB_ALIGNMENT == 0 &&
+			chunk.vertexOffset >= sizeof(RChunkHeader) &&
+			chunk.vertexOffset <= chunk.indexOffset &&
+			chunk.indexOffset <= header->chunkTableOffset &&
+			u64(chunk.vertexCount) * sizeof(Vertex) <= chunk.indexOffset - chunk.vertexOffset &&
+			u64(chunk.submesh.indexCount) * sizeof(u32) <= header->chunkTableOffset - chunk.indexOffset &&
+			chunk.submesh.indexOffset == 0;
+		vertexCount += chunk.vertexCount;
+		indexCount += chunk.submesh.indexCount;
+	}
+	valid = valid && vertexCount == header->vertexCount && indexCount == header->indexCount;
+
+	if (!valid)
+	{
+		file_unmap(&mesh->file);
+		return false;
+	}
+
+	mesh->header = header;
+	mesh->chunks = chunks;
+	mesh->submesh = { 0, u32(header->indexCount), MESH_NO_MATERIAL };
+
+	return true;
+}
+
+void rchunk_close(ChunkedMesh* mesh)
+{
+	file_unmap(&mesh->file);
+	mesh->header = nullptr;
+	mesh->chunks = nullptr;
+}
+
+MeshView rchunk_chunkView(const ChunkedMesh& mesh, u32 chunk)
+{
+	assert(chunk < mesh.header->chunkCount);
+	const RChunkEntry& entry = mesh.chunks[chunk];
+	const u8* base = (const u8*)mesh.file.data;
+
+	MeshView view = {};
+	view.vertices = (const Vertex*)(base + entry.vertexOffset);
+	view.vertexCount = entry.vertexCount;
+	view.indices = (const u32*)(base + entry.indexOffset);
+	view.indexCount = entry.submesh.indexCount;
+	view.submeshes = &entry.submesh;
+	view.submeshCount = 1;
+	view.bounds = entry.bounds;
+
+	return view;
+}
+
+void rchunk_releaseChunk(const ChunkedMesh& mesh, u32 chunk)
+{
+	assert(chunk < mesh.header->chunkCount);
+	const RChunkEntry& entry = mesh.chunks[chunk];
+	file_releasePages(mesh.file, entry.vertexOffset, entry.indexOffset + u64(entry.submesh.indexCount) * sizeof(u32) - entry.vertexOffset);
+}
+
+MeshView chunkedMesh_view(const ChunkedMesh& mesh)
+{
+	MeshView view = {};
+	view.vertexCount = u32(mesh.header->vertexCount);
+	view.indexCount = u32(mesh.header->indexCount);
+	view.submeshes = &mesh.submesh;
+	view.submeshCount = 1;
+	view.bounds = mesh.header->bounds;
+
+	return view;
+}
+
+bool32 chunkedMesh_load(ChunkedMesh* mesh, const char* path, const char* chunkedPath, const MeshCookSettings& settings, MeshCookStats* stats)
+{
+	const u32 flags = meshCookSettings_flags(settings);
+	FileVersion sourceVersion;
+	if (!file_version(path, &sourceVersion))
+	{
+		return false;
+	}
+
+	// The source is only hashed when its size or write time changed since the cook, or when asked to verify
+	bool32 cached = rchunk_open(chunkedPath, flags, mesh);
+	if (cached && !fileVersion_matches(mesh->header->source, &sourceVersion, path, settings.verifySource))
+	{
+		rchunk_close(mesh);
+		cached = false;
+	}
+	else if (cached && !fileVersion_sameStamp(mesh->header->source, sourceVersion))
+	{
+		// Same content under a new write time: stamp the cook with it so the next load doesn't hash again
+		rchunk_close(mesh);
+		file_writeAt(chunkedPath, offsetof(RChunkHeader, source), &sourceVersion, sizeof(sourceVersion));
+		cached = rchunk_open(chunkedPath, flags, mesh);
+	}
+	if (!cached)
+	{
+		sourceVersion.hash = sourceVersion.hash ? sourceVersion.hash : file_hash(path);
+		if (sourceVersion.hash == 0 || !cookMeshChunked(path, chunkedPath, sourceVersion, settings, stats) || !rchunk_open(chunkedPath, flags, mesh))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "common.h"
+#include "glm.h"
+#include "model.h"
+#include "mesh_cache.h"
+#include "red_file.h"
+
+/*
+Out-of-core cooking for OBJ files that don't fit in memory. The OBJ is streamed three times:
+1. vertex attributes go to temporary files and the bounds are measured
+2. triangles are sorted into a uniform grid of cells, in chained blocks of a temporary bucket file
+3. cell by cell, runs of at most maxChunkTriangles are deduplicated, optimized and appended to the chunked file
+Attributes are read back through memory mapped temporary files: those pages belong to the OS file cache and are evicted
+under pressure, the memory budget bounds everything the cook allocates.
+*/
+
+// Chunked cooked mesh (.rchunks): header, per chunk aligned vertex and index blobs, then the chunk table
+#define RCHUNK_MAGIC 0x4B434D52u // "RMCK"
+#define RCHUNK_VERSION 3
+#define RCHUNK_BLOB_ALIGNMENT 64
+
+// Working memory per chunk triangle, worst case of three unique vertices per triangle: triangle records, vertex table,
+// vertices and their fetch-optimized copy, indices, meshopt scratch and the attribute kernel streams
+#define MESH_COOK_BYTES_PER_TRIANGLE 640
+// Per cell write buffer of the bucket pass
+#define MESH_COOK_BUCKET_BLOCK_SIZE (64 * KILOBYTE)
+
+struct RChunkHeader
+{
+	u32 magic;
+	u32 version;
+	FileVersion source;
+	u64 fileSize;
+	u32 vertexStride;
+	u32 flags; // meshCookFlags the mesh was cooked with
+	u32 chunkCount;
+	u32 cellCount;
+	u64 chunkTableOffset;
+	u64 vertexCount;
+	u64 indexCount;
+	MeshBounds bounds;
+	// Of the chunk vertices, so they can be quantized chunk by chunk as packMesh would quantize the whole mesh
+	glm::vec2 texCoordMin;
+	glm::vec2 texCoordMax;
+};
+
+// Indices are local to the chunk vertices
+struct RChunkEntry
+{
+	u64 vertexOffset;
+	u64 indexOffset;
+	u32 vertexCount;
+	u32 cell;
+	Submesh submesh; // The whole chunk, so a chunk view can be drawn like any mesh
+	MeshBounds bounds;
+};
+
+struct MeshCookSettings
+{
+	// Bytes the cook may allocate at once, whatever the input size
+	u64 memoryBudget;
+	u32 attributeFlags; // MeshAttributeFlagBits
+	bool32 optimize; // Vertex cache and vertex fetch order per chunk
+	bool32 verifySource; // Hash the source on every load instead of trusting an unchanged size and write time
+};
+
+struct MeshCookStats
+{
+	u64 faceCount;
+	u64 triangleCount;
+	u64 vertexCount;
+	u32 cellCount;
+	u32 chunkCount;
+	u32 maxChunkTriangles;
+	u64 peakWorkingBytes;
+	u64 peakResidentBytes;
+	double attributeSeconds;
+	double bucketSeconds;
+	double chunkSeconds;
+	double totalSeconds;
+};
+
+struct ChunkedMesh
+{
+	MappedFile file;
+	const RChunkHeader* header;
+	const RChunkEntry* chunks;
+	Submesh submesh; // Every chunk, one after the other in file order
+};
+
+// False if the file can't be read, assigns materials (chunks have none) or the budget is too small to hold the bucket pass and one chunk
+bool32 cookMeshChunked(const char* path, const char* outputPath, const FileVersion& source, const MeshCookSettings& settings, MeshCookStats* stats = nullptr);
+void printMeshCookStats(const char* path, const MeshCookStats& stats);
+u32 meshCookSettings_flags(const MeshCookSettings& settings);
+
+// Fails when the file is missing, corrupt, from another format version or cooked with different flags. Whether it is
+// stale is up to the caller, see fileVersion_matches with header->source
+bool32 rchunk_open(const char* path, u32 flags, ChunkedMesh* mesh);
+void rchunk_close(ChunkedMesh* mesh);
+// Points into the mapped file: only the pages of the chunks that are used get loaded
+MeshView rchunk_chunkView(const ChunkedMesh& mesh, u32 chunk);
+// Drops the pages of a chunk that has been consumed, so streaming through the chunks doesn't leave the file resident
+void rchunk_releaseChunk(const ChunkedMesh& mesh, u32 chunk);
+
+// Opens the chunked cook of path, cooking it into chunkedPath first if it is missing or stale. Nothing is read yet:
+// chunks are consumed one at a time with rchunk_chunkView and rchunk_releaseChunk. stats is only written by a cook
+bool32 chunkedMesh_load(ChunkedMesh* mesh, const char* path, const char* chunkedPath, const MeshCookSettings& settings, MeshCookStats* stats = nullptr);
+// The chunks concatenated in file order as a single submesh, indices rebased: sizes, bounds and draws, but no vertex
+// or index data to read
+MeshView chunkedMesh_view(const ChunkedMesh& mesh);
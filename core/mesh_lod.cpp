@@ -0,0 +1,223 @@
+#include "common.h"
+#include "glm.h"
+
+#include "mesh_lod.h"
+
+#include <meshoptimizer.h>
+#include <float.h>
+
+MeshLodSettings meshLodSettings_default()
+{
+	MeshLodSettings settings = {};
+	settings.levelCount = 5;
+	settings.triangleRatio = 0.5f;
+	const float targetErrors[] = { 0.0f, 0.005f, 0.01f, 0.02f, 0.04f, 0.08f, 0.16f, 0.32f };
+	static_assert(ARRAYSIZE(targetErrors) == MAX_MESH_LODS, "One target error per level");
+	memcpy(settings.targetErrors, targetErrors, sizeof(targetErrors));
+
+	return settings;
+}
+
+void buildMeshLods(const MeshView& mesh, const MeshLodSettings& settings, MeshLodChain* chain)
+{
+	assert(settings.levelCount >= 1 && settings.levelCount <= MAX_MESH_LODS);
+	const float* positions = &mesh.vertices[0].pos.x;
+	const u32 submeshCount = mesh.submeshCount;
+
+	chain->indices.assign(mesh.indices, mesh.indices + mesh.indexCount);
+	chain->submeshes.assign(mesh.submeshes, mesh.submeshes + submeshCount);
+	chain->submeshCount = submeshCount;
+	chain->levels[0] = { 0, mesh.indexCount, 0.0f };
+	chain->levelCount = 1;
+
+	glm::vec3 minPos = mesh.vertices[0].pos;
+	glm::vec3 maxPos = mesh.vertices[0].pos;
+	for (u32 i = 1; i < mesh.vertexCount; i++)
+	{
+		minPos = glm::min(minPos, mesh.vertices[i].pos);
+		maxPos = glm::max(maxPos, mesh.vertices[i].pos);
+	}
+	chain->center = (minPos + maxPos) * 0.5f;
+	chain->radius = glm::length(maxPos - minPos) * 0.5f;
+
+	// meshopt reports errors relative to the mesh extents
+	const float errorScale = meshopt_simplifyScale(positions, mesh.vertexCount, sizeof(Vertex));
+
+	vector<u32> lodIndices;
+	vector<Submesh> lodSubmeshes(submeshCount);
+	float ratio = 1.0f;
+	for (u32 level = 1; level < settings.levelCount; level++)
+	{
+		ratio *= settings.triangleRatio;
+		lodIndices.clear();
+		float levelError = 0.0f;
+
+		// Each submesh is simplified on its own so materials never bleed into each other
+		for (u32 s = 0; s < submeshCount; s++)
+		{
+			const Submesh& submesh = mesh.submeshes[s];
+			const u32* sourceIndices = mesh.indices + submesh.indexOffset;
+			const size_t targetIndexCount = size_t(float(submesh.indexCount / 3) * ratio) * 3;
+			const size_t lodOffset = lodIndices.size();
+			lodIndices.resize(lodOffset + submesh.indexCount);
+
+			// Always simplify the full detail mesh, so errors don't accumulate from level to level
+			float resultError = 0.0f;
+			size_t indexCount = meshopt_simplify(&lodIndices[lodOffset], sourceIndices, submesh.indexCount, positions, mesh.vertexCount, sizeof(Vertex),
+				targetIndexCount, settings.targetErrors[level], 0, &resultError);
+
+			// Small parts collapse completely: keep the previous level rather than dropping the material
+			if (indexCount == 0)
+			{
+				const Submesh& previous = chain->submeshes[(level - 1) * submeshCount + s];
+				const u32* previousIndices = &chain->indices[chain->levels[level - 1].indexOffset + previous.indexOffset];
+				memcpy(&lodIndices[lodOffset], previousIndices, previous.indexCount * sizeof(u32));
+				indexCount = previous.indexCount;
+			}
+			else
+			{
+				meshopt_optimizeVertexCache(&lodIndices[lodOffset], &lodIndices[lodOffset], indexCount, mesh.vertexCount);
+				levelError = glm::max(levelError, resultError);
+			}
+
+			lodIndices.resize(lodOffset + indexCount);
+			lodSubmeshes[s] = { u32(lodOffset), u32(indexCount), submesh.material };
+		}
+
+		const MeshLod& previous = chain->levels[level - 1];
+		// Error bound hit: this level would barely be cheaper than the previous one
+		if (lodIndices.size() > previous.indexCount * 9 / 10)
+		{
+			break;
+		}
+
+		MeshLod& lod = chain->levels[level];
+		lod.indexOffset = u32(chain->indices.size());
+		lod.indexCount = u32(lodIndices.size());
+		lod.error = glm::max(levelError * errorScale, previous.error);
+
+		chain->indices.insert(chain->indices.end(), lodIndices.begin(), lodIndices.end());
+		chain->submeshes.insert(chain->submeshes.end(), lodSubmeshes.begin(), lodSubmeshes.end());
+		chain->levelCount++;
+	}
+}
+
+MeshView meshLodView(const MeshView& mesh, const MeshLodChain& chain, u32 level)
+{
+	MeshView view = mesh;
+	view.indices = &chain.indices[chain.levels[level].indexOffset];
+	view.indexCount = chain.levels[level].indexCount;
+	view.submeshes = &chain.submeshes[level * chain.submeshCount];
+
+	return view;
+}
+
+void printMeshLodChain(const MeshLodChain& chain)
+{
+	printf("LOD chain: %u levels\n", chain.levelCount);
+	for (u32 level = 0; level < chain.levelCount; level++)
+	{
+		const MeshLod& lod = chain.levels[level];
+		printf("\tLOD %u: %u triangles (%.1f%%), error %f\n", level, lod.indexCount / 3, 100.0 * lod.indexCount / chain.levels[0].indexCount, lod.error);
+	}
+}
+
+MeshLodView meshLodCamera(const UniformBufferObject& ubo, float viewportHeight)
+{
+	MeshLodView view;
+	glm::mat4 viewInverse = glm::inverse(ubo.view);
+	view.cameraPosition = glm::vec3(viewInverse[3].x, viewInverse[3].y, viewInverse[3].z);
+	// proj[1][1] is cot(fovy / 2); its sign is flipped to render upside up
+	view.pixelsPerUnit = fabsf(ubo.proj[1][1]) * 0.5f * viewportHeight;
+
+	return view;
+}
+
+float meshLod_projectedError(const MeshLodChain& chain, u32 level, const MeshLodView& view, const glm::mat4& model)
+{
+	glm::vec4 center = model * glm::vec4(chain.center, 1.0f);
+	float scale = glm::max(glm::length(glm::vec3(model[0].x, model[0].y, model[0].z)),
+		glm::max(glm::length(glm::vec3(model[1].x, model[1].y, model[1].z)), glm::length(glm::vec3(model[2].x, model[2].y, model[2].z))));
+
+	// Distance to the closest point of the bounding sphere: conservative for the part of the mesh nearest to the camera
+	float distance = glm::length(glm::vec3(center.x, center.y, center.z) - view.cameraPosition) - chain.radius * scale;
+	if (distance <= 0.0f)
+	{
+		return FLT_MAX;
+	}
+
+	return chain.levels[level].error * scale * view.pixelsPerUnit / distance;
+}
+
+u32 meshLod_select(const MeshLodChain& chain, const MeshLodView& view, const glm::mat4& model, float thresholdPixels, float hysteresis, u32 currentLevel)
+{
+	currentLevel = currentLevel < chain.levelCount ? currentLevel : chain.levelCount - 1;
+
+	u32 level = 0;
+	for (u32 candidate = chain.levelCount - 1; candidate > 0; candidate--)
+	{
+		if (meshLod_projectedError(chain, candidate, view, model) <= thresholdPixels)
+		{
+			level = candidate;
+			break;
+		}
+	}
+
+	if (level > currentLevel)
+	{
+		// Coarser: only once comfortably under the threshold
+		while (level > currentLevel && meshLod_projectedError(chain, level, view, model) > thresholdPixels * (1.0f - hysteresis))
+		{
+			level--;
+		}
+	}
+	else if (level < currentLevel && meshLod_projectedError(chain, currentLevel, view, model) <= thresholdPixels * (1.0f + hysteresis))
+	{
+		// Finer: keep the current level until it is clearly over the threshold
+		level = currentLevel;
+	}
+
+	return level;
+}
+
+// Instances on a grid of this many rows (away from the camera) and columns
+#define LOD_BENCHMARK_ROWS 32
+#define LOD_BENCHMARK_COLUMNS 8
+
+void meshLod_benchmark(const MeshLodChain& chain, const UniformBufferObject& ubo, float viewportHeight, float thresholdPixels)
+{
+	MeshLodView view = meshLodCamera(ubo, viewportHeight);
+	glm::mat4 viewInverse = glm::inverse(ubo.view);
+	glm::vec3 right = glm::vec3(viewInverse[0].x, viewInverse[0].y, viewInverse[0].z);
+	glm::vec3 forward = -glm::vec3(viewInverse[2].x, viewInverse[2].y, viewInverse[2].z);
+
+	const float modelScale = glm::length(glm::vec3(ubo.model[0].x, ubo.model[0].y, ubo.model[0].z));
+	const float spacing = chain.radius * modelScale * 2.5f;
+
+	u64 trianglesWithoutLods = 0;
+	u64 trianglesWithLods = 0;
+	u32 levelHistogram[MAX_MESH_LODS] = {};
+
+	for (u32 row = 0; row < LOD_BENCHMARK_ROWS; row++)
+	{
+		for (u32 column = 0; column < LOD_BENCHMARK_COLUMNS; column++)
+		{
+			glm::vec3 offset = forward * (spacing * float(row + 1)) + right * (spacing * (float(column) - 0.5f * float(LOD_BENCHMARK_COLUMNS - 1)));
+			glm::mat4 model = ubo.model;
+			model[3] = glm::vec4(view.cameraPosition + offset, 1.0f);
+
+			u32 level = meshLod_select(chain, view, model, thresholdPixels, 0.0f, 0);
+			levelHistogram[level]++;
+			trianglesWithoutLods += chain.levels[0].indexCount / 3;
+			trianglesWithLods += chain.levels[level].indexCount / 3;
+		}
+	}
+
+	printf("LOD benchmark: %u instances, threshold %.2f px\n", LOD_BENCHMARK_ROWS * LOD_BENCHMARK_COLUMNS, thresholdPixels);
+	printf("\tTriangles without LODs: %llu\n", trianglesWithoutLods);
+	printf("\tTriangles with LODs: %llu (%.1f%%)\n", trianglesWithLods, 100.0 * double(trianglesWithLods) / double(trianglesWithoutLods));
+	for (u32 level = 0; level < chain.levelCount; level++)
+	{
+		printf("\tLOD %u: %u instances\n", level, levelHistogram[level]);
+	}
+}
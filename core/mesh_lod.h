@@ -0,0 +1,56 @@
+#pragma once
+
+#include "common.h"
+#include "glm.h"
+
+#define MAX_MESH_LODS 8
+
+struct MeshLodSettings
+{
+	u32 levelCount; // including the full detail level 0
+	// Each level targets this fraction of the previous level's triangles...
+	float triangleRatio;
+	// ...unless that would deviate more than this from the original surface, relative to the mesh extents (0.01 = 1%)
+	float targetErrors[MAX_MESH_LODS];
+};
+
+struct MeshLod
+{
+	u32 indexOffset;
+	u32 indexCount;
+	float error; // in model units, never smaller than the error of the finer levels
+};
+
+// Every level indexes the same vertex buffer, so switching level only changes the index range
+struct MeshLodChain
+{
+	vector<u32> indices;
+	// submeshCount per level, offsets relative to the start of their level
+	vector<Submesh> submeshes;
+	u32 submeshCount;
+	MeshLod levels[MAX_MESH_LODS];
+	u32 levelCount;
+	glm::vec3 center;
+	float radius;
+};
+
+// What LOD selection needs from the camera
+struct MeshLodView
+{
+	glm::vec3 cameraPosition; // world space
+	float pixelsPerUnit; // screen pixels covered by one world unit at distance 1
+};
+
+MeshLodSettings meshLodSettings_default();
+void buildMeshLods(const MeshView& mesh, const MeshLodSettings& settings, MeshLodChain* chain);
+MeshView meshLodView(const MeshView& mesh, const MeshLodChain& chain, u32 level);
+void printMeshLodChain(const MeshLodChain& chain);
+
+MeshLodView meshLodCamera(const UniformBufferObject& ubo, float viewportHeight);
+// Projected error of the level in pixels for an instance with the given model matrix
+float meshLod_projectedError(const MeshLodChain& chain, u32 level, const MeshLodView& view, const glm::mat4& model);
+// Coarsest level under thresholdPixels. Moving away from currentLevel needs a margin of hysteresis (0.25 = 25%) so levels don't pop back and forth
+u32 meshLod_select(const MeshLodChain& chain, const MeshLodView& view, const glm::mat4& model, float thresholdPixels, float hysteresis, u32 currentLevel);
+
+// Triangles drawn for a grid of instances receding from the camera, with and without LODs
+void meshLod_benchmark(const MeshLodChain& chain, const UniformBufferObject& ubo, float viewportHeight, float thresholdPixels);
@@ -0,0 +1,315 @@
+#include "common.h"
+#include "glm.h"
+
+#include "meshlet.h"
+#include "red_thread_pool.h"
+
+#include <meshoptimizer.h>
+#include <chrono>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define MESHLET_SSE 1
+#include <emmintrin.h>
+
+// Bit count and lowest set bit of the 4 bit lane masks returned by _mm_movemask_ps
+static const u8 laneMaskBitCount[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+static const u8 laneMaskLowestBit[16] = { 0, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0 };
+#else
+#define MESHLET_SSE 0
+#endif
+
+void buildMeshlets(const MeshView& mesh, MeshletMesh* meshlets)
+{
+	assert(mesh.submeshCount > 0);
+	const float* positions = &mesh.vertices[0].pos.x;
+
+	*meshlets = {};
+	meshlets->indices.resize(mesh.indexCount);
+	meshlets->submeshCount = mesh.submeshCount;
+	meshlets->submeshMeshletOffsets.resize(mesh.submeshCount + 1);
+
+	vector<meshopt_Meshlet> meshoptMeshlets;
+	vector<u32> meshletVertices;
+	vector<u8> meshletTriangles;
+	u32 indexOffset = 0;
+
+	// Meshlets never straddle submeshes, so the visible meshlets of a submesh stay one contiguous index range
+	for (u32 s = 0; s < mesh.submeshCount; s++)
+	{
+		const Submesh& submesh = mesh.submeshes[s];
+		meshlets->submeshMeshletOffsets[s] = meshlets->meshletCount;
+
+		const size_t maxMeshlets = meshopt_buildMeshletsBound(submesh.indexCount, MESHLET_MAX_VERTICES, MESHLET_MAX_TRIANGLES);
+		meshoptMeshlets.resize(maxMeshlets);
+		meshletVertices.resize(maxMeshlets * MESHLET_MAX_VERTICES);
+		meshletTriangles.resize(maxMeshlets * MESHLET_MAX_TRIANGLES * 3);
+
+		const size_t meshletCount = meshopt_buildMeshlets(meshoptMeshlets.data(), meshletVertices.data(), meshletTriangles.data(),
+			mesh.indices + submesh.indexOffset, submesh.indexCount, positions, mesh.vertexCount, sizeof(Vertex), MESHLET_MAX_VERTICES, MESHLET_MAX_TRIANGLES, MESHLET_CONE_WEIGHT);
+
+		for (size_t i = 0; i < meshletCount; i++)
+		{
+			const meshopt_Meshlet& meshlet = meshoptMeshlets[i];
+			const u32* vertices = &meshletVertices[meshlet.vertex_offset];
+			const u8* triangles = &meshletTriangles[meshlet.triangle_offset];
+
+			meshlets->indexOffsets.push_back(indexOffset);
+			meshlets->indexCounts.push_back(meshlet.triangle_count * 3);
+			meshlets->submeshes.push_back(s);
+			for (u32 j = 0; j < meshlet.triangle_count * 3; j++)
+			{
+				meshlets->indices[indexOffset + j] = vertices[triangles[j]];
+			}
+			indexOffset += meshlet.triangle_count * 3;
+
+			meshopt_Bounds bounds = meshopt_computeMeshletBounds(vertices, triangles, meshlet.triangle_count, positions, mesh.vertexCount, sizeof(Vertex));
+			meshlets->centerX.push_back(bounds.center[0]);
+			meshlets->centerY.push_back(bounds.center[1]);
+			meshlets->centerZ.push_back(bounds.center[2]);
+			meshlets->radius.push_back(bounds.radius);
+			meshlets->coneAxisX.push_back(bounds.cone_axis[0]);
+			meshlets->coneAxisY.push_back(bounds.cone_axis[1]);
+			meshlets->coneAxisZ.push_back(bounds.cone_axis[2]);
+			meshlets->coneCutoff.push_back(bounds.cone_cutoff);
+		}
+		meshlets->meshletCount += u32(meshletCount);
+	}
+	meshlets->submeshMeshletOffsets[mesh.submeshCount] = meshlets->meshletCount;
+	assert(indexOffset == mesh.indexCount);
+}
+
+MeshletCullView meshletCullView(const UniformBufferObject& ubo)
+{
+	MeshletCullView view;
+
+	// Gribb-Hartmann on the model-view-projection matrix gives the planes in model space. Depth is [0, 1]
+	glm::mat4 mvp = ubo.proj * ubo.view * ubo.model;
+	glm::vec4 rows[4];
+	for (u32 i = 0; i < 4; i++)
+	{
+		rows[i] = glm::vec4(mvp[0][i], mvp[1][i], mvp[2][i], mvp[3][i]);
+	}
+
+	view.planes[0] = rows[3] + rows[0]; // left
+	view.planes[1] = rows[3] - rows[0]; // right
+	view.planes[2] = rows[3] + rows[1]; // bottom
+	view.planes[3] = rows[3] - rows[1]; // top
+	view.planes[4] = rows[2]; // near
+	view.planes[5] = rows[3] - rows[2]; // far
+
+	// Normalized so plane distances compare against the model space radius
+	for (glm::vec4& plane : view.planes)
+	{
+		float length = sqrtf(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+		plane = plane * (1.0f / length);
+	}
+
+	// The cone test assumes the model matrix has no non-uniform scale, as normals would need the inverse transpose
+	glm::mat4 modelViewInverse = glm::inverse(ubo.view * ubo.model);
+	view.cameraPosition = glm::vec3(modelViewInverse[3].x, modelViewInverse[3].y, modelViewInverse[3].z);
+
+	return view;
+}
+
+void meshletCuller_create(MeshletCuller* culler, const MeshletMesh& meshlets, ThreadPool* pool)
+{
+	culler->pool = pool;
+	culler->rangeCount = pool ? pool->threadCount * 4 : 1;
+	culler->visibleMeshlets.resize(meshlets.meshletCount);
+	culler->rangeVisibleCounts.resize(culler->rangeCount);
+	culler->rangeIndexOffsets.resize(culler->rangeCount + 1);
+	culler->rangeStats.resize(culler->rangeCount);
+}
+
+// Meshopt's normal cone test with the bounding sphere instead of the cone apex: the whole meshlet faces away from the camera
+static inline bool32 meshlet_isVisible(const MeshletMesh& meshlets, const MeshletCullView& view, u32 i, bool32* frustumCulled)
+{
+	for (const glm::vec4& plane : view.planes)
+	{
+		if (plane.x * meshlets.centerX[i] + plane.y * meshlets.centerY[i] + plane.z * meshlets.centerZ[i] + plane.w < -meshlets.radius[i])
+		{
+			*frustumCulled = true;
+			return false;
+		}
+	}
+	*frustumCulled = false;
+
+	float dx = meshlets.centerX[i] - view.cameraPosition.x;
+	float dy = meshlets.centerY[i] - view.cameraPosition.y;
+	float dz = meshlets.centerZ[i] - view.cameraPosition.z;
+	float distance = sqrtf(dx * dx + dy * dy + dz * dz);
+	float coneDot = dx * meshlets.coneAxisX[i] + dy * meshlets.coneAxisY[i] + dz * meshlets.coneAxisZ[i];
+
+	return coneDot < meshlets.coneCutoff[i] * distance + meshlets.radius[i];
+}
+
+// Culls [begin, end) and appends the visible meshlets to visible. Returns the visible count
+static u32 meshlet_cullRange(const MeshletMesh& meshlets, const MeshletCullView& view, u32 begin, u32 end, u32* visible, MeshletCullStats* stats)
+{
+	u32 visibleCount = 0;
+	u32 i = begin;
+
+#if MESHLET_SSE
+	__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+	for (u32 p = 0; p < 6; p++)
+	{
+		planeX[p] = _mm_set1_ps(view.planes[p].x);
+		planeY[p] = _mm_set1_ps(view.planes[p].y);
+		planeZ[p] = _mm_set1_ps(view.planes[p].z);
+		planeW[p] = _mm_set1_ps(view.planes[p].w);
+	}
+	const __m128 cameraX = _mm_set1_ps(view.cameraPosition.x);
+	const __m128 cameraY = _mm_set1_ps(view.cameraPosition.y);
+	const __m128 cameraZ = _mm_set1_ps(view.cameraPosition.z);
+	const __m128 zero = _mm_setzero_ps();
+
+	for (; i + 4 <= end; i += 4)
+	{
+		__m128 centerX = _mm_loadu_ps(&meshlets.centerX[i]);
+		__m128 centerY = _mm_loadu_ps(&meshlets.centerY[i]);
+		__m128 centerZ = _mm_loadu_ps(&meshlets.centerZ[i]);
+		__m128 radius = _mm_loadu_ps(&meshlets.radius[i]);
+		__m128 negativeRadius = _mm_sub_ps(zero, radius);
+
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (u32 p = 0; p < 6; p++)
+		{
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], centerX), _mm_mul_ps(planeY[p], centerY)), _mm_add_ps(_mm_mul_ps(planeZ[p], centerZ), planeW[p]));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+		}
+
+		__m128 dx = _mm_sub_ps(centerX, cameraX);
+		__m128 dy = _mm_sub_ps(centerY, cameraY);
+		__m128 dz = _mm_sub_ps(centerZ, cameraZ);
+		__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+		__m128 coneDot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, _mm_loadu_ps(&meshlets.coneAxisX[i])), _mm_mul_ps(dy, _mm_loadu_ps(&meshlets.coneAxisY[i]))), _mm_mul_ps(dz, _mm_loadu_ps(&meshlets.coneAxisZ[i])));
+		__m128 coneLimit = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&meshlets.coneCutoff[i]), distance), radius);
+		__m128 frontFacing = _mm_cmplt_ps(coneDot, coneLimit);
+
+		u32 insideMask = u32(_mm_movemask_ps(inside));
+		u32 visibleMask = u32(_mm_movemask_ps(_mm_and_ps(inside, frontFacing)));
+
+		stats->frustumCulled += 4 - laneMaskBitCount[insideMask];
+		stats->coneCulled += laneMaskBitCount[insideMask & ~visibleMask];
+
+		for (; visibleMask; visibleMask &= visibleMask - 1)
+		{
+			u32 meshlet = i + laneMaskLowestBit[visibleMask];
+			visible[visibleCount++] = meshlet;
+			stats->drawnIndexCount += meshlets.indexCounts[meshlet];
+		}
+	}
+#endif
+
+	for (; i < end; i++)
+	{
+		bool32 frustumCulled;
+		if (meshlet_isVisible(meshlets, view, i, &frustumCulled))
+		{
+			visible[visibleCount++] = i;
+			stats->drawnIndexCount += meshlets.indexCounts[i];
+		}
+		else if (frustumCulled)
+		{
+			stats->frustumCulled++;
+		}
+		else
+		{
+			stats->coneCulled++;
+		}
+	}
+
+	stats->tested += end - begin;
+	stats->drawn += visibleCount;
+
+	return visibleCount;
+}
+
+u32 meshletCuller_cull(MeshletCuller* culler, const MeshletMesh& meshlets, const MeshletCullView& view, u32* outIndices, u32* submeshIndexCounts, MeshletCullStats* stats)
+{
+	using Clock = std::chrono::high_resolution_clock;
+	Clock::time_point start = Clock::now();
+
+	assert(meshlets.meshletCount <= culler->visibleMeshlets.size());
+	const u32 rangeCount = culler->rangeCount;
+	auto cullRange = [&](u32 range, u32)
+	{
+		u32 begin = u32(threadPool_rangeBegin(meshlets.meshletCount, range, rangeCount));
+		u32 end = u32(threadPool_rangeBegin(meshlets.meshletCount, range + 1, rangeCount));
+		// Each range owns [begin, end) of visibleMeshlets, so no synchronization is needed
+		culler->rangeStats[range] = {};
+		culler->rangeVisibleCounts[range] = meshlet_cullRange(meshlets, view, begin, end, &culler->visibleMeshlets[begin], &culler->rangeStats[range]);
+	};
+
+	if (culler->pool)
+	{
+		threadPool_parallelFor(culler->pool, rangeCount, cullRange);
+	}
+	else
+	{
+		cullRange(0, 0);
+	}
+
+	MeshletCullStats total = {};
+	culler->rangeIndexOffsets[0] = 0;
+	for (u32 range = 0; range < rangeCount; range++)
+	{
+		const MeshletCullStats& rangeStats = culler->rangeStats[range];
+		culler->rangeIndexOffsets[range + 1] = culler->rangeIndexOffsets[range] + rangeStats.drawnIndexCount;
+		total.tested += rangeStats.tested;
+		total.frustumCulled += rangeStats.frustumCulled;
+		total.coneCulled += rangeStats.coneCulled;
+		total.drawn += rangeStats.drawn;
+		total.drawnIndexCount += rangeStats.drawnIndexCount;
+	}
+
+	auto compactRange = [&](u32 range, u32)
+	{
+		u32 begin = u32(threadPool_rangeBegin(meshlets.meshletCount, range, rangeCount));
+		u32* destination = outIndices + culler->rangeIndexOffsets[range];
+		for (u32 i = 0; i < culler->rangeVisibleCounts[range]; i++)
+		{
+			u32 meshlet = culler->visibleMeshlets[begin + i];
+			memcpy(destination, &meshlets.indices[meshlets.indexOffsets[meshlet]], meshlets.indexCounts[meshlet] * sizeof(u32));
+			destination += meshlets.indexCounts[meshlet];
+		}
+	};
+
+	if (culler->pool)
+	{
+		threadPool_parallelFor(culler->pool, rangeCount, compactRange);
+	}
+	else
+	{
+		compactRange(0, 0);
+	}
+
+	// Ranges are compacted in meshlet order, so each submesh's indices follow the previous submesh's
+	if (submeshIndexCounts)
+	{
+		memset(submeshIndexCounts, 0, meshlets.submeshCount * sizeof(u32));
+		for (u32 range = 0; range < rangeCount; range++)
+		{
+			u32 begin = u32(threadPool_rangeBegin(meshlets.meshletCount, range, rangeCount));
+			for (u32 i = 0; i < culler->rangeVisibleCounts[range]; i++)
+			{
+				u32 meshlet = culler->visibleMeshlets[begin + i];
+				submeshIndexCounts[meshlets.submeshes[meshlet]] += meshlets.indexCounts[meshlet];
+			}
+		}
+	}
+
+	total.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	if (stats)
+	{
+		*stats = total;
+	}
+
+	return total.drawnIndexCount;
+}
+
+void printMeshletCullStats(const MeshletCullStats& stats)
+{
+	printf("Meshlets: %u tested, %u frustum culled, %u cone culled, %u drawn (%u triangles) in %.3f ms\n",
+		stats.tested, stats.frustumCulled, stats.coneCulled, stats.drawn, stats.drawnIndexCount / 3, stats.seconds * 1000.0);
+}
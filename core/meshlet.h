@@ -0,0 +1,74 @@
+#pragma once
+
+#include "common.h"
+#include "glm.h"
+
+struct ThreadPool;
+
+// Limits recommended by meshoptimizer for NVIDIA hardware; the CPU culling path works with any size
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+// How much meshopt_buildMeshlets favours tight normal cones over tight spheres
+#define MESHLET_CONE_WEIGHT 0.25f
+
+/*
+Meshlet ordered copy of the index buffer, still indexing the source vertex buffer, so visible meshlets can be
+drawn as index ranges. Meshlets are grouped by submesh. Culling data is stored as structure of arrays so four meshlets are tested per SSE instruction.
+*/
+struct MeshletMesh
+{
+	vector<u32> indices;
+	vector<u32> indexOffsets;
+	vector<u32> indexCounts;
+	vector<float> centerX;
+	vector<float> centerY;
+	vector<float> centerZ;
+	vector<float> radius;
+	vector<float> coneAxisX;
+	vector<float> coneAxisY;
+	vector<float> coneAxisZ;
+	vector<float> coneCutoff;
+	vector<u32> submeshes;
+	// Meshlets of submesh i are [submeshMeshletOffsets[i], submeshMeshletOffsets[i + 1])
+	vector<u32> submeshMeshletOffsets;
+	u32 submeshCount;
+	u32 meshletCount;
+};
+
+// Frustum planes and camera position in the mesh (model) space
+struct MeshletCullView
+{
+	glm::vec4 planes[6];
+	glm::vec3 cameraPosition;
+};
+
+struct MeshletCullStats
+{
+	u32 tested;
+	u32 frustumCulled;
+	u32 coneCulled;
+	u32 drawn;
+	u32 drawnIndexCount;
+	double seconds;
+};
+
+// Per thread range scratch, reused every frame
+struct MeshletCuller
+{
+	ThreadPool* pool;
+	u32 rangeCount;
+	vector<u32> visibleMeshlets;
+	vector<u32> rangeVisibleCounts;
+	vector<u32> rangeIndexOffsets;
+	vector<MeshletCullStats> rangeStats;
+};
+
+void buildMeshlets(const MeshView& mesh, MeshletMesh* meshlets);
+
+MeshletCullView meshletCullView(const UniformBufferObject& ubo);
+// pool may be null to cull on the calling thread. The culler can be used for any MeshletMesh with at most as many meshlets
+void meshletCuller_create(MeshletCuller* culler, const MeshletMesh& meshlets, ThreadPool* pool);
+// Writes the indices of every visible meshlet to outIndices (room for meshlets.indices.size()) and returns how many were written.
+// Optionally writes how many of those belong to each submesh; they are stored in submesh order
+u32 meshletCuller_cull(MeshletCuller* culler, const MeshletMesh& meshlets, const MeshletCullView& view, u32* outIndices, u32* submeshIndexCounts = nullptr, MeshletCullStats* stats = nullptr);
+void printMeshletCullStats(const MeshletCullStats& stats);
@@ -2,50 +2,73 @@
 #include "glm.h"
 
 #include "model.h"
+#include "red_thread_pool.h"
+#include "red_arena.h"
+#include "mesh_cache.h"
+#include "mesh_attributes.h"
+#include "obj_stream.h"
+#include "red_memory.h"
 
 #include <meshoptimizer.h>
 #include <fast_obj.h>
+#include <chrono>
 
-Mesh loadMesh_fast(const char* path)
-{
-	fastObjMesh* obj = fast_obj_read(path);
+using MeshClock = std::chrono::high_resolution_clock;
 
-	size_t totalIndices = 0;
+static inline double secondsSince(MeshClock::time_point start)
+{
+	return std::chrono::duration<double>(MeshClock::now() - start).count();
+}
 
-	for (u32 i = 0; i < obj->face_count; i++)
+static inline Vertex obj_getVertex(const fastObjMesh* obj, fastObjIndex gi)
+{
+	Vertex v;
+	v.pos =
 	{
-		totalIndices += 3 * (obj->face_vertices[i] - 2);
-	}
+		obj->positions[gi.p * 3 + 0],
+		obj->positions[gi.p * 3 + 1],
+		obj->positions[gi.p * 3 + 2]
+	};
+	// Index 0 is fast_obj's dummy zero normal, used when the file has none
+	v.normal =
+	{
+		obj->normals[gi.n * 3 + 0],
+		obj->normals[gi.n * 3 + 1],
+		obj->normals[gi.n * 3 + 2]
+	};
+	v.texCoord =
+	{
+		obj->texcoords[gi.t * 2 + 0],
+		1.0f - obj->texcoords[gi.t * 2 + 1] // originally: obj->texcoords[gi.t * 2 + 1]
+	};
 
-	vector<Vertex> vertices(totalIndices);
+	return v;
+}
 
-	size_t vertexOffset = 0;
-	size_t indexOffset = 0;
+// Material bucket of a face: its material, or material_count for faces without one
+static inline u32 obj_faceMaterial(const fastObjMesh* obj, u32 face)
+{
+	u32 material = obj->face_materials ? obj->face_materials[face] : obj->material_count;
+	return material < obj->material_count ? material : obj->material_count;
+}
 
-	for (u32 i = 0; i < obj->face_count; i++)
+/*
+Fan triangulation of faces [faceBegin, faceEnd). indexOffset points into obj->indices, vertexOffset into the unindexed
+vertex array. The material bucket of every triangle goes to triangleMaterials[vertexOffset / 3 ...]
+*/
+static void obj_triangulateFaces(const fastObjMesh* obj, u32 faceBegin, u32 faceEnd, size_t indexOffset, size_t vertexOffset, Vertex* vertices, u32* triangleMaterials)
+{
+	for (u32 i = faceBegin; i < faceEnd; i++)
 	{
+		const u32 material = obj_faceMaterial(obj, i);
+		for (u32 j = 2; j < obj->face_vertices[i]; j++)
+		{
+			triangleMaterials[vertexOffset / 3 + j - 2] = material;
+		}
+
 		for (u32 j = 0; j < obj->face_vertices[i]; j++)
 		{
-			fastObjIndex gi = obj->indices[indexOffset + j];
-						
-			Vertex v;
-			v.pos =
-			{
-				obj->positions[gi.p * 3 + 0],
-				obj->positions[gi.p * 3 + 1],
-				obj->positions[gi.p * 3 + 2]
-			};
-			v.color =
-			{
-				obj->positions[gi.p * 3 + 0],
-				obj->positions[gi.p * 3 + 1],
-				obj->positions[gi.p * 3 + 2]
-			};
-			v.texCoord =
-			{
-				obj->texcoords[gi.t * 2 + 0],
-				1.0f - obj->texcoords[gi.t * 2 + 1] // originally: obj->texcoords[gi.t * 2 + 1]
-			};
+			Vertex v = obj_getVertex(obj, obj->indices[indexOffset + j]);
 
 			if (j >= 3)
 			{
@@ -60,20 +83,676 @@ Mesh loadMesh_fast(const char* path)
 
 		indexOffset += obj->face_vertices[i];
 	}
+}
 
-	fast_obj_destroy(obj);
+static void obj_getMaterials(const fastObjMesh* obj, vector<MeshMaterial>& materials)
+{
+	materials.resize(obj->material_count);
+	for (u32 i = 0; i < obj->material_count; i++)
+	{
+		const fastObjMaterial& objMaterial = obj->materials[i];
+		MeshMaterial& material = materials[i];
+		material = {};
+		if (objMaterial.name)
+		{
+			strncpy(material.name, objMaterial.name, MESH_MATERIAL_NAME_SIZE - 1);
+		}
+		// fast_obj resolves the path relative to the OBJ file
+		if (objMaterial.map_Kd.path)
+		{
+			strncpy(material.diffuseTexturePath, objMaterial.map_Kd.path, MESH_MATERIAL_PATH_SIZE - 1);
+		}
+		material.diffuseColor = glm::vec3(objMaterial.Kd[0], objMaterial.Kd[1], objMaterial.Kd[2]);
+	}
+}
 
-	Mesh result;
+// Stable counting sort of the triangles by material bucket, one submesh per non-empty bucket. Bucket materialCount holds faces without material
+static void mesh_sortByMaterial(Mesh& mesh, const vector<u32>& triangleMaterials, u32 materialCount)
+{
+	const u32 bucketCount = materialCount + 1;
+	const size_t triangleCount = mesh.indices.size() / 3;
+	assert(triangleMaterials.size() == triangleCount);
+
+	vector<u32> bucketOffsets(bucketCount + 1, 0);
+	for (u32 material : triangleMaterials)
+	{
+		bucketOffsets[material + 1]++;
+	}
+	for (u32 bucket = 0; bucket < bucketCount; bucket++)
+	{
+		bucketOffsets[bucket + 1] += bucketOffsets[bucket];
+	}
+
+	mesh.submeshes.clear();
+	for (u32 bucket = 0; bucket < bucketCount; bucket++)
+	{
+		u32 triangles = bucketOffsets[bucket + 1] - bucketOffsets[bucket];
+		if (triangles)
+		{
+			mesh.submeshes.push_back({ bucketOffsets[bucket] * 3, triangles * 3, bucket < materialCount ? bucket : MESH_NO_MATERIAL });
+		}
+	}
+
+	// A single bucket is already sorted
+	if (mesh.submeshes.size() <= 1)
+	{
+		return;
+	}
+
+	vector<u32> sorted(mesh.indices.size());
+	for (size_t triangle = 0; triangle < triangleCount; triangle++)
+	{
+		u32 destination = bucketOffsets[triangleMaterials[triangle]]++ * 3;
+		sorted[destination + 0] = mesh.indices[triangle * 3 + 0];
+		sorted[destination + 1] = mesh.indices[triangle * 3 + 1];
+		sorted[destination + 2] = mesh.indices[triangle * 3 + 2];
+	}
+	mesh.indices.swap(sorted);
+}
 
+static inline u32 vertexPartition(u32 hash, u32 partitionCount)
+{
+	// High bits pick the partition, low bits pick the slot inside the partition table
+	return u32((u64(hash) * partitionCount) >> 32);
+}
+
+struct VertexPartition
+{
+	vector<u32> uniqueVertices; // index of the first occurrence in the unindexed vertex array
+	u32 base;
+};
+
+static void mesh_remapSerial(Mesh& result, const vector<Vertex>& vertices)
+{
+	size_t totalIndices = vertices.size();
 	vector<u32> remap(totalIndices);
 
 	size_t totalVertices = meshopt_generateVertexRemap(&remap[0], nullptr, totalIndices, &vertices[0], totalIndices, sizeof(Vertex));
-	
+
 	result.indices.resize(totalIndices);
 	meshopt_remapIndexBuffer(&result.indices[0], nullptr, totalIndices, &remap[0]);
 
 	result.vertices.resize(totalVertices);
 	meshopt_remapVertexBuffer(&result.vertices[0], &vertices[0], totalIndices, sizeof(Vertex), &remap[0]);
+}
+
+/*
+Parallel equivalent of meshopt_generateVertexRemap + remap: vertices are hash-partitioned so each partition
+can be deduplicated independently. The resulting vertex order is grouped by partition instead of first use,
+meshopt_optimizeVertexFetch restores locality if needed.
+*/
+static void mesh_remapParallel(ThreadPool* pool, Mesh& result, const vector<Vertex>& vertices)
+{
+	const size_t totalIndices = vertices.size();
+	const u32 partitionCount = pool->threadCount;
+	const u32 rangeCount = pool->threadCount * 4;
+
+	vector<u32> hashes(totalIndices);
+	vector<u32> remap(totalIndices);
+	vector<VertexPartition> partitions(partitionCount);
+	// Vertex indices bucketed by partition, each bucket in index order so the first occurrence stays the one kept
+	vector<u32> members(totalIndices);
+	vector<size_t> bucketOffsets(size_t(rangeCount) * partitionCount, 0);
+	vector<size_t> partitionBegin(partitionCount + 1);
+
+	threadPool_parallelFor(pool, rangeCount, [&](u32 range, u32)
+	{
+		size_t begin = threadPool_rangeBegin(totalIndices, range, rangeCount);
+		size_t end = threadPool_rangeBegin(totalIndices, range + 1, rangeCount);
+		size_t* counts = &bucketOffsets[size_t(range) * partitionCount];
+		for (size_t i = begin; i < end; i++)
+		{
+			hashes[i] = hashVertex(vertices[i]);
+			counts[vertexPartition(hashes[i], partitionCount)]++;
+		}
+	});
+
+	size_t offset = 0;
+	for (u32 partitionIndex = 0; partitionIndex < partitionCount; partitionIndex++)
+	{
+		partitionBegin[partitionIndex] = offset;
+		for (u32 range = 0; range < rangeCount; range++)
+		{
+			size_t& bucketOffset = bucketOffsets[size_t(range) * partitionCount + partitionIndex];
+			size_t count = bucketOffset;
+			bucketOffset = offset;
+			offset += count;
+		}
+	}
+	partitionBegin[partitionCount] = offset;
+
+	threadPool_parallelFor(pool, rangeCount, [&](u32 range, u32)
+	{
+		size_t begin = threadPool_rangeBegin(totalIndices, range, rangeCount);
+		size_t end = threadPool_rangeBegin(totalIndices, range + 1, rangeCount);
+		size_t* offsets = &bucketOffsets[size_t(range) * partitionCount];
+		for (size_t i = begin; i < end; i++)
+		{
+			members[offsets[vertexPartition(hashes[i], partitionCount)]++] = u32(i);
+		}
+	});
+
+	threadPool_parallelFor(pool, partitionCount, [&](u32 partitionIndex, u32 threadIndex)
+	{
+		const size_t memberBegin = partitionBegin[partitionIndex];
+		const size_t memberCount = partitionBegin[partitionIndex + 1] - memberBegin;
+
+		size_t tableSize = 16;
+		while (tableSize < memberCount * 2)
+		{
+			tableSize *= 2;
+		}
+		const size_t tableMask = tableSize - 1;
+		ScratchVector<u32> table(tableSize, ~0u, LinearArenaAllocator(threadPool_scratch(pool, threadIndex)));
+
+		VertexPartition& partition = partitions[partitionIndex];
+		partition.uniqueVertices.reserve(memberCount);
+
+		for (size_t member = 0; member < memberCount; member++)
+		{
+			size_t i = members[memberBegin + member];
+			u32 hash = hashes[i];
+			for (size_t slot = hash & tableMask;; slot = (slot + 1) & tableMask)
+			{
+				u32 localIndex = table[slot];
+				if (localIndex == ~0u)
+				{
+					localIndex = u32(partition.uniqueVertices.size());
+					table[slot] = localIndex;
+					partition.uniqueVertices.push_back(u32(i));
+					remap[i] = localIndex;
+					break;
+				}
+
+				u32 candidate = partition.uniqueVertices[localIndex];
+				if (hashes[candidate] == hash && memcmp(&vertices[candidate], &vertices[i], sizeof(Vertex)) == 0)
+				{
+					remap[i] = localIndex;
+					break;
+				}
+			}
+		}
+	});
+
+	u32 totalVertices = 0;
+	for (VertexPartition& partition : partitions)
+	{
+		partition.base = totalVertices;
+		totalVertices += u32(partition.uniqueVertices.size());
+	}
+
+	result.vertices.resize(totalVertices);
+	result.indices.resize(totalIndices);
+
+	threadPool_parallelFor(pool, partitionCount, [&](u32 partitionIndex, u32)
+	{
+		const VertexPartition& partition = partitions[partitionIndex];
+		for (size_t i = 0; i < partition.uniqueVertices.size(); i++)
+		{
+			result.vertices[partition.base + i] = vertices[partition.uniqueVertices[i]];
+		}
+	});
+
+	threadPool_parallelFor(pool, rangeCount, [&](u32 range, u32)
+	{
+		size_t begin = threadPool_rangeBegin(totalIndices, range, rangeCount);
+		size_t end = threadPool_rangeBegin(totalIndices, range + 1, rangeCount);
+		for (size_t i = begin; i < end; i++)
+		{
+			result.indices[i] = partitions[vertexPartition(hashes[i], partitionCount)].base + remap[i];
+		}
+	});
+}
+
+Mesh loadMesh_fast(const char* path)
+{
+	MeshLoadSettings settings = {};
+	return loadMesh_fast(path, settings);
+}
+
+// fast_obj parse, parallel triangulation into an unindexed vertex array, then remap
+static void mesh_loadFastObj(const char* path, const MeshLoadSettings& settings, Mesh& result, MeshLoadStats& localStats)
+{
+	MeshClock::time_point parseStart = MeshClock::now();
+
+	fastObjMesh* obj = fast_obj_read(path);
+	assert(obj);
+	localStats.parseSeconds = secondsSince(parseStart);
+
+	ThreadPool* pool = settings.threadPool;
+	bool32 ownsPool = false;
+	if (!pool && settings.threadCount != 1)
+	{
+		pool = threadPool_create(settings.threadCount);
+		ownsPool = true;
+	}
+	localStats.threadCount = pool ? pool->threadCount : 1;
+
+	MeshClock::time_point triangulateStart = MeshClock::now();
+
+	vector<Vertex> vertices;
+	vector<u32> triangleMaterials;
+	size_t objIndexCount = 0;
+
+	if (localStats.threadCount == 1)
+	{
+		size_t totalIndices = 0;
+
+		for (u32 i = 0; i < obj->face_count; i++)
+		{
+			objIndexCount += obj->face_vertices[i];
+			totalIndices += 3 * (obj->face_vertices[i] - 2);
+		}
+
+		vertices.resize(totalIndices);
+		triangleMaterials.resize(totalIndices / 3);
+		obj_triangulateFaces(obj, 0, obj->face_count, 0, 0, vertices.data(), triangleMaterials.data());
+	}
+	else
+	{
+		// Prefix sum over obj->face_vertices per face range, so each worker knows where its input and output start
+		const u32 rangeCount = pool->threadCount * 4;
+		vector<size_t> rangeIndexOffsets(rangeCount + 1);
+		vector<size_t> rangeVertexOffsets(rangeCount + 1);
+
+		threadPool_parallelFor(pool, rangeCount, [&](u32 range, u32)
+		{
+			u32 faceBegin = u32(threadPool_rangeBegin(obj->face_count, range, rangeCount));
+			u32 faceEnd = u32(threadPool_rangeBegin(obj->face_count, range + 1, rangeCount));
+			size_t indexCount = 0;
+			size_t vertexCount = 0;
+			for (u32 i = faceBegin; i < faceEnd; i++)
+			{
+				indexCount += obj->face_vertices[i];
+				vertexCount += 3 * (obj->face_vertices[i] - 2);
+			}
+			rangeIndexOffsets[range + 1] = indexCount;
+			rangeVertexOffsets[range + 1] = vertexCount;
+		});
+
+		rangeIndexOffsets[0] = 0;
+		rangeVertexOffsets[0] = 0;
+		for (u32 range = 0; range < rangeCount; range++)
+		{
+			rangeIndexOffsets[range + 1] += rangeIndexOffsets[range];
+			rangeVertexOffsets[range + 1] += rangeVertexOffsets[range];
+		}
+
+		objIndexCount = rangeIndexOffsets[rangeCount];
+		vertices.resize(rangeVertexOffsets[rangeCount]);
+		triangleMaterials.resize(rangeVertexOffsets[rangeCount] / 3);
+
+		threadPool_parallelFor(pool, rangeCount, [&](u32 range, u32)
+		{
+			u32 faceBegin = u32(threadPool_rangeBegin(obj->face_count, range, rangeCount));
+			u32 faceEnd = u32(threadPool_rangeBegin(obj->face_count, range + 1, rangeCount));
+			obj_triangulateFaces(obj, faceBegin, faceEnd, rangeIndexOffsets[range], rangeVertexOffsets[range], vertices.data(), triangleMaterials.data());
+		});
+	}
+
+	localStats.faceCount = obj->face_count;
+	const u32 materialCount = obj->material_count;
+	obj_getMaterials(obj, result.materials);
+	const u64 objBytes =
+		u64(obj->position_count * 3 + obj->normal_count * 3 + obj->texcoord_count * 2) * sizeof(float) +
+		u64(obj->face_count) * 2 * sizeof(u32) +
+		u64(objIndexCount) * sizeof(fastObjIndex);
+	fast_obj_destroy(obj);
+	localStats.triangulateSeconds = secondsSince(triangulateStart);
+
+	MeshClock::time_point remapStart = MeshClock::now();
+
+	if (localStats.threadCount == 1)
+	{
+		mesh_remapSerial(result, vertices);
+	}
+	else
+	{
+		mesh_remapParallel(pool, result, vertices);
+	}
+
+	// Index order still follows the unindexed vertices, so triangle i still has material triangleMaterials[i]
+	mesh_sortByMaterial(result, triangleMaterials, materialCount);
+
+	localStats.remapSeconds = secondsSince(remapStart);
+
+	// Two peaks: the OBJ next to the unindexed vertices, then the unindexed vertices next to the remap tables and the result
+	const u64 unindexedBytes = CONTAINER_BYTES(vertices);
+	const u64 remapBytes = u64(vertices.size()) * sizeof(u32) * (localStats.threadCount == 1 ? 1 : 2) + CONTAINER_BYTES(triangleMaterials);
+	const u64 resultBytes = CONTAINER_BYTES(result.vertices) + CONTAINER_BYTES(result.indices);
+	const u64 parsePeak = objBytes + unindexedBytes + CONTAINER_BYTES(triangleMaterials);
+	const u64 remapPeak = unindexedBytes + remapBytes + resultBytes;
+	localStats.peakWorkingBytes = parsePeak > remapPeak ? parsePeak : remapPeak;
+
+	if (ownsPool)
+	{
+		threadPool_destroy(pool);
+	}
+}
+
+u32 meshCookFlags(const MeshLoadSettings& settings)
+{
+	return settings.optimization.flags | (settings.attributeFlags << 8);
+}
+
+// OBJ files without normals leave every normal zero
+static bool32 mesh_hasNormals(const Mesh& mesh)
+{
+	for (const Vertex& vertex : mesh.vertices)
+	{
+		if (vertex.normal.x != 0.0f || vertex.normal.y != 0.0f || vertex.normal.z != 0.0f)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+Mesh loadMesh_fast(const char* path, const MeshLoadSettings& settings, MeshLoadStats* stats)
+{
+	MeshClock::time_point loadStart = MeshClock::now();
+	MeshLoadStats localStats = {};
+
+	Mesh result;
+
+	if (settings.streaming)
+	{
+		localStats.threadCount = 1;
+		localStats.streamed = true;
+		bool32 loaded = obj_loadStreaming(path, &result, &localStats);
+		assert(loaded);
+	}
+	else
+	{
+		mesh_loadFastObj(path, settings, result, localStats);
+	}
+
+	if (settings.optimization.flags)
+	{
+		optimizeMesh(result, settings.optimization, &localStats.optimization);
+	}
+
+	if (settings.attributeFlags)
+	{
+		u32 attributeFlags = settings.attributeFlags;
+		if (!mesh_hasNormals(result))
+		{
+			attributeFlags |= MESH_ATTRIBUTE_NORMALS_BIT;
+		}
+		computeMeshAttributes(result.vertices.data(), u32(result.vertices.size()), result.indices.data(), u32(result.indices.size()), attributeFlags,
+			meshSimd_supportedLevel(), &result.bounds, &localStats.attributes);
+	}
+
+	localStats.indexCount = result.indices.size();
+	localStats.vertexCount = result.vertices.size();
+
+	if (settings.cachePath)
+	{
+		MeshClock::time_point hashStart = MeshClock::now();
+		FileVersion sourceVersion = settings.sourceVersion;
+		if (!sourceVersion.hash)
+		{
+			file_version(path, &sourceVersion);
+			sourceVersion.hash = file_hash(path);
+		}
+		localStats.hashSeconds = secondsSince(hashStart);
+
+		MeshClock::time_point cacheStart = MeshClock::now();
+		bool32 written = sourceVersion.hash && rmesh_write(settings.cachePath, meshView(result), sourceVersion, meshCookFlags(settings));
+		localStats.cacheSeconds = secondsSince(cacheStart);
+		if (!written)
+		{
+			printf("Couldn't write cooked mesh %s\n", settings.cachePath);
+		}
+	}
+
+	localStats.totalSeconds = secondsSince(loadStart);
+	localStats.peakResidentBytes = process_peakResidentBytes();
+
+	if (stats)
+	{
+		*stats = localStats;
+	}
 
 	return result;
-}
\ No newline at end of file
+}
+
+void printMeshLoadStats(const char* path, const MeshLoadStats& stats)
+{
+	printf("Mesh %s\n", path);
+	if (stats.cacheHit)
+	{
+		printf("\tLoaded from cooked cache\n");
+		printf("\tIndices: %llu, vertices: %llu\n", stats.indexCount, stats.vertexCount);
+		printf("\tHash source: %.3f ms\n", stats.hashSeconds * 1000.0);
+		printf("\tMap cooked mesh: %.3f ms\n", stats.cacheSeconds * 1000.0);
+		printf("\tTotal: %.3f ms\n", stats.totalSeconds * 1000.0);
+		return;
+	}
+	printf("\tThreads: %u\n", stats.threadCount);
+	printf("\tFaces: %llu, indices: %llu, vertices: %llu\n", stats.faceCount, stats.indexCount, stats.vertexCount);
+	if (stats.streamed)
+	{
+		printf("\tStreamed parse + deduplication: %.3f ms\n", stats.parseSeconds * 1000.0);
+	}
+	else
+	{
+		printf("\tParse: %.3f ms\n", stats.parseSeconds * 1000.0);
+		printf("\tTriangulate: %.3f ms\n", stats.triangulateSeconds * 1000.0);
+		printf("\tRemap: %.3f ms\n", stats.remapSeconds * 1000.0);
+	}
+	printf("\tPeak loader memory: %.2f MiB (output mesh: %.2f MiB)\n", double(stats.peakWorkingBytes) / (1024.0 * 1024.0),
+		double(stats.vertexCount * sizeof(Vertex) + stats.indexCount * sizeof(u32)) / (1024.0 * 1024.0));
+	printf("\tPeak process resident memory: %.2f MiB\n", double(stats.peakResidentBytes) / (1024.0 * 1024.0));
+	if (stats.optimization.seconds > 0.0)
+	{
+		printf("\tOptimize: %.3f ms\n", stats.optimization.seconds * 1000.0);
+		const MeshStatistics& before = stats.optimization.before;
+		const MeshStatistics& after = stats.optimization.after;
+		if (after.acmr > 0.0f)
+		{
+			printf("\t\tACMR: %.3f -> %.3f\n", before.acmr, after.acmr);
+			printf("\t\tATVR: %.3f -> %.3f\n", before.atvr, after.atvr);
+			printf("\t\tOverdraw: %.3f -> %.3f\n", before.overdraw, after.overdraw);
+			printf("\t\tOverfetch: %.3f -> %.3f\n", before.overfetch, after.overfetch);
+		}
+	}
+	if (stats.attributes.totalSeconds > 0.0)
+	{
+		printMeshAttributeStats(stats.attributes);
+	}
+	if (stats.cacheSeconds > 0.0)
+	{
+		printf("\tHash source: %.3f ms\n", stats.hashSeconds * 1000.0);
+		printf("\tWrite cooked mesh: %.3f ms\n", stats.cacheSeconds * 1000.0);
+	}
+	printf("\tTotal: %.3f ms\n", stats.totalSeconds * 1000.0);
+}
+
+// Vertex cache size used for the statistics, a typical FIFO size for current hardware
+#define MESH_ANALYSIS_CACHE_SIZE 16
+
+MeshStatistics analyzeMesh(const MeshView& mesh)
+{
+	MeshStatistics statistics = {};
+	if (mesh.indexCount == 0)
+	{
+		return statistics;
+	}
+
+	meshopt_VertexCacheStatistics vertexCache = meshopt_analyzeVertexCache(mesh.indices, mesh.indexCount, mesh.vertexCount, MESH_ANALYSIS_CACHE_SIZE, 0, 0);
+	meshopt_OverdrawStatistics overdraw = meshopt_analyzeOverdraw(mesh.indices, mesh.indexCount, &mesh.vertices[0].pos.x, mesh.vertexCount, sizeof(Vertex));
+	meshopt_VertexFetchStatistics vertexFetch = meshopt_analyzeVertexFetch(mesh.indices, mesh.indexCount, mesh.vertexCount, sizeof(Vertex));
+
+	statistics.acmr = vertexCache.acmr;
+	statistics.atvr = vertexCache.atvr;
+	statistics.overdraw = overdraw.overdraw;
+	statistics.overfetch = vertexFetch.overfetch;
+
+	return statistics;
+}
+
+void optimizeMesh(Mesh& mesh, const MeshOptimizationSettings& settings, MeshOptimizationStats* stats)
+{
+	MeshClock::time_point optimizeStart = MeshClock::now();
+	MeshOptimizationStats localStats = {};
+
+	const size_t indexCount = mesh.indices.size();
+	const size_t vertexCount = mesh.vertices.size();
+	if (indexCount == 0)
+	{
+		return;
+	}
+
+	if (settings.analyze)
+	{
+		localStats.before = analyzeMesh(meshView(mesh));
+	}
+
+	// Each pass can run in place. Triangles are only reordered inside their submesh, so material ranges stay intact
+	for (const Submesh& submesh : mesh.submeshes)
+	{
+		u32* indices = mesh.indices.data() + submesh.indexOffset;
+
+		if (settings.flags & MESH_OPTIMIZE_VERTEX_CACHE_BIT)
+		{
+			meshopt_optimizeVertexCache(indices, indices, submesh.indexCount, vertexCount);
+		}
+
+		if (settings.flags & MESH_OPTIMIZE_OVERDRAW_BIT)
+		{
+			const float threshold = settings.overdrawThreshold > 0.0f ? settings.overdrawThreshold : 1.05f;
+			meshopt_optimizeOverdraw(indices, indices, submesh.indexCount, &mesh.vertices[0].pos.x, vertexCount, sizeof(Vertex), threshold);
+		}
+	}
+
+	if (settings.flags & MESH_OPTIMIZE_VERTEX_FETCH_BIT)
+	{
+		size_t usedVertices = meshopt_optimizeVertexFetch(mesh.vertices.data(), mesh.indices.data(), indexCount, mesh.vertices.data(), vertexCount, sizeof(Vertex));
+		mesh.vertices.resize(usedVertices);
+	}
+
+	localStats.seconds = secondsSince(optimizeStart);
+
+	if (settings.analyze)
+	{
+		localStats.after = analyzeMesh(meshView(mesh));
+	}
+
+	if (stats)
+	{
+		*stats = localStats;
+	}
+}
+
+static inline u16 quantizeUnorm16(float value, float offset, float inverseScale)
+{
+	float normalized = glm::clamp((value - offset) * inverseScale, 0.0f, 1.0f);
+	return u16(normalized * 65535.0f + 0.5f);
+}
+
+static inline i16 quantizeSnorm16(float value)
+{
+	float clamped = glm::clamp(value, -1.0f, 1.0f);
+	return i16(clamped * 32767.0f + (clamped >= 0.0f ? 0.5f : -0.5f));
+}
+
+// Octahedral mapping: project on the octahedron |x|+|y|+|z| = 1 and fold the lower half over the upper one
+static inline glm::vec2 octEncode(glm::vec3 n)
+{
+	float sum = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	if (sum == 0.0f)
+	{
+		return glm::vec2(0.0f, 0.0f);
+	}
+
+	glm::vec2 p = glm::vec2(n.x, n.y) * (1.0f / sum);
+	if (n.z < 0.0f)
+	{
+		p = glm::vec2((1.0f - fabsf(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f), (1.0f - fabsf(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+	}
+
+	return p;
+}
+
+MeshQuantization meshQuantization_fromBounds(glm::vec3 minPos, glm::vec3 maxPos, glm::vec2 minUV, glm::vec2 maxUV)
+{
+	glm::vec3 posScale = maxPos - minPos;
+	glm::vec2 uvScale = maxUV - minUV;
+
+	MeshQuantization quantization;
+	quantization.positionOffset = glm::vec4(minPos, 0.0f);
+	quantization.positionScale = glm::vec4(posScale, 0.0f);
+	quantization.texCoordOffsetScale = glm::vec4(minUV.x, minUV.y, uvScale.x, uvScale.y);
+
+	return quantization;
+}
+
+void packVertices(const Vertex* vertices, u32 vertexCount, const MeshQuantization& quantization, PackedVertex* packed)
+{
+	const glm::vec3 minPos = glm::vec3(quantization.positionOffset.x, quantization.positionOffset.y, quantization.positionOffset.z);
+	const glm::vec3 posScale = glm::vec3(quantization.positionScale.x, quantization.positionScale.y, quantization.positionScale.z);
+	const glm::vec2 minUV = glm::vec2(quantization.texCoordOffsetScale.x, quantization.texCoordOffsetScale.y);
+	const glm::vec2 uvScale = glm::vec2(quantization.texCoordOffsetScale.z, quantization.texCoordOffsetScale.w);
+
+	// A flat axis keeps scale 0 and quantizes to 0; the inverse scale only has to avoid the division
+	glm::vec3 posInverseScale = glm::vec3(posScale.x > 0.0f ? 1.0f / posScale.x : 0.0f, posScale.y > 0.0f ? 1.0f / posScale.y : 0.0f, posScale.z > 0.0f ? 1.0f / posScale.z : 0.0f);
+	glm::vec2 uvInverseScale = glm::vec2(uvScale.x > 0.0f ? 1.0f / uvScale.x : 0.0f, uvScale.y > 0.0f ? 1.0f / uvScale.y : 0.0f);
+
+	for (u32 i = 0; i < vertexCount; i++)
+	{
+		const Vertex& v = vertices[i];
+		PackedVertex& p = packed[i];
+
+		p.pos[0] = quantizeUnorm16(v.pos.x, minPos.x, posInverseScale.x);
+		p.pos[1] = quantizeUnorm16(v.pos.y, minPos.y, posInverseScale.y);
+		p.pos[2] = quantizeUnorm16(v.pos.z, minPos.z, posInverseScale.z);
+		p.pos[3] = 0;
+
+		glm::vec2 octNormal = octEncode(v.normal);
+		p.normal[0] = quantizeSnorm16(octNormal.x);
+		p.normal[1] = quantizeSnorm16(octNormal.y);
+
+		p.texCoord[0] = quantizeUnorm16(v.texCoord.x, minUV.x, uvInverseScale.x);
+		p.texCoord[1] = quantizeUnorm16(v.texCoord.y, minUV.y, uvInverseScale.y);
+	}
+}
+
+void packMesh(const MeshView& mesh, PackedMesh* packed)
+{
+	packed->vertices.resize(mesh.vertexCount);
+	packed->quantization = meshQuantization_identity();
+	if (mesh.vertexCount == 0)
+	{
+		return;
+	}
+
+	glm::vec3 minPos = mesh.vertices[0].pos;
+	glm::vec3 maxPos = mesh.vertices[0].pos;
+	glm::vec2 minUV = mesh.vertices[0].texCoord;
+	glm::vec2 maxUV = mesh.vertices[0].texCoord;
+	for (u32 i = 1; i < mesh.vertexCount; i++)
+	{
+		minPos = glm::min(minPos, mesh.vertices[i].pos);
+		maxPos = glm::max(maxPos, mesh.vertices[i].pos);
+		minUV = glm::min(minUV, mesh.vertices[i].texCoord);
+		maxUV = glm::max(maxUV, mesh.vertices[i].texCoord);
+	}
+
+	packed->quantization = meshQuantization_fromBounds(minPos, maxPos, minUV, maxUV);
+	packVertices(mesh.vertices, mesh.vertexCount, packed->quantization, packed->vertices.data());
+}
+
+void floatMesh(const MeshView& mesh, vector<FloatVertex>* vertices)
+{
+	vertices->resize(mesh.vertexCount);
+	for (u32 i = 0; i < mesh.vertexCount; i++)
+	{
+		const Vertex& v = mesh.vertices[i];
+		FloatVertex& f = (*vertices)[i];
+		f.pos = v.pos;
+		f.normal = v.normal;
+		f.texCoord = v.texCoord;
+	}
+}
@@ -1,2 +1,119 @@
 #pragma once
+#include "red_file.h"
+
+struct ThreadPool;
+
+enum MeshOptimizationFlagBits : u32
+{
+	MESH_OPTIMIZE_VERTEX_CACHE_BIT = 0x1,
+	MESH_OPTIMIZE_OVERDRAW_BIT = 0x2,
+	MESH_OPTIMIZE_VERTEX_FETCH_BIT = 0x4,
+	MESH_OPTIMIZE_ALL = MESH_OPTIMIZE_VERTEX_CACHE_BIT | MESH_OPTIMIZE_OVERDRAW_BIT | MESH_OPTIMIZE_VERTEX_FETCH_BIT,
+};
+
+struct MeshOptimizationSettings
+{
+	u32 flags; // MeshOptimizationFlagBits
+	// How much the vertex cache efficiency may degrade to reduce overdraw, 1.05 = 5%
+	float overdrawThreshold;
+	// Gather the statistics below before and after optimizing. Overdraw analysis rasterizes the mesh, so it is not free
+	bool32 analyze;
+};
+
+struct MeshStatistics
+{
+	float acmr; // average transformed vertices per triangle (post-transform cache misses)
+	float atvr; // average transforms per vertex, 1.0 is optimal
+	float overdraw; // shaded pixels / covered pixels
+	float overfetch; // fetched vertex bytes / vertex buffer bytes
+};
+
+struct MeshOptimizationStats
+{
+	MeshStatistics before;
+	MeshStatistics after;
+	double seconds;
+};
+
+enum MeshAttributeFlagBits : u32
+{
+	// Area weighted. Replaces the source normals; the loader sets it by itself if the source has none
+	MESH_ATTRIBUTE_NORMALS_BIT = 0x1,
+	MESH_ATTRIBUTE_TANGENTS_BIT = 0x2,
+	MESH_ATTRIBUTE_BOUNDS_BIT = 0x4,
+	MESH_ATTRIBUTE_ALL = MESH_ATTRIBUTE_NORMALS_BIT | MESH_ATTRIBUTE_TANGENTS_BIT | MESH_ATTRIBUTE_BOUNDS_BIT,
+};
+
+enum class MeshSimdLevel : u32
+{
+	SCALAR,
+	SSE,
+	AVX2,
+};
+
+struct MeshAttributeStats
+{
+	MeshSimdLevel simd;
+	double boundsSeconds;
+	double normalsSeconds;
+	double tangentsSeconds;
+	double totalSeconds;
+};
+
+struct MeshLoadSettings
+{
+	// 0 = one thread per hardware thread, 1 = serial path
+	u32 threadCount;
+	// Optional: reuse an existing pool instead of spawning threadCount threads for this load
+	ThreadPool* threadPool;
+	// Optional: write the result as a cooked .rmesh here
+	const char* cachePath;
+	// Version of the source file stored in the cooked mesh, a 0 hash = take it while loading
+	FileVersion sourceVersion;
+	// Hash the source on every cache hit instead of trusting an unchanged size and write time
+	bool32 verifySource;
+	// Parse with obj_loadStreaming instead of fast_obj: single threaded, but no unindexed intermediate copy
+	bool32 streaming;
+	MeshOptimizationSettings optimization;
+	// MeshAttributeFlagBits computed once the mesh is optimized
+	u32 attributeFlags;
+};
+
+struct MeshLoadStats
+{
+	u32 threadCount;
+	u64 faceCount;
+	u64 indexCount;
+	u64 vertexCount;
+	bool32 cacheHit;
+	double hashSeconds;
+	double cacheSeconds;
+	double parseSeconds;
+	double triangulateSeconds;
+	double remapSeconds;
+	MeshOptimizationStats optimization;
+	MeshAttributeStats attributes;
+	double totalSeconds;
+	bool32 streamed;
+	// Loader owned buffers at their high-water mark (estimated from the element counts on the fast_obj path)
+	u64 peakWorkingBytes;
+	// Whole process, includes everything loaded before the mesh
+	u64 peakResidentBytes;
+};
+
 Mesh loadMesh_fast(const char* path);
+Mesh loadMesh_fast(const char* path, const MeshLoadSettings& settings, MeshLoadStats* stats = nullptr);
+void printMeshLoadStats(const char* path, const MeshLoadStats& stats);
+// What a cooked mesh depends on besides its source: a cache cooked with other flags is stale
+u32 meshCookFlags(const MeshLoadSettings& settings);
+
+MeshStatistics analyzeMesh(const MeshView& mesh);
+void optimizeMesh(Mesh& mesh, const MeshOptimizationSettings& settings, MeshOptimizationStats* stats = nullptr);
+
+// Quantizes positions and texture coordinates to the mesh bounds and encodes normals as octahedral, see PackedVertex
+void packMesh(const MeshView& mesh, PackedMesh* packed);
+// The same in parts, for meshes whose bounds are known before their vertices are all read
+MeshQuantization meshQuantization_fromBounds(glm::vec3 minPos, glm::vec3 maxPos, glm::vec2 minUV, glm::vec2 maxUV);
+void packVertices(const Vertex* vertices, u32 vertexCount, const MeshQuantization& quantization, PackedVertex* packed);
+// Drops the tangents, for the unpacked vertex shader
+void floatMesh(const MeshView& mesh, vector<FloatVertex>* vertices);
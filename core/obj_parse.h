@@ -0,0 +1,163 @@
+#pragma once
+
+#include "common.h"
+#include <stdlib.h>
+
+/*
+OBJ lexing shared by the streaming loaders. Every parser stops at '\n', so a buffer of whole lines needs no bounds checks.
+*/
+
+// Exact powers of ten in double precision
+static const double objPowersOf10[] =
+{
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static inline bool32 obj_isDigit(char c)
+{
+	return u32(c - '0') < 10;
+}
+
+static inline const char* obj_skipBlanks(const char* p)
+{
+	while (*p == ' ' || *p == '\t')
+	{
+		p++;
+	}
+	return p;
+}
+
+static inline const char* obj_skipLine(const char* p)
+{
+	while (*p != '\n')
+	{
+		p++;
+	}
+	return p;
+}
+
+// The blanks after keyword when the line starts with it, nullptr otherwise
+static inline const char* obj_skipKeyword(const char* p, const char* keyword)
+{
+	for (; *keyword && *p == *keyword; p++, keyword++)
+	{
+	}
+	return !*keyword && (*p == ' ' || *p == '\t') ? p : nullptr;
+}
+
+/*
+Clinger's fast path: the significant digits go into an integer mantissa, which is scaled by an exact power of ten in
+double precision. That is only correctly rounded while the mantissa fits in 53 bits and the power is at most 10^22, which
+covers what exporters write; longer mantissas, dropped digits and larger exponents fall back to strtod.
+*/
+static inline const char* obj_parseFloat(const char* p, float* result)
+{
+	p = obj_skipBlanks(p);
+	const char* start = p;
+
+	bool32 negative = *p == '-';
+	if (*p == '-' || *p == '+')
+	{
+		p++;
+	}
+
+	u64 mantissa = 0;
+	i32 exponent = 0;
+	u32 digits = 0;
+	bool32 truncated = false;
+
+	for (; obj_isDigit(*p); p++)
+	{
+		if (digits < 19)
+		{
+			mantissa = mantissa * 10 + u64(*p - '0');
+			digits += mantissa != 0;
+		}
+		else
+		{
+			exponent++;
+			truncated = true;
+		}
+	}
+
+	if (*p == '.')
+	{
+		p++;
+		for (; obj_isDigit(*p); p++)
+		{
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + u64(*p - '0');
+				digits += mantissa != 0;
+				exponent--;
+			}
+			else
+			{
+				truncated = true;
+			}
+		}
+	}
+
+	if (*p == 'e' || *p == 'E')
+	{
+		p++;
+		bool32 negativeExponent = *p == '-';
+		if (*p == '-' || *p == '+')
+		{
+			p++;
+		}
+
+		i32 explicitExponent = 0;
+		for (; obj_isDigit(*p); p++)
+		{
+			if (explicitExponent < 10000)
+			{
+				explicitExponent = explicitExponent * 10 + (*p - '0');
+			}
+		}
+		exponent += negativeExponent ? -explicitExponent : explicitExponent;
+	}
+
+	if (truncated || mantissa > (1ull << 53) || exponent < -22 || exponent > 22)
+	{
+		*result = float(strtod(start, nullptr));
+		return p;
+	}
+
+	double value = double(mantissa);
+	value = exponent < 0 ? value / objPowersOf10[-exponent] : value * objPowersOf10[exponent];
+
+	*result = float(negative ? -value : value);
+	return p;
+}
+
+static inline const char* obj_parseInt(const char* p, i32* result)
+{
+	bool32 negative = *p == '-';
+	if (*p == '-' || *p == '+')
+	{
+		p++;
+	}
+
+	// Saturates, an index that large is out of range and resolves to "not present"
+	i32 value = 0;
+	for (; obj_isDigit(*p); p++)
+	{
+		i32 digit = *p - '0';
+		value = value > (INT32_MAX - digit) / 10 ? INT32_MAX : value * 10 + digit;
+	}
+
+	*result = negative ? -value : value;
+	return p;
+}
+
+// Every attribute array starts with a zero element so index 0 means "not present", as in fast_obj
+static inline u32 obj_resolveIndex(i32 index, size_t elementCount)
+{
+	if (index < 0)
+	{
+		index += i32(elementCount);
+	}
+	return (index > 0 && size_t(index) < elementCount) ? u32(index) : 0;
+}
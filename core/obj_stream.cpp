@@ -0,0 +1,402 @@
+#include "common.h"
+#include "glm.h"
+
+#include "obj_stream.h"
+#include "obj_parse.h"
+#include <chrono>
+
+// Open addressing table of output vertex indices keyed by the vertex bits
+struct ObjVertexTable
+{
+	vector<u32> slots;
+	u32 mask;
+};
+
+static void obj_growVertexTable(ObjVertexTable* table, const vector<Vertex>& vertices)
+{
+	size_t slotCount = table->slots.empty() ? 1024 : table->slots.size() * 2;
+	table->slots.clear();
+	table->slots.resize(slotCount, ~0u);
+	table->mask = u32(slotCount - 1);
+
+	for (u32 i = 0; i < u32(vertices.size()); i++)
+	{
+		u32 slot = hashVertex(vertices[i]) & table->mask;
+		while (table->slots[slot] != ~0u)
+		{
+			slot = (slot + 1) & table->mask;
+		}
+		table->slots[slot] = i;
+	}
+}
+
+struct ObjStreamState
+{
+	vector<float> positions;
+	vector<float> normals;
+	vector<float> texCoords;
+	ObjVertexTable table;
+	Mesh* mesh;
+	u64 faceCount;
+	// Faces after a usemtl, one list per material. Faces without material go straight to mesh->indices
+	vector<vector<u32>> materialIndices;
+	u32 material; // MESH_NO_MATERIAL before the first usemtl
+	string directory; // mtllib and map_Kd paths are relative to the OBJ, as in fast_obj
+};
+
+// Copies the rest of the line, without trailing blanks, truncated to size
+static const char* obj_parseName(const char* p, char* name, size_t size)
+{
+	p = obj_skipBlanks(p);
+	const char* end = obj_skipLine(p);
+	const char* last = end;
+	while (last > p && (last[-1] == ' ' || last[-1] == '\t' || last[-1] == '\r'))
+	{
+		last--;
+	}
+	size_t length = size_t(last - p) < size - 1 ? size_t(last - p) : size - 1;
+	memcpy(name, p, length);
+	name[length] = 0;
+	return end;
+}
+
+// A usemtl may come before the newmtl that defines it: the material starts out white and untextured, like fast_obj's default
+static u32 obj_findMaterial(ObjStreamState* state, const char* name)
+{
+	vector<MeshMaterial>& materials = state->mesh->materials;
+	for (u32 i = 0; i < u32(materials.size()); i++)
+	{
+		if (strcmp(materials[i].name, name) == 0)
+		{
+			return i;
+		}
+	}
+
+	MeshMaterial material = {};
+	strncpy(material.name, name, MESH_MATERIAL_NAME_SIZE - 1);
+	material.diffuseColor = glm::vec3(1.0f);
+	materials.push_back(material);
+	state->materialIndices.emplace_back();
+	return u32(materials.size() - 1);
+}
+
+// Only what MeshMaterial keeps: newmtl, Kd and map_Kd. A missing library leaves its materials at the default
+static void obj_loadMaterialLibrary(ObjStreamState* state, const char* name)
+{
+	const string path = state->directory + name;
+	u32 material = MESH_NO_MATERIAL;
+	obj_forEachLines(path.c_str(), [&](const char* text, const char* end)
+	{
+		for (const char* p = text; p < end; p = obj_skipLine(p) + 1)
+		{
+			p = obj_skipBlanks(p);
+			char value[MESH_MATERIAL_PATH_SIZE];
+			if (const char* q = obj_skipKeyword(p, "newmtl"))
+			{
+				p = obj_parseName(q, value, MESH_MATERIAL_NAME_SIZE);
+				material = obj_findMaterial(state, value);
+			}
+			else if (material == MESH_NO_MATERIAL)
+			{
+				continue;
+			}
+			else if (const char* q = obj_skipKeyword(p, "Kd"))
+			{
+				glm::vec3& color = state->mesh->materials[material].diffuseColor;
+				p = obj_parseFloat(q, &color.x);
+				p = obj_parseFloat(p, &color.y);
+				p = obj_parseFloat(p, &color.z);
+			}
+			else if (const char* q = obj_skipKeyword(p, "map_Kd"))
+			{
+				p = obj_parseName(q, value, sizeof(value));
+				snprintf(state->mesh->materials[material].diffuseTexturePath, MESH_MATERIAL_PATH_SIZE, "%s%s", state->directory.c_str(), value);
+			}
+		}
+	});
+}
+
+static u32 obj_addVertex(ObjStreamState* state, u32 p, u32 t, u32 n)
+{
+	Vertex v;
+	v.pos = { state->positions[p * 3 + 0], state->positions[p * 3 + 1], state->positions[p * 3 + 2] };
+	v.normal = { state->normals[n * 3 + 0], state->normals[n * 3 + 1], state->normals[n * 3 + 2] };
+	v.texCoord = { state->texCoords[t * 2 + 0], 1.0f - state->texCoords[t * 2 + 1] };
+
+	vector<Vertex>& vertices = state->mesh->vertices;
+	// Keep the load factor under 1/2
+	if ((vertices.size() + 1) * 2 > state->table.slots.size())
+	{
+		obj_growVertexTable(&state->table, vertices);
+	}
+
+	u32 slot = hashVertex(v) & state->table.mask;
+	for (;; slot = (slot + 1) & state->table.mask)
+	{
+		u32 index = state->table.slots[slot];
+		if (index == ~0u)
+		{
+			index = u32(vertices.size());
+			state->table.slots[slot] = index;
+			vertices.push_back(v);
+			return index;
+		}
+		if (memcmp(&vertices[index], &v, sizeof(Vertex)) == 0)
+		{
+			return index;
+		}
+	}
+}
+
+static const char* obj_parseFace(ObjStreamState* state, const char* p)
+{
+	vector<u32>& indices = state->material == MESH_NO_MATERIAL ? state->mesh->indices : state->materialIndices[state->material];
+	u32 first = 0;
+	u32 previous = 0;
+	u32 cornerCount = 0;
+
+	for (;;)
+	{
+		p = obj_skipBlanks(p);
+		if (!obj_isDigit(*p) && *p != '-' && *p != '+')
+		{
+			break;
+		}
+
+		i32 pi = 0, ti = 0, ni = 0;
+		p = obj_parseInt(p, &pi);
+		if (*p == '/')
+		{
+			p++;
+			if (*p != '/')
+			{
+				p = obj_parseInt(p, &ti);
+			}
+			if (*p == '/')
+			{
+				p++;
+				p = obj_parseInt(p, &ni);
+			}
+		}
+
+		u32 index = obj_addVertex(state,
+			obj_resolveIndex(pi, state->positions.size() / 3),
+			obj_resolveIndex(ti, state->texCoords.size() / 2),
+			obj_resolveIndex(ni, state->normals.size() / 3));
+
+		// Fan triangulation, same winding as the fast_obj path
+		if (cornerCount == 0)
+		{
+			first = index;
+		}
+		else if (cornerCount >= 2)
+		{
+			indices.push_back(first);
+			indices.push_back(previous);
+			indices.push_back(index);
+		}
+		previous = index;
+		cornerCount++;
+	}
+
+	state->faceCount += cornerCount >= 3;
+	return p;
+}
+
+// text is a run of whole lines: it ends with '\n', which stops every parser above
+static void obj_parseLines(ObjStreamState* state, const char* text, const char* end)
+{
+	const char* p = text;
+	while (p < end)
+	{
+		p = obj_skipBlanks(p);
+		if (p[0] == 'v')
+		{
+			if (p[1] == ' ' || p[1] == '\t')
+			{
+				float xyz[3];
+				p = obj_parseFloat(p + 2, &xyz[0]);
+				p = obj_parseFloat(p, &xyz[1]);
+				p = obj_parseFloat(p, &xyz[2]);
+				state->positions.insert(state->positions.end(), xyz, xyz + 3);
+			}
+			else if (p[1] == 't')
+			{
+				float uv[2];
+				p = obj_parseFloat(p + 2, &uv[0]);
+				p = obj_parseFloat(p, &uv[1]);
+				state->texCoords.insert(state->texCoords.end(), uv, uv + 2);
+			}
+			else if (p[1] == 'n')
+			{
+				float xyz[3];
+				p = obj_parseFloat(p + 2, &xyz[0]);
+				p = obj_parseFloat(p, &xyz[1]);
+				p = obj_parseFloat(p, &xyz[2]);
+				state->normals.insert(state->normals.end(), xyz, xyz + 3);
+			}
+		}
+		else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			p = obj_parseFace(state, p + 2);
+		}
+		else if (const char* q = obj_skipKeyword(p, "usemtl"))
+		{
+			char name[MESH_MATERIAL_NAME_SIZE];
+			p = obj_parseName(q, name, sizeof(name));
+			state->material = obj_findMaterial(state, name);
+		}
+		else if (const char* q = obj_skipKeyword(p, "mtllib"))
+		{
+			char name[MESH_MATERIAL_PATH_SIZE];
+			p = obj_parseName(q, name, sizeof(name));
+			obj_loadMaterialLibrary(state, name);
+		}
+
+		p = obj_skipLine(p) + 1;
+	}
+}
+
+bool32 obj_streamLines(const char* path, ObjLineFunction function, void* userData, u64* bufferBytes)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file)
+	{
+		return false;
+	}
+
+	// One spare byte for the '\n' appended to an unterminated last line
+	vector<char> buffer(OBJ_STREAM_CHUNK_SIZE + 1);
+	size_t pending = 0;
+	for (;;)
+	{
+		size_t bytesRead = fread(buffer.data() + pending, 1, buffer.size() - 1 - pending, file);
+		size_t available = pending + bytesRead;
+		bool32 endOfFile = bytesRead == 0;
+
+		if (endOfFile)
+		{
+			if (available > 0)
+			{
+				buffer[available] = '\n';
+				function(userData, buffer.data(), buffer.data() + available + 1);
+			}
+			break;
+		}
+
+		size_t lineEnd = available;
+		while (lineEnd > 0 && buffer[lineEnd - 1] != '\n')
+		{
+			lineEnd--;
+		}
+
+		if (lineEnd == 0)
+		{
+			// A single line longer than the buffer
+			if (available == buffer.size() - 1)
+			{
+				buffer.resize(buffer.size() * 2);
+			}
+			pending = available;
+			continue;
+		}
+
+		function(userData, buffer.data(), buffer.data() + lineEnd);
+		pending = available - lineEnd;
+		memmove(buffer.data(), buffer.data() + lineEnd, pending);
+	}
+	fclose(file);
+
+	if (bufferBytes)
+	{
+		*bufferBytes = CONTAINER_BYTES(buffer);
+	}
+
+	return true;
+}
+
+bool32 obj_loadStreaming(const char* path, Mesh* mesh, MeshLoadStats* stats)
+{
+	using Clock = std::chrono::high_resolution_clock;
+	Clock::time_point start = Clock::now();
+
+	ObjStreamState state = {};
+	state.mesh = mesh;
+	state.material = MESH_NO_MATERIAL;
+	const char* fileName = path;
+	for (const char* p = path; *p; p++)
+	{
+		fileName = *p == '/' || *p == '\\' ? p + 1 : fileName;
+	}
+	state.directory.assign(path, fileName);
+	state.positions.assign(3, 0.0f);
+	state.normals.assign(3, 0.0f);
+	state.texCoords.assign(2, 0.0f);
+	mesh->vertices.clear();
+	mesh->indices.clear();
+	mesh->submeshes.clear();
+	mesh->materials.clear();
+
+	u64 bufferBytes = 0;
+	bool32 read = obj_forEachLines(path, [&](const char* text, const char* end)
+	{
+		obj_parseLines(&state, text, end);
+	}, &bufferBytes);
+	if (!read)
+	{
+		return false;
+	}
+
+	// One submesh per material in material order, faces without material last, as mesh_sortByMaterial orders them
+	u64 concatenationBytes = 0;
+	if (state.materialIndices.empty())
+	{
+		mesh->submeshes.push_back({ 0, u32(mesh->indices.size()), MESH_NO_MATERIAL });
+	}
+	else
+	{
+		vector<u32> unassigned;
+		unassigned.swap(mesh->indices);
+		size_t indexCount = unassigned.size();
+		concatenationBytes = CONTAINER_BYTES(unassigned);
+		for (const vector<u32>& indices : state.materialIndices)
+		{
+			indexCount += indices.size();
+			concatenationBytes += CONTAINER_BYTES(indices);
+		}
+		mesh->indices.reserve(indexCount);
+		for (u32 material = 0; material < u32(state.materialIndices.size()); material++)
+		{
+			vector<u32>& indices = state.materialIndices[material];
+			if (!indices.empty())
+			{
+				mesh->submeshes.push_back({ u32(mesh->indices.size()), u32(indices.size()), material });
+				mesh->indices.insert(mesh->indices.end(), indices.begin(), indices.end());
+			}
+			vector<u32>().swap(indices);
+		}
+		if (!unassigned.empty())
+		{
+			mesh->submeshes.push_back({ u32(mesh->indices.size()), u32(unassigned.size()), MESH_NO_MATERIAL });
+			mesh->indices.insert(mesh->indices.end(), unassigned.begin(), unassigned.end());
+		}
+	}
+
+	if (stats)
+	{
+		// Capacities only grow, so together they are the high-water mark of what this loader owns (reallocation copies aside)
+		u64 peakBytes =
+			bufferBytes +
+			u64(state.positions.capacity() + state.normals.capacity() + state.texCoords.capacity()) * sizeof(float) +
+			u64(state.table.slots.capacity()) * sizeof(u32) +
+			u64(mesh->vertices.capacity()) * sizeof(Vertex) +
+			u64(mesh->indices.capacity()) * sizeof(u32) +
+			concatenationBytes;
+
+		stats->faceCount = state.faceCount;
+		stats->parseSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+		stats->peakWorkingBytes = peakBytes;
+	}
+
+	return true;
+}
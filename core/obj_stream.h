@@ -0,0 +1,32 @@
+#pragma once
+
+#include "common.h"
+#include "glm.h"
+#include "model.h"
+
+// Size of the read buffer; lines longer than this grow it
+#define OBJ_STREAM_CHUNK_SIZE (1 << 20)
+
+/*
+Single pass OBJ loader: reads the file in fixed size chunks, triangulates faces as they are parsed and deduplicates
+vertices on the fly, so no unindexed vertex array is ever built. Peak memory is the attribute arrays plus the
+output mesh and its hash table. Faces are split by usemtl into one submesh per material, and mtllib fills the
+materials as fast_obj does; groups are ignored.
+*/
+bool32 obj_loadStreaming(const char* path, Mesh* mesh, MeshLoadStats* stats = nullptr);
+
+// Calls function on runs of whole lines, each ending with '\n', read in OBJ_STREAM_CHUNK_SIZE chunks. bufferBytes: read buffer high-water mark
+typedef void (*ObjLineFunction)(void* userData, const char* text, const char* end);
+bool32 obj_streamLines(const char* path, ObjLineFunction function, void* userData, u64* bufferBytes = nullptr);
+
+template<typename Function>
+inline void obj_lineFunction(void* userData, const char* text, const char* end)
+{
+	(*(const Function*)userData)(text, end);
+}
+
+template<typename Function>
+inline bool32 obj_forEachLines(const char* path, const Function& function, u64* bufferBytes = nullptr)
+{
+	return obj_streamLines(path, obj_lineFunction<Function>, (void*)&function, bufferBytes);
+}
@@ -0,0 +1,561 @@
+#include "common.h"
+#include "red_allocation_log.h"
+#include "red_allocator.h"
+
+#include <EASTL/sort.h>
+#include <chrono>
+#include <thread>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef _MSC_VER
+extern "C" IMAGE_DOS_HEADER __ImageBase;
+#endif
+
+static_assert(ALLOCATION_TAG_COUNT <= 256, "Events store the tag in a byte");
+static_assert(sizeof(AllocationLogEvent) == 32, "AllocationLogEvent is written to the log as is");
+
+// Written by one thread, read by the drainer. head and tail are free running
+struct AllocationLogRing
+{
+	alignas(64) std::atomic<u64> head;
+	alignas(64) std::atomic<u64> tail;
+	std::atomic<u64> droppedEventCount;
+	std::atomic<u32> abandoned; // Its thread finished, the next new thread takes it over
+	u16 thread;
+	AllocationLogEvent events[ALLOCATION_LOG_RING_CAPACITY];
+};
+
+struct AllocationLogGlobals
+{
+	std::atomic<u32> lock;
+	AllocationLogRing* rings[ALLOCATION_LOG_MAX_THREADS];
+	std::atomic<u32> ringCount;
+	std::atomic<u32> stopDrainer;
+	std::thread* drainer;
+	FILE* file;
+	u32 callerDepth;
+	u64 beginDroppedEventCount; // Of all rings, which count for as long as they live
+	AllocationLogHeader header;
+	std::chrono::high_resolution_clock::time_point beginTime;
+};
+
+std::atomic<u32> allocationLog_active;
+static AllocationLogGlobals allocationLog;
+static thread_local AllocationLogRing* allocationLog_threadRing;
+static thread_local bool32 allocationLog_threadExited;
+// The drainer allocates through stdio: its allocations would feed the rings it drains
+static thread_local bool32 allocationLog_threadIgnored;
+
+struct AllocationLogThreadExit
+{
+	AllocationLogRing* ring;
+
+	~AllocationLogThreadExit()
+	{
+		allocationLog_threadRing = nullptr;
+		allocationLog_threadExited = true;
+		if (ring)
+		{
+			ring->abandoned.store(1, std::memory_order_release);
+		}
+	}
+};
+
+static thread_local AllocationLogThreadExit allocationLog_threadExit;
+
+static void* allocationLog_allocatePages(size_t size)
+{
+#ifdef _WIN64
+	return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+	void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return memory == MAP_FAILED ? nullptr : memory;
+#endif
+}
+
+static inline u64 allocationLog_ticks()
+{
+	return __rdtsc();
+}
+
+// Rings are never released: threads that come and go reuse the ones left behind
+static AllocationLogRing* allocationLog_acquireRing()
+{
+	while (allocationLog.lock.exchange(1, std::memory_order_acquire))
+	{
+		std::this_thread::yield();
+	}
+
+	AllocationLogRing* ring = nullptr;
+	u32 ringCount = allocationLog.ringCount.load(std::memory_order_relaxed);
+	for (u32 i = 0; i < ringCount; i++)
+	{
+		u32 abandoned = 1;
+		if (allocationLog.rings[i]->abandoned.compare_exchange_strong(abandoned, 0, std::memory_order_acquire))
+		{
+			ring = allocationLog.rings[i];
+			break;
+		}
+	}
+	if (!ring && ringCount < ALLOCATION_LOG_MAX_THREADS)
+	{
+		ring = (AllocationLogRing*)allocationLog_allocatePages(sizeof(AllocationLogRing));
+		if (ring)
+		{
+			ring->thread = u16(ringCount);
+			allocationLog.rings[ringCount] = ring;
+			allocationLog.ringCount.store(ringCount + 1, std::memory_order_release);
+		}
+	}
+
+	allocationLog.lock.store(0, std::memory_order_release);
+	return ring;
+}
+
+void allocationLog_record(AllocationLogEventType type, void* address, u64 size, u32 tag, void* returnAddress)
+{
+	AllocationLogRing* ring = allocationLog_threadRing;
+	if (!ring)
+	{
+		if (allocationLog_threadIgnored)
+		{
+			return;
+		}
+		ring = allocationLog_acquireRing();
+		if (!ring)
+		{
+			return;
+		}
+		allocationLog_threadRing = ring;
+		if (!allocationLog_threadExited)
+		{
+			allocationLog_threadExit.ring = ring;
+		}
+	}
+
+	const u64 head = ring->head.load(std::memory_order_relaxed);
+	if (head - ring->tail.load(std::memory_order_acquire) >= ALLOCATION_LOG_RING_CAPACITY)
+	{
+		ring->droppedEventCount.store(ring->droppedEventCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		return;
+	}
+
+#ifdef _WIN64
+	if (allocationLog.callerDepth)
+	{
+		// Frame 0 is this function and frame 1 the operator new or delete that called it
+		void* frame = nullptr;
+		if (RtlCaptureStackBackTrace(2 + allocationLog.callerDepth, 1, &frame, nullptr))
+		{
+			returnAddress = frame;
+		}
+	}
+#endif
+
+	AllocationLogEvent& event = ring->events[head & (ALLOCATION_LOG_RING_CAPACITY - 1)];
+	event.timestamp = allocationLog_ticks();
+	event.callsite = (u64)returnAddress;
+	event.address = (u64)address;
+	event.size = size < 0xFFFFFFFFull ? u32(size) : 0xFFFFFFFFu;
+	event.type = u8(type);
+	event.tag = u8(tag);
+	event.thread = ring->thread;
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+/*
+A thread that saw the previous log still active may publish its event after this log began and reset the rings. Its
+timestamp is older than the log: leave it out
+*/
+static u64 allocationLog_write(const AllocationLogEvent* events, u64 count)
+{
+	const u64 beginTicks = allocationLog.header.beginTicks;
+	u64 writtenCount = 0;
+	u64 runStart = 0;
+	for (u64 i = 0; i <= count; i++)
+	{
+		if (i == count || events[i].timestamp < beginTicks)
+		{
+			fwrite(&events[runStart], sizeof(AllocationLogEvent), size_t(i - runStart), allocationLog.file);
+			writtenCount += i - runStart;
+			runStart = i + 1;
+		}
+	}
+	return writtenCount;
+}
+
+static u64 allocationLog_drain()
+{
+	u64 drainedCount = 0;
+	const u32 ringCount = allocationLog.ringCount.load(std::memory_order_acquire);
+	for (u32 i = 0; i < ringCount; i++)
+	{
+		AllocationLogRing* ring = allocationLog.rings[i];
+		const u64 head = ring->head.load(std::memory_order_acquire);
+		u64 tail = ring->tail.load(std::memory_order_relaxed);
+		while (tail != head)
+		{
+			// Up to the end of the ring, then from its start
+			const u64 start = tail & (ALLOCATION_LOG_RING_CAPACITY - 1);
+			const u64 count = min(head - tail, ALLOCATION_LOG_RING_CAPACITY - start);
+			drainedCount += allocationLog_write(&ring->events[start], count);
+			tail += count;
+		}
+		ring->tail.store(tail, std::memory_order_release);
+	}
+	return drainedCount;
+}
+
+static void allocationLog_drainerLoop()
+{
+	allocationLog_threadIgnored = true;
+	while (!allocationLog.stopDrainer.load(std::memory_order_acquire))
+	{
+		allocationLog.header.eventCount += allocationLog_drain();
+		std::this_thread::sleep_for(std::chrono::milliseconds(ALLOCATION_LOG_DRAIN_INTERVAL_MS));
+	}
+}
+
+bool32 allocationLog_begin(const char* path, u32 callerDepth)
+{
+	assert(!allocationLog_active.load());
+	allocationLog.file = fopen(path, "wb");
+	if (!allocationLog.file)
+	{
+		return false;
+	}
+
+	AllocationLogHeader& header = allocationLog.header;
+	header = {};
+	header.magic = ALLOCATION_LOG_MAGIC;
+	header.version = ALLOCATION_LOG_VERSION;
+#ifdef _MSC_VER
+	header.imageBase = (u64)&__ImageBase;
+#endif
+	fwrite(&header, sizeof(header), 1, allocationLog.file);
+	// Before the rings are reset: whatever the previous log's late writers publish from now on is older and dropped
+	allocationLog.beginTime = std::chrono::high_resolution_clock::now();
+	header.beginTicks = allocationLog_ticks();
+
+	// Events left over from the previous log, written after its last drain. Dropped counts are never reset, a late
+	// writer could overwrite the reset with its own count
+	allocationLog.beginDroppedEventCount = 0;
+	const u32 ringCount = allocationLog.ringCount.load(std::memory_order_acquire);
+	for (u32 i = 0; i < ringCount; i++)
+	{
+		allocationLog.rings[i]->tail.store(allocationLog.rings[i]->head.load(std::memory_order_acquire), std::memory_order_release);
+		allocationLog.beginDroppedEventCount += allocationLog.rings[i]->droppedEventCount.load(std::memory_order_relaxed);
+	}
+
+	allocationLog.callerDepth = callerDepth;
+	allocationLog.stopDrainer.store(0);
+	allocationLog.drainer = new std::thread(allocationLog_drainerLoop);
+	allocationLog_active.store(1, std::memory_order_release);
+	return true;
+}
+
+void allocationLog_end()
+{
+	if (!allocationLog_active.load())
+	{
+		return;
+	}
+	allocationLog_active.store(0);
+	AllocationLogHeader& header = allocationLog.header;
+	header.endTicks = allocationLog_ticks();
+	header.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - allocationLog.beginTime).count();
+
+	allocationLog.stopDrainer.store(1, std::memory_order_release);
+	allocationLog.drainer->join();
+	delete allocationLog.drainer;
+	allocationLog.drainer = nullptr;
+	header.eventCount += allocationLog_drain();
+
+	const u32 ringCount = allocationLog.ringCount.load(std::memory_order_acquire);
+	for (u32 i = 0; i < ringCount; i++)
+	{
+		header.droppedEventCount += allocationLog.rings[i]->droppedEventCount.load(std::memory_order_relaxed);
+	}
+	header.droppedEventCount -= allocationLog.beginDroppedEventCount;
+	fseek(allocationLog.file, 0, SEEK_SET);
+	fwrite(&header, sizeof(header), 1, allocationLog.file);
+	fclose(allocationLog.file);
+	allocationLog.file = nullptr;
+	printf("Allocation log: %llu events, %llu dropped\n", header.eventCount, header.droppedEventCount);
+}
+
+struct AllocationLogCallsite
+{
+	u64 callsite; // 0 for an empty entry
+	u64 count;
+	u64 bytes;
+};
+
+// An allocation seen by the summary that wasn't freed yet
+struct AllocationLogLiveEntry
+{
+	u64 address; // 0 for an empty entry
+	u64 timestamp;
+	u32 size;
+};
+
+#define ALLOCATION_LOG_SIZE_BUCKETS 33
+// Bucket b holds lifetimes in [2^(b-1), 2^b) microseconds, bucket 0 those under one, the last one is open ended
+#define ALLOCATION_LOG_LIFETIME_BUCKETS 36
+
+static inline size_t allocationLog_hashSlot(u64 key, size_t tableSize)
+{
+	return size_t((key * 0x9E3779B97F4A7C15ull) >> 20) & (tableSize - 1);
+}
+
+static void allocationLog_growLive(vector<AllocationLogLiveEntry>& live)
+{
+	vector<AllocationLogLiveEntry> grown(live.size() * 2);
+	for (const AllocationLogLiveEntry& entry : live)
+	{
+		if (entry.address)
+		{
+			size_t index = allocationLog_hashSlot(entry.address, grown.size());
+			while (grown[index].address)
+			{
+				index = (index + 1) & (grown.size() - 1);
+			}
+			grown[index] = entry;
+		}
+	}
+	live.swap(grown);
+}
+
+// Backward shift deletion keeps linear probing chains intact without tombstones
+static void allocationLog_removeLive(vector<AllocationLogLiveEntry>& live, size_t index)
+{
+	const size_t mask = live.size() - 1;
+	size_t hole = index;
+	for (size_t next = (hole + 1) & mask; live[next].address; next = (next + 1) & mask)
+	{
+		const size_t home = allocationLog_hashSlot(live[next].address, live.size());
+		// Move next into the hole unless its home lies cyclically in (hole, next]
+		if (((next - home) & mask) >= ((next - hole) & mask))
+		{
+			live[hole] = live[next];
+			hole = next;
+		}
+	}
+	live[hole].address = 0;
+}
+
+void allocationLog_summarize(const char* path, u32 topCallsiteCount)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file)
+	{
+		printf("Allocation log %s: can't open\n", path);
+		return;
+	}
+	AllocationLogHeader header;
+	if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != ALLOCATION_LOG_MAGIC || header.version != ALLOCATION_LOG_VERSION)
+	{
+		printf("Allocation log %s: not a version %u log\n", path, ALLOCATION_LOG_VERSION);
+		fclose(file);
+		return;
+	}
+
+	// Rings are drained in batches, so the file is only in order per thread: pairing frees needs the whole log sorted
+	vector<AllocationLogEvent> events;
+	vector<AllocationLogEvent> batch(64 * 1024);
+	size_t readCount;
+	while ((readCount = fread(batch.data(), sizeof(AllocationLogEvent), batch.size(), file)) > 0)
+	{
+		events.insert(events.end(), batch.begin(), batch.begin() + readCount);
+	}
+	fclose(file);
+	batch.clear();
+	batch.shrink_to_fit();
+	eastl::sort(events.begin(), events.end(), [](const AllocationLogEvent& a, const AllocationLogEvent& b) { return a.timestamp < b.timestamp; });
+
+	// Open addressing on the callsite and on the live addresses, grown at half load
+	vector<AllocationLogCallsite> callsites(1024);
+	u64 callsiteCount = 0;
+	u64 sizeCounts[ALLOCATION_LOG_SIZE_BUCKETS] = {};
+	u64 sizeBytes[ALLOCATION_LOG_SIZE_BUCKETS] = {};
+	u64 tagCounts[ALLOCATION_TAG_COUNT] = {};
+	u64 tagBytes[ALLOCATION_TAG_COUNT] = {};
+	u64 totalCount = 0;
+	u64 totalBytes = 0;
+
+	vector<AllocationLogLiveEntry> live(1024);
+	u64 liveCount = 0;
+	u64 liveBytes = 0;
+	u64 peakLiveBytes = 0;
+	u64 peakLiveTimestamp = header.beginTicks;
+	u64 freeCount = 0;
+	u64 unmatchedFreeCount = 0;
+	u64 unmatchedAllocationCount = 0;
+	u64 lifetimeCounts[ALLOCATION_LOG_LIFETIME_BUCKETS] = {};
+	const double seconds = header.seconds > 0.0 ? header.seconds : 1.0;
+	const double ticksPerMicrosecond = header.endTicks > header.beginTicks ? double(header.endTicks - header.beginTicks) / (seconds * 1e6) : 1.0;
+
+	for (const AllocationLogEvent& event : events)
+	{
+		if (event.type == ALLOCATION_LOG_EVENT_FREE)
+		{
+			freeCount++;
+			size_t index = allocationLog_hashSlot(event.address, live.size());
+			while (live[index].address && live[index].address != event.address)
+			{
+				index = (index + 1) & (live.size() - 1);
+			}
+			if (!live[index].address)
+			{
+				unmatchedFreeCount++;
+				continue;
+			}
+
+			const double microseconds = double(event.timestamp - live[index].timestamp) / ticksPerMicrosecond;
+			u32 bucket = 0;
+			while (bucket + 1 < ALLOCATION_LOG_LIFETIME_BUCKETS && microseconds >= double(1ull << bucket))
+			{
+				bucket++;
+			}
+			lifetimeCounts[bucket]++;
+			liveBytes -= live[index].size;
+			liveCount--;
+			allocationLog_removeLive(live, index);
+			continue;
+		}
+
+		totalCount++;
+		totalBytes += event.size;
+
+		// Bucket b holds sizes in [2^(b-1), 2^b), bucket 0 the empty allocations
+		u32 bucket = 0;
+		for (u32 size = event.size; size; size >>= 1)
+		{
+			bucket++;
+		}
+		sizeCounts[bucket]++;
+		sizeBytes[bucket] += event.size;
+		const u32 tag = event.tag < ALLOCATION_TAG_COUNT ? event.tag : ALLOCATION_TAG_UNTAGGED;
+		tagCounts[tag]++;
+		tagBytes[tag] += event.size;
+
+		if (callsiteCount * 2 >= callsites.size())
+		{
+			vector<AllocationLogCallsite> grown(callsites.size() * 2);
+			for (const AllocationLogCallsite& entry : callsites)
+			{
+				if (entry.callsite)
+				{
+					size_t index = allocationLog_hashSlot(entry.callsite, grown.size());
+					while (grown[index].callsite)
+					{
+						index = (index + 1) & (grown.size() - 1);
+					}
+					grown[index] = entry;
+				}
+			}
+			callsites.swap(grown);
+		}
+		const u64 callsite = event.callsite ? event.callsite : 1;
+		size_t index = allocationLog_hashSlot(callsite, callsites.size());
+		while (callsites[index].callsite && callsites[index].callsite != callsite)
+		{
+			index = (index + 1) & (callsites.size() - 1);
+		}
+		if (!callsites[index].callsite)
+		{
+			callsites[index].callsite = callsite;
+			callsiteCount++;
+		}
+		callsites[index].count++;
+		callsites[index].bytes += event.size;
+
+		if (!event.address)
+		{
+			continue;
+		}
+		if (liveCount * 2 >= live.size())
+		{
+			allocationLog_growLive(live);
+		}
+		size_t liveIndex = allocationLog_hashSlot(event.address, live.size());
+		while (live[liveIndex].address && live[liveIndex].address != event.address)
+		{
+			liveIndex = (liveIndex + 1) & (live.size() - 1);
+		}
+		if (live[liveIndex].address)
+		{
+			// Handed out again without a free in the log: that free was dropped
+			unmatchedAllocationCount++;
+			liveBytes -= live[liveIndex].size;
+		}
+		else
+		{
+			liveCount++;
+		}
+		live[liveIndex] = { event.address, event.timestamp, event.size };
+		liveBytes += event.size;
+		if (liveBytes > peakLiveBytes)
+		{
+			peakLiveBytes = liveBytes;
+			peakLiveTimestamp = event.timestamp;
+		}
+	}
+
+	printf("Allocation log %s: %llu events (%llu dropped) in %.2f s, %.2f MiB, %llu callsites\n", path, u64(events.size()), header.droppedEventCount, header.seconds, double(totalBytes) / (1024.0 * 1024.0), callsiteCount);
+	printf("\t%.0f allocations/s, %.2f MiB/s, %.0f frees/s\n", double(totalCount) / seconds, double(totalBytes) / (1024.0 * 1024.0) / seconds, double(freeCount) / seconds);
+
+	eastl::sort(callsites.begin(), callsites.end(), [](const AllocationLogCallsite& a, const AllocationLogCallsite& b) { return a.count > b.count; });
+	printf("\tTop callsites, image relative:\n");
+	for (u32 i = 0; i < topCallsiteCount && i < callsiteCount; i++)
+	{
+		const AllocationLogCallsite& entry = callsites[i];
+		printf("\t\t+0x%llx: %llu allocations (%.1f%%), %.2f MiB, %.0f bytes on average\n", entry.callsite - header.imageBase, entry.count, 100.0 * double(entry.count) / double(totalCount), double(entry.bytes) / (1024.0 * 1024.0), double(entry.bytes) / double(entry.count));
+	}
+
+	printf("\tSizes:\n");
+	for (u32 bucket = 0; bucket < ALLOCATION_LOG_SIZE_BUCKETS; bucket++)
+	{
+		if (sizeCounts[bucket])
+		{
+			const u64 low = bucket ? 1ull << (bucket - 1) : 0;
+			printf("\t\t%10llu - %10llu: %10llu allocations (%5.1f%%), %.2f MiB\n", low, bucket ? (1ull << bucket) - 1 : 0, sizeCounts[bucket], 100.0 * double(sizeCounts[bucket]) / double(totalCount), double(sizeBytes[bucket]) / (1024.0 * 1024.0));
+		}
+	}
+
+	printf("\tTags:\n");
+	for (u32 tag = 0; tag < ALLOCATION_TAG_COUNT; tag++)
+	{
+		if (tagCounts[tag])
+		{
+			printf("\t\t%-12s %10llu allocations, %.2f MiB\n", allocationTag_name(AllocationTag(tag)), tagCounts[tag], double(tagBytes[tag]) / (1024.0 * 1024.0));
+		}
+	}
+
+	// Memory allocated before the log started isn't counted, its frees show up as unmatched
+	printf("\tLive: %.2f MiB peak at %.3f s, %.2f MiB in %llu allocations left at the end\n", double(peakLiveBytes) / (1024.0 * 1024.0),
+		double(peakLiveTimestamp - header.beginTicks) / (ticksPerMicrosecond * 1e6), double(liveBytes) / (1024.0 * 1024.0), liveCount);
+	const u64 pairedCount = freeCount - unmatchedFreeCount;
+	printf("\tFrees: %llu, %llu without a logged allocation (made before the log started, or dropped), %llu allocations whose free was dropped\n", freeCount, unmatchedFreeCount, unmatchedAllocationCount);
+	printf("\tLifetimes of the %llu allocations freed while logging:\n", pairedCount);
+	for (u32 bucket = 0; bucket < ALLOCATION_LOG_LIFETIME_BUCKETS; bucket++)
+	{
+		if (lifetimeCounts[bucket])
+		{
+			const u64 low = bucket ? 1ull << (bucket - 1) : 0;
+			if (bucket + 1 < ALLOCATION_LOG_LIFETIME_BUCKETS)
+			{
+				printf("\t\t%11llu - %11llu us: %10llu allocations (%5.1f%%)\n", low, 1ull << bucket, lifetimeCounts[bucket], 100.0 * double(lifetimeCounts[bucket]) / double(pairedCount));
+			}
+			else
+			{
+				printf("\t\t%11llu us or more:  %10llu allocations (%5.1f%%)\n", low, lifetimeCounts[bucket], 100.0 * double(lifetimeCounts[bucket]) / double(pairedCount));
+			}
+		}
+	}
+}
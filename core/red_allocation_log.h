@@ -0,0 +1,84 @@
+#pragma once
+
+#include "common.h"
+#include <atomic>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/*
+Binary log of every operator new and delete while recording. Each thread appends compact events to its own lock-free
+ring and a background thread drains the rings to a file, so recording costs a timestamp and a few stores per event.
+Full rings drop events instead of waiting. Allocations are stamped once they returned and frees before they release
+the memory, so in timestamp order an address is always freed before it is handed out again.
+*/
+#define ALLOCATION_LOG_RING_CAPACITY (64 * 1024)
+#define ALLOCATION_LOG_MAX_THREADS 256
+#define ALLOCATION_LOG_DRAIN_INTERVAL_MS 2
+
+enum AllocationLogEventType : u8
+{
+	ALLOCATION_LOG_EVENT_ALLOCATE,
+	ALLOCATION_LOG_EVENT_FREE,
+};
+
+struct AllocationLogEvent
+{
+	u64 timestamp; // TSC ticks
+	u64 callsite; // Return address in the allocating or freeing code
+	u64 address; // Pairs a free with its allocation
+	u32 size; // Saturates at 4 GiB, 0 for frees
+	u8 type; // AllocationLogEventType
+	u8 tag; // AllocationTag
+	u16 thread;
+};
+
+struct AllocationLogHeader
+{
+	u32 magic;
+	u32 version;
+	u64 imageBase; // Subtract from callsites to get addresses the debugger and the PDB agree on
+	u64 beginTicks;
+	u64 endTicks;
+	double seconds; // Wall time between beginTicks and endTicks
+	u64 eventCount;
+	u64 droppedEventCount;
+};
+
+#define ALLOCATION_LOG_MAGIC 0x474F4C41 // "ALOG"
+#define ALLOCATION_LOG_VERSION 2
+
+extern std::atomic<u32> allocationLog_active;
+
+/*
+callerDepth 0 attributes each allocation to the code that called operator new. EASTL containers all allocate from
+eastl::allocator::allocate, so their real callsite is 1 or 2 frames up: a depth above 0 walks the stack to find it,
+which costs microseconds instead of nanoseconds (Windows only).
+*/
+bool32 allocationLog_begin(const char* path, u32 callerDepth = 0);
+void allocationLog_end();
+void allocationLog_record(AllocationLogEventType type, void* address, u64 size, u32 tag, void* returnAddress);
+/*
+Reads a finished log: top callsites by count, size histogram and bytes per tag of the allocations, then live bytes
+over time and a lifetime histogram from pairing frees with allocations. The pairing sorts the whole log in memory.
+*/
+void allocationLog_summarize(const char* path, u32 topCallsiteCount);
+
+#ifdef _MSC_VER
+#define ALLOCATION_LOG_RETURN_ADDRESS() _ReturnAddress()
+#else
+#define ALLOCATION_LOG_RETURN_ADDRESS() __builtin_return_address(0)
+#endif
+
+// Inline in the operator new and delete overrides, so the return address is the allocating code and not a helper
+#define ALLOCATION_LOG_RECORD(memory, size, tag)\
+if (allocationLog_active.load(std::memory_order_relaxed))\
+{\
+	allocationLog_record(ALLOCATION_LOG_EVENT_ALLOCATE, (memory), (size), (tag), ALLOCATION_LOG_RETURN_ADDRESS());\
+}
+
+#define ALLOCATION_LOG_RECORD_FREE(memory)\
+if ((memory) && allocationLog_active.load(std::memory_order_relaxed))\
+{\
+	allocationLog_record(ALLOCATION_LOG_EVENT_FREE, (memory), 0, ALLOCATION_TAG_UNTAGGED, ALLOCATION_LOG_RETURN_ADDRESS());\
+}
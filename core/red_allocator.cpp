@@ -1,259 +1,1328 @@
 #include "common.h"
+#include "red_allocator.h"
+#include "red_allocation_log.h"
+#include "red_memory.h"
 
-#define OWN_GENERAL_PURPOSE_ALLOCATOR 0
-#define OWN_ALLOCATOR_FOR_EASTL 0
-#define EASTL_ALLOCATION_DEBUGGING_INFO 1
-#define GENERAL_PURPOSE_ALLOCATION_DEBUGGING_INFO 1
+#include <atomic>
+#include <new>
+#include <thread>
+#ifndef _WIN64
+#include <sys/mman.h>
+#endif
+
+#define OWN_GENERAL_PURPOSE_ALLOCATOR 1
+// EASTL frees through operator delete[], so both have to come from the same allocator
+#define OWN_ALLOCATOR_FOR_EASTL 1
+// Lets allocationLog_begin record every operator new and delete. Costs a relaxed load per call while not recording
+#define ALLOCATION_LOG 1
+
+#if OWN_ALLOCATOR_FOR_EASTL != OWN_GENERAL_PURPOSE_ALLOCATOR
+#error "EASTL memory is freed by operator delete[]: OWN_ALLOCATOR_FOR_EASTL and OWN_GENERAL_PURPOSE_ALLOCATOR go together"
+#endif
+
+#if !OWN_GENERAL_PURPOSE_ALLOCATOR
+/*
+Without the allocator every operator new goes through malloc with the original pointer stored right before the
+returned one, so the same free takes aligned and unaligned memory. _aligned_offset_malloc and posix_memalign can't be
+freed by the same function on both platforms, and posix_memalign has no offset
+*/
+static void* system_allocate(size_t size, size_t alignment, size_t alignmentOffset)
+{
+	alignmentOffset &= alignment - 1;
+	u8* base = (u8*)malloc(size + alignment + sizeof(void*));
+	if (!base)
+	{
+		return nullptr;
+	}
+	u8* memory = (u8*)((((size_t)base + sizeof(void*) + alignmentOffset + alignment - 1) & ~(alignment - 1)) - alignmentOffset);
+	memcpy(memory - sizeof(void*), &base, sizeof(void*));
+	return memory;
+}
 
-#ifndef STATIC_MEMORY_SIZE 
-#define STATIC_MEMORY_SIZE (20 * MEGABYTE)
+static void system_free(void* memory)
+{
+	if (memory)
+	{
+		void* base;
+		memcpy(&base, (u8*)memory - sizeof(void*), sizeof(void*));
+		free(base);
+	}
+}
 #endif
 
-size_t staticMemorySize = STATIC_MEMORY_SIZE;
-char staticBlob[STATIC_MEMORY_SIZE];
+struct AllocatorFreeBlock
+{
+	AllocatorFreeBlock* next;
+};
+
+struct AllocatorPage
+{
+	AllocatorFreeBlock* freeList;
+	u8* start;
+	u32 blockSize;
+	u32 capacity;
+	u32 usedCount;
+	u32 bumpCount; // Blocks past it were never handed out and aren't in freeList
+	u8 sizeClass;
+	u8 full; // Unlinked from the heap list until one of its blocks is freed
+	std::atomic<u8> hasAligned; // Holds pointers past the block start, frees have to round down. Remote frees read it
+	u8 tag;
+	AllocatorPage* next;
+	AllocatorPage* previous;
+};
+
+enum class AllocatorSegmentKind : u32
+{
+	SMALL,
+	MEDIUM,
+	LARGE,
+};
+
+struct AllocatorHeap;
+
+struct AllocatorSegment
+{
+	AllocatorSegmentKind kind;
+	u32 pageShift;
+	u32 pageCount;
+	u32 usedPageCount;
+	u32 bumpPageCount;
+	AllocatorHeap* heap;
+	AllocatorSegment* next;
+	AllocatorSegment* previous;
+	AllocatorPage* freePages;
+	void* osBase;
+	size_t osSize;
+	size_t size; // Usable bytes from the segment start
+	size_t largeSize; // Bytes asked for, LARGE only
+	u32 largeTag;
+	AllocatorPage pages[ALLOCATOR_SEGMENT_SIZE / ALLOCATOR_SMALL_PAGE_SIZE];
+};
+
+// Page 0 starts after the header, so a segment loses no page to it
+#define ALLOCATOR_SEGMENT_HEADER_SIZE ((sizeof(AllocatorSegment) + 63) & ~size_t(63))
+
+// Read by allocator_getStats from any thread, written only by the owner: relaxed loads and stores, no locked RMW
+struct AllocatorCounter
+{
+	std::atomic<u64> value;
+
+	inline void add(u64 count)
+	{
+		value.store(value.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+	}
+};
 
-struct MemoryBlock
+// Cache line aligned: neighbouring heaps belong to different threads
+struct alignas(64) AllocatorHeap
 {
-    void* blob;
-    void* freePointer;
+	AllocatorPage* pages[ALLOCATION_TAG_COUNT][ALLOCATOR_SIZE_CLASS_COUNT]; // Pages with room first, full pages are unlinked
+	AllocatorSegment* segments[2]; // SMALL and MEDIUM
+	std::atomic<AllocatorFreeBlock*> remoteFrees;
+	AllocatorHeap* nextHeap;
+	AllocatorHeap* nextAbandoned;
+	AllocatorCounter allocations;
+	AllocatorCounter frees;
 };
 
-struct StaticMemory : MemoryBlock
+#define ALLOCATOR_HEAPS_PER_CHUNK 64
+// Freed segments kept mapped for reuse, so large allocation churn doesn't turn into map, fault and unmap churn
+#define ALLOCATOR_SEGMENT_CACHE_COUNT 32
+#define ALLOCATOR_SEGMENT_CACHE_BYTES (64 * MEGABYTE)
+#define ALLOCATOR_HUGE_PAGE_THRESHOLD (8 * MEGABYTE)
+
+struct AllocatorHeapChunk
 {
-    StaticMemory()
-	   : MemoryBlock({ (void*)staticBlob, (void*)staticBlob })
-    {}
+	AllocatorHeap heaps[ALLOCATOR_HEAPS_PER_CHUNK];
+	AllocatorHeapChunk* next;
 };
 
-const size_t staticBigPoolSize = 4 * GIGABYTE;
-char bigPool[staticBigPoolSize];
+// Shared by every thread: tagged allocations pay a locked add, plain operator new doesn't
+struct alignas(64) AllocationTagCounters
+{
+	std::atomic<u64> liveBytes;
+	std::atomic<u64> peakBytes;
+	std::atomic<u64> liveCount;
+	std::atomic<u64> allocationCount;
+};
 
-struct StaticBigPool : MemoryBlock
+// Zero initialized before any constructor runs, so operator new works during static initialization
+struct AllocatorGlobals
 {
-    StaticBigPool()
-	   :MemoryBlock({ (void*)bigPool, (void*)bigPool })
-    {}
+	std::atomic<u32> lock;
+	AllocatorHeapChunk* heapChunk;
+	u32 heapChunkUsed;
+	AllocatorHeap* heaps;
+	AllocatorHeap* abandonedHeaps;
+	AllocatorSegment* cachedSegments[ALLOCATOR_SEGMENT_CACHE_COUNT];
+	u32 cachedSegmentCount;
+	u64 cachedSegmentBytes;
+	std::atomic<u64> largeAllocations;
+	std::atomic<u64> largeBytes;
+	std::atomic<u64> largeFrees;
+	std::atomic<u64> remoteFrees;
+	std::atomic<u64> segmentCount;
+	std::atomic<u64> segmentBytes;
+	AllocationTagCounters tags[ALLOCATION_TAG_COUNT];
 };
 
-StaticMemory staticMemory;
-//StaticBigPool bigPool;
+static AllocatorGlobals allocator;
+static thread_local AllocatorHeap* allocator_threadHeap;
+static thread_local bool32 allocator_threadExited;
+static thread_local AllocationTag allocator_threadTag;
 
-static inline void* allocateStaticMemory(size_t size)
+static void allocator_lock()
 {
-    size_t addressAfterAllocation = (size_t)(staticMemory.freePointer) + size;
-    size_t highestAddressAvailable = (size_t)(staticMemory.blob) + staticMemorySize;
-    if (!(addressAfterAllocation > highestAddressAvailable))
-    {
-	   void* allocatedMemory = staticMemory.freePointer;
-	   staticMemory.freePointer = (char*)staticMemory.freePointer + size;
+	while (allocator.lock.exchange(1, std::memory_order_acquire))
+	{
+		while (allocator.lock.load(std::memory_order_relaxed))
+		{
+			std::this_thread::yield();
+		}
+	}
+}
 
-	   return allocatedMemory;
-    }
-    else
-	   // static memory allocation failed
-    {
+static void allocator_unlock()
+{
+	allocator.lock.store(0, std::memory_order_release);
+}
+
+static void* os_allocatePages(size_t size)
+{
 #ifdef _WIN64
-	   OutputDebugString("Static allocation failed");
+	return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+	void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return memory == MAP_FAILED ? nullptr : memory;
 #endif
-	   return nullptr;
-    }
 }
 
-static inline void* allocateHeapMemory(size_t size)
+static void os_freePages(void* memory, size_t size)
 {
-    return malloc(size);
+#ifdef _WIN64
+	VirtualFree(memory, 0, MEM_RELEASE);
+#else
+	munmap(memory, size);
+#endif
 }
 
-/*
-This function returns the total system memory in kilobytes
-*/
-static inline u64 getTotalRAMSize()
+// size bytes at an ALLOCATOR_SEGMENT_SIZE aligned address, zeroed
+static AllocatorSegment* os_allocateSegment(size_t size)
+{
+#ifdef _WIN64
+	// Reserve enough to hold an aligned range, then commit only that range
+	u8* base = (u8*)VirtualAlloc(nullptr, size + ALLOCATOR_SEGMENT_SIZE, MEM_RESERVE, PAGE_READWRITE);
+	if (!base)
+	{
+		return nullptr;
+	}
+	u8* aligned = (u8*)(((size_t)base + ALLOCATOR_SEGMENT_SIZE - 1) & ~size_t(ALLOCATOR_SEGMENT_SIZE - 1));
+	if (!VirtualAlloc(aligned, size, MEM_COMMIT, PAGE_READWRITE))
+	{
+		VirtualFree(base, 0, MEM_RELEASE);
+		return nullptr;
+	}
+	AllocatorSegment* segment = (AllocatorSegment*)aligned;
+	segment->osBase = base;
+	segment->osSize = size + ALLOCATOR_SEGMENT_SIZE;
+#else
+	// Map enough to hold an aligned range, then unmap what sticks out on both sides
+	u8* base = (u8*)os_allocatePages(size + ALLOCATOR_SEGMENT_SIZE);
+	if (!base)
+	{
+		return nullptr;
+	}
+	u8* aligned = (u8*)(((size_t)base + ALLOCATOR_SEGMENT_SIZE - 1) & ~size_t(ALLOCATOR_SEGMENT_SIZE - 1));
+	if (aligned > base)
+	{
+		munmap(base, aligned - base);
+	}
+	if (aligned + size < base + size + ALLOCATOR_SEGMENT_SIZE)
+	{
+		munmap(aligned + size, base + size + ALLOCATOR_SEGMENT_SIZE - (aligned + size));
+	}
+	AllocatorSegment* segment = (AllocatorSegment*)aligned;
+	segment->osBase = aligned;
+	segment->osSize = size;
+#endif
+
+	segment->size = size;
+	allocator.segmentCount.fetch_add(1, std::memory_order_relaxed);
+	allocator.segmentBytes.fetch_add(size, std::memory_order_relaxed);
+	return segment;
+}
+
+static void os_freeSegment(AllocatorSegment* segment)
 {
-    u64 kilobytes;
-    BOOL success = GetPhysicallyInstalledSystemMemory(&kilobytes);
-    assert(success == TRUE);
-    return kilobytes;
+	allocator.segmentCount.fetch_sub(1, std::memory_order_relaxed);
+	allocator.segmentBytes.fetch_sub(segment->size, std::memory_order_relaxed);
+	os_freePages(segment->osBase, segment->osSize);
 }
 
-static inline void* allocateMemoryInBlock(MemoryBlock* block, size_t size)
-{
-    void* allocatedMemory = block->freePointer;
-    block->freePointer = (char*)block->freePointer + size;
-
-    return allocatedMemory;
-}
-
-static inline void allocateMemoryBlock(MemoryBlock* block, size_t size)
-{
-    block->blob = allocateHeapMemory(size);
-    assert(block->blob);
-    block->freePointer = block->blob;
-}
-
-static inline void deallocateMemoryBlock(MemoryBlock* block)
-{
-    // it gives error because alignment is not implemented
-    free(block->blob);
-    block->blob = nullptr;
-    block->freePointer = nullptr;
-}
-
-struct BlockAllocator
-{
-    u64 RAM_Kilobytes;
-    MemoryBlock* memoryBlocks; // array of block whose count depends on system total RAM
-    u64 blockCount;
-    u64 allocatedBlockCount;
-    u64 blockSize;
-
-    BlockAllocator(size_t _blockSize = (256 * MEGABYTE))
-	   :
-	   RAM_Kilobytes(getTotalRAMSize()),
-	   blockSize(_blockSize)
-    {
-	   double memoryPercentageToBeUsed = 0.4;
-	   u64 memoryToBeUsedInKilobytes = u64(memoryPercentageToBeUsed * RAM_Kilobytes);
-	   u64 memoryToBeUsed = memoryToBeUsedInKilobytes * KILOBYTE;
-
-	   blockCount = memoryToBeUsed / blockSize;
-
-	   memoryBlocks = (MemoryBlock*)allocateStaticMemory(blockCount * sizeof(MemoryBlock));
-
-
-	   for (u64 i = 0; i < blockCount; i++)
-	   {
-		  MemoryBlock* block = &memoryBlocks[i];
-		  block->blob = nullptr;
-		  block->freePointer = nullptr;
-	   }
-
-	   MemoryBlock* firstBlock = &memoryBlocks[0];
-	   allocateMemoryBlock(firstBlock, blockSize);
-	   allocatedBlockCount = 1;
-    }
-
-    void* allocate(size_t size)
-    {
-	   if (size < blockSize)
-	   {
-		  for (int i = 0; i < allocatedBlockCount; i++)
-		  {
-			 MemoryBlock* block = &memoryBlocks[i];
-			 size_t addressAfterAllocation = (size_t)(block->freePointer) + size;
-			 size_t highestAddressAvailable = (size_t)(block->blob) + blockSize;
-
-			 if (!(addressAfterAllocation > highestAddressAvailable))
-			 {
-				// do allocation
-				void* allocatedMemory = allocateMemoryInBlock(block, size);
-
-				return allocatedMemory;
-			 }
-		  }
-
-		  if (allocatedBlockCount < blockCount)
-		  {
-			 // Allocate a new block
-			 MemoryBlock* blockToAllocate = &memoryBlocks[allocatedBlockCount];
-			 allocateMemoryBlock(blockToAllocate, blockSize);
-			 allocatedBlockCount++;
-
-			 void* allocatedMemory = allocateMemoryInBlock(blockToAllocate, size);
-			 return allocatedMemory;
-		  }
-		  else
-		  {
-			 return nullptr;
-		  }
-	   }
-	   else
-	   {
-		  // TODO: implement in cases the total memory needed is bigger than the actual block
-	   }
-    }
-
-    ~BlockAllocator()
-    {
-	   for (u64 i = 0; i < allocatedBlockCount; i++)
-	   {
-		  MemoryBlock* block = &memoryBlocks[i];
-		  deallocateMemoryBlock(block);
-	   }
-    }
-};
-
-BlockAllocator blockAllocator;
+// Smallest cached segment of at least size bytes, if it is at most twice as big
+static AllocatorSegment* allocator_takeCachedSegment(size_t size)
+{
+	allocator_lock();
+	u32 best = ALLOCATOR_SEGMENT_CACHE_COUNT;
+	for (u32 i = 0; i < allocator.cachedSegmentCount; i++)
+	{
+		size_t cachedSize = allocator.cachedSegments[i]->size;
+		if (cachedSize >= size && cachedSize <= size * 2 && (best == ALLOCATOR_SEGMENT_CACHE_COUNT || cachedSize < allocator.cachedSegments[best]->size))
+		{
+			best = i;
+		}
+	}
+	AllocatorSegment* segment = nullptr;
+	if (best != ALLOCATOR_SEGMENT_CACHE_COUNT)
+	{
+		segment = allocator.cachedSegments[best];
+		allocator.cachedSegments[best] = allocator.cachedSegments[--allocator.cachedSegmentCount];
+		allocator.cachedSegmentBytes -= segment->size;
+	}
+	allocator_unlock();
 
-#define ALLOC_DBG_INFO(msg) ( OutputDebugString(msg) )
+	return segment;
+}
 
-void* __cdecl operator new(size_t size)
+static void allocator_releaseSegment(AllocatorSegment* segment)
 {
-#if _DEBUG
-#if EASTL_ALLOCATION_DEBUGGING_INFO
-    char message[512];
-    sprintf(message, "General purpose allocation of %zu bytes\n", size);
-    ALLOC_DBG_INFO(message);
-#endif
+	allocator_lock();
+	bool32 cached = allocator.cachedSegmentCount < ALLOCATOR_SEGMENT_CACHE_COUNT && allocator.cachedSegmentBytes + segment->size <= ALLOCATOR_SEGMENT_CACHE_BYTES;
+	if (cached)
+	{
+		allocator.cachedSegments[allocator.cachedSegmentCount++] = segment;
+		allocator.cachedSegmentBytes += segment->size;
+	}
+	allocator_unlock();
+
+	if (!cached)
+	{
+		os_freeSegment(segment);
+	}
+}
+
+static inline AllocatorSegment* allocator_segment(const void* memory)
+{
+	return (AllocatorSegment*)((size_t)memory & ~size_t(ALLOCATOR_SEGMENT_SIZE - 1));
+}
+
+static inline u32 allocator_highestBit(u64 value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return u32(index);
+#else
+	return 63 - u32(__builtin_clzll(value));
 #endif
+}
+
+static inline u32 allocator_sizeClass(size_t size)
+{
+	if (size <= 128)
+	{
+		return size ? u32((size + 15) >> 4) - 1 : 0;
+	}
+	u64 last = size - 1;
+	u32 highestBit = allocator_highestBit(last);
+	return 8 + (highestBit - 7) * 4 + u32((last >> (highestBit - 2)) & 3);
+}
+
+static inline u32 allocator_classSize(u32 sizeClass)
+{
+	if (sizeClass < 8)
+	{
+		return (sizeClass + 1) * 16;
+	}
+	u32 highestBit = 7 + (sizeClass - 8) / 4;
+	return (1u << highestBit) + ((sizeClass - 8) % 4 + 1) * (1u << (highestBit - 2));
+}
+
+static AllocatorHeap* allocator_acquireHeap()
+{
+	allocator_lock();
+	AllocatorHeap* heap = allocator.abandonedHeaps;
+	if (heap)
+	{
+		allocator.abandonedHeaps = heap->nextAbandoned;
+		heap->nextAbandoned = nullptr;
+	}
+	else
+	{
+		if (!allocator.heapChunk || allocator.heapChunkUsed == ALLOCATOR_HEAPS_PER_CHUNK)
+		{
+			AllocatorHeapChunk* chunk = (AllocatorHeapChunk*)os_allocatePages(sizeof(AllocatorHeapChunk));
+			if (chunk)
+			{
+				chunk->next = allocator.heapChunk;
+				allocator.heapChunk = chunk;
+				allocator.heapChunkUsed = 0;
+			}
+		}
+		if (allocator.heapChunk && allocator.heapChunkUsed < ALLOCATOR_HEAPS_PER_CHUNK)
+		{
+			heap = &allocator.heapChunk->heaps[allocator.heapChunkUsed++];
+			heap->nextHeap = allocator.heaps;
+			allocator.heaps = heap;
+		}
+	}
+	allocator_unlock();
+
+	return heap;
+}
+
+// A finished thread leaves its heap, live blocks included, to the next thread that starts
+struct AllocatorThreadExit
+{
+	AllocatorHeap* heap;
+
+	~AllocatorThreadExit()
+	{
+		allocator_threadHeap = nullptr;
+		allocator_threadExited = true;
+		if (heap)
+		{
+			allocator_lock();
+			heap->nextAbandoned = allocator.abandonedHeaps;
+			allocator.abandonedHeaps = heap;
+			allocator_unlock();
+		}
+	}
+};
+
+static thread_local AllocatorThreadExit allocator_threadExit;
+
+static inline AllocatorHeap* allocator_heap()
+{
+	AllocatorHeap* heap = allocator_threadHeap;
+	if (!heap)
+	{
+		heap = allocator_acquireHeap();
+		allocator_threadHeap = heap;
+		// Past thread_local destruction the heap can't be handed back: it stays with the thread
+		if (!allocator_threadExited)
+		{
+			allocator_threadExit.heap = heap;
+		}
+	}
+	return heap;
+}
+
+static inline void heap_linkPage(AllocatorHeap* heap, AllocatorPage* page)
+{
+	page->previous = nullptr;
+	page->next = heap->pages[page->tag][page->sizeClass];
+	if (page->next)
+	{
+		page->next->previous = page;
+	}
+	heap->pages[page->tag][page->sizeClass] = page;
+}
+
+static inline void heap_unlinkPage(AllocatorHeap* heap, AllocatorPage* page)
+{
+	if (page->previous)
+	{
+		page->previous->next = page->next;
+	}
+	else
+	{
+		heap->pages[page->tag][page->sizeClass] = page->next;
+	}
+	if (page->next)
+	{
+		page->next->previous = page->previous;
+	}
+	page->next = nullptr;
+	page->previous = nullptr;
+}
+
+static inline void segment_link(AllocatorSegment** list, AllocatorSegment* segment)
+{
+	segment->previous = nullptr;
+	segment->next = *list;
+	if (segment->next)
+	{
+		segment->next->previous = segment;
+	}
+	*list = segment;
+}
+
+static inline void segment_unlink(AllocatorSegment** list, AllocatorSegment* segment)
+{
+	if (segment->previous)
+	{
+		segment->previous->next = segment->next;
+	}
+	else
+	{
+		*list = segment->next;
+	}
+	if (segment->next)
+	{
+		segment->next->previous = segment->previous;
+	}
+}
+
+static AllocatorPage* heap_newPage(AllocatorHeap* heap, u32 sizeClass, AllocationTag tag)
+{
+	const u32 blockSize = allocator_classSize(sizeClass);
+	const AllocatorSegmentKind kind = blockSize <= ALLOCATOR_MAX_SMALL_SIZE ? AllocatorSegmentKind::SMALL : AllocatorSegmentKind::MEDIUM;
+	AllocatorSegment** segments = &heap->segments[u32(kind)];
+
+	AllocatorSegment* segment = *segments;
+	while (segment && !segment->freePages && segment->bumpPageCount == segment->pageCount)
+	{
+		segment = segment->next;
+	}
+	if (!segment)
+	{
+		segment = allocator_takeCachedSegment(ALLOCATOR_SEGMENT_SIZE);
+		segment = segment ? segment : os_allocateSegment(ALLOCATOR_SEGMENT_SIZE);
+		if (!segment)
+		{
+			return nullptr;
+		}
+		segment->kind = kind;
+		segment->usedPageCount = 0;
+		segment->bumpPageCount = 0;
+		segment->freePages = nullptr;
+		segment->pageShift = allocator_highestBit(kind == AllocatorSegmentKind::SMALL ? ALLOCATOR_SMALL_PAGE_SIZE : ALLOCATOR_MEDIUM_PAGE_SIZE);
+		segment->pageCount = u32(ALLOCATOR_SEGMENT_SIZE >> segment->pageShift);
+		segment->heap = heap;
+		segment_link(segments, segment);
+	}
+
+	AllocatorPage* page = segment->freePages;
+	if (page)
+	{
+		segment->freePages = page->next;
+	}
+	else
+	{
+		page = &segment->pages[segment->bumpPageCount++];
+	}
+	segment->usedPageCount++;
+
+	const size_t pageIndex = size_t(page - segment->pages);
+	const size_t pageBegin = pageIndex << segment->pageShift;
+	u8* start = (u8*)segment + (pageBegin > ALLOCATOR_SEGMENT_HEADER_SIZE ? pageBegin : ALLOCATOR_SEGMENT_HEADER_SIZE);
+	u8* end = (u8*)segment + ((pageIndex + 1) << segment->pageShift);
+	page->freeList = nullptr;
+	page->start = start;
+	page->blockSize = blockSize;
+	page->capacity = u32((end - start) / blockSize);
+	page->usedCount = 0;
+	page->bumpCount = 0;
+	page->sizeClass = u8(sizeClass);
+	page->full = 0;
+	page->hasAligned.store(0, std::memory_order_relaxed);
+	page->tag = u8(tag);
+	heap_linkPage(heap, page);
+
+	return page;
+}
+
+static void heap_retirePage(AllocatorHeap* heap, AllocatorSegment* segment, AllocatorPage* page)
+{
+	heap_unlinkPage(heap, page);
+	page->next = segment->freePages;
+	segment->freePages = page;
+	segment->usedPageCount--;
+
+	// The last segment of its kind stays mapped for the next page
+	AllocatorSegment** segments = &heap->segments[u32(segment->kind)];
+	if (segment->usedPageCount == 0 && (segment->previous || segment->next))
+	{
+		segment_unlink(segments, segment);
+		allocator_releaseSegment(segment);
+	}
+}
+
+static inline AllocatorPage* segment_page(AllocatorSegment* segment, const void* memory)
+{
+	return &segment->pages[((const u8*)memory - (const u8*)segment) >> segment->pageShift];
+}
+
+static void heap_freeLocal(AllocatorHeap* heap, AllocatorSegment* segment, void* memory)
+{
+	AllocatorPage* page = segment_page(segment, memory);
+	if (page->hasAligned.load(std::memory_order_relaxed))
+	{
+		memory = page->start + size_t((u8*)memory - page->start) / page->blockSize * page->blockSize;
+	}
+
+	AllocatorFreeBlock* block = (AllocatorFreeBlock*)memory;
+	block->next = page->freeList;
+	page->freeList = block;
+	page->usedCount--;
+
+	if (page->full)
+	{
+		page->full = 0;
+		heap_linkPage(heap, page);
+	}
+	// Keep one page per class and tag around, so a class that empties and fills again doesn't churn pages
+	if (page->usedCount == 0 && (page->previous || page->next))
+	{
+		heap_retirePage(heap, segment, page);
+	}
+}
+
+static void heap_collectRemoteFrees(AllocatorHeap* heap)
+{
+	AllocatorFreeBlock* block = heap->remoteFrees.exchange(nullptr, std::memory_order_acquire);
+	while (block)
+	{
+		AllocatorFreeBlock* next = block->next;
+		heap_freeLocal(heap, allocator_segment(block), block);
+		block = next;
+	}
+}
+
+static inline void* page_allocate(AllocatorPage* page)
+{
+	AllocatorFreeBlock* block = page->freeList;
+	if (block)
+	{
+		page->freeList = block->next;
+		page->usedCount++;
+		return block;
+	}
+	if (page->bumpCount < page->capacity)
+	{
+		page->usedCount++;
+		return page->start + size_t(page->bumpCount++) * page->blockSize;
+	}
+	return nullptr;
+}
+
+static void* heap_allocateSlow(AllocatorHeap* heap, u32 sizeClass, AllocationTag tag)
+{
+	heap_collectRemoteFrees(heap);
+
+	AllocatorPage* page = heap->pages[tag][sizeClass];
+	while (page)
+	{
+		AllocatorPage* next = page->next;
+		void* memory = page_allocate(page);
+		if (memory)
+		{
+			if (page->previous)
+			{
+				heap_unlinkPage(heap, page);
+				heap_linkPage(heap, page);
+			}
+			return memory;
+		}
+		heap_unlinkPage(heap, page);
+		page->full = 1;
+		page = next;
+	}
+
+	page = heap_newPage(heap, sizeClass, tag);
+	return page ? page_allocate(page) : nullptr;
+}
+
+static inline void allocator_trackTagged(AllocationTag tag, u64 bytes)
+{
+	AllocationTagCounters& counters = allocator.tags[tag];
+	u64 liveBytes = counters.liveBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+	u64 peakBytes = counters.peakBytes.load(std::memory_order_relaxed);
+	while (liveBytes > peakBytes && !counters.peakBytes.compare_exchange_weak(peakBytes, liveBytes, std::memory_order_relaxed))
+	{
+	}
+	counters.liveCount.fetch_add(1, std::memory_order_relaxed);
+	counters.allocationCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+static inline void allocator_untrackTagged(u32 tag, u64 bytes)
+{
+	allocator.tags[tag].liveBytes.fetch_sub(bytes, std::memory_order_relaxed);
+	allocator.tags[tag].liveCount.fetch_sub(1, std::memory_order_relaxed);
+}
+
+static void* allocator_allocateLarge(size_t size, size_t alignment, size_t alignmentOffset, AllocationTag tag)
+{
+	// Worst case alignment padding, rounded up to the OS allocation granularity
+	const size_t segmentSize = (ALLOCATOR_SEGMENT_HEADER_SIZE + size + alignment + 64 * KILOBYTE - 1) & ~size_t(64 * KILOBYTE - 1);
+	AllocatorSegment* segment = allocator_takeCachedSegment(segmentSize);
+	if (!segment)
+	{
+		segment = os_allocateSegment(segmentSize);
+		if (!segment)
+		{
+			return nullptr;
+		}
+		// Vertex and index arrays of big meshes: a fraction of the TLB entries if the OS can back them with huge pages
+		if (segmentSize >= ALLOCATOR_HUGE_PAGE_THRESHOLD)
+		{
+			virtualMemory_adviseHugePages(segment, segmentSize);
+		}
+	}
+	segment->kind = AllocatorSegmentKind::LARGE;
+	segment->largeSize = size;
+	segment->largeTag = tag;
+	if (tag)
+	{
+		allocator_trackTagged(tag, size);
+	}
+	allocator.largeAllocations.fetch_add(1, std::memory_order_relaxed);
+	allocator.largeBytes.fetch_add(size, std::memory_order_relaxed);
+
+	size_t memory = (size_t)segment + ALLOCATOR_SEGMENT_HEADER_SIZE;
+	return (void*)(((memory + alignmentOffset + alignment - 1) & ~(alignment - 1)) - alignmentOffset);
+}
+
+void* allocator_allocateTagged(size_t size, size_t alignment, size_t alignmentOffset, AllocationTag tag)
+{
+	assert(alignment && (alignment & (alignment - 1)) == 0 && alignment < ALLOCATOR_SEGMENT_SIZE / 2);
+	alignmentOffset &= alignment - 1;
+	const bool32 padded = alignment > ALLOCATOR_MIN_ALIGNMENT || (alignmentOffset & (ALLOCATOR_MIN_ALIGNMENT - 1));
+	const size_t blockSize = padded ? size + alignment - 1 : size;
+	if (blockSize > ALLOCATOR_MAX_MEDIUM_SIZE)
+	{
+		return allocator_allocateLarge(size, alignment < ALLOCATOR_MIN_ALIGNMENT ? ALLOCATOR_MIN_ALIGNMENT : alignment, alignmentOffset, tag);
+	}
+
+	AllocatorHeap* heap = allocator_heap();
+	if (!heap)
+	{
+		return nullptr;
+	}
+
+	const u32 sizeClass = allocator_sizeClass(blockSize);
+	AllocatorPage* page = heap->pages[tag][sizeClass];
+	void* memory = page ? page_allocate(page) : nullptr;
+	if (!memory)
+	{
+		memory = heap_allocateSlow(heap, sizeClass, tag);
+		if (!memory)
+		{
+			return nullptr;
+		}
+	}
+	heap->allocations.add(1);
+	if (tag)
+	{
+		allocator_trackTagged(tag, allocator_classSize(sizeClass));
+	}
+
+	if (padded)
+	{
+		AllocatorSegment* segment = allocator_segment(memory);
+		// Relaxed is enough: whoever frees this block got it from this thread after the store
+		segment_page(segment, memory)->hasAligned.store(1, std::memory_order_relaxed);
+		memory = (void*)((((size_t)memory + alignmentOffset + alignment - 1) & ~(alignment - 1)) - alignmentOffset);
+	}
+	return memory;
+}
+
+void* allocator_allocateAligned(size_t size, size_t alignment, size_t alignmentOffset)
+{
+	return allocator_allocateTagged(size, alignment, alignmentOffset, ALLOCATION_TAG_UNTAGGED);
+}
 
-#if OWN_GENERAL_PURPOSE_ALLOCATOR 
-    void* allocatedMemory = blockAllocator.allocate(size);
-    return allocatedMemory;
+void* allocator_allocate(size_t size)
+{
+	return allocator_allocateAligned(size, ALLOCATOR_MIN_ALIGNMENT, 0);
+}
+
+void allocator_free(void* memory)
+{
+	if (!memory)
+	{
+		return;
+	}
+
+	AllocatorSegment* segment = allocator_segment(memory);
+	if (segment->kind == AllocatorSegmentKind::LARGE)
+	{
+		allocator.largeFrees.fetch_add(1, std::memory_order_relaxed);
+		allocator.largeBytes.fetch_sub(segment->largeSize, std::memory_order_relaxed);
+		if (segment->largeTag)
+		{
+			allocator_untrackTagged(segment->largeTag, segment->largeSize);
+		}
+		allocator_releaseSegment(segment);
+		return;
+	}
+
+	// The page can't be retired while one of its blocks is live, so reading it from any thread is safe
+	AllocatorPage* page = segment_page(segment, memory);
+	if (page->tag)
+	{
+		allocator_untrackTagged(page->tag, page->blockSize);
+	}
+
+	AllocatorHeap* owner = segment->heap;
+	AllocatorHeap* heap = allocator_threadHeap;
+	if (owner == heap)
+	{
+		heap->frees.add(1);
+		heap_freeLocal(heap, segment, memory);
+		return;
+	}
+	allocator.remoteFrees.fetch_add(1, std::memory_order_relaxed);
+
+	AllocatorFreeBlock* block = (AllocatorFreeBlock*)memory;
+	if (page->hasAligned.load(std::memory_order_relaxed))
+	{
+		block = (AllocatorFreeBlock*)(page->start + size_t((u8*)memory - page->start) / page->blockSize * page->blockSize);
+	}
+	AllocatorFreeBlock* head = owner->remoteFrees.load(std::memory_order_relaxed);
+	do
+	{
+		block->next = head;
+	}
+	while (!owner->remoteFrees.compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed));
+}
+
+AllocatorStats allocator_getStats()
+{
+	AllocatorStats stats = {};
+	allocator_lock();
+	for (AllocatorHeap* heap = allocator.heaps; heap; heap = heap->nextHeap)
+	{
+		stats.smallAllocations += heap->allocations.value.load(std::memory_order_relaxed);
+		stats.frees += heap->frees.value.load(std::memory_order_relaxed);
+		stats.heapCount++;
+	}
+	for (AllocatorHeap* heap = allocator.abandonedHeaps; heap; heap = heap->nextAbandoned)
+	{
+		stats.abandonedHeapCount++;
+	}
+	stats.cachedSegmentCount = allocator.cachedSegmentCount;
+	stats.cachedSegmentBytes = allocator.cachedSegmentBytes;
+	allocator_unlock();
+
+	stats.remoteFrees = allocator.remoteFrees.load(std::memory_order_relaxed);
+	stats.frees += stats.remoteFrees;
+	stats.largeAllocations = allocator.largeAllocations.load(std::memory_order_relaxed);
+	stats.frees += allocator.largeFrees.load(std::memory_order_relaxed);
+	stats.segmentCount = allocator.segmentCount.load(std::memory_order_relaxed);
+	stats.segmentBytes = allocator.segmentBytes.load(std::memory_order_relaxed);
+	stats.largeBytes = allocator.largeBytes.load(std::memory_order_relaxed);
+	return stats;
+}
+
+u64 allocator_allocationCount()
+{
+	u64 count = 0;
+	allocator_lock();
+	for (AllocatorHeap* heap = allocator.heaps; heap; heap = heap->nextHeap)
+	{
+		count += heap->allocations.value.load(std::memory_order_relaxed);
+	}
+	allocator_unlock();
+	return count + allocator.largeAllocations.load(std::memory_order_relaxed);
+}
+
+void printAllocatorStats(const AllocatorStats& stats)
+{
+	printf("Allocator\n");
+	printf("\tAllocations: %llu small, %llu large\n", stats.smallAllocations, stats.largeAllocations);
+	printf("\tFrees: %llu, %llu from another thread\n", stats.frees, stats.remoteFrees);
+	printf("\tSegments: %llu, %.2f MiB mapped\n", stats.segmentCount, double(stats.segmentBytes) / (1024.0 * 1024.0));
+	printf("\tCached segments: %u, %.2f MiB\n", stats.cachedSegmentCount, double(stats.cachedSegmentBytes) / (1024.0 * 1024.0));
+	printf("\tLive large allocations: %.2f MiB\n", double(stats.largeBytes) / (1024.0 * 1024.0));
+	printf("\tHeaps: %u, %u abandoned\n", stats.heapCount, stats.abandonedHeapCount);
+}
+
+static const char* const allocationTagNames[ALLOCATION_TAG_COUNT] =
+{
+	"untagged",
+	"containers",
+	"strings",
+	"mesh",
+	"swapchain",
+	"descriptors",
+	"textures",
+};
+
+const char* allocationTag_name(AllocationTag tag)
+{
+	return tag < ALLOCATION_TAG_COUNT ? allocationTagNames[tag] : "unknown";
+}
+
+AllocationTag allocationTag_fromName(const char* name)
+{
+	if (!name)
+	{
+		return ALLOCATION_TAG_UNTAGGED;
+	}
+	if (strcmp(name, "EASTL basic_string") == 0)
+	{
+		return ALLOCATION_TAG_STRINGS;
+	}
+	// The tag name, alone or followed by a slash and anything that tells allocations of the same tag apart
+	for (u32 tag = ALLOCATION_TAG_CONTAINERS; tag < ALLOCATION_TAG_COUNT; tag++)
+	{
+		size_t length = strlen(allocationTagNames[tag]);
+		if (strncmp(name, allocationTagNames[tag], length) == 0 && (name[length] == 0 || name[length] == '/'))
+		{
+			return AllocationTag(tag);
+		}
+	}
+	return ALLOCATION_TAG_UNTAGGED;
+}
+
+AllocationTagStats allocator_getTagStats(AllocationTag tag)
+{
+	AllocationTagStats stats;
+	stats.liveBytes = allocator.tags[tag].liveBytes.load(std::memory_order_relaxed);
+	stats.peakBytes = allocator.tags[tag].peakBytes.load(std::memory_order_relaxed);
+	stats.liveCount = allocator.tags[tag].liveCount.load(std::memory_order_relaxed);
+	stats.allocationCount = allocator.tags[tag].allocationCount.load(std::memory_order_relaxed);
+	return stats;
+}
+
+void printAllocationTagStats()
+{
+	printf("Allocation tags\n");
+	printf("\t%-12s %12s %12s %10s %12s\n", "Tag", "Live KiB", "Peak KiB", "Live", "Allocations");
+	for (u32 tag = ALLOCATION_TAG_CONTAINERS; tag < ALLOCATION_TAG_COUNT; tag++)
+	{
+		AllocationTagStats stats = allocator_getTagStats(AllocationTag(tag));
+		printf("\t%-12s %12.1f %12.1f %10llu %12llu\n", allocationTagNames[tag], double(stats.liveBytes) / 1024.0, double(stats.peakBytes) / 1024.0, stats.liveCount, stats.allocationCount);
+	}
+}
+
+AllocationTag allocationTag_current()
+{
+	return allocator_threadTag ? allocator_threadTag : ALLOCATION_TAG_CONTAINERS;
+}
+
+AllocationTagScope::AllocationTagScope(AllocationTag tag)
+	: previous(allocator_threadTag)
+{
+	allocator_threadTag = tag;
+}
+
+AllocationTagScope::~AllocationTagScope()
+{
+	allocator_threadTag = previous;
+}
+
+struct AllocationTraceRecord
+{
+	void* memory;
+	u64 size; // 0 for a free
+	u32 alignment;
+	std::atomic<u32> written;
+};
+
+struct AllocationTraceCapture
+{
+	std::atomic<u32> active;
+	AllocationTraceRecord* records;
+	u64 capacity;
+	std::atomic<u64> count;
+};
+
+static AllocationTraceCapture allocationTrace;
+
+static inline void allocationTrace_record(void* memory, u64 size, u32 alignment)
+{
+	u64 index = allocationTrace.count.fetch_add(1, std::memory_order_relaxed);
+	if (index < allocationTrace.capacity)
+	{
+		AllocationTraceRecord* record = &allocationTrace.records[index];
+		record->memory = memory;
+		record->size = size;
+		record->alignment = alignment;
+		record->written.store(1, std::memory_order_release);
+	}
+}
+
+bool32 allocationTrace_begin(u64 maxEventCount)
+{
+	assert(!allocationTrace.active.load());
+	allocationTrace.records = (AllocationTraceRecord*)os_allocatePages(size_t(maxEventCount * sizeof(AllocationTraceRecord)));
+	if (!allocationTrace.records)
+	{
+		return false;
+	}
+	allocationTrace.capacity = maxEventCount;
+	allocationTrace.count.store(0);
+	allocationTrace.active.store(1, std::memory_order_release);
+	return true;
+}
+
+static inline u64 allocationTrace_hash(const void* memory, u32 shift)
+{
+	return (u64((size_t)memory >> 4) * 0x9E3779B97F4A7C15ull) >> shift;
+}
+
+void allocationTrace_end(AllocationTrace* trace)
+{
+	allocationTrace.active.store(0);
+	const u64 recordedCount = allocationTrace.count.load();
+	const u64 recordCount = recordedCount < allocationTrace.capacity ? recordedCount : allocationTrace.capacity;
+	trace->events.clear();
+	trace->events.reserve(size_t(recordCount));
+	trace->slotCount = 0;
+	trace->droppedEventCount = recordedCount - recordCount;
+
+	// Live pointers to their slot. Freed entries become tombstones, so the table never holds more than recordCount keys
+	u32 shift = 64;
+	u64 tableSize = 1;
+	while (tableSize < recordCount * 2 + 2)
+	{
+		tableSize *= 2;
+		shift--;
+	}
+	const size_t emptyKey = 0;
+	const size_t tombstoneKey = 1;
+	vector<size_t> keys(size_t(tableSize), emptyKey);
+	vector<u32> slots((size_t)tableSize);
+	vector<u32> slotAlignments;
+	vector<u8> liveSlots;
+
+	for (u64 i = 0; i < recordCount; i++)
+	{
+		// Threads that saw the capture active a moment ago may not have written their record yet
+		const AllocationTraceRecord& record = allocationTrace.records[i];
+		if (!record.written.load(std::memory_order_acquire) || !record.memory)
+		{
+			trace->droppedEventCount++;
+			continue;
+		}
+
+		u64 index = allocationTrace_hash(record.memory, shift);
+		if (record.size)
+		{
+			while (keys[size_t(index)] != emptyKey && keys[size_t(index)] != tombstoneKey)
+			{
+				index = (index + 1) & (tableSize - 1);
+			}
+			keys[size_t(index)] = (size_t)record.memory;
+			slots[size_t(index)] = trace->slotCount;
+			trace->events.push_back({ record.size, trace->slotCount, record.alignment });
+			slotAlignments.push_back(record.alignment);
+			liveSlots.push_back(1);
+			trace->slotCount++;
+		}
+		else
+		{
+			while (keys[size_t(index)] != emptyKey && keys[size_t(index)] != (size_t)record.memory)
+			{
+				index = (index + 1) & (tableSize - 1);
+			}
+			if (keys[size_t(index)] == emptyKey)
+			{
+				trace->droppedEventCount++;
+				continue;
+			}
+			keys[size_t(index)] = tombstoneKey;
+			u32 slot = slots[size_t(index)];
+			trace->events.push_back({ 0, slot, slotAlignments[slot] });
+			liveSlots[slot] = 0;
+		}
+	}
+
+	// Replays end with nothing allocated
+	for (u32 slot = 0; slot < trace->slotCount; slot++)
+	{
+		if (liveSlots[slot])
+		{
+			trace->events.push_back({ 0, slot, slotAlignments[slot] });
+		}
+	}
+
+	os_freePages(allocationTrace.records, size_t(allocationTrace.capacity * sizeof(AllocationTraceRecord)));
+	allocationTrace.records = nullptr;
+	allocationTrace.capacity = 0;
+}
+
+static inline void* allocator_new(size_t size, size_t alignment, size_t alignmentOffset, AllocationTag tag = ALLOCATION_TAG_UNTAGGED)
+{
+	void* allocatedMemory = allocator_allocateTagged(size, alignment, alignmentOffset, tag);
+	if (allocatedMemory && allocationTrace.active.load(std::memory_order_relaxed))
+	{
+		allocationTrace_record(allocatedMemory, size ? size : 1, u32(alignment));
+	}
+	return allocatedMemory;
+}
+
+static inline AllocationTag allocator_eastlTag(const char* name)
+{
+	AllocationTag tag = allocationTag_fromName(name);
+	return tag ? tag : allocationTag_current();
+}
+
+static inline void allocator_delete(void* memory)
+{
+	if (allocationTrace.active.load(std::memory_order_relaxed))
+	{
+		allocationTrace_record(memory, 0, 0);
+	}
+	allocator_free(memory);
+}
+
+// A throwing operator new never returns null: the new-handler gets a chance to release memory, then it's bad_alloc
+static void* operator_allocate(size_t size, size_t alignment, size_t alignmentOffset, AllocationTag tag)
+{
+	for (;;)
+	{
+#if OWN_GENERAL_PURPOSE_ALLOCATOR
+		void* memory = allocator_new(size, alignment, alignmentOffset, tag);
 #else
-    return malloc(size);
+		void* memory = system_allocate(size, alignment, alignmentOffset);
+#endif
+		if (memory)
+		{
+			return memory;
+		}
+
+		std::new_handler handler = std::get_new_handler();
+		if (!handler)
+		{
+			throw std::bad_alloc();
+		}
+		handler();
+	}
+}
+
+void* __cdecl operator new(size_t size)
+{
+    void* memory = operator_allocate(size, ALLOCATOR_MIN_ALIGNMENT, 0, ALLOCATION_TAG_UNTAGGED);
+#if ALLOCATION_LOG
+    ALLOCATION_LOG_RECORD(memory, size, ALLOCATION_TAG_UNTAGGED);
 #endif
+    return memory;
 }
 
 void* __cdecl operator new[](size_t size)
 {
-#if _DEBUG
-#if EASTL_ALLOCATION_DEBUGGING_INFO
-    char message[512];
-    sprintf(message, "General purpose allocation of %zu bytes\n", size);
-    ALLOC_DBG_INFO(message);
+    void* memory = operator_allocate(size, ALLOCATOR_MIN_ALIGNMENT, 0, ALLOCATION_TAG_UNTAGGED);
+#if ALLOCATION_LOG
+    ALLOCATION_LOG_RECORD(memory, size, ALLOCATION_TAG_UNTAGGED);
 #endif
+    return memory;
+}
+
+// Over-aligned types: alignas(64) per-thread data, SIMD vectors
+void* __cdecl operator new(size_t size, std::align_val_t alignment)
+{
+    void* memory = operator_allocate(size, size_t(alignment), 0, ALLOCATION_TAG_UNTAGGED);
+#if ALLOCATION_LOG
+    ALLOCATION_LOG_RECORD(memory, size, ALLOCATION_TAG_UNTAGGED);
 #endif
+    return memory;
+}
 
-#if OWN_GENERAL_PURPOSE_ALLOCATOR 
-    void* allocatedMemory = blockAllocator.allocate(size);
-    return allocatedMemory;
-#else
-    return malloc(size);
+void* __cdecl operator new[](size_t size, std::align_val_t alignment)
+{
+    void* memory = operator_allocate(size, size_t(alignment), 0, ALLOCATION_TAG_UNTAGGED);
+#if ALLOCATION_LOG
+    ALLOCATION_LOG_RECORD(memory, size, ALLOCATION_TAG_UNTAGGED);
 #endif
+    return memory;
 }
 
 void* __cdecl operator new[](size_t size, const char* name, int flags, unsigned debugFlags, const char* file, int line)
 {
-#if _DEBUG
-#if EASTL_ALLOCATION_DEBUGGING_INFO
-    static char message[128];
-    sprintf(message, "Allocation of %s (size %zu) of new[] (no alignment)\n", name, size);
-    ALLOC_DBG_INFO(message);
+    const AllocationTag tag = allocator_eastlTag(name);
+    void* memory = operator_allocate(size, ALLOCATOR_MIN_ALIGNMENT, 0, tag);
+#if ALLOCATION_LOG
+    ALLOCATION_LOG_RECORD(memory, size, tag);
 #endif
+    return memory;
+}
+
+void* __cdecl operator new[](size_t size, size_t alignment, size_t alignmentOffset, const char* name, int flags, unsigned debugFlags, const char* file, int line)
+{
+    const AllocationTag tag = allocator_eastlTag(name);
+    void* memory = operator_allocate(size, alignment, alignmentOffset, tag);
+#if ALLOCATION_LOG
+    ALLOCATION_LOG_RECORD(memory, size, tag);
 #endif
+    return memory;
+}
 
-#if OWN_ALLOCATOR_FOR_EASTL
-    void* allocatedMemory = blockAllocator.allocate(size);
-    return allocatedMemory;
+static inline void operator_free(void* memory)
+{
+#if OWN_GENERAL_PURPOSE_ALLOCATOR
+    allocator_delete(memory);
 #else
-    return malloc(size);
+    system_free(memory);
 #endif
-   
 }
 
-void* __cdecl operator new[](size_t size, size_t alignment, size_t alignmentOffset, const char* name, int flags, unsigned debugFlags, const char* file, int line)
+void __cdecl operator delete(void* memory) noexcept
 {
-#if _DEBUG
-#if EASTL_ALLOCATION_DEBUGGING_INFO
-    ALLOC_DBG_INFO("new[] (alignment)");
+#if ALLOCATION_LOG
+    ALLOCATION_LOG_RECORD_FREE(memory);
 #endif
+    operator_free(memory);
+}
+
+void __cdecl operator delete[](void* memory) noexcept
+{
+#if ALLOCATION_LOG
+    ALLOCATION_LOG_RECORD_FREE(memory);
 #endif
-    
-#if OWN_ALLOCATOR_FOR_EASTL
-    void* allocatedMemory = blockAllocator.allocate(size);
-    return allocatedMemory;
-#else
-    return _aligned_offset_malloc(size, alignment, alignmentOffset);
+    operator_free(memory);
+}
+
+void __cdecl operator delete(void* memory, size_t) noexcept
+{
+#if ALLOCATION_LOG
+    ALLOCATION_LOG_RECORD_FREE(memory);
 #endif
+    operator_free(memory);
 }
 
+void __cdecl operator delete[](void* memory, size_t) noexcept
+{
+#if ALLOCATION_LOG
+    ALLOCATION_LOG_RECORD_FREE(memory);
+#endif
+    operator_free(memory);
+}
+
+// Aligned or not, every pointer frees the same way
+void __cdecl operator delete(void* memory, std::align_val_t) noexcept
+{
+#if ALLOCATION_LOG
+    ALLOCATION_LOG_RECORD_FREE(memory);
+#endif
+    operator_free(memory);
+}
+
+void __cdecl operator delete[](void* memory, std::align_val_t) noexcept
+{
+#if ALLOCATION_LOG
+    ALLOCATION_LOG_RECORD_FREE(memory);
+#endif
+    operator_free(memory);
+}
+
+void __cdecl operator delete(void* memory, size_t, std::align_val_t) noexcept
+{
+#if ALLOCATION_LOG
+    ALLOCATION_LOG_RECORD_FREE(memory);
+#endif
+    operator_free(memory);
+}
+
+void __cdecl operator delete[](void* memory, size_t, std::align_val_t) noexcept
+{
+#if ALLOCATION_LOG
+    ALLOCATION_LOG_RECORD_FREE(memory);
+#endif
+    operator_free(memory);
+}
+
+struct alignas(64) AlignmentCheckLine
+{
+	u8 bytes[64];
+};
+
+struct alignas(256) AlignmentCheckBlock
+{
+	u8 bytes[256];
+};
+
+struct AlignmentCheckAllocation
+{
+	u8* memory;
+	size_t size;
+	size_t alignment;
+	size_t offset;
+};
+
+static bool32 allocator_checkAllocation(const char* overload, const AlignmentCheckAllocation& allocation, u8 pattern)
+{
+	if (!allocation.memory || ((size_t)allocation.memory + allocation.offset) & (allocation.alignment - 1))
+	{
+		printf("%s: %zu bytes at alignment %zu offset %zu misaligned at %p\n", overload, allocation.size, allocation.alignment, allocation.offset, allocation.memory);
+		return false;
+	}
+	for (size_t i = 0; i < allocation.size; i++)
+	{
+		if (allocation.memory[i] != pattern)
+		{
+			printf("%s: %zu bytes at alignment %zu offset %zu overwritten at byte %zu\n", overload, allocation.size, allocation.alignment, allocation.offset, i);
+			return false;
+		}
+	}
+	return true;
+}
+
+bool32 allocator_checkAlignment()
+{
+	static const size_t alignments[] = { 1, 2, 8, 16, 32, 64, 128, 4096, 64 * KILOBYTE };
+	// Small, medium and large
+	static const size_t sizes[] = { 1, 24, 100, 5000, 40 * KILOBYTE, 300 * KILOBYTE };
+	bool32 passed = true;
+
+	// EASTL's aligned overload, everything live at once so overlapping blocks show, half freed by another thread
+	vector<AlignmentCheckAllocation> allocations;
+	for (size_t alignment : alignments)
+	{
+		for (size_t offset = 0; offset < alignment; offset += offset < 16 ? 4 : offset)
+		{
+			for (size_t size : sizes)
+			{
+				u8* memory = (u8*)operator new[](size, alignment, offset, "AlignmentCheck", 0, 0, __FILE__, __LINE__);
+				AlignmentCheckAllocation allocation = { memory, size, alignment, offset };
+				if (memory)
+				{
+					memset(memory, u8(allocations.size()), size);
+				}
+				allocations.push_back(allocation);
+			}
+		}
+	}
+	// And the unaligned one, which still guarantees ALLOCATOR_MIN_ALIGNMENT
+	for (size_t size : sizes)
+	{
+		u8* memory = (u8*)operator new[](size, "AlignmentCheck", 0, 0, __FILE__, __LINE__);
+		AlignmentCheckAllocation allocation = { memory, size, ALLOCATOR_MIN_ALIGNMENT, 0 };
+		if (memory)
+		{
+			memset(memory, u8(allocations.size()), size);
+		}
+		allocations.push_back(allocation);
+	}
+	for (size_t i = 0; i < allocations.size(); i++)
+	{
+		passed &= allocator_checkAllocation("EASTL operator new[]", allocations[i], u8(i));
+	}
+	const size_t half = allocations.size() / 2;
+	std::thread remoteFree([&allocations, half]()
+	{
+		for (size_t i = 0; i < half; i++)
+		{
+			operator delete[](allocations[i].memory);
+		}
+	});
+	remoteFree.join();
+	for (size_t i = half; i < allocations.size(); i++)
+	{
+		operator delete[](allocations[i].memory);
+	}
+
+	// EASTL containers of over-aligned types take the aligned overload through eastl::allocator
+	vector<AlignmentCheckLine> lines;
+	vector<AlignmentCheckBlock> blocks;
+	for (u32 i = 0; i < 100; i++)
+	{
+		lines.push_back({});
+		blocks.push_back({});
+		passed &= allocator_checkAllocation("eastl::vector", { (u8*)lines.data(), 0, alignof(AlignmentCheckLine), 0 }, 0);
+		passed &= allocator_checkAllocation("eastl::vector", { (u8*)blocks.data(), 0, alignof(AlignmentCheckBlock), 0 }, 0);
+	}
+
+	// C++17 aligned new and delete, single objects and arrays
+	AlignmentCheckLine* line = new AlignmentCheckLine;
+	AlignmentCheckBlock* blockArray = new AlignmentCheckBlock[33];
+	passed &= allocator_checkAllocation("operator new(std::align_val_t)", { (u8*)line, 0, alignof(AlignmentCheckLine), 0 }, 0);
+	passed &= allocator_checkAllocation("operator new[](std::align_val_t)", { (u8*)blockArray, 0, alignof(AlignmentCheckBlock), 0 }, 0);
+	delete line;
+	delete[] blockArray;
+
+	return passed;
+}
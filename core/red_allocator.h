@@ -0,0 +1,109 @@
+#pragma once
+
+#include "common.h"
+
+/*
+General purpose allocator behind the global operator new and delete overrides. Requests up to ALLOCATOR_MAX_MEDIUM_SIZE
+round up to one of ALLOCATOR_SIZE_CLASS_COUNT size classes and are served from pages owned by a per-thread heap, so
+allocations and same thread frees take no lock. Frees from other threads are pushed lock-free onto the owning heap,
+which takes them back on its next refill. Bigger requests map their own memory. Pages and large allocations live in
+ALLOCATOR_SEGMENT_SIZE aligned segments, so any pointer finds its owner by masking.
+*/
+#define ALLOCATOR_SEGMENT_SIZE (4 * MEGABYTE)
+#define ALLOCATOR_SMALL_PAGE_SIZE (64 * KILOBYTE)
+#define ALLOCATOR_MEDIUM_PAGE_SIZE MEGABYTE
+#define ALLOCATOR_MAX_SMALL_SIZE (8 * KILOBYTE)
+#define ALLOCATOR_MAX_MEDIUM_SIZE (128 * KILOBYTE)
+// 16 byte steps up to 128 bytes, then four classes per power of two
+#define ALLOCATOR_SIZE_CLASS_COUNT 48
+#define ALLOCATOR_MIN_ALIGNMENT 16
+
+struct AllocatorStats
+{
+	u64 smallAllocations; // Small and medium size classes
+	u64 largeAllocations;
+	u64 frees;
+	u64 remoteFrees; // Frees from a thread that doesn't own the memory
+	u64 segmentCount;
+	u64 segmentBytes;
+	u64 cachedSegmentBytes; // Freed segments kept mapped for reuse, counted in segmentBytes
+	u64 largeBytes; // Live large allocations
+	u32 cachedSegmentCount;
+	u32 heapCount;
+	u32 abandonedHeapCount; // Heaps of finished threads, waiting for a new thread to adopt them
+};
+
+void* allocator_allocate(size_t size);
+// alignment is a power of two below ALLOCATOR_SEGMENT_SIZE. The pointer plus alignmentOffset is aligned
+void* allocator_allocateAligned(size_t size, size_t alignment, size_t alignmentOffset);
+// Any pointer from the allocator, aligned or not, from any thread
+void allocator_free(void* memory);
+AllocatorStats allocator_getStats();
+// Allocations made so far, from all threads
+u64 allocator_allocationCount();
+void printAllocatorStats(const AllocatorStats& stats);
+// Every alignment overload of operator new, EASTL's included, at every alignment and offset, freed locally and from
+// another thread. Prints failures
+bool32 allocator_checkAlignment();
+
+/*
+EASTL containers allocate from pages of their own tag, so a free finds its tag through its page and every tag keeps
+live, peak and count statistics. The tag comes from the container's allocator name when EASTL passes one ("mesh",
+"mesh/meshlets", "EASTL basic_string" for strings), otherwise from the innermost AllocationTagScope of the thread.
+Release builds of EASTL pass no names, only scopes apply there. Plain operator new stays untagged and untracked.
+*/
+enum AllocationTag : u32
+{
+	ALLOCATION_TAG_UNTAGGED,
+	ALLOCATION_TAG_CONTAINERS, // EASTL outside of any scope
+	ALLOCATION_TAG_STRINGS,
+	ALLOCATION_TAG_MESH,
+	ALLOCATION_TAG_SWAPCHAIN,
+	ALLOCATION_TAG_DESCRIPTORS,
+	ALLOCATION_TAG_TEXTURES,
+	ALLOCATION_TAG_COUNT,
+};
+
+struct AllocationTagStats
+{
+	u64 liveBytes; // Block bytes, size class rounding included
+	u64 peakBytes;
+	u64 liveCount;
+	u64 allocationCount;
+};
+
+void* allocator_allocateTagged(size_t size, size_t alignment, size_t alignmentOffset, AllocationTag tag);
+const char* allocationTag_name(AllocationTag tag);
+// ALLOCATION_TAG_UNTAGGED if the name doesn't pick one
+AllocationTag allocationTag_fromName(const char* name);
+AllocationTagStats allocator_getTagStats(AllocationTag tag);
+void printAllocationTagStats();
+
+// Tag of the EASTL allocations of this thread that don't name one. Thread pool jobs inherit it from the thread that dispatches them
+AllocationTag allocationTag_current();
+struct AllocationTagScope
+{
+	AllocationTag previous;
+
+	AllocationTagScope(AllocationTag tag);
+	~AllocationTagScope();
+};
+
+// Every operator new and delete between begin and end, from all threads, in the order they happened
+struct AllocationTraceEvent
+{
+	u64 size; // 0 frees the slot
+	u32 slot;
+	u32 alignment;
+};
+
+struct AllocationTrace
+{
+	vector<AllocationTraceEvent> events;
+	u32 slotCount;
+	u64 droppedEventCount; // Past maxEventCount, or frees of memory allocated before the capture
+};
+
+// The capture buffer is mapped straight from the OS, so capturing doesn't allocate
+bool32 allocationTrace_begin(u64 maxEventCount);
+void allocationTrace_end(AllocationTrace* trace);
@@ -0,0 +1,395 @@
+#include "common.h"
+#include "red_allocator_benchmark.h"
+#include "red_file.h"
+#include "red_memory.h"
+#include "red_thread_pool.h"
+
+#include <EASTL/sort.h>
+#include <chrono>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+struct AllocationTraceFileHeader
+{
+	u32 magic;
+	u32 version;
+	u64 eventCount;
+	u64 droppedEventCount;
+	u32 slotCount;
+	u32 padding;
+};
+
+bool32 allocationTrace_save(const char* path, const AllocationTrace& trace)
+{
+	FILE* file = fopen(path, "wb");
+	if (!file)
+	{
+		return false;
+	}
+	AllocationTraceFileHeader header = {};
+	header.magic = ALLOCATION_TRACE_MAGIC;
+	header.version = ALLOCATION_TRACE_VERSION;
+	header.eventCount = trace.events.size();
+	header.droppedEventCount = trace.droppedEventCount;
+	header.slotCount = trace.slotCount;
+	bool32 success = fwrite(&header, sizeof(header), 1, file) == 1;
+	success = success && fwrite(trace.events.data(), sizeof(AllocationTraceEvent), trace.events.size(), file) == trace.events.size();
+	fclose(file);
+	return success;
+}
+
+bool32 allocationTrace_load(const char* path, AllocationTrace* trace)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file)
+	{
+		return false;
+	}
+	AllocationTraceFileHeader header;
+	bool32 success = fread(&header, sizeof(header), 1, file) == 1 && header.magic == ALLOCATION_TRACE_MAGIC && header.version == ALLOCATION_TRACE_VERSION;
+
+	// The counts come from the file: a truncated or corrupt one must not size the event array or the replay slots
+	const i64 fileSize = success && file_seek(file, 0, SEEK_END) == 0 ? file_tell(file) : -1;
+	success = success && fileSize >= i64(sizeof(header)) && file_seek(file, i64(sizeof(header)), SEEK_SET) == 0;
+	success = success && header.eventCount == u64(fileSize - i64(sizeof(header))) / sizeof(AllocationTraceEvent);
+	// Every slot is allocated at least once
+	success = success && header.slotCount <= header.eventCount;
+	if (success)
+	{
+		trace->events.resize(size_t(header.eventCount));
+		trace->slotCount = header.slotCount;
+		trace->droppedEventCount = header.droppedEventCount;
+		success = fread(trace->events.data(), sizeof(AllocationTraceEvent), trace->events.size(), file) == trace->events.size();
+	}
+	fclose(file);
+
+	// Replays index slots and free them without checks: each slot has to alternate between allocated and freed, at
+	// an alignment the allocators take, and end freed
+	vector<u8> liveSlots(success ? trace->slotCount : 0, 0);
+	for (size_t i = 0; success && i < trace->events.size(); i++)
+	{
+		const AllocationTraceEvent& event = trace->events[i];
+		success = event.slot < trace->slotCount && event.alignment && (event.alignment & (event.alignment - 1)) == 0 &&
+			event.alignment < ALLOCATOR_SEGMENT_SIZE / 2 && liveSlots[event.slot] == (event.size ? 0 : 1);
+		if (success)
+		{
+			liveSlots[event.slot] = event.size ? 1 : 0;
+		}
+	}
+	for (size_t slot = 0; success && slot < liveSlots.size(); slot++)
+	{
+		success = !liveSlots[slot];
+	}
+
+	if (!success)
+	{
+		trace->events.clear();
+		trace->slotCount = 0;
+		trace->droppedEventCount = 0;
+	}
+	return success;
+}
+
+void allocationTrace_synthetic(AllocationTrace* trace, u32 allocationCount, u32 seed)
+{
+	// Live allocations the workload settles around
+	const u32 liveTarget = 4096;
+	u32 random = seed ? seed : 1;
+	auto next = [&random]()
+	{
+		random ^= random << 13;
+		random ^= random >> 17;
+		random ^= random << 5;
+		return random;
+	};
+
+	trace->events.clear();
+	trace->events.reserve(size_t(allocationCount) * 2);
+	trace->slotCount = 0;
+	trace->droppedEventCount = 0;
+	vector<u32> liveSlots;
+	vector<u32> freeSlots;
+	vector<u32> slotAlignments;
+	for (u32 allocation = 0; allocation < allocationCount;)
+	{
+		// Free a random live allocation as often as a new one comes once the workload reaches its size
+		if (!liveSlots.empty() && (liveSlots.size() >= liveTarget || next() % liveTarget < liveSlots.size() / 2))
+		{
+			u32 live = next() % u32(liveSlots.size());
+			u32 slot = liveSlots[live];
+			liveSlots[live] = liveSlots.back();
+			liveSlots.pop_back();
+			trace->events.push_back({ 0, slot, slotAlignments[slot] });
+			freeSlots.push_back(slot);
+			continue;
+		}
+
+		u32 sizeClass = next() % 100;
+		u64 size = sizeClass < 80 ? 8 + next() % 248 : sizeClass < 98 ? 256 + next() % (64 * 1024) : 64 * 1024 + next() % (4 * 1024 * 1024);
+		u32 alignment = next() % 32 == 0 ? 64 : ALLOCATOR_MIN_ALIGNMENT;
+		u32 slot;
+		if (freeSlots.empty())
+		{
+			slot = trace->slotCount++;
+			slotAlignments.push_back(alignment);
+		}
+		else
+		{
+			slot = freeSlots.back();
+			freeSlots.pop_back();
+			slotAlignments[slot] = alignment;
+		}
+		trace->events.push_back({ size, slot, alignment });
+		liveSlots.push_back(slot);
+		allocation++;
+	}
+	for (u32 slot : liveSlots)
+	{
+		trace->events.push_back({ 0, slot, slotAlignments[slot] });
+	}
+}
+
+typedef void* (*ReplayAllocateFunction)(size_t size, size_t alignment);
+typedef void (*ReplayFreeFunction)(void* memory, size_t alignment);
+
+static void* replay_allocatorAllocate(size_t size, size_t alignment)
+{
+	return allocator_allocateAligned(size, alignment, 0);
+}
+
+static void replay_allocatorFree(void* memory, size_t)
+{
+	allocator_free(memory);
+}
+
+static void* replay_mallocAllocate(size_t size, size_t alignment)
+{
+#ifdef _WIN64
+	return alignment > ALLOCATOR_MIN_ALIGNMENT ? _aligned_malloc(size, alignment) : malloc(size);
+#else
+	void* memory = nullptr;
+	return alignment > ALLOCATOR_MIN_ALIGNMENT ? (posix_memalign(&memory, alignment, size) == 0 ? memory : nullptr) : malloc(size);
+#endif
+}
+
+static void replay_mallocFree(void* memory, size_t alignment)
+{
+#ifdef _WIN64
+	if (alignment > ALLOCATOR_MIN_ALIGNMENT)
+	{
+		_aligned_free(memory);
+		return;
+	}
+#endif
+	free(memory);
+}
+
+static inline void replay_event(const AllocationTraceEvent& event, void** slots, ReplayAllocateFunction allocate, ReplayFreeFunction release)
+{
+	if (event.size)
+	{
+		// Touch the memory like its owner would
+		u8* memory = (u8*)allocate(size_t(event.size), event.alignment);
+		memory[0] = u8(event.slot);
+		slots[event.slot] = memory;
+	}
+	else
+	{
+		release(slots[event.slot], event.alignment);
+	}
+}
+
+static void allocator_replay(const AllocationTrace& trace, void** slots, ReplayAllocateFunction allocate, ReplayFreeFunction release)
+{
+	for (const AllocationTraceEvent& event : trace.events)
+	{
+		replay_event(event, slots, allocate, release);
+	}
+}
+
+/*
+Replays stop at the trace's peak until all of them hold it, then the last one to arrive samples the resident set.
+Every replay runs on its own thread, since there are never more jobs than pool threads
+*/
+struct PeakBarrier
+{
+	std::atomic<u32> arrivedCount;
+	std::atomic<bool32> sampled;
+	u32 threadCount;
+	u64 residentBytes;
+};
+
+static void peakBarrier_arrive(PeakBarrier* barrier)
+{
+	if (barrier->arrivedCount.fetch_add(1, std::memory_order_acq_rel) + 1 == barrier->threadCount)
+	{
+		barrier->residentBytes = process_residentBytes();
+		barrier->sampled.store(true, std::memory_order_release);
+	}
+	while (!barrier->sampled.load(std::memory_order_acquire))
+	{
+		std::this_thread::yield();
+	}
+}
+
+// Times every sampleStride-th event. With a peak barrier, waits at it right after event peakEvent
+static void allocator_replayTimed(const AllocationTrace& trace, void** slots, ReplayAllocateFunction allocate, ReplayFreeFunction release, u64 sampleStride, u32* latencies, u64 peakEvent, PeakBarrier* peak)
+{
+	const u64 eventCount = trace.events.size();
+	u64 sample = 0;
+	for (u64 i = 0; i < eventCount; i++)
+	{
+		if (i % sampleStride == 0)
+		{
+			u64 start = __rdtsc();
+			replay_event(trace.events[size_t(i)], slots, allocate, release);
+			u64 ticks = __rdtsc() - start;
+			latencies[sample++] = ticks < 0xFFFFFFFF ? u32(ticks) : 0xFFFFFFFF;
+		}
+		else
+		{
+			replay_event(trace.events[size_t(i)], slots, allocate, release);
+		}
+		if (peak && i == peakEvent)
+		{
+			peakBarrier_arrive(peak);
+		}
+	}
+}
+
+// Most bytes the trace holds at once, and the event after which it does
+static u64 allocationTrace_peak(const AllocationTrace& trace, u64* peakEvent)
+{
+	vector<u64> slotSizes(trace.slotCount);
+	u64 liveBytes = 0;
+	u64 peakBytes = 0;
+	*peakEvent = 0;
+	for (u64 i = 0; i < trace.events.size(); i++)
+	{
+		const AllocationTraceEvent& event = trace.events[size_t(i)];
+		if (event.size)
+		{
+			slotSizes[event.slot] = event.size;
+			liveBytes += event.size;
+			if (liveBytes > peakBytes)
+			{
+				peakBytes = liveBytes;
+				*peakEvent = i;
+			}
+		}
+		else
+		{
+			liveBytes -= slotSizes[event.slot];
+		}
+	}
+	return peakBytes;
+}
+
+void allocator_benchmark(const char* name, const AllocationTrace& trace, u32 iterationCount, ThreadPool* pool)
+{
+	using Clock = std::chrono::high_resolution_clock;
+
+	struct Contender
+	{
+		const char* name;
+		ReplayAllocateFunction allocate;
+		ReplayFreeFunction release;
+	};
+	const Contender contenders[] =
+	{
+		{ "RedAllocator", replay_allocatorAllocate, replay_allocatorFree },
+#ifdef _WIN64
+		{ "CRT malloc", replay_mallocAllocate, replay_mallocFree },
+#else
+		{ "libc malloc", replay_mallocAllocate, replay_mallocFree },
+#endif
+	};
+
+	const u32 maxThreadCount = pool ? pool->threadCount : 1;
+	const u64 eventCount = trace.events.size();
+	u64 peakEvent;
+	const u64 peakBytes = allocationTrace_peak(trace, &peakEvent);
+	printf("Allocator benchmark %s: %llu events, %u allocations, %.2f MiB peak, %llu dropped\n", name, eventCount, trace.slotCount, double(peakBytes) / (1024.0 * 1024.0), trace.droppedEventCount);
+	if (!trace.slotCount)
+	{
+		return;
+	}
+
+	const u64 sampleStride = eventCount > ALLOCATOR_BENCHMARK_LATENCY_SAMPLES ? (eventCount + ALLOCATOR_BENCHMARK_LATENCY_SAMPLES - 1) / ALLOCATOR_BENCHMARK_LATENCY_SAMPLES : 1;
+	const u64 samplesPerThread = (eventCount + sampleStride - 1) / sampleStride;
+	vector<void*> slots(size_t(trace.slotCount) * maxThreadCount);
+	vector<u32> latencies(size_t(samplesPerThread * maxThreadCount));
+
+	// 1, 2, 4... and every pool thread, so a scalability regression shows at the count it starts at
+	for (u32 threadCount = 1;; threadCount = threadCount * 2 < maxThreadCount ? threadCount * 2 : maxThreadCount)
+	{
+		for (const Contender& contender : contenders)
+		{
+			// A slower replay first, for latencies and resident memory: at 1 thread nothing of the trace is cached yet.
+			// Later thread counts only grow by what the previous ones left behind
+			const u64 residentBefore = process_residentBytes();
+			PeakBarrier peak;
+			peak.arrivedCount.store(0);
+			peak.sampled.store(false);
+			peak.threadCount = threadCount;
+			peak.residentBytes = residentBefore;
+			auto timedReplay = [&](u32 jobIndex, u32)
+			{
+				allocator_replayTimed(trace, &slots[size_t(jobIndex) * trace.slotCount], contender.allocate, contender.release, sampleStride, &latencies[size_t(jobIndex * samplesPerThread)], peakEvent, &peak);
+			};
+			Clock::time_point timedStart = Clock::now();
+			const u64 startTicks = __rdtsc();
+			if (threadCount > 1)
+			{
+				threadPool_parallelFor(pool, threadCount, timedReplay);
+			}
+			else
+			{
+				timedReplay(0, 0);
+			}
+			const double nanosecondsPerTick = std::chrono::duration<double, std::nano>(Clock::now() - timedStart).count() / double(__rdtsc() - startTicks);
+			const u64 residentAfter = process_residentBytes();
+
+			auto replay = [&](u32 jobIndex, u32)
+			{
+				allocator_replay(trace, &slots[size_t(jobIndex) * trace.slotCount], contender.allocate, contender.release);
+			};
+			double bestSeconds = 1e30;
+			for (u32 iteration = 0; iteration < iterationCount; iteration++)
+			{
+				Clock::time_point start = Clock::now();
+				if (threadCount > 1)
+				{
+					threadPool_parallelFor(pool, threadCount, replay);
+				}
+				else
+				{
+					replay(0, 0);
+				}
+				double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+				bestSeconds = seconds < bestSeconds ? seconds : bestSeconds;
+			}
+
+			u32* sorted = latencies.data();
+			const u64 sampleCount = samplesPerThread * threadCount;
+			eastl::sort(sorted, sorted + sampleCount);
+			const double p50 = double(sorted[sampleCount / 2]) * nanosecondsPerTick;
+			const double p99 = double(sorted[sampleCount * 99 / 100]) * nanosecondsPerTick;
+			const double worst = double(sorted[sampleCount - 1]) * nanosecondsPerTick;
+			const u64 residentGrowth = peak.residentBytes > residentBefore ? peak.residentBytes - residentBefore : 0;
+			const u64 retained = residentAfter > residentBefore ? residentAfter - residentBefore : 0;
+
+			printf("\t%-12s %2u threads: %8.3f ms, %7.2f M events/s, p50 %5.0f ns, p99 %6.0f ns, max %8.0f ns, resident %7.2f MiB at peak (%.2fx live), %7.2f MiB retained\n",
+				contender.name, threadCount, bestSeconds * 1000.0, double(eventCount) * threadCount / bestSeconds * 1e-6, p50, p99, worst,
+				double(residentGrowth) / (1024.0 * 1024.0), double(residentGrowth) / double(peakBytes * threadCount), double(retained) / (1024.0 * 1024.0));
+		}
+
+		if (threadCount == maxThreadCount)
+		{
+			break;
+		}
+	}
+}
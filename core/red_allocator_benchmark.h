@@ -0,0 +1,32 @@
+#pragma once
+
+#include "common.h"
+#include "red_allocator.h"
+
+struct ThreadPool;
+
+/*
+Replays of captured allocation traces against this allocator and the C runtime malloc (the CRT on Windows, libc
+elsewhere). Traces saved to a file replay the same way in later builds, so allocator changes can be compared on the
+exact workload that was captured.
+*/
+#define ALLOCATION_TRACE_MAGIC 0x43525441 // "ATRC"
+#define ALLOCATION_TRACE_VERSION 1
+// Events timed one by one per thread for the latency percentiles, spread evenly over the trace
+#define ALLOCATOR_BENCHMARK_LATENCY_SAMPLES (1024 * 1024)
+
+bool32 allocationTrace_save(const char* path, const AllocationTrace& trace);
+bool32 allocationTrace_load(const char* path, AllocationTrace* trace);
+// For when no captured trace is at hand: mostly small allocations, some medium ones and the odd large buffer, a few
+// over-aligned, freed in random order around a steady live count. The same seed gives the same trace
+void allocationTrace_synthetic(AllocationTrace* trace, u32 allocationCount, u32 seed);
+
+/*
+For each allocator, on 1, 2, 4... up to every pool thread, each thread replaying its own copy of the trace:
+- throughput: best of iterationCount replays, events per second over all threads
+- p50, p99 and worst latency of single allocations and frees
+- fragmentation: resident memory the replay grew by once every thread holds the trace's peak, over the bytes live then
+- retained: resident memory still grown once everything is freed
+pool may be null to stay on one thread.
+*/
+void allocator_benchmark(const char* name, const AllocationTrace& trace, u32 iterationCount, ThreadPool* pool);
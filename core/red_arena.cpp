@@ -0,0 +1,158 @@
+#include "common.h"
+#include "red_arena.h"
+#include "red_allocator.h"
+#include "red_memory.h"
+
+void linearArena_create(LinearArena* arena, size_t capacity, u32 flags)
+{
+	arena->memory = nullptr;
+	arena->largePages = false;
+	if (flags & LINEAR_ARENA_LARGE_PAGES_BIT)
+	{
+		const size_t largePageSize = virtualMemory_largePageSize();
+		if (largePageSize)
+		{
+			capacity = (capacity + largePageSize - 1) & ~(largePageSize - 1);
+			arena->memory = (u8*)virtualMemory_allocateLargePages(capacity);
+			arena->largePages = arena->memory != nullptr;
+		}
+	}
+	if (!arena->memory)
+	{
+		capacity = (capacity + LINEAR_ARENA_COMMIT_SIZE - 1) & ~size_t(LINEAR_ARENA_COMMIT_SIZE - 1);
+		arena->memory = (u8*)((flags & LINEAR_ARENA_NUMA_LOCAL_BIT) ? virtualMemory_reserveOnNode(capacity, numa_currentNode()) : virtualMemory_reserve(capacity));
+	}
+	assert(arena->memory);
+	arena->capacity = capacity;
+	arena->committed = arena->largePages ? capacity : 0;
+	arena->used = 0;
+	arena->previousUsed = 0;
+	arena->peak = 0;
+	arena->resetPeak = 0;
+	arena->allocationCount = 0;
+	arena->overflowCount = 0;
+	arena->flags = flags;
+}
+
+void linearArena_destroy(LinearArena* arena)
+{
+	virtualMemory_release(arena->memory, arena->capacity);
+	arena->memory = nullptr;
+	arena->capacity = 0;
+	arena->committed = 0;
+	arena->used = 0;
+}
+
+static bool32 linearArena_commit(LinearArena* arena, size_t end)
+{
+	// At least double, so an arena that grows one allocation at a time doesn't commit one page at a time
+	size_t committed = (end + LINEAR_ARENA_COMMIT_SIZE - 1) & ~size_t(LINEAR_ARENA_COMMIT_SIZE - 1);
+	committed = max(committed, min(arena->committed * 2, arena->capacity));
+	if (!virtualMemory_commit(arena->memory + arena->committed, committed - arena->committed))
+	{
+		return false;
+	}
+	if (arena->flags & LINEAR_ARENA_HUGE_PAGES_BIT)
+	{
+		virtualMemory_adviseHugePages(arena->memory + arena->committed, committed - arena->committed);
+	}
+	arena->committed = committed;
+	return true;
+}
+
+void* linearArena_allocate(LinearArena* arena, size_t size, size_t alignment, size_t alignmentOffset)
+{
+	if (!arena)
+	{
+		return allocator_allocateAligned(size, alignment, alignmentOffset);
+	}
+
+	assert(alignment && (alignment & (alignment - 1)) == 0);
+	size_t address = (size_t)arena->memory + arena->used;
+	size_t aligned = ((address + alignmentOffset + alignment - 1) & ~(alignment - 1)) - alignmentOffset;
+	size_t end = aligned + size - (size_t)arena->memory;
+	if (end > arena->capacity || (end > arena->committed && !linearArena_commit(arena, end)))
+	{
+		arena->overflowCount++;
+		return allocator_allocateAligned(size, alignment, alignmentOffset);
+	}
+
+	arena->previousUsed = arena->used;
+	arena->used = end;
+	arena->peak = arena->used > arena->peak ? arena->used : arena->peak;
+	arena->resetPeak = arena->used > arena->resetPeak ? arena->used : arena->resetPeak;
+	arena->allocationCount++;
+	return (void*)aligned;
+}
+
+void linearArena_free(LinearArena* arena, void* memory, size_t size)
+{
+	u8* bytes = (u8*)memory;
+	if (!arena || bytes < arena->memory || bytes >= arena->memory + arena->capacity)
+	{
+		allocator_free(memory);
+		return;
+	}
+
+	if (bytes + size == arena->memory + arena->used)
+	{
+		size_t start = size_t(bytes - arena->memory);
+		arena->used = arena->previousUsed <= start ? arena->previousUsed : start;
+		arena->previousUsed = arena->used;
+	}
+}
+
+void linearArena_reset(LinearArena* arena)
+{
+	if (!arena->largePages)
+	{
+		size_t keep = (arena->resetPeak + LINEAR_ARENA_COMMIT_SIZE - 1) & ~size_t(LINEAR_ARENA_COMMIT_SIZE - 1);
+		if (arena->committed > keep)
+		{
+			virtualMemory_decommit(arena->memory + keep, arena->committed - keep);
+			arena->committed = keep;
+		}
+	}
+	arena->used = 0;
+	arena->previousUsed = 0;
+	arena->resetPeak = 0;
+	arena->allocationCount = 0;
+	arena->overflowCount = 0;
+}
+
+bool32 linearArena_checkAlignment()
+{
+	static const size_t alignments[] = { 1, 2, 8, 16, 32, 64, 128, 4096 };
+	bool32 passed = true;
+	LinearArena arena;
+	linearArena_create(&arena, 64 * KILOBYTE);
+	for (size_t alignment : alignments)
+	{
+		for (size_t offset = 0; offset < alignment; offset += offset < 16 ? 4 : offset)
+		{
+			// The second size doesn't fit: the general purpose allocator serves it
+			for (size_t size : { size_t(24), size_t(128 * KILOBYTE) })
+			{
+				u8* memory = (u8*)linearArena_allocate(&arena, size, alignment, offset);
+				if (!memory || ((size_t)memory + offset) & (alignment - 1))
+				{
+					printf("Linear arena: %zu bytes at alignment %zu offset %zu misaligned at %p\n", size, alignment, offset, memory);
+					passed = false;
+				}
+				if (memory)
+				{
+					memset(memory, 0xAB, size);
+				}
+				size_t used = arena.used;
+				linearArena_free(&arena, memory, size);
+				if (size < arena.capacity && arena.used != 0)
+				{
+					printf("Linear arena: freeing %zu bytes at alignment %zu offset %zu left %zu of %zu bytes used\n", size, alignment, offset, arena.used, used);
+					passed = false;
+				}
+			}
+		}
+	}
+	linearArena_destroy(&arena);
+	return passed;
+}
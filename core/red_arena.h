@@ -0,0 +1,104 @@
+#pragma once
+
+#include "common.h"
+
+enum LinearArenaFlags : u32
+{
+	// Linux: ask for transparent huge pages as the arena commits. Fewer TLB misses on big arenas
+	LINEAR_ARENA_HUGE_PAGES_BIT = (1 << 0),
+	// Explicit large pages, committed up front because Windows can't commit them piecewise. Falls back to regular pages
+	LINEAR_ARENA_LARGE_PAGES_BIT = (1 << 1),
+	// Pages come from the NUMA node of the creating thread, which should be the thread using the arena
+	LINEAR_ARENA_NUMA_LOCAL_BIT = (1 << 2),
+};
+
+// Granularity of commits and of what a reset keeps
+#define LINEAR_ARENA_COMMIT_SIZE (64 * KILOBYTE)
+
+/*
+Bump allocator for memory that dies all at once. Not thread safe: one owner at a time. capacity is only reserved:
+pages are committed as allocations reach them, and a reset decommits the pages the arena no longer uses, so a
+generous capacity costs address space and nothing else.
+*/
+struct LinearArena
+{
+	u8* memory;
+	size_t capacity;
+	size_t committed;
+	size_t used;
+	size_t previousUsed; // Before the latest allocation: freeing it gives its alignment padding back too
+	size_t peak;
+	size_t resetPeak; // Highest used since the last reset
+	u64 allocationCount; // Since the last reset
+	u64 overflowCount; // Requests that didn't fit, served by the general purpose allocator instead
+	u32 flags;
+	bool32 largePages; // Committed whole at creation
+};
+
+void linearArena_create(LinearArena* arena, size_t capacity, u32 flags = 0);
+void linearArena_destroy(LinearArena* arena);
+/*
+alignment is a power of two, the pointer plus alignmentOffset is aligned. Falls back to the general purpose allocator
+when full; linearArena_free gives that memory back, aligned or not
+*/
+void* linearArena_allocate(LinearArena* arena, size_t size, size_t alignment = 16, size_t alignmentOffset = 0);
+// Only the most recent allocation is actually given back, anything else waits for the reset
+void linearArena_free(LinearArena* arena, void* memory, size_t size);
+// Decommits the pages past what was used since the previous reset, so a spike holds memory for one more use only
+void linearArena_reset(LinearArena* arena);
+// Allocates and frees at every alignment and offset, in the arena and past its end. Prints failures
+bool32 linearArena_checkAlignment();
+
+// EASTL allocator over a LinearArena, for containers that live no longer than the arena's current use.
+// Without an arena it forwards to the general purpose allocator
+class LinearArenaAllocator
+{
+public:
+	LinearArenaAllocator(const char* name = "LinearArenaAllocator")
+		: arena(nullptr), name(name)
+	{}
+	LinearArenaAllocator(LinearArena* arena, const char* name = "LinearArenaAllocator")
+		: arena(arena), name(name)
+	{}
+	LinearArenaAllocator(const LinearArenaAllocator& other, const char* name)
+		: arena(other.arena), name(name)
+	{}
+
+	void* allocate(size_t n, int flags = 0)
+	{
+		return linearArena_allocate(arena, n);
+	}
+	void* allocate(size_t n, size_t alignment, size_t offset, int flags = 0)
+	{
+		return linearArena_allocate(arena, n, alignment, offset);
+	}
+	void deallocate(void* p, size_t n)
+	{
+		linearArena_free(arena, p, n);
+	}
+
+	const char* get_name() const
+	{
+		return name;
+	}
+	void set_name(const char* newName)
+	{
+		name = newName;
+	}
+
+	LinearArena* arena;
+	const char* name;
+};
+
+inline bool operator==(const LinearArenaAllocator& a, const LinearArenaAllocator& b)
+{
+	return a.arena == b.arena;
+}
+
+inline bool operator!=(const LinearArenaAllocator& a, const LinearArenaAllocator& b)
+{
+	return a.arena != b.arena;
+}
+
+template<typename T>
+using ScratchVector = eastl::vector<T, LinearArenaAllocator>;
@@ -0,0 +1,245 @@
+#include "common.h"
+#include "red_file.h"
+#include "red_memory.h"
+
+#ifndef _WIN64
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+bool32 file_map(const char* path, MappedFile* mappedFile)
+{
+	mappedFile->data = nullptr;
+	mappedFile->size = 0;
+#ifdef _WIN64
+	mappedFile->mapping = nullptr;
+	mappedFile->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (mappedFile->file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(mappedFile->file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(mappedFile->file);
+		return false;
+	}
+
+	mappedFile->mapping = CreateFileMappingA(mappedFile->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mappedFile->mapping)
+	{
+		CloseHandle(mappedFile->file);
+		return false;
+	}
+
+	mappedFile->data = MapViewOfFile(mappedFile->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!mappedFile->data)
+	{
+		CloseHandle(mappedFile->mapping);
+		CloseHandle(mappedFile->file);
+		return false;
+	}
+	mappedFile->size = u64(fileSize.QuadPart);
+#else
+	mappedFile->file = open(path, O_RDONLY);
+	if (mappedFile->file < 0)
+	{
+		return false;
+	}
+
+	struct stat fileStat;
+	if (fstat(mappedFile->file, &fileStat) != 0 || fileStat.st_size == 0)
+	{
+		close(mappedFile->file);
+		return false;
+	}
+
+	void* data = mmap(nullptr, size_t(fileStat.st_size), PROT_READ, MAP_PRIVATE, mappedFile->file, 0);
+	if (data == MAP_FAILED)
+	{
+		close(mappedFile->file);
+		return false;
+	}
+	madvise(data, size_t(fileStat.st_size), MADV_SEQUENTIAL);
+	mappedFile->data = data;
+	mappedFile->size = u64(fileStat.st_size);
+#endif
+
+	return true;
+}
+
+void file_unmap(MappedFile* mappedFile)
+{
+	if (!mappedFile->data)
+	{
+		return;
+	}
+#ifdef _WIN64
+	UnmapViewOfFile(mappedFile->data);
+	CloseHandle(mappedFile->mapping);
+	CloseHandle(mappedFile->file);
+#else
+	munmap((void*)mappedFile->data, size_t(mappedFile->size));
+	close(mappedFile->file);
+#endif
+	mappedFile->data = nullptr;
+	mappedFile->size = 0;
+}
+
+void file_releasePages(const MappedFile& mappedFile, u64 offset, u64 size)
+{
+	assert(offset + size <= mappedFile.size);
+	const u64 pageSize = virtualMemory_pageSize();
+	const u64 begin = offset & ~(pageSize - 1);
+	const u64 end = (offset + size + pageSize - 1) & ~(pageSize - 1);
+	u8* pages = (u8*)mappedFile.data + begin;
+	const u64 pagesSize = (end < mappedFile.size ? end : mappedFile.size) - begin;
+#ifdef _WIN64
+	// Pages that aren't locked leave the working set, and the call reports ERROR_NOT_LOCKED
+	VirtualUnlock(pages, SIZE_T(pagesSize));
+#else
+	// The mapping is private but never written, so its pages are still the file's
+	madvise(pages, size_t(pagesSize), MADV_DONTNEED);
+#endif
+}
+
+static const u64 hashPrime1 = 0x9E3779B185EBCA87ull;
+static const u64 hashPrime2 = 0xC2B2AE3D27D4EB4Full;
+static const u64 hashPrime3 = 0x165667B19E3779F9ull;
+
+static inline u64 hash_rotl(u64 x, u32 r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline u64 hash_round(u64 lane, u64 word)
+{
+	lane += word * hashPrime2;
+	lane = hash_rotl(lane, 31);
+	return lane * hashPrime1;
+}
+
+static inline u64 hash_read64(const u8* p)
+{
+	u64 word;
+	memcpy(&word, p, sizeof(word));
+	return word;
+}
+
+// xxHash64 style: four independent lanes keep the multiplier pipeline busy so hashing runs close to memory bandwidth
+bool32 file_writeAt(const char* path, u64 offset, const void* data, u64 size)
+{
+	FILE* file = fopen(path, "r+b");
+	if (!file)
+	{
+		return false;
+	}
+	bool32 success = file_seek(file, i64(offset), SEEK_SET) == 0 && fwrite(data, 1, size_t(size), file) == size_t(size);
+	success = (fclose(file) == 0) && success;
+
+	return success;
+}
+
+u64 hash64(const void* data, u64 size, u64 seed)
+{
+	const u8* p = (const u8*)data;
+	const u8* end = p + size;
+
+	u64 lanes[4] =
+	{
+		seed + hashPrime1 + hashPrime2,
+		seed + hashPrime2,
+		seed,
+		seed - hashPrime1
+	};
+
+	while (end - p >= 32)
+	{
+		lanes[0] = hash_round(lanes[0], hash_read64(p + 0));
+		lanes[1] = hash_round(lanes[1], hash_read64(p + 8));
+		lanes[2] = hash_round(lanes[2], hash_read64(p + 16));
+		lanes[3] = hash_round(lanes[3], hash_read64(p + 24));
+		p += 32;
+	}
+
+	u64 hash = hash_rotl(lanes[0], 1) + hash_rotl(lanes[1], 7) + hash_rotl(lanes[2], 12) + hash_rotl(lanes[3], 18);
+	hash += size;
+
+	while (end - p >= 8)
+	{
+		hash ^= hash_round(0, hash_read64(p));
+		hash = hash_rotl(hash, 27) * hashPrime1 + hashPrime3;
+		p += 8;
+	}
+
+	while (p < end)
+	{
+		hash ^= (*p) * hashPrime3;
+		hash = hash_rotl(hash, 11) * hashPrime1;
+		p++;
+	}
+
+	hash ^= hash >> 33;
+	hash *= hashPrime2;
+	hash ^= hash >> 29;
+	hash *= hashPrime3;
+	hash ^= hash >> 32;
+
+	return hash;
+}
+
+u64 file_hash(const char* path)
+{
+	MappedFile file;
+	if (!file_map(path, &file))
+	{
+		return 0;
+	}
+
+	u64 hash = hash64(file.data, file.size);
+	file_unmap(&file);
+
+	return hash;
+}
+
+bool32 file_version(const char* path, FileVersion* version)
+{
+	*version = {};
+#ifdef _WIN64
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesExA(path, GetFileExInfoStandard, &attributes))
+	{
+		return false;
+	}
+	version->size = (u64(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+	version->writeTime = (u64(attributes.ftLastWriteTime.dwHighDateTime) << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+#else
+	struct stat fileStat;
+	if (stat(path, &fileStat) != 0)
+	{
+		return false;
+	}
+	version->size = u64(fileStat.st_size);
+	version->writeTime = u64(fileStat.st_mtim.tv_sec) * 1000000000ull + u64(fileStat.st_mtim.tv_nsec);
+#endif
+
+	return true;
+}
+
+bool32 fileVersion_matches(const FileVersion& cooked, FileVersion* current, const char* path, bool32 verify)
+{
+	if (!verify && fileVersion_sameStamp(cooked, *current))
+	{
+		return true;
+	}
+
+	if (!current->hash)
+	{
+		current->hash = file_hash(path);
+	}
+
+	return current->hash != 0 && current->hash == cooked.hash;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "common.h"
+
+// fseek and ftell with 64 bit offsets everywhere
+inline i32 file_seek(FILE* file, i64 offset, i32 origin)
+{
+#ifdef _WIN64
+	return _fseeki64(file, offset, origin);
+#else
+	return fseeko(file, off_t(offset), origin);
+#endif
+}
+
+inline i64 file_tell(FILE* file)
+{
+#ifdef _WIN64
+	return _ftelli64(file);
+#else
+	return i64(ftello(file));
+#endif
+}
+
+// Read-only view of a whole file mapped into the address space
+struct MappedFile
+{
+	const void* data;
+	u64 size;
+#ifdef _WIN64
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int file;
+#endif
+};
+
+bool32 file_map(const char* path, MappedFile* mappedFile);
+void file_unmap(MappedFile* mappedFile);
+// Drops the pages of a mapped range from the working set, widened to whole pages. Touching them again reads them back
+void file_releasePages(const MappedFile& mappedFile, u64 offset, u64 size);
+// Overwrites size bytes at offset in an existing file. The file must not be mapped
+bool32 file_writeAt(const char* path, u64 offset, const void* data, u64 size);
+
+u64 hash64(const void* data, u64 size, u64 seed = 0);
+// Content hash of a file, 0 if it can't be opened
+u64 file_hash(const char* path);
+
+// What a cooked file records about its source. Size and write time are cheap to compare on every load, the content
+// hash settles it when they changed without the content changing (a copy, a checkout)
+struct FileVersion
+{
+	u64 size;
+	u64 writeTime;
+	u64 hash;
+};
+
+// Size and write time only, hash is left 0. False if the file doesn't exist
+bool32 file_version(const char* path, FileVersion* version);
+// Whether the file at path, whose size and write time are in current, still has the content cooked was taken from.
+// Hashes it into current->hash, unless already there, only when size or write time differ or when verify is set.
+// A match despite a different stamp keeps hashing on every load until the caller writes current into the cook
+bool32 fileVersion_matches(const FileVersion& cooked, FileVersion* current, const char* path, bool32 verify);
+
+inline bool32 fileVersion_sameStamp(const FileVersion& a, const FileVersion& b)
+{
+	return a.size == b.size && a.writeTime == b.writeTime;
+}
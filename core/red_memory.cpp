@@ -0,0 +1,401 @@
+#include "common.h"
+#include "red_memory.h"
+
+#ifdef _WIN64
+#include <psapi.h>
+#else
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/sysinfo.h>
+#include <unistd.h>
+#endif
+
+u64 process_residentBytes()
+{
+#ifdef _WIN64
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+	{
+		return 0;
+	}
+	return u64(counters.WorkingSetSize);
+#else
+	FILE* file = fopen("/proc/self/statm", "r");
+	if (!file)
+	{
+		return 0;
+	}
+
+	unsigned long long totalPages = 0;
+	unsigned long long residentPages = 0;
+	int fields = fscanf(file, "%llu %llu", &totalPages, &residentPages);
+	fclose(file);
+
+	return fields == 2 ? u64(residentPages) * u64(sysconf(_SC_PAGESIZE)) : 0;
+#endif
+}
+
+u64 process_peakResidentBytes()
+{
+#ifdef _WIN64
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+	{
+		return 0;
+	}
+	return u64(counters.PeakWorkingSetSize);
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+	{
+		return 0;
+	}
+	// Linux reports kilobytes
+	return u64(usage.ru_maxrss) * 1024;
+#endif
+}
+
+void* virtualMemory_reserve(size_t size)
+{
+#ifdef _WIN64
+	return VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+	void* memory = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	return memory == MAP_FAILED ? nullptr : memory;
+#endif
+}
+
+bool32 virtualMemory_commit(void* memory, size_t size)
+{
+#ifdef _WIN64
+	return VirtualAlloc(memory, size, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+	return mprotect(memory, size, PROT_READ | PROT_WRITE) == 0;
+#endif
+}
+
+void virtualMemory_decommit(void* memory, size_t size)
+{
+#ifdef _WIN64
+	VirtualFree(memory, size, MEM_DECOMMIT);
+#else
+	madvise(memory, size, MADV_DONTNEED);
+	mprotect(memory, size, PROT_NONE);
+#endif
+}
+
+void virtualMemory_release(void* memory, size_t size)
+{
+#ifdef _WIN64
+	VirtualFree(memory, 0, MEM_RELEASE);
+#else
+	munmap(memory, size);
+#endif
+}
+
+size_t virtualMemory_pageSize()
+{
+#ifdef _WIN64
+	SYSTEM_INFO systemInfo;
+	GetSystemInfo(&systemInfo);
+	return size_t(systemInfo.dwPageSize);
+#else
+	return size_t(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+#ifdef _WIN64
+// Large pages are locked in memory: the process token has to hold the privilege and have it enabled
+static bool32 virtualMemory_enableLockMemoryPrivilege()
+{
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+	{
+		return false;
+	}
+	TOKEN_PRIVILEGES privileges;
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	bool32 enabled = LookupPrivilegeValueA(nullptr, "SeLockMemoryPrivilege", &privileges.Privileges[0].Luid) &&
+		AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr) && GetLastError() == ERROR_SUCCESS;
+	CloseHandle(token);
+	return enabled;
+}
+#endif
+
+size_t virtualMemory_largePageSize()
+{
+#ifdef _WIN64
+	static const size_t largePageSize = virtualMemory_enableLockMemoryPrivilege() ? size_t(GetLargePageMinimum()) : 0;
+	return largePageSize;
+#else
+	FILE* file = fopen("/proc/meminfo", "r");
+	if (!file)
+	{
+		return 0;
+	}
+	char line[256];
+	unsigned long long kilobytes = 0;
+	unsigned long long freePages = 0;
+	while (fgets(line, sizeof(line), file))
+	{
+		sscanf(line, "HugePages_Free: %llu", &freePages);
+		sscanf(line, "Hugepagesize: %llu kB", &kilobytes);
+	}
+	fclose(file);
+	return freePages ? size_t(kilobytes * 1024) : 0;
+#endif
+}
+
+void virtualMemory_adviseHugePages(void* memory, size_t size)
+{
+#if !defined(_WIN64) && defined(MADV_HUGEPAGE)
+	madvise(memory, size, MADV_HUGEPAGE);
+#endif
+}
+
+void* virtualMemory_allocateLargePages(size_t size)
+{
+	size_t largePageSize = virtualMemory_largePageSize();
+	if (!largePageSize || size % largePageSize)
+	{
+		return nullptr;
+	}
+#ifdef _WIN64
+	return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+#else
+	void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	return memory == MAP_FAILED ? nullptr : memory;
+#endif
+}
+
+void* virtualMemory_reserveOnNode(size_t size, u32 node)
+{
+	if (numa_nodeCount() < 2)
+	{
+		return virtualMemory_reserve(size);
+	}
+#ifdef _WIN64
+	return VirtualAllocExNuma(GetCurrentProcess(), nullptr, size, MEM_RESERVE, PAGE_NOACCESS, node);
+#else
+	void* memory = virtualMemory_reserve(size);
+#ifdef SYS_mbind
+	// The policy sticks to the range and applies as pages fault in. No libnuma: MPOL_PREFERRED is 1 in the kernel ABI
+	const int preferred = 1;
+	unsigned long nodeMask = 1ul << node;
+	if (memory && node < sizeof(nodeMask) * 8)
+	{
+		syscall(SYS_mbind, memory, size, preferred, &nodeMask, sizeof(nodeMask) * 8, 0);
+	}
+#endif
+	return memory;
+#endif
+}
+
+#ifndef _WIN64
+// Reads the first line of a small sysfs or procfs file
+static bool32 readLine(const char* path, char* line, size_t size)
+{
+	FILE* file = fopen(path, "r");
+	if (!file)
+	{
+		return false;
+	}
+	bool32 read = fgets(line, int(size), file) != nullptr;
+	fclose(file);
+	return read;
+}
+
+// "max" in cgroup v2, a huge page-rounded number in v1: both mean no limit
+static u64 readCgroupLimit(const char* path)
+{
+	char line[64];
+	unsigned long long limit = 0;
+	if (!readLine(path, line, sizeof(line)) || sscanf(line, "%llu", &limit) != 1 || limit >= (1ull << 62))
+	{
+		return 0;
+	}
+	return u64(limit);
+}
+
+// The tightest memory limit of the cgroup this process is in and of its ancestors
+static u64 cgroup_memoryLimit()
+{
+	FILE* file = fopen("/proc/self/cgroup", "r");
+	if (!file)
+	{
+		return 0;
+	}
+
+	u64 limit = 0;
+	char line[512];
+	while (fgets(line, sizeof(line), file))
+	{
+		// hierarchy-ID:controllers:path, v2 has an empty controller list
+		char* controllers = strchr(line, ':');
+		char* cgroupPath = controllers ? strchr(controllers + 1, ':') : nullptr;
+		if (!cgroupPath)
+		{
+			continue;
+		}
+		*cgroupPath++ = 0;
+		controllers++;
+		cgroupPath[strcspn(cgroupPath, "\n")] = 0;
+
+		const char* root;
+		const char* limitFile;
+		if (!controllers[0])
+		{
+			root = "/sys/fs/cgroup";
+			limitFile = "memory.max";
+		}
+		else if (strstr(controllers, "memory"))
+		{
+			root = "/sys/fs/cgroup/memory";
+			limitFile = "memory.limit_in_bytes";
+		}
+		else
+		{
+			continue;
+		}
+
+		// Inside a container the path is usually / or doesn't exist in the mounted tree: walking up reaches the root either way
+		char directory[512];
+		snprintf(directory, sizeof(directory), "%s%s", root, cgroupPath);
+		const size_t rootLength = strlen(root);
+		for (;;)
+		{
+			char path[600];
+			snprintf(path, sizeof(path), "%s/%s", directory, limitFile);
+			u64 directoryLimit = readCgroupLimit(path);
+			if (directoryLimit && (!limit || directoryLimit < limit))
+			{
+				limit = directoryLimit;
+			}
+			char* slash = strrchr(directory, '/');
+			if (strlen(directory) <= rootLength || !slash)
+			{
+				break;
+			}
+			*slash = 0;
+		}
+	}
+	fclose(file);
+	return limit;
+}
+#endif
+
+u32 numa_nodeCount()
+{
+#ifdef _WIN64
+	ULONG highestNode = 0;
+	return GetNumaHighestNodeNumber(&highestNode) ? u32(highestNode) + 1 : 1;
+#else
+	// A list of ranges such as 0-1,3
+	char line[256];
+	if (!readLine("/sys/devices/system/node/online", line, sizeof(line)))
+	{
+		return 1;
+	}
+	u32 count = 0;
+	for (const char* range = line; *range >= '0' && *range <= '9';)
+	{
+		char* end;
+		unsigned long first = strtoul(range, &end, 10);
+		unsigned long last = *end == '-' ? strtoul(end + 1, &end, 10) : first;
+		count += u32(last - first + 1);
+		range = *end == ',' ? end + 1 : end;
+	}
+	return count ? count : 1;
+#endif
+}
+
+u32 numa_currentNode()
+{
+#ifdef _WIN64
+	PROCESSOR_NUMBER processor;
+	GetCurrentProcessorNumberEx(&processor);
+	USHORT node = 0;
+	return GetNumaProcessorNodeEx(&processor, &node) ? u32(node) : 0;
+#elif defined(SYS_getcpu)
+	unsigned cpu = 0;
+	unsigned node = 0;
+	return syscall(SYS_getcpu, &cpu, &node, nullptr) == 0 ? u32(node) : 0;
+#else
+	return 0;
+#endif
+}
+
+SystemMemoryInfo systemMemory_query()
+{
+	SystemMemoryInfo info = {};
+#ifdef _WIN64
+	MEMORYSTATUSEX status;
+	status.dwLength = sizeof(status);
+	if (GlobalMemoryStatusEx(&status))
+	{
+		info.physicalBytes = status.ullTotalPhys;
+		info.availableBytes = status.ullAvailPhys;
+	}
+	// Job objects limit committed memory rather than resident memory, the closest Windows has to a cgroup
+	JOBOBJECT_EXTENDED_LIMIT_INFORMATION job;
+	if (QueryInformationJobObject(nullptr, JobObjectExtendedLimitInformation, &job, sizeof(job), nullptr))
+	{
+		if (job.BasicLimitInformation.LimitFlags & JOB_OBJECT_LIMIT_PROCESS_MEMORY)
+		{
+			info.limitBytes = job.ProcessMemoryLimit;
+		}
+		if ((job.BasicLimitInformation.LimitFlags & JOB_OBJECT_LIMIT_JOB_MEMORY) && (!info.limitBytes || job.JobMemoryLimit < info.limitBytes))
+		{
+			info.limitBytes = job.JobMemoryLimit;
+		}
+	}
+#else
+	struct sysinfo system;
+	if (sysinfo(&system) == 0)
+	{
+		info.physicalBytes = u64(system.totalram) * system.mem_unit;
+		info.availableBytes = u64(system.freeram + system.bufferram) * system.mem_unit;
+	}
+	// Counts the page cache the kernel would drop, which sysinfo doesn't
+	FILE* file = fopen("/proc/meminfo", "r");
+	if (file)
+	{
+		char line[256];
+		unsigned long long kilobytes;
+		while (fgets(line, sizeof(line), file))
+		{
+			if (sscanf(line, "MemAvailable: %llu kB", &kilobytes) == 1)
+			{
+				info.availableBytes = u64(kilobytes) * 1024;
+				break;
+			}
+		}
+		fclose(file);
+	}
+	info.limitBytes = cgroup_memoryLimit();
+#endif
+	info.effectiveBytes = info.limitBytes && info.limitBytes < info.physicalBytes ? info.limitBytes : info.physicalBytes;
+	info.numaNodeCount = numa_nodeCount();
+	return info;
+}
+
+void printSystemMemoryInfo(const SystemMemoryInfo& info)
+{
+	const double gibibyte = 1024.0 * 1024.0 * 1024.0;
+	printf("System memory\n");
+	printf("\tPhysical: %.2f GiB, available: %.2f GiB\n", double(info.physicalBytes) / gibibyte, double(info.availableBytes) / gibibyte);
+	if (info.limitBytes)
+	{
+		printf("\tLimit: %.2f GiB\n", double(info.limitBytes) / gibibyte);
+	}
+	printf("\tEffective: %.2f GiB, NUMA nodes: %u\n", double(info.effectiveBytes) / gibibyte, info.numaNodeCount);
+}
+
+size_t systemMemory_budget(const SystemMemoryInfo& info, double fraction, size_t maximum)
+{
+	u64 budget = u64(double(info.effectiveBytes) * fraction);
+	// Unknown effective memory keeps the maximum
+	return budget && budget < maximum ? size_t(budget) : maximum;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "common.h"
+
+// Resident set of the current process, 0 if the platform can't tell
+u64 process_residentBytes();
+// High-water mark of the resident set since the process started
+u64 process_peakResidentBytes();
+
+/*
+Reserved address space costs no memory until it is committed, and committed pages only take physical memory once
+touched. Decommitted pages read back as zero when committed again.
+*/
+void* virtualMemory_reserve(size_t size);
+bool32 virtualMemory_commit(void* memory, size_t size);
+void virtualMemory_decommit(void* memory, size_t size);
+void virtualMemory_release(void* memory, size_t size);
+// Commit granularity
+size_t virtualMemory_pageSize();
+// 0 when the OS can't provide large pages to this process
+size_t virtualMemory_largePageSize();
+// Asks the OS to back a committed range with transparent huge pages. Linux only, a no-op elsewhere
+void virtualMemory_adviseHugePages(void* memory, size_t size);
+// Reserved and committed at once: Windows large pages can't be committed piecewise. Needs SeLockMemoryPrivilege on
+// Windows and preallocated hugetlbfs pages on Linux, nullptr otherwise. size is a multiple of virtualMemory_largePageSize
+void* virtualMemory_allocateLargePages(size_t size);
+// Reserved like virtualMemory_reserve, with its pages preferably taken from the given NUMA node once committed
+void* virtualMemory_reserveOnNode(size_t size, u32 node);
+
+// 1 on machines without NUMA or where the OS doesn't say
+u32 numa_nodeCount();
+// Node of the processor the calling thread runs on right now
+u32 numa_currentNode();
+
+struct SystemMemoryInfo
+{
+	u64 physicalBytes;
+	u64 availableBytes; // Free or reclaimable without swapping, right now
+	u64 limitBytes; // cgroup memory.max on Linux, job object limit on Windows. 0 without one
+	u64 effectiveBytes; // What this process can count on: the smaller of physicalBytes and limitBytes
+	u32 numaNodeCount;
+};
+
+// Reads the OS every time: call it when sizing something, not per frame
+SystemMemoryInfo systemMemory_query();
+void printSystemMemoryInfo(const SystemMemoryInfo& info);
+// fraction of the effective memory, at most maximum: sizes that follow the machine or the container the process runs in
+size_t systemMemory_budget(const SystemMemoryInfo& info, double fraction, size_t maximum);
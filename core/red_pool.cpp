@@ -0,0 +1,73 @@
+#include "common.h"
+#include "red_pool.h"
+
+void handlePool_create(HandlePool* pool, u32 capacity)
+{
+	assert(capacity <= HANDLE_MAX_SLOTS);
+	pool->slotGenerations.reserve(capacity);
+	pool->slotRecords.reserve(capacity);
+	pool->recordSlots.reserve(capacity);
+	pool->firstFreeSlot = HANDLE_INVALID_INDEX;
+	pool->count = 0;
+	pool->capacity = capacity;
+}
+
+u32 handlePool_allocate(HandlePool* pool)
+{
+	u32 slot = pool->firstFreeSlot;
+	if (slot != HANDLE_INVALID_INDEX)
+	{
+		pool->firstFreeSlot = pool->slotRecords[slot];
+	}
+	else if (pool->slotGenerations.size() < pool->capacity)
+	{
+		slot = u32(pool->slotGenerations.size());
+		pool->slotGenerations.push_back(1);
+		pool->slotRecords.push_back(0);
+	}
+	else
+	{
+		return 0;
+	}
+
+	pool->slotRecords[slot] = pool->count;
+	pool->recordSlots.push_back(slot);
+	pool->count++;
+	return (pool->slotGenerations[slot] << HANDLE_SLOT_BITS) | slot;
+}
+
+u32 handlePool_recordIndex(const HandlePool& pool, u32 handle)
+{
+	const u32 slot = handle & HANDLE_MAX_SLOTS;
+	if (!handle || slot >= pool.slotGenerations.size() || pool.slotGenerations[slot] != (handle >> HANDLE_SLOT_BITS))
+	{
+		return HANDLE_INVALID_INDEX;
+	}
+	return pool.slotRecords[slot];
+}
+
+bool32 handlePool_free(HandlePool* pool, u32 handle, u32* recordIndex)
+{
+	const u32 record = handlePool_recordIndex(*pool, handle);
+	if (record == HANDLE_INVALID_INDEX)
+	{
+		return false;
+	}
+
+	// The last record takes the place of the freed one
+	const u32 slot = handle & HANDLE_MAX_SLOTS;
+	const u32 lastSlot = pool->recordSlots.back();
+	pool->recordSlots[record] = lastSlot;
+	pool->slotRecords[lastSlot] = record;
+	pool->recordSlots.pop_back();
+	pool->count--;
+
+	// Generation 0 would let handle 0 resolve
+	u32 generation = (pool->slotGenerations[slot] + 1) & HANDLE_GENERATION_MASK;
+	pool->slotGenerations[slot] = generation ? generation : 1;
+	pool->slotRecords[slot] = pool->firstFreeSlot;
+	pool->firstFreeSlot = slot;
+
+	*recordIndex = record;
+	return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "common.h"
+
+/*
+Handles to records kept dense in parallel arrays (SoA), so walking every live record touches no holes. A 32 bit
+handle packs the slot in the low HANDLE_SLOT_BITS and the slot generation above them: freeing a record bumps its
+slot generation, so handles to it stop resolving even once the slot is reused. 0 is never a valid handle.
+Allocation appends a record, freeing moves the last record into the hole: both O(1). The pool only tracks slots,
+its owner keeps the record arrays and moves their entries as handlePool_free says.
+*/
+#define HANDLE_SLOT_BITS 20
+#define HANDLE_MAX_SLOTS ((1u << HANDLE_SLOT_BITS) - 1)
+#define HANDLE_GENERATION_MASK ((1u << (32 - HANDLE_SLOT_BITS)) - 1)
+#define HANDLE_INVALID_INDEX 0xFFFFFFFFu
+
+struct HandlePool
+{
+	vector<u32> slotGenerations;
+	vector<u32> slotRecords; // Record of a live slot, next free slot of a free one
+	vector<u32> recordSlots;
+	u32 firstFreeSlot;
+	u32 count;
+	u32 capacity;
+};
+
+// Every array grows to capacity once, here: allocating and freeing never touch the heap afterwards
+void handlePool_create(HandlePool* pool, u32 capacity);
+// 0 once capacity records are live. The new record goes at index count - 1
+u32 handlePool_allocate(HandlePool* pool);
+// HANDLE_INVALID_INDEX for stale and invalid handles
+u32 handlePool_recordIndex(const HandlePool& pool, u32 handle);
+/*
+On success the record of handle has to be overwritten with the last record, at index count (already decremented),
+which then goes away: soaPool_removeRecord does both for one array.
+*/
+bool32 handlePool_free(HandlePool* pool, u32 handle, u32* recordIndex);
+inline u32 handlePool_handle(const HandlePool& pool, u32 recordIndex)
+{
+	u32 slot = pool.recordSlots[recordIndex];
+	return (pool.slotGenerations[slot] << HANDLE_SLOT_BITS) | slot;
+}
+
+template<typename T>
+inline void soaPool_removeRecord(vector<T>& records, u32 recordIndex)
+{
+	records[recordIndex] = records.back();
+	records.pop_back();
+}
@@ -0,0 +1,151 @@
+#include "common.h"
+#include "red_thread_pool.h"
+#include "red_allocator.h"
+#include "red_memory.h"
+
+u32 threadPool_hardwareThreadCount()
+{
+	u32 threadCount = std::thread::hardware_concurrency();
+	return threadCount > 0 ? threadCount : 1;
+}
+
+static void threadPool_executeJobs(ThreadPool* pool, u32 threadIndex)
+{
+	for (;;)
+	{
+		u32 jobIndex = pool->nextJob.fetch_add(1);
+		if (jobIndex >= pool->jobCount)
+		{
+			break;
+		}
+
+		pool->function(pool->userData, jobIndex, threadIndex);
+
+		if (pool->finishedJobs.fetch_add(1) + 1 == pool->jobCount)
+		{
+			std::lock_guard<std::mutex> lock(pool->mutex);
+			pool->done.notify_all();
+		}
+	}
+}
+
+static void threadPool_workerLoop(ThreadPool* pool, u32 threadIndex)
+{
+	linearArena_create(&pool->scratchArenas[threadIndex], pool->scratchArenaSize, LINEAR_ARENA_NUMA_LOCAL_BIT);
+	u64 seenGeneration = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(pool->mutex);
+			pool->wake.wait(lock, [&] { return pool->quit || pool->generation != seenGeneration; });
+			if (pool->quit)
+			{
+				return;
+			}
+			seenGeneration = pool->generation;
+			pool->activeWorkers++;
+		}
+
+		{
+			AllocationTagScope tagScope(AllocationTag(pool->allocationTag));
+			threadPool_executeJobs(pool, threadIndex);
+		}
+		linearArena_reset(&pool->scratchArenas[threadIndex]);
+
+		{
+			std::lock_guard<std::mutex> lock(pool->mutex);
+			pool->activeWorkers--;
+			pool->done.notify_all();
+		}
+	}
+}
+
+ThreadPool* threadPool_create(u32 threadCount)
+{
+	ThreadPool* pool = new ThreadPool();
+	pool->function = nullptr;
+	pool->userData = nullptr;
+	pool->allocationTag = ALLOCATION_TAG_UNTAGGED;
+	pool->jobCount = 0;
+	pool->nextJob = 0;
+	pool->finishedJobs = 0;
+	pool->activeWorkers = 0;
+	pool->generation = 0;
+	pool->quit = false;
+	pool->threadCount = threadCount ? threadCount : threadPool_hardwareThreadCount();
+
+	pool->scratchArenaSize = systemMemory_budget(systemMemory_query(), THREAD_POOL_SCRATCH_MEMORY_SHARE / pool->threadCount, THREAD_POOL_MAX_SCRATCH_ARENA_SIZE);
+	pool->scratchArenas.resize(pool->threadCount);
+	linearArena_create(&pool->scratchArenas[0], pool->scratchArenaSize, LINEAR_ARENA_NUMA_LOCAL_BIT);
+	pool->workers.reserve(pool->threadCount - 1);
+	for (u32 i = 1; i < pool->threadCount; i++)
+	{
+		pool->workers.emplace_back(threadPool_workerLoop, pool, i);
+	}
+
+	return pool;
+}
+
+void threadPool_destroy(ThreadPool* pool)
+{
+	{
+		std::lock_guard<std::mutex> lock(pool->mutex);
+		pool->quit = true;
+		pool->wake.notify_all();
+	}
+
+	for (std::thread& worker : pool->workers)
+	{
+		worker.join();
+	}
+	for (LinearArena& scratchArena : pool->scratchArenas)
+	{
+		linearArena_destroy(&scratchArena);
+	}
+
+	delete pool;
+}
+
+void threadPool_run(ThreadPool* pool, u32 jobCount, JobFunction function, void* userData)
+{
+	if (jobCount == 0)
+	{
+		return;
+	}
+
+	// Single threaded pools and single jobs don't pay for the wake up. Thread index 0 and its scratch arena belong to one
+	// dispatching thread at a time either way
+	std::lock_guard<std::mutex> dispatchLock(pool->dispatchMutex);
+	if (pool->threadCount == 1 || jobCount == 1)
+	{
+		for (u32 i = 0; i < jobCount; i++)
+		{
+			function(userData, i, 0);
+		}
+		linearArena_reset(&pool->scratchArenas[0]);
+		return;
+	}
+
+	{
+		// A worker that wakes up after the previous run returned still joins that run's generation and claims from its
+		// counters. It only ever finds them exhausted, but resetting them under it would hand it a job of this run that
+		// another thread claims too, so wait for it to leave first
+		std::unique_lock<std::mutex> lock(pool->mutex);
+		pool->done.wait(lock, [&] { return pool->activeWorkers == 0; });
+		pool->function = function;
+		pool->userData = userData;
+		pool->allocationTag = allocationTag_current();
+		pool->jobCount = jobCount;
+		pool->nextJob = 0;
+		pool->finishedJobs = 0;
+		pool->generation++;
+		pool->wake.notify_all();
+	}
+
+	threadPool_executeJobs(pool, 0);
+	linearArena_reset(&pool->scratchArenas[0]);
+
+	// Workers that woke up late may still be inside threadPool_executeJobs, wait for them before the job data goes out of scope
+	std::unique_lock<std::mutex> lock(pool->mutex);
+	pool->done.wait(lock, [&] { return pool->finishedJobs.load() == pool->jobCount && pool->activeWorkers == 0; });
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "common.h"
+#include "red_arena.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+// jobIndex is in [0, jobCount), threadIndex in [0, threadCount)
+typedef void (*JobFunction)(void* userData, u32 jobIndex, u32 threadIndex);
+
+// Each pool thread's scratch arena may grow to this share of the effective memory, split between the threads
+#define THREAD_POOL_SCRATCH_MEMORY_SHARE 0.25
+#define THREAD_POOL_MAX_SCRATCH_ARENA_SIZE (256 * MEGABYTE)
+
+struct ThreadPool
+{
+	vector<std::thread> workers;
+	// One per thread index, created by its thread so its pages sit on that thread's NUMA node. Reset after each run
+	vector<LinearArena> scratchArenas;
+	size_t scratchArenaSize;
+	std::mutex dispatchMutex;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	JobFunction function;
+	void* userData;
+	u32 allocationTag; // Of the dispatching thread, for the workers
+	std::atomic<u32> jobCount;
+	std::atomic<u32> nextJob;
+	std::atomic<u32> finishedJobs;
+	u32 activeWorkers;
+	u64 generation;
+	bool32 quit;
+	u32 threadCount;
+};
+
+u32 threadPool_hardwareThreadCount();
+// threadCount counts the calling thread, which also executes jobs while it waits. 0 means one per hardware thread
+ThreadPool* threadPool_create(u32 threadCount);
+void threadPool_destroy(ThreadPool* pool);
+// Blocks until every job has finished
+void threadPool_run(ThreadPool* pool, u32 jobCount, JobFunction function, void* userData);
+// Scratch memory of the thread running a job, for allocations that die with the job
+inline LinearArena* threadPool_scratch(ThreadPool* pool, u32 threadIndex)
+{
+	return &pool->scratchArenas[threadIndex];
+}
+
+template<typename Function>
+static void threadPool_runFunction(void* userData, u32 jobIndex, u32 threadIndex)
+{
+	(*(const Function*)userData)(jobIndex, threadIndex);
+}
+
+template<typename Function>
+inline void threadPool_parallelFor(ThreadPool* pool, u32 jobCount, const Function& function)
+{
+	threadPool_run(pool, jobCount, threadPool_runFunction<Function>, (void*)&function);
+}
+
+// Splits [0, count) into contiguous ranges of similar size, one per job
+inline size_t threadPool_rangeBegin(size_t count, u32 jobIndex, u32 jobCount)
+{
+	return size_t(u64(count) * jobIndex / jobCount);
+}
@@ -0,0 +1,251 @@
+#include "common.h"
+#include "red_tlsf.h"
+
+static inline u32 tlsf_highestBit(u64 value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return u32(index);
+#else
+	return 63 - u32(__builtin_clzll(value));
+#endif
+}
+
+static inline u32 tlsf_lowestBit(u64 value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, value);
+	return u32(index);
+#else
+	return u32(__builtin_ctzll(value));
+#endif
+}
+
+// Size class a free block of this size is listed in
+static inline void tlsf_mapping(u64 size, u32* firstLevel, u32* secondLevel)
+{
+	if (size < TLSF_SECOND_LEVEL_COUNT)
+	{
+		*firstLevel = 0;
+		*secondLevel = u32(size);
+		return;
+	}
+	u32 highestBit = tlsf_highestBit(size);
+	*firstLevel = highestBit - TLSF_SECOND_LEVEL_BITS + 1;
+	*secondLevel = u32(size >> (highestBit - TLSF_SECOND_LEVEL_BITS)) ^ TLSF_SECOND_LEVEL_COUNT;
+}
+
+static u32 tlsf_newNode(TlsfAllocator* tlsf, u64 offset, u64 size)
+{
+	u32 node;
+	if (!tlsf->unusedNodes.empty())
+	{
+		node = tlsf->unusedNodes.back();
+		tlsf->unusedNodes.pop_back();
+	}
+	else
+	{
+		node = u32(tlsf->nodeOffsets.size());
+		tlsf->nodeOffsets.push_back(0);
+		tlsf->nodeSizes.push_back(0);
+		tlsf->nodePhysicalPrevious.push_back(TLSF_INVALID_NODE);
+		tlsf->nodePhysicalNext.push_back(TLSF_INVALID_NODE);
+		tlsf->nodeFreePrevious.push_back(TLSF_INVALID_NODE);
+		tlsf->nodeFreeNext.push_back(TLSF_INVALID_NODE);
+		tlsf->nodeUsed.push_back(0);
+	}
+	tlsf->nodeOffsets[node] = offset;
+	tlsf->nodeSizes[node] = size;
+	tlsf->nodePhysicalPrevious[node] = TLSF_INVALID_NODE;
+	tlsf->nodePhysicalNext[node] = TLSF_INVALID_NODE;
+	tlsf->nodeUsed[node] = 0;
+	return node;
+}
+
+static void tlsf_insertFree(TlsfAllocator* tlsf, u32 node)
+{
+	u32 firstLevel;
+	u32 secondLevel;
+	tlsf_mapping(tlsf->nodeSizes[node], &firstLevel, &secondLevel);
+	u32 head = tlsf->freeLists[firstLevel][secondLevel];
+	tlsf->nodeFreePrevious[node] = TLSF_INVALID_NODE;
+	tlsf->nodeFreeNext[node] = head;
+	if (head != TLSF_INVALID_NODE)
+	{
+		tlsf->nodeFreePrevious[head] = node;
+	}
+	tlsf->freeLists[firstLevel][secondLevel] = node;
+	tlsf->firstLevelBitmap |= 1ull << firstLevel;
+	tlsf->secondLevelBitmaps[firstLevel] |= 1u << secondLevel;
+	tlsf->nodeUsed[node] = 0;
+}
+
+static void tlsf_removeFree(TlsfAllocator* tlsf, u32 node)
+{
+	u32 firstLevel;
+	u32 secondLevel;
+	tlsf_mapping(tlsf->nodeSizes[node], &firstLevel, &secondLevel);
+	u32 previous = tlsf->nodeFreePrevious[node];
+	u32 next = tlsf->nodeFreeNext[node];
+	if (previous != TLSF_INVALID_NODE)
+	{
+		tlsf->nodeFreeNext[previous] = next;
+	}
+	else
+	{
+		tlsf->freeLists[firstLevel][secondLevel] = next;
+		if (next == TLSF_INVALID_NODE)
+		{
+			tlsf->secondLevelBitmaps[firstLevel] &= ~(1u << secondLevel);
+			if (!tlsf->secondLevelBitmaps[firstLevel])
+			{
+				tlsf->firstLevelBitmap &= ~(1ull << firstLevel);
+			}
+		}
+	}
+	if (next != TLSF_INVALID_NODE)
+	{
+		tlsf->nodeFreePrevious[next] = previous;
+	}
+}
+
+// Splits [node offset, node offset + size) off the front of node; the rest becomes a new node right after it
+static u32 tlsf_split(TlsfAllocator* tlsf, u32 node, u64 size)
+{
+	u32 rest = tlsf_newNode(tlsf, tlsf->nodeOffsets[node] + size, tlsf->nodeSizes[node] - size);
+	tlsf->nodeSizes[node] = size;
+	u32 next = tlsf->nodePhysicalNext[node];
+	tlsf->nodePhysicalPrevious[rest] = node;
+	tlsf->nodePhysicalNext[rest] = next;
+	tlsf->nodePhysicalNext[node] = rest;
+	if (next != TLSF_INVALID_NODE)
+	{
+		tlsf->nodePhysicalPrevious[next] = rest;
+	}
+	return rest;
+}
+
+// Absorbs next, which follows node in memory, into node
+static void tlsf_merge(TlsfAllocator* tlsf, u32 node, u32 next)
+{
+	tlsf->nodeSizes[node] += tlsf->nodeSizes[next];
+	u32 afterNext = tlsf->nodePhysicalNext[next];
+	tlsf->nodePhysicalNext[node] = afterNext;
+	if (afterNext != TLSF_INVALID_NODE)
+	{
+		tlsf->nodePhysicalPrevious[afterNext] = node;
+	}
+	// A stale handle to the absorbed node has to fail tlsf_free's assert instead of passing as an allocation
+	tlsf->nodeUsed[next] = 0;
+	tlsf->unusedNodes.push_back(next);
+}
+
+void tlsf_create(TlsfAllocator* tlsf, u64 size, u32 nodeCapacity)
+{
+	tlsf->nodeOffsets.reserve(nodeCapacity);
+	tlsf->nodeSizes.reserve(nodeCapacity);
+	tlsf->nodePhysicalPrevious.reserve(nodeCapacity);
+	tlsf->nodePhysicalNext.reserve(nodeCapacity);
+	tlsf->nodeFreePrevious.reserve(nodeCapacity);
+	tlsf->nodeFreeNext.reserve(nodeCapacity);
+	tlsf->nodeUsed.reserve(nodeCapacity);
+	tlsf->firstLevelBitmap = 0;
+	memset(tlsf->secondLevelBitmaps, 0, sizeof(tlsf->secondLevelBitmaps));
+	memset(tlsf->freeLists, 0xFF, sizeof(tlsf->freeLists));
+	tlsf->size = size;
+	tlsf->freeBytes = size;
+	tlsf->allocationCount = 0;
+
+	tlsf_insertFree(tlsf, tlsf_newNode(tlsf, 0, size));
+}
+
+u32 tlsf_allocate(TlsfAllocator* tlsf, u64 size, u64 alignment, u64* offset)
+{
+	assert(size && alignment && (alignment & (alignment - 1)) == 0);
+	// Any block of the class searched is large enough, whatever its alignment: round up to the next class boundary
+	u64 searchSize = size + alignment - 1;
+	if (searchSize >= TLSF_SECOND_LEVEL_COUNT)
+	{
+		searchSize += (1ull << (tlsf_highestBit(searchSize) - TLSF_SECOND_LEVEL_BITS)) - 1;
+	}
+	u32 firstLevel;
+	u32 secondLevel;
+	tlsf_mapping(searchSize, &firstLevel, &secondLevel);
+	if (firstLevel >= TLSF_FIRST_LEVEL_COUNT)
+	{
+		return TLSF_INVALID_NODE;
+	}
+
+	u32 secondLevelMap = tlsf->secondLevelBitmaps[firstLevel] & (~0u << secondLevel);
+	if (!secondLevelMap)
+	{
+		u64 firstLevelMap = firstLevel + 1 < 64 ? tlsf->firstLevelBitmap & (~0ull << (firstLevel + 1)) : 0;
+		if (!firstLevelMap)
+		{
+			return TLSF_INVALID_NODE;
+		}
+		firstLevel = tlsf_lowestBit(firstLevelMap);
+		secondLevelMap = tlsf->secondLevelBitmaps[firstLevel];
+	}
+	u32 node = tlsf->freeLists[firstLevel][tlsf_lowestBit(secondLevelMap)];
+	tlsf_removeFree(tlsf, node);
+
+	// Alignment padding in front goes back to the free lists. The block before is used, or it would have been merged
+	u64 nodeOffset = tlsf->nodeOffsets[node];
+	u64 padding = ((nodeOffset + alignment - 1) & ~(alignment - 1)) - nodeOffset;
+	if (padding)
+	{
+		u32 aligned = tlsf_split(tlsf, node, padding);
+		tlsf_insertFree(tlsf, node);
+		node = aligned;
+	}
+	if (tlsf->nodeSizes[node] > size)
+	{
+		tlsf_insertFree(tlsf, tlsf_split(tlsf, node, size));
+	}
+
+	tlsf->nodeUsed[node] = 1;
+	tlsf->freeBytes -= size;
+	tlsf->allocationCount++;
+	*offset = tlsf->nodeOffsets[node];
+	return node;
+}
+
+void tlsf_free(TlsfAllocator* tlsf, u32 node)
+{
+	assert(node < tlsf->nodeUsed.size() && tlsf->nodeUsed[node]);
+	tlsf->freeBytes += tlsf->nodeSizes[node];
+	tlsf->allocationCount--;
+
+	u32 previous = tlsf->nodePhysicalPrevious[node];
+	if (previous != TLSF_INVALID_NODE && !tlsf->nodeUsed[previous])
+	{
+		tlsf_removeFree(tlsf, previous);
+		tlsf_merge(tlsf, previous, node);
+		node = previous;
+	}
+	u32 next = tlsf->nodePhysicalNext[node];
+	if (next != TLSF_INVALID_NODE && !tlsf->nodeUsed[next])
+	{
+		tlsf_removeFree(tlsf, next);
+		tlsf_merge(tlsf, node, next);
+	}
+	tlsf_insertFree(tlsf, node);
+}
+
+u64 tlsf_largestFreeBlock(const TlsfAllocator& tlsf)
+{
+	if (!tlsf.firstLevelBitmap)
+	{
+		return 0;
+	}
+	u32 firstLevel = tlsf_highestBit(tlsf.firstLevelBitmap);
+	u64 largest = 0;
+	for (u32 node = tlsf.freeLists[firstLevel][tlsf_highestBit(tlsf.secondLevelBitmaps[firstLevel])]; node != TLSF_INVALID_NODE; node = tlsf.nodeFreeNext[node])
+	{
+		largest = tlsf.nodeSizes[node] > largest ? tlsf.nodeSizes[node] : largest;
+	}
+	return largest;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "common.h"
+
+/*
+Two-level segregated fit allocator over an abstract range [0, size): it hands out offsets and keeps all its bookkeeping
+out of band, so the range can be memory the CPU can't touch, like a VkDeviceMemory block. Free blocks sit in lists by
+size class, a power of two split in TLSF_SECOND_LEVEL_COUNT steps, and two bitmaps find a fitting list in O(1).
+Freed blocks merge with free neighbours right away. Nodes are kept in parallel arrays and reused.
+*/
+#define TLSF_SECOND_LEVEL_BITS 5
+#define TLSF_SECOND_LEVEL_COUNT (1 << TLSF_SECOND_LEVEL_BITS)
+#define TLSF_FIRST_LEVEL_COUNT (64 - TLSF_SECOND_LEVEL_BITS + 1)
+#define TLSF_INVALID_NODE 0xFFFFFFFFu
+
+struct TlsfAllocator
+{
+	vector<u64> nodeOffsets;
+	vector<u64> nodeSizes;
+	// Every node of the range in address order
+	vector<u32> nodePhysicalPrevious;
+	vector<u32> nodePhysicalNext;
+	// Free nodes of the same size class
+	vector<u32> nodeFreePrevious;
+	vector<u32> nodeFreeNext;
+	vector<u8> nodeUsed;
+	vector<u32> unusedNodes;
+	u64 firstLevelBitmap;
+	u32 secondLevelBitmaps[TLSF_FIRST_LEVEL_COUNT];
+	u32 freeLists[TLSF_FIRST_LEVEL_COUNT][TLSF_SECOND_LEVEL_COUNT];
+	u64 size;
+	u64 freeBytes;
+	u32 allocationCount;
+};
+
+// Node storage for nodeCapacity blocks is reserved up front and only grows past it
+void tlsf_create(TlsfAllocator* tlsf, u64 size, u32 nodeCapacity = 256);
+// alignment is a power of two. Returns the node to free the block with, TLSF_INVALID_NODE when nothing fits
+u32 tlsf_allocate(TlsfAllocator* tlsf, u64 size, u64 alignment, u64* offset);
+void tlsf_free(TlsfAllocator* tlsf, u32 node);
+u64 tlsf_largestFreeBlock(const TlsfAllocator& tlsf);
@@ -12,6 +12,16 @@ u32 height = 576;
 #include "win32.h"
 #include "glm.h"
 #include "model.h"
+#include "mesh_cache.h"
+#include "meshlet.h"
+#include "mesh_lod.h"
+#include "mesh_attributes.h"
+#include "mesh_chunked.h"
+#include "red_thread_pool.h"
+#include "red_allocator.h"
+#include "red_allocator_benchmark.h"
+#include "red_allocation_log.h"
+#include "red_memory.h"
 #include "VK/vulkan.h"
 #include "D3D11/d3d11.h"
 
@@ -39,18 +49,72 @@ const string modelsDirectory = "core/models/";
 const string texturesDirectory = "core/textures/";
 
 const string vertexShaderBytecodeName = "triangle.vert.spv";
+const string packedVertexShaderBytecodeName = "triangle_packed.vert.spv";
 const string fragmentShaderBytecodeName = "triangle.frag.spv";
 
 const string modelName = "taylorswift.obj";
+// 0: one loader thread per hardware thread, 1: serial loader
+const u32 meshLoadThreadCount = 0;
+// Single pass chunked OBJ parser: slower on many cores, but peak memory stays close to the output mesh
+const bool32 meshLoadStreaming = false;
+// Upload 16 byte PackedVertex instead of 32 byte FloatVertex, dequantized in the vertex shader
+const bool32 packedVertices = true;
+// Cull meshlets on the CPU every frame and draw only the visible ones
+const bool32 meshletCulling = true;
+// Frames between two meshlet culling and frame timing reports
+const u32 meshletStatsInterval = 300;
+// Frames the CPU may record ahead of the GPU. 1 serializes them, which the timing reports compare against
+const u32 framesInFlight = 2;
+// Record the draws every frame on the worker threads, instead of replaying a command buffer recorded once per swapchain image
+const bool32 recordEveryFrame = true;
+// Draws a recording job needs before another thread gets one. The shipped models have far fewer submeshes than
+// VULKAN_RECORD_MIN_DRAWS_PER_JOB, so only 1 splits their frames across the pool: one job per draw, up to the thread count
+const u32 recordMinDrawsPerJob = VULKAN_RECORD_MIN_DRAWS_PER_JOB;
+// Switch between simplified versions of the mesh by projected error. Needs meshletCulling, which builds the draw every frame
+const bool32 meshLods = true;
+const float lodThresholdPixels = 1.0f;
+const float lodHysteresis = 0.25f;
+// Print the triangles a grid of instances would draw with and without LODs
+const bool32 lodBenchmark = true;
+// Time the SIMD normal, tangent and bounds kernel against the scalar one on these meshes
+const bool32 meshAttributeBenchmark = false;
+const u32 meshAttributeBenchmarkIterations = 10;
+const char* const meshAttributeBenchmarkModels[] = { "chalet.obj", "nanosuit/nanosuit.obj" };
+// Cook the model into spatial chunks within a fixed memory budget, for OBJ files larger than RAM, and stream the chunks
+// to the GPU without assembling the mesh. No materials, and no meshlets or LODs, which need the whole mesh in memory
+const bool32 meshOutOfCore = false;
+const u64 meshCookMemoryBudget = 256 * MEGABYTE;
+// Trace the allocations of the loader, of a run of frames and of a storm of swapchain rebuilds into files, which
+// benchmarks/allocator_benchmark replays with the allocator and with malloc
+const bool32 allocatorTraceCapture = false;
+const u64 allocatorTraceMaxEvents = 16 * 1024 * 1024;
+const u32 allocatorTraceFirstFrame = 60;
+const u32 allocatorTraceFrameCount = 300;
+const u32 allocatorResizeStormCount = 30;
+const char* const allocatorTracePaths[] = { "loader.atrace", "frames.atrace", "resize.atrace" };
+// Log every allocation of the session to a file and summarize it at exit. Depth 2 sees through eastl::allocator to the container's owner, slowly
+const bool32 allocationLog = false;
+const u32 allocationLogCallerDepth = 0;
+const u32 allocationLogTopCallsites = 20;
+const char* const allocationLogPath = "allocations.alog";
 const string textureName = "taylorswift.jpeg";
+const string cookedMeshExtension = ".rmesh";
+const string chunkedMeshExtension = ".rchunks";
 
 const string vertexShaderFullPath = rootDirectory + shaderBytecodePath + vertexShaderBytecodeName;
+const string packedVertexShaderFullPath = rootDirectory + shaderBytecodePath + packedVertexShaderBytecodeName;
 const string fragmentShaderFullPath = rootDirectory + shaderBytecodePath + fragmentShaderBytecodeName;
 const string modelFullPath = rootDirectory + modelsDirectory + modelName;
+const string cookedModelFullPath = modelFullPath + cookedMeshExtension;
+const string chunkedModelFullPath = modelFullPath + chunkedMeshExtension;
 const string textureFullPath = rootDirectory + texturesDirectory + textureName;
 
 int WinMain(HINSTANCE currentInstance, HINSTANCE previousInstance, LPSTR, int)
 {
+	if (allocationLog)
+	{
+		allocationLog_begin(allocationLogPath, allocationLogCallerDepth);
+	}
 	bool32 vulkan = true;
 	bool32 d3d11 = true;
 	u64 win32_timerFrequency = win32_getTimerFrequency();
@@ -79,49 +143,234 @@ int WinMain(HINSTANCE currentInstance, HINSTANCE previousInstance, LPSTR, int)
 	vk.physicalDevice = vulkan_pickPhysicalDevice(vk.instance, vk.surface);
 	vk.deviceDescription = vulkan_getPhysicalDeviceDescription(vk.physicalDevice, vk.surface);
 	vk.device = vulkan_createDevice(vk.physicalDevice, vk.deviceDescription);
+	vulkan_createMemoryAllocator(&vk.memoryAllocator, vk.device, vk.deviceDescription);
 	vk.graphicsQueue = nullptr;
 	vkGetDeviceQueue(vk.device, vk.deviceDescription.queueFamilyIndices.graphics, 0, &vk.graphicsQueue);
-
+	// Uploaded resources stay exclusive to one family at a time: the uploader transfers their ownership to the graphics family
+	vk.transferQueue = vk.graphicsQueue;
+	if (vk.deviceDescription.queueFamilyIndices.transfer != vk.deviceDescription.queueFamilyIndices.graphics)
 	{
-		// TODO: not used at the moment: implement!
-		//VkQueue transferQueue = nullptr;
-		//dedicatedTransferQueue = vk.deviceDescription.queueFamilyIndices.graphics != vk.deviceDescription.queueFamilyIndices.transfer;
-		//if (dedicatedTransferQueue)
-		//	vkGetDeviceQueue(vk.device, vk.deviceDescription.queueFamilyIndices.transfer, 0, &transferQueue);
-
-		//const u32 queueFamilyIndexArray[2] = { vk.deviceDescription.queueFamilyIndices.graphics, vk.deviceDescription.queueFamilyIndices.transfer };
-		//vk.queueInfo = vulkan_getQueueInfo(physicalDeviceDescription.queueFamilyIndices, queueFamilyIndexArray, ARRAYSIZE(queueFamilyIndexArray));
+		vkGetDeviceQueue(vk.device, vk.deviceDescription.queueFamilyIndices.transfer, 0, &vk.transferQueue);
 	}
-	
+
 	vk.swapchain = vulkan_createSwapchain(vk.physicalDevice, vk.device, vk.surface, width, height);
 	vk.graphicsCommandPool = vulkan_createCommandPool(vk.device, vk.deviceDescription.queueFamilyIndices.graphics);
-	vk.msaa = vulkan_createMultisamplingBuffer(vk.device, vk.graphicsCommandPool, vk.graphicsQueue, vk.deviceDescription.properties, vk.deviceDescription.memoryProperties, vk.swapchain.surfaceFormat.format, vk.swapchain.extent, 1);
+	vulkan_createUploader(&vk.uploader, vk.device, vk.transferQueue, vk.deviceDescription.queueFamilyIndices.transfer, vk.graphicsQueue, vk.deviceDescription.queueFamilyIndices.graphics, &vk.memoryAllocator);
+	vulkan_createResources(&vk.resources);
+	const VulkanMSAA msaa = vulkan_createMultisamplingBuffer(vk.device, vk.graphicsCommandPool, vk.graphicsQueue, vk.deviceDescription.properties, &vk.memoryAllocator, vk.swapchain.surfaceFormat.format, vk.swapchain.extent, 1);
+	vk.msaa = vulkan_addMSAA(&vk.resources, msaa);
 
-	vk.VS = vulkan_createShaderModule(vk.device, vertexShaderFullPath.c_str());
+	vk.VS = vulkan_createShaderModule(vk.device, packedVertices ? packedVertexShaderFullPath.c_str() : vertexShaderFullPath.c_str());
+	vk.vertexInput = packedVertices ? vulkan_getVertexInput<PackedVertex>() : vulkan_getVertexInput<FloatVertex>();
 	vk.FS = vulkan_createShaderModule(vk.device, fragmentShaderFullPath.c_str());
-	vk.descriptorSetLayout = vulkan_createDescriptorSetLayout(vk.device);
-	vk.graphicsPipelineLayout = vulkan_createPipelineLayout(vk.device, &vk.descriptorSetLayout);
-	vk.depthStencil = vulkan_createDepthStencil(vk.device, vk.physicalDevice, vk.swapchain.extent, vk.deviceDescription.memoryProperties);
-	vk.renderPass = vulkan_createRenderPass(vk.device, vk.swapchain.surfaceFormat.format, vk.depthStencil.depthFormat, vk.msaa.samples);
+	vk.descriptorSetLayouts = vulkan_createDescriptorSetLayouts(vk.device);
+	vk.graphicsPipelineLayout = vulkan_createPipelineLayout(vk.device, vk.descriptorSetLayouts);
+	vk.depthStencil = vulkan_createDepthStencil(vk.device, vk.physicalDevice, vk.swapchain.extent, &vk.memoryAllocator);
+	vk.renderPass = vulkan_createRenderPass(vk.device, vk.swapchain.surfaceFormat.format, vk.depthStencil.depthFormat, msaa.samples);
 
-	vk.graphicsPipeline = vulkan_createGraphicsPipeline(vk.device, vk.VS, vk.FS, vk.swapchain.extent, vk.graphicsPipelineLayout, vk.renderPass, vk.msaa.samples);
+	vk.graphicsPipeline = vulkan_createGraphicsPipeline(vk.device, vk.VS, vk.FS, vk.vertexInput, vk.swapchain.extent, vk.graphicsPipelineLayout, vk.renderPass, msaa.samples);
 
-	vk.framebuffers = vulkan_createFramebuffers(vk.device, vk.swapchain.imageViews, vk.swapchain.extent, vk.renderPass, vk.depthStencil.imageView, vk.msaa.view);
+	vk.framebuffers = vulkan_createFramebuffers(vk.device, vk.swapchain.imageViews, vk.swapchain.extent, vk.renderPass, vk.depthStencil.imageView, msaa.view);
 	vk.drawCommandBuffers = vulkan_createCommandBuffers(vk.device, vk.graphicsCommandPool, (u32)vk.framebuffers.size());
 
-	vk.texture = vulkan_loadTexture(textureFullPath.c_str(), vk.physicalDevice, vk.device, vk.graphicsCommandPool, vk.graphicsQueue, vk.deviceDescription.memoryProperties, VK_SAMPLE_COUNT_1_BIT);
-	vk.mesh = loadMesh_fast(modelFullPath.c_str());
+	// Container limits included: scratch arenas size themselves from it
+	printSystemMemoryInfo(systemMemory_query());
+	// Shared by the mesh loader and the per-frame culling
+	ThreadPool* workerPool = threadPool_create(meshLoadThreadCount);
+	MeshLoadSettings meshLoadSettings = {};
+	meshLoadSettings.threadCount = meshLoadThreadCount;
+	meshLoadSettings.threadPool = workerPool;
+	meshLoadSettings.streaming = meshLoadStreaming;
+	meshLoadSettings.optimization.flags = MESH_OPTIMIZE_ALL;
+	meshLoadSettings.optimization.analyze = true;
+	meshLoadSettings.attributeFlags = MESH_ATTRIBUTE_TANGENTS_BIT | MESH_ATTRIBUTE_BOUNDS_BIT;
+	if (meshAttributeBenchmark)
+	{
+		for (const char* model : meshAttributeBenchmarkModels)
+		{
+			meshAttributes_benchmark((rootDirectory + modelsDirectory + model).c_str(), meshAttributeBenchmarkIterations);
+		}
+	}
+	AllocationTrace loaderTrace;
+	AllocationTrace frameTrace;
+	AllocationTrace resizeTrace;
+	bool32 resizeStormPending = false;
+	if (allocatorTraceCapture)
+	{
+		allocationTrace_begin(allocatorTraceMaxEvents);
+	}
+	MeshLoadStats meshLoadStats;
+	MeshAsset meshAsset = {};
+	ChunkedMesh chunkedMesh = {};
+	if (meshOutOfCore)
+	{
+		AllocationTagScope tagScope(ALLOCATION_TAG_MESH);
+		MeshCookSettings meshCookSettings = {};
+		meshCookSettings.memoryBudget = meshCookMemoryBudget;
+		meshCookSettings.attributeFlags = meshLoadSettings.attributeFlags;
+		meshCookSettings.optimize = true;
+		MeshCookStats meshCookStats = {};
+		bool32 loaded = chunkedMesh_load(&chunkedMesh, modelFullPath.c_str(), chunkedModelFullPath.c_str(), meshCookSettings, &meshCookStats);
+		assert(loaded);
+		if (meshCookStats.chunkCount)
+		{
+			printMeshCookStats(modelFullPath.c_str(), meshCookStats);
+		}
+		vk.mesh = chunkedMesh_view(chunkedMesh);
+		printf("Chunked mesh: %u vertices, %u indices in %u chunks\n", vk.mesh.vertexCount, vk.mesh.indexCount, chunkedMesh.header->chunkCount);
+	}
+	else
+	{
+		AllocationTagScope tagScope(ALLOCATION_TAG_MESH);
+		meshAsset_load(&meshAsset, modelFullPath.c_str(), cookedModelFullPath.c_str(), meshLoadSettings, &meshLoadStats);
+		printMeshLoadStats(modelFullPath.c_str(), meshLoadStats);
+		vk.mesh = meshAsset.view;
+	}
+
+	// Texture 0 is the fallback for submeshes without material or whose diffuse texture is missing. Materials sharing a texture share its set
+	vector<string> texturePaths;
+	texturePaths.push_back(textureFullPath);
+	vk.textures.push_back(vulkan_addTexture(&vk.resources, vulkan_loadTexture(textureFullPath.c_str(), vk.physicalDevice, vk.device, &vk.uploader, &vk.memoryAllocator, VK_SAMPLE_COUNT_1_BIT)));
+	vector<u32> materialSets(vk.mesh.materialCount, 0);
+	for (u32 i = 0; i < vk.mesh.materialCount; i++)
+	{
+		const char* texturePath = vk.mesh.materials[i].diffuseTexturePath;
+		if (!texturePath[0] || GetFileAttributesA(texturePath) == INVALID_FILE_ATTRIBUTES)
+		{
+			continue;
+		}
+
+		u32 texture = 0;
+		while (texture < texturePaths.size() && texturePaths[texture] != texturePath)
+		{
+			texture++;
+		}
+		if (texture == texturePaths.size())
+		{
+			texturePaths.push_back(texturePath);
+			vk.textures.push_back(vulkan_addTexture(&vk.resources, vulkan_loadTexture(texturePath, vk.physicalDevice, vk.device, &vk.uploader, &vk.memoryAllocator, VK_SAMPLE_COUNT_1_BIT)));
+		}
+		materialSets[i] = texture;
+	}
+	vk.submeshDraws = vulkan_buildSubmeshDraws(vk.mesh, materialSets, 0);
+	printf("Submeshes: %u, materials: %u, textures: %zu\n", vk.mesh.submeshCount, vk.mesh.materialCount, vk.textures.size());
 
 	const VulkanQueueInfo onlyOneQueue = { nullptr, 0, VK_SHARING_MODE_EXCLUSIVE };
 
-	vk.vertexBuffer = vulkan_bufferDataIntoLocalDevice(vk.device, vk.mesh.vertices.data(), CONTAINER_BYTES(vk.mesh.vertices), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vk.graphicsCommandPool, vk.graphicsQueue, onlyOneQueue, vk.deviceDescription.memoryProperties);
-	vk.indexBuffer = vulkan_bufferDataIntoLocalDevice(vk.device, vk.mesh.indices.data(), CONTAINER_BYTES(vk.mesh.indices), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, vk.graphicsCommandPool, vk.graphicsQueue, onlyOneQueue, vk.deviceDescription.memoryProperties);
-	vk.uniformBuffers = vulkan_createUniformBuffers(vk.device, vk.swapchain.images.size(), onlyOneQueue, vk.deviceDescription.memoryProperties);
-	vk.descriptorPool = vulkan_createDescriptorPool(vk.device, (u32)vk.swapchain.images.size());
-	vk.descriptorSets = vulkan_createDescriptorSets(vk.device, vk.descriptorPool, u32(vk.swapchain.images.size()), vk.descriptorSetLayout, vk.uniformBuffers, vk.texture.view, vk.texture.sampler);
-	vulkan_buildCommandBuffers(vk.renderPass, vk.swapchain.extent, vk.drawCommandBuffers, vk.framebuffers, vk.vertexBuffer.handle, vk.indexBuffer.handle, vk.graphicsPipeline, vk.graphicsPipelineLayout, vk.mesh.vertices, vk.mesh.indices, vk.descriptorSets);
+	// With a cooked mesh the indices upload straight from the mapped file. Vertices are packed or stripped of their tangent first
+	if (meshOutOfCore)
+	{
+		// Into buffers sized for the whole mesh, one chunk at a time: each is converted, copied into the staging ring and
+		// its pages released, so what stays resident is a chunk and the ring, not the model
+		AllocationTagScope tagScope(ALLOCATION_TAG_MESH);
+		const RChunkHeader& header = *chunkedMesh.header;
+		vk.meshQuantization = packedVertices ? meshQuantization_fromBounds(header.bounds.min, header.bounds.max, header.texCoordMin, header.texCoordMax) : meshQuantization_identity();
+		const u64 vertexSize = packedVertices ? sizeof(PackedVertex) : sizeof(FloatVertex);
+		const u64 vertexBytes = header.vertexCount * vertexSize;
+		const u64 indexBytes = header.indexCount * sizeof(u32);
+		const VulkanBuffer vertexBuffer = vulkan_createLocalDeviceBuffer(vk.device, vertexBytes, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, onlyOneQueue, &vk.memoryAllocator);
+		const VulkanBuffer indexBuffer = vulkan_createLocalDeviceBuffer(vk.device, indexBytes, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, onlyOneQueue, &vk.memoryAllocator);
+		vector<PackedVertex> packedChunk;
+		vector<FloatVertex> floatChunk;
+		vector<u32> chunkIndices;
+		u32 baseVertex = 0;
+		u32 baseIndex = 0;
+		for (u32 i = 0; i < header.chunkCount; i++)
+		{
+			const MeshView chunk = rchunk_chunkView(chunkedMesh, i);
+			if (packedVertices)
+			{
+				packedChunk.resize(chunk.vertexCount);
+				packVertices(chunk.vertices, chunk.vertexCount, vk.meshQuantization, packedChunk.data());
+				vulkan_uploadBuffer(&vk.uploader, vertexBuffer.handle, u64(baseVertex) * vertexSize, packedChunk.data(), CONTAINER_BYTES(packedChunk));
+			}
+			else
+			{
+				floatMesh(chunk, &floatChunk);
+				vulkan_uploadBuffer(&vk.uploader, vertexBuffer.handle, u64(baseVertex) * vertexSize, floatChunk.data(), CONTAINER_BYTES(floatChunk));
+			}
+			chunkIndices.resize(chunk.indexCount);
+			for (u32 j = 0; j < chunk.indexCount; j++)
+			{
+				chunkIndices[j] = chunk.indices[j] + baseVertex;
+			}
+			vulkan_uploadBuffer(&vk.uploader, indexBuffer.handle, u64(baseIndex) * sizeof(u32), chunkIndices.data(), CONTAINER_BYTES(chunkIndices));
+			rchunk_releaseChunk(chunkedMesh, i);
+			baseVertex += chunk.vertexCount;
+			baseIndex += chunk.indexCount;
+		}
+		vk.vertexBuffer = vulkan_addBuffer(&vk.resources, vertexBuffer, vertexBytes);
+		vk.indexBuffer = vulkan_addBuffer(&vk.resources, indexBuffer, indexBytes);
+	}
+	else if (packedVertices)
+	{
+		AllocationTagScope tagScope(ALLOCATION_TAG_MESH);
+		PackedMesh packedMesh;
+		packMesh(vk.mesh, &packedMesh);
+		vk.meshQuantization = packedMesh.quantization;
+		vk.vertexBuffer = vulkan_addBuffer(&vk.resources, vulkan_bufferDataIntoLocalDevice(vk.device, &vk.uploader, packedMesh.vertices.data(), CONTAINER_BYTES(packedMesh.vertices), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, onlyOneQueue, &vk.memoryAllocator), CONTAINER_BYTES(packedMesh.vertices));
+	}
+	else
+	{
+		AllocationTagScope tagScope(ALLOCATION_TAG_MESH);
+		vector<FloatVertex> floatVertices;
+		floatMesh(vk.mesh, &floatVertices);
+		vk.meshQuantization = meshQuantization_identity();
+		vk.vertexBuffer = vulkan_addBuffer(&vk.resources, vulkan_bufferDataIntoLocalDevice(vk.device, &vk.uploader, floatVertices.data(), CONTAINER_BYTES(floatVertices), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, onlyOneQueue, &vk.memoryAllocator), CONTAINER_BYTES(floatVertices));
+	}
+	if (!meshOutOfCore)
+	{
+		const u64 indexBytes = u64(vk.mesh.indexCount) * sizeof(u32);
+		vk.indexBuffer = vulkan_addBuffer(&vk.resources, vulkan_bufferDataIntoLocalDevice(vk.device, &vk.uploader, vk.mesh.indices, indexBytes, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, onlyOneQueue, &vk.memoryAllocator), indexBytes);
+	}
+	// One meshlet set per LOD, all indexing the same vertex buffer
+	MeshLodChain lodChain;
+	MeshletMesh meshlets[MAX_MESH_LODS];
+	MeshletCuller meshletCuller;
+	vector<u32> submeshIndexCounts(vk.mesh.submeshCount);
+	vk.meshletCulling = meshletCulling && !meshOutOfCore;
+	if (vk.meshletCulling)
+	{
+		AllocationTagScope tagScope(ALLOCATION_TAG_MESH);
+		u32 lodLevelCount = 1;
+		if (meshLods)
+		{
+			buildMeshLods(vk.mesh, meshLodSettings_default(), &lodChain);
+			printMeshLodChain(lodChain);
+			lodLevelCount = lodChain.levelCount;
+			if (lodBenchmark)
+			{
+				meshLod_benchmark(lodChain, vulkan_buildUniformBufferObject(vk.swapchain.extent, 0.0f), float(vk.swapchain.extent.height), lodThresholdPixels);
+			}
+		}
 
-	vk.frameSync = vulkan_createSynchronizationResources(vk.device, MAX_FRAMES_IN_FLIGHT);
+		for (u32 level = 0; level < lodLevelCount; level++)
+		{
+			buildMeshlets(meshLods ? meshLodView(vk.mesh, lodChain, level) : vk.mesh, &meshlets[level]);
+		}
+		meshletCuller_create(&meshletCuller, meshlets[0], workerPool);
+		vk.meshletDraws = vulkan_createMeshletDraws(vk.device, vk.swapchain.images.size(), vk.mesh.submeshCount, u32(meshlets[0].indices.size()), onlyOneQueue, &vk.memoryAllocator);
+		printf("Meshlets: %u\n", meshlets[0].meshletCount);
+	}
+	if (allocatorTraceCapture)
+	{
+		allocationTrace_end(&loaderTrace);
+	}
+	vk.uniformRing = vulkan_createUniformRing(vk.device, vk.deviceDescription.properties, u32(vk.swapchain.images.size()), u32(vk.submeshDraws.size()), onlyOneQueue, &vk.memoryAllocator);
+	vk.descriptorPool = vulkan_createDescriptorPool(vk.device, u32(vk.textures.size()));
+	vk.frameDescriptorSet = vulkan_createFrameDescriptorSet(vk.device, vk.descriptorPool, vk.descriptorSetLayouts[DESCRIPTOR_SET_FRAME], vk.uniformRing);
+	vk.materialDescriptorSets = vulkan_createMaterialDescriptorSets(vk.device, vk.descriptorPool, vk.descriptorSetLayouts[DESCRIPTOR_SET_MATERIAL], vk.resources, vk.textures);
+	vulkan_createFrameTimings(&vk.frameTimings, vk.device, vk.deviceDescription, u32(vk.swapchain.images.size()));
+	vulkan_buildCommandBuffers(vk.renderPass, vk.swapchain.extent, vk.drawCommandBuffers, vk.framebuffers, vulkan_getBuffer(vk.resources, vk.vertexBuffer).handle, vulkan_getBuffer(vk.resources, vk.indexBuffer).handle, vk.graphicsPipeline, vk.graphicsPipelineLayout, vk.submeshDraws, vk.meshletCulling ? &vk.meshletDraws : nullptr, vk.meshQuantization, vk.frameDescriptorSet, vk.uniformRing, vk.materialDescriptorSets, vk.frameTimings.queryPool);
+
+	vk.frameSync = vulkan_createSynchronizationResources(vk.device, framesInFlight, u32(vk.swapchain.images.size()));
+	vulkan_createFrameRecorder(&vk.frameRecorder, vk.device, vk.deviceDescription.queueFamilyIndices.graphics, workerPool->threadCount, framesInFlight, recordMinDrawsPerJob);
+	// Everything the scene loaded goes out in as few submits as the staging ring allows, and is waited on once
+	const VulkanUploadToken sceneUploads = vulkan_submitUploads(&vk.uploader);
+	vulkan_waitForUpload(&vk.uploader, sceneUploads);
+	printVulkanResourceStats(vk.resources);
+	printVulkanMemoryStats(vk.memoryAllocator);
+	printVulkanUploadStats(vk.uploader);
 
 	// END VULKAN SETUP
 
@@ -146,6 +395,11 @@ int WinMain(HINSTANCE currentInstance, HINSTANCE previousInstance, LPSTR, int)
 	win32vk.running = true;
 	VkResult swapchainUpToDate = VK_SUCCESS;
 	u64 startCount = win32_getTimerValue();
+	u32 frameCount = 0;
+	i64 previousFrameStart = 0;
+	// Allocations between the fence wait and the submit, which a steady frame should keep at 0. Resizes are outside
+	u64 frameAllocations = 0;
+	u32 lodLevel = 0;
 
 	if (d3d11)
 	{
@@ -160,7 +414,35 @@ int WinMain(HINSTANCE currentInstance, HINSTANCE previousInstance, LPSTR, int)
 		float deltaT = win32_deltaT(startCount, win32_timerFrequency);
 		if (vulkan)
 		{
-			SwapchainStatus swapchainStatus = vulkan_updateSwapchain(vk.swapchain, vk.device, vk.physicalDevice, vk.surface);
+			// GPU fences. Swapchain rebuilds allocate from the slot's scratch arena too, so they wait for them as well
+			const i64 frameStart = win32_getTimerValue();
+			vulkan_waitForFrameSlot(vk.device, vk.frameSync);
+			LinearArena* frameScratch = vulkan_resetFrameScratch(vk.frameSync);
+			const i64 swapchainStart = win32_getTimerValue();
+			if (resizeStormPending)
+			{
+				// What dragging the window edge does, at the current size: the surface only accepts its current extent
+				allocationTrace_begin(allocatorTraceMaxEvents);
+				for (u32 i = 0; i < allocatorResizeStormCount; i++)
+				{
+					VKCHECK(vkDeviceWaitIdle(vk.device));
+					vk.swapchain = vulkan_createSwapchain(vk.physicalDevice, vk.device, vk.surface, vk.swapchain.extent.width, vk.swapchain.extent.height, &vk.swapchain, frameScratch);
+					vulkan_onWindowResize(&vk);
+				}
+				allocationTrace_end(&resizeTrace);
+				resizeStormPending = false;
+
+				const AllocationTrace* traces[] = { &loaderTrace, &frameTrace, &resizeTrace };
+				for (u32 i = 0; i < ARRAYSIZE(traces); i++)
+				{
+					if (!allocationTrace_save(allocatorTracePaths[i], *traces[i]))
+					{
+						printf("Couldn't save the allocation trace %s\n", allocatorTracePaths[i]);
+					}
+				}
+				printAllocatorStats(allocator_getStats());
+			}
+			SwapchainStatus swapchainStatus = vulkan_updateSwapchain(vk.swapchain, vk.device, vk.physicalDevice, vk.surface, frameScratch);
 
 			if (swapchainStatus == SwapchainStatus::RESIZED)
 			{
@@ -171,16 +453,73 @@ int WinMain(HINSTANCE currentInstance, HINSTANCE previousInstance, LPSTR, int)
 				WIN32_HANDLE_MESSAGES_DEFAULT(win32vk.window);
 				continue;
 			}
-			// GPU fences
-			const u32 fencesUsed = 1;
-			VKCHECK(vkWaitForFences(vk.device, fencesUsed, vk.frameSync.inflightFences.data(), true, ~0ui64));
-			// Send info to local device
+			// Rebuilds don't count as waiting on the GPU
+			const i64 swapchainTicks = win32_getTimerValue() - swapchainStart;
+			u64 frameAllocationsStart = allocator_allocationCount();
 			u32 imageIndex;
 			VKCHECK(vkAcquireNextImageKHR(vk.device, vk.swapchain.handle, ULLONG_MAX, vk.frameSync.imageAcquireSemaphores[vk.frameSync.currentFrame], nullptr, &imageIndex));
-			vulkan_updateUniformBuffer(vk.device, vk.swapchain.extent, vk.uniformBuffers.memory[imageIndex], deltaT);
+			vulkan_waitForImage(vk.device, vk.frameSync, imageIndex);
+			vulkan_readFrameTimestamps(vk.device, &vk.frameTimings, imageIndex);
+			if (previousFrameStart)
+			{
+				vulkan_addFrameTimes(&vk.frameTimings, double(frameStart - previousFrameStart) / win32_timerFrequency, double(win32_getTimerValue() - frameStart - swapchainTicks) / win32_timerFrequency);
+			}
+			previousFrameStart = frameStart;
+			// Send info to local device
+			UniformBufferObject ubo = vulkan_buildUniformBufferObject(vk.swapchain.extent, deltaT);
+			// Every submesh shares the model transform for now, but each draw reads its own slot
+			for (u32 draw = 0; draw < vk.uniformRing.slotCount; draw++)
+			{
+				vulkan_writeUniforms(vk.uniformRing, imageIndex, draw, ubo);
+			}
+
+			if (vk.meshletCulling)
+			{
+				if (meshLods)
+				{
+					lodLevel = meshLod_select(lodChain, meshLodCamera(ubo, float(vk.swapchain.extent.height)), ubo.model, lodThresholdPixels, lodHysteresis, lodLevel);
+				}
+
+				MeshletCullStats meshletStats;
+				meshletCuller_cull(&meshletCuller, meshlets[lodLevel], meshletCullView(ubo), vulkan_meshletDrawIndices(vk.meshletDraws, imageIndex), submeshIndexCounts.data(), &meshletStats);
+				vulkan_setMeshletDrawIndexCounts(vk.meshletDraws, imageIndex, submeshIndexCounts.data());
+				if (frameCount % meshletStatsInterval == 0)
+				{
+					printf("LOD %u: ", lodLevel);
+					printMeshletCullStats(meshletStats);
+				}
+			}
+
+			VkCommandBuffer drawCommandBuffer = vk.drawCommandBuffers[imageIndex];
+			if (recordEveryFrame)
+			{
+				drawCommandBuffer = vulkan_recordFrame(&vk.frameRecorder, workerPool, vk.device, vk.frameSync.currentFrame, imageIndex, vk.renderPass, vk.framebuffers[imageIndex], vk.swapchain.extent, vulkan_getBuffer(vk.resources, vk.vertexBuffer).handle, vulkan_getBuffer(vk.resources, vk.indexBuffer).handle, vk.graphicsPipeline, vk.graphicsPipelineLayout, vk.submeshDraws, vk.meshletCulling ? &vk.meshletDraws : nullptr, vk.meshQuantization, vk.frameDescriptorSet, vk.uniformRing, vk.materialDescriptorSets, vk.frameTimings.queryPool);
+			}
+			frameAllocations += allocator_allocationCount() - frameAllocationsStart;
+			frameCount++;
+			if (frameCount % meshletStatsInterval == 0)
+			{
+				printf("General purpose allocations in the last %u frames: %llu\n", meshletStatsInterval, frameAllocations);
+				frameAllocations = 0;
+				printVulkanFrameTimings(&vk.frameTimings, vk.frameSync.maxFramesInFlight);
+				if (recordEveryFrame)
+				{
+					printf("Frame recording: %u jobs for %zu draws on %u threads\n", vk.frameRecorder.jobCount, vk.submeshDraws.size(), workerPool->threadCount);
+				}
+			}
+			if (allocatorTraceCapture && frameCount == allocatorTraceFirstFrame)
+			{
+				allocationTrace_begin(allocatorTraceMaxEvents);
+			}
+			else if (allocatorTraceCapture && frameCount == allocatorTraceFirstFrame + allocatorTraceFrameCount)
+			{
+				allocationTrace_end(&frameTrace);
+				// Swapchain rebuilds have to wait for the start of the next frame
+				resizeStormPending = true;
+			}
 
 			// RENDER:
-			vulkan_submitQueue(vk.device, vk.graphicsQueue, vk.drawCommandBuffers[imageIndex], vk.frameSync.inflightFences.data(), &vk.frameSync.imageAcquireSemaphores[vk.frameSync.currentFrame], &vk.frameSync.imageReleaseSemaphores[vk.frameSync.currentFrame]);
+			vulkan_submitQueue(vk.device, vk.graphicsQueue, drawCommandBuffer, &vk.frameSync.inflightFences[vk.frameSync.currentFrame], &vk.frameSync.imageAcquireSemaphores[vk.frameSync.currentFrame], &vk.frameSync.imageReleaseSemaphores[vk.frameSync.currentFrame]);
 			VKCHECK(vulkan_present(vk.device, vk.swapchain.handle, vk.frameSync.currentFrame, vk.graphicsQueue, &imageIndex, &vk.frameSync.imageReleaseSemaphores[vk.frameSync.currentFrame]));
 			vulkan_updateCurrentFrame(vk.frameSync);
 
@@ -197,7 +536,17 @@ int WinMain(HINSTANCE currentInstance, HINSTANCE previousInstance, LPSTR, int)
 	}
 	while (win32vk.running && win32d3d11.running);
 
+	// What each subsystem still holds after a whole session, and the most it ever held
+	printAllocationTagStats();
 	destroyVulkanApplication(vk);
+	meshAsset_release(&meshAsset);
+	rchunk_close(&chunkedMesh);
+	threadPool_destroy(workerPool);
 	shutdownD3D11Renderer(renderer);
+	if (allocationLog)
+	{
+		allocationLog_end();
+		allocationLog_summarize(allocationLogPath, allocationLogTopCallsites);
+	}
 }
 #endif
\ No newline at end of file
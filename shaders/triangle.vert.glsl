@@ -8,16 +8,17 @@ layout(binding = 0) uniform UniformBufferObject
 	mat4 proj;
 } ubo;
 
+// FloatVertex (see core/glm.h)
 layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec3 inColor;
+layout(location = 1) in vec3 inNormal;
 layout(location = 2) in vec2 inTexCoord;
 
-layout(location = 0) out vec3 fragColor;
+layout(location = 0) out vec3 fragNormal;
 layout(location = 1) out vec2 fragTexCoord;
 	
 void main()
 {
     gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
-    fragColor = inColor;
+    fragNormal = mat3(ubo.model) * inNormal;
 	fragTexCoord = inTexCoord;
 }
\ No newline at end of file
@@ -0,0 +1,38 @@
+#version 450
+// Same interface as triangle.vert.glsl, fed with PackedVertex (see core/glm.h)
+layout(binding = 0) uniform UniformBufferObject
+{
+	mat4 model;
+	mat4 view;
+	mat4 proj;
+} ubo;
+
+layout(push_constant) uniform MeshQuantization
+{
+	vec4 positionOffset;
+	vec4 positionScale;
+	vec4 texCoordOffsetScale;
+} quantization;
+
+layout(location = 0) in vec4 inPosition; // unorm16
+layout(location = 1) in vec2 inNormal; // octahedral snorm16
+layout(location = 2) in vec2 inTexCoord; // unorm16
+
+layout(location = 0) out vec3 fragNormal;
+layout(location = 1) out vec2 fragTexCoord;
+
+vec3 octDecode(vec2 e)
+{
+	vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
+void main()
+{
+	vec3 position = quantization.positionOffset.xyz + quantization.positionScale.xyz * inPosition.xyz;
+    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(position, 1.0);
+    fragNormal = mat3(ubo.model) * octDecode(inNormal);
+	fragTexCoord = quantization.texCoordOffsetScale.xy + quantization.texCoordOffsetScale.zw * inTexCoord;
+}
@@ -0,0 +1,80 @@
+#include "../core/common.h"
+#include "../core/red_allocation_log.h"
+#include "../core/red_allocator.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+static u8* volatile testSink;
+
+// Every event of a finished log is stamped after the log began, and the header counts exactly the events written
+static bool32 checkLog(const char* path, u32 logIndex)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file)
+	{
+		printf("Log %u: couldn't open %s\n", logIndex, path);
+		return false;
+	}
+	AllocationLogHeader header;
+	bool32 passed = fread(&header, sizeof(header), 1, file) == 1 && header.magic == ALLOCATION_LOG_MAGIC;
+	u64 eventCount = 0;
+	u64 earlyCount = 0;
+	AllocationLogEvent event;
+	while (passed && fread(&event, sizeof(event), 1, file) == 1)
+	{
+		earlyCount += event.timestamp < header.beginTicks;
+		eventCount++;
+	}
+	fclose(file);
+	if (!passed || eventCount != header.eventCount || earlyCount)
+	{
+		printf("Log %u: %llu events for %llu in the header, %llu stamped before it began\n", logIndex, eventCount, header.eventCount, earlyCount);
+		return false;
+	}
+	return true;
+}
+
+/*
+Threads allocate nonstop while logs end and begin back to back: a thread that saw one log running may still be
+recording when the next begins
+*/
+int main()
+{
+	const char* path = "allocation_log_test.alog";
+	const u32 threadCount = 4;
+	const u32 logCount = 50;
+	std::atomic<u32> stop;
+	stop.store(0);
+	vector<std::thread> threads;
+	for (u32 i = 0; i < threadCount; i++)
+	{
+		threads.push_back(std::thread([&stop]()
+		{
+			while (!stop.load(std::memory_order_relaxed))
+			{
+				testSink = new u8[32];
+				delete[] testSink;
+			}
+		}));
+	}
+
+	bool32 passed = true;
+	for (u32 log = 0; log < logCount; log++)
+	{
+		passed &= allocationLog_begin(path);
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		allocationLog_end();
+		passed &= checkLog(path, log);
+	}
+	stop.store(1);
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+	remove(path);
+
+	printf("Allocation log check %s\n", passed ? "passed" : "failed");
+	return passed ? 0 : 1;
+}
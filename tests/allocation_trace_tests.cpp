@@ -0,0 +1,49 @@
+#include "../core/common.h"
+#include "../core/red_allocator_benchmark.h"
+
+// Loads the fixtures in the directory given as the first argument
+static bool32 checkTrace(const char* directory, const char* name, bool32 valid)
+{
+	char path[1024];
+	snprintf(path, sizeof(path), "%s/%s", directory, name);
+	AllocationTrace trace;
+	trace.slotCount = 0;
+	trace.droppedEventCount = 0;
+	bool32 loaded = allocationTrace_load(path, &trace);
+	bool32 passed = loaded == valid;
+	// A rejected trace is left empty, so a replay of it does nothing
+	passed &= valid || (trace.events.empty() && !trace.slotCount);
+	if (!passed)
+	{
+		printf("%s: %s\n", name, loaded ? "loaded, should have been rejected" : "rejected, should have loaded");
+	}
+	return passed;
+}
+
+int main(int argc, char** argv)
+{
+	const char* directory = argc > 1 ? argv[1] : "tests/fixtures";
+	bool32 passed = checkTrace(directory, "valid.atrace", true);
+	passed &= checkTrace(directory, "truncated.atrace", false);
+	passed &= checkTrace(directory, "bad_slot.atrace", false);
+	passed &= checkTrace(directory, "double_free.atrace", false);
+	passed &= checkTrace(directory, "unaligned_alignment.atrace", false);
+	passed &= checkTrace(directory, "leaked.atrace", false);
+
+	// What the synthetic benchmark trace saves has to load back unchanged
+	AllocationTrace synthetic;
+	allocationTrace_synthetic(&synthetic, 10000, 1);
+	AllocationTrace loaded;
+	bool32 roundTrip = allocationTrace_save("synthetic.atrace", synthetic) && allocationTrace_load("synthetic.atrace", &loaded);
+	roundTrip = roundTrip && loaded.slotCount == synthetic.slotCount && loaded.events.size() == synthetic.events.size() &&
+		memcmp(loaded.events.data(), synthetic.events.data(), CONTAINER_BYTES(synthetic.events)) == 0;
+	remove("synthetic.atrace");
+	if (!roundTrip)
+	{
+		printf("synthetic.atrace: didn't survive a save and load\n");
+	}
+	passed &= roundTrip;
+
+	printf("Allocation trace check %s\n", passed ? "passed" : "failed");
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,13 @@
+#include "../core/common.h"
+#include "../core/red_allocator.h"
+#include "../core/red_arena.h"
+
+// Every aligned allocation path of the allocator and the linear arenas. Both checks print their failures
+int main()
+{
+	bool32 passed = allocator_checkAlignment();
+	passed &= linearArena_checkAlignment();
+	printf("Aligned allocation check %s\n", passed ? "passed" : "failed");
+
+	return passed ? 0 : 1;
+}